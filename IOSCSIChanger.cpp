@@ -0,0 +1,1340 @@
+/*
+ *  IOSCSIChanger.cpp
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+#include <AssertMacros.h>
+#include <sys/conf.h>
+#include <miscfs/devfs/devfs.h>
+#include <sys/errno.h>
+#include <sys/ioctl.h>
+
+#include <IOKit/scsi/SCSICommandOperationCodes.h>
+
+#include "IOSCSIChanger.h"
+#include "chio.h"
+
+#define GROW_FACTOR 10
+#define CH_MOTION_TIMEOUT     (kThirtySecondTimeoutInMS * 2 * 5)
+#define CH_NOMOTION_TIMEOUT    kTenSecondTimeoutInMS
+#define CH_INIT_TIMEOUT       (kThirtySecondTimeoutInMS * 2 * 30)
+#define CH_MODE_BUFFER_SIZE   (4 + 255)
+#define CH_DESCRIPTOR_MAX     (12 + 36 + 36)
+
+#define super IOSCSIPrimaryCommandsDevice
+OSDefineMetaClassAndStructors(IOSCSIChanger, IOSCSIPrimaryCommandsDevice)
+
+/* CHET_* to SMC element type code */
+static const UInt8 ch_smc_type[CHET_MAX] =
+{
+	kSMCElementType_MediumTransport,
+	kSMCElementType_Storage,
+	kSMCElementType_ImportExport,
+	kSMCElementType_DataTransfer
+};
+
+#if 0
+#pragma mark -
+#pragma mark Initialization & support
+#pragma mark -
+#endif /* 0 */
+
+/* The changer has its own character device major, set up on kext load
+ * like the tape's. */
+class ChangerCdevMajorIniter
+{
+public:
+	int majorNumber;
+	static struct cdevsw cdevsw;
+	ChangerCdevMajorIniter(void);
+	~ChangerCdevMajorIniter(void);
+};
+
+ChangerCdevMajorIniter::ChangerCdevMajorIniter(void)
+{
+	majorNumber = cdevsw_add(-1, &cdevsw);
+}
+
+ChangerCdevMajorIniter::~ChangerCdevMajorIniter(void)
+{
+	cdevsw_remove(majorNumber, &cdevsw);
+}
+
+/* character device system call vectors */
+struct cdevsw ChangerCdevMajorIniter::cdevsw =
+{
+	ch_open,
+	ch_close,
+	eno_rdwrt,
+	eno_rdwrt,
+	ch_ioctl,
+	eno_stop,
+	eno_reset,
+	0,
+	(select_fcn_t *)enodev,
+	eno_mmap,
+	eno_strat,
+	eno_getc,
+	eno_putc,
+	0
+};
+
+static ChangerCdevMajorIniter ChangerCdevMajorIniter;
+
+IOSCSIChanger **IOSCSIChanger::devices = NULL;
+int IOSCSIChanger::deviceCount = 0;
+
+bool
+IOSCSIChanger::FindDeviceMinorNumber(void)
+{
+	int i;
+	
+	if (deviceCount == 0)
+		if (!GrowDeviceMinorNumberMemory())
+			return false;
+	
+	for (i = 0; i < deviceCount && devices[i]; i++);
+	
+	if (i == deviceCount)
+		if (!GrowDeviceMinorNumberMemory())
+			return false;
+	
+	changerNumber = i;
+	devices[changerNumber] = this;
+	
+	return true;
+}
+
+bool
+IOSCSIChanger::GrowDeviceMinorNumberMemory(void)
+{
+	IOSCSIChanger **newDevices;
+	int cur_size = sizeof(IOSCSIChanger *) *  deviceCount;
+	int new_size = sizeof(IOSCSIChanger *) * (deviceCount + GROW_FACTOR);
+	
+	newDevices = (IOSCSIChanger **)IOMalloc(new_size);
+	
+	if (!newDevices)
+		return false;
+	
+	bzero(newDevices, new_size);
+	
+	if (deviceCount)
+	{
+		memcpy(newDevices, devices, cur_size);
+		IOFree(devices, cur_size);
+	}
+	
+	devices = newDevices;
+	deviceCount += GROW_FACTOR;
+	
+	return true;
+}
+
+void
+IOSCSIChanger::ClearDeviceMinorNumber(void)
+{
+	devices[changerNumber] = NULL;
+	changerNumber = 0;
+}
+
+bool
+IOSCSIChanger::InitializeDeviceSupport(void)
+{
+	flags = 0;
+	picker = 0;
+	bzero(firstAddr, sizeof(firstAddr));
+	bzero(count, sizeof(count));
+	elements = NULL;
+	elementCount = 0;
+	
+	logLevel = MT_LOG_INFO;
+	bzero(logLimits, sizeof(logLimits));
+	
+	lock = IOLockAlloc();
+	logLock = IOLockAlloc();
+	
+	if (!lock || !logLock)
+	{
+		TerminateDeviceSupport();
+		return false;
+	}
+	
+	if (FindDeviceMinorNumber())
+	{
+		cdev_node = devfs_make_node(
+									makedev(ChangerCdevMajorIniter.majorNumber, changerNumber),
+									DEVFS_CHAR,
+									UID_ROOT,
+									GID_OPERATOR,
+									0664,
+									CHANGER_FORMAT, changerNumber);
+		
+		if (cdev_node)
+			return true;
+		
+		ClearDeviceMinorNumber();
+	}
+	
+	TerminateDeviceSupport();
+	
+	return false;
+}
+
+void
+IOSCSIChanger::StartDeviceSupport(void)
+{
+	STATUS_LOG("<%s, %s, %s> changer",
+			   GetVendorString(),
+			   GetProductString(),
+			   GetRevisionString());
+	
+	/* the inventory itself is read on first use */
+	if (GetElementAddresses() == kIOReturnSuccess)
+		STATUS_LOG("%d pickers, %d slots, %d portals, %d drives",
+				   count[CHET_MT], count[CHET_ST], count[CHET_IE], count[CHET_DT]);
+}
+
+void
+IOSCSIChanger::SuspendDeviceSupport(void)
+{
+}
+
+void
+IOSCSIChanger::ResumeDeviceSupport(void)
+{
+}
+
+void
+IOSCSIChanger::StopDeviceSupport(void)
+{
+	devfs_remove(cdev_node);
+	ClearDeviceMinorNumber();
+}
+
+bool
+IOSCSIChanger::ClearNotReadyStatus(void)
+{
+	return false;
+}
+
+#if 0
+#pragma mark -
+#pragma mark IOKit power management
+#pragma mark -
+#endif /* 0 */
+
+UInt32
+IOSCSIChanger::GetInitialPowerState(void)
+{
+	return 0;
+}
+
+void
+IOSCSIChanger::HandlePowerChange(void)
+{
+}
+
+void
+IOSCSIChanger::HandleCheckPowerState(void)
+{
+}
+
+void
+IOSCSIChanger::TicklePowerManager(void)
+{
+}
+
+void
+IOSCSIChanger::TerminateDeviceSupport(void)
+{
+	FreeElements();
+	
+	if (lock)
+	{
+		IOLockFree(lock);
+		lock = NULL;
+	}
+	
+	if (logLock)
+	{
+		IOLockFree(logLock);
+		logLock = NULL;
+	}
+}
+
+UInt32
+IOSCSIChanger::GetNumberOfPowerStateTransitions(void)
+{
+	return 0;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Event log
+#pragma mark -
+#endif /* 0 */
+
+/*
+ *  LogEvent()
+ *  Log a changer event at the given MT_LOG_* level. The changer keeps
+ *  no event ring; it only shares the tape driver's rate limiting so a
+ *  flapping library cannot flood the system log.
+ */
+void
+IOSCSIChanger::LogEvent(int level, const char *format, ...)
+{
+	char		msg[MTLOG_MSGLEN];
+	va_list		ap;
+	UInt32		suppressed = 0;
+	
+	if (level > logLevel)
+		return;
+	
+	if (!st_log_allowed(logLimits, logLock, ST_LOG_BURST, ST_LOG_INTERVAL,
+						format, &suppressed))
+		return;
+	
+	va_start(ap, format);
+	vsnprintf(msg, sizeof(msg), format, ap);
+	va_end(ap);
+	
+	if (suppressed)
+		IOLog(CHANGER_FORMAT ": %s (%u similar messages suppressed)\n",
+			  changerNumber, msg, suppressed);
+	else
+		IOLog(CHANGER_FORMAT ": %s\n", changerNumber, msg);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Element status cache
+#pragma mark -
+#endif /* 0 */
+
+void
+IOSCSIChanger::FreeElements(void)
+{
+	if (elements)
+	{
+		IOFree(elements, sizeof(CHElement) * elementCount);
+		elements = NULL;
+	}
+	
+	elementCount = 0;
+	flags &= ~CH_STATUS_VALID;
+}
+
+/* Elements are kept by type in CHET_* order, by unit within a type. */
+CHElement *
+IOSCSIChanger::FindElement(int type, int unit)
+{
+	UInt32 index = 0;
+	
+	if (type < 0 || type >= CHET_MAX || unit < 0 || unit >= count[type])
+		return NULL;
+	
+	for (int i = 0; i < type; i++)
+		index += count[i];
+	
+	index += unit;
+	
+	if (index >= elementCount)
+		return NULL;
+	
+	return &elements[index];
+}
+
+CHElement *
+IOSCSIChanger::FindElementByAddress(UInt16 addr, int *type, int *unit)
+{
+	for (int i = 0; i < CHET_MAX; i++)
+	{
+		if (addr >= firstAddr[i] && addr < firstAddr[i] + count[i])
+		{
+			*type = i;
+			*unit = addr - firstAddr[i];
+			
+			return FindElement(i, addr - firstAddr[i]);
+		}
+	}
+	
+	return NULL;
+}
+
+/*
+ *  MoveCached()
+ *  Update the cache for a medium the changer has moved, rather than
+ *  reading the whole inventory again.
+ */
+void
+IOSCSIChanger::MoveCached(CHElement *from, CHElement *to, bool invert)
+{
+	to->flags &= ~CH_MEDIUM_FLAGS;
+	to->flags |= CES_FULL | CES_SOURCE_VALID |
+		(from->flags & (CES_INVERT | CES_VOLTAG_VALID));
+	
+	if (invert)
+		to->flags ^= CES_INVERT;
+	
+	to->source = from->addr;
+	bcopy(from->voltag, to->voltag, sizeof(to->voltag));
+	
+	from->flags &= ~CH_MEDIUM_FLAGS;
+	bzero(from->voltag, sizeof(from->voltag));
+}
+
+/*
+ *  GetElementStatus()
+ *  Fill in a batch of element status from the cache, reading the
+ *  inventory from the changer first if the cache is not valid.
+ */
+IOReturn
+IOSCSIChanger::GetElementStatus(struct changer_element_status_request *cesr)
+{
+	IOReturn status = kIOReturnSuccess;
+	
+	if (cesr->cesr_type >= CHET_MAX)
+		return kIOReturnBadArgument;
+	
+	if (!(flags & CH_STATUS_VALID) || (cesr->cesr_flags & CESR_REFRESH))
+		status = ReadElementStatus();
+	
+	if (status != kIOReturnSuccess)
+		return status;
+	
+	cesr->cesr_count = 0;
+	
+	for (int unit = cesr->cesr_unit;
+		 unit < count[cesr->cesr_type] && cesr->cesr_count < CH_STATUS_BATCH;
+		 unit++)
+	{
+		struct changer_element_status *ces = &cesr->cesr_data[cesr->cesr_count++];
+		CHElement *elem = FindElement(cesr->cesr_type, unit);
+		int sourceType = 0;
+		int sourceUnit = 0;
+		
+		bzero(ces, sizeof(*ces));
+		
+		if (elem == NULL)
+			continue;
+		
+		ces->ces_type = cesr->cesr_type;
+		ces->ces_unit = unit;
+		ces->ces_addr = elem->addr;
+		ces->ces_flags = elem->flags;
+		ces->ces_asc = elem->asc;
+		ces->ces_ascq = elem->ascq;
+		
+		if ((elem->flags & CES_SOURCE_VALID) &&
+			FindElementByAddress(elem->source, &sourceType, &sourceUnit))
+		{
+			ces->ces_source_type = sourceType;
+			ces->ces_source_unit = sourceUnit;
+		}
+		else
+			ces->ces_flags &= ~CES_SOURCE_VALID;
+		
+		bcopy(elem->voltag, ces->ces_voltag, sizeof(ces->ces_voltag));
+	}
+	
+	return kIOReturnSuccess;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Changer driver operations
+#pragma mark -
+#endif /* 0 */
+
+/*
+ *  ch_errno()
+ *  Map the outcome of the last failed command to an errno.
+ */
+static int ch_errno(IOSCSIChanger *ch)
+{
+	switch (ch->lastTaskStatus)
+	{
+		case kSCSITaskStatus_GOOD:
+		case kSCSITaskStatus_CHECK_CONDITION:
+			break;
+		case kSCSITaskStatus_BUSY:
+		case kSCSITaskStatus_TASK_SET_FULL:
+		case kSCSITaskStatus_RESERVATION_CONFLICT:
+			return EBUSY;
+		case kSCSITaskStatus_TaskTimeoutOccurred:
+		case kSCSITaskStatus_ProtocolTimeoutOccurred:
+			return ETIMEDOUT;
+		case kSCSITaskStatus_DeviceNotPresent:
+			return ENXIO;
+		default:
+			return EIO;
+	}
+	
+	switch (ch->lastSenseKey)
+	{
+		case kSENSE_KEY_NOT_READY:
+			return EBUSY;
+		case kSENSE_KEY_ILLEGAL_REQUEST:
+			/* INVALID COMMAND OPERATION CODE */
+			if (ch->lastASC == 0x20)
+				return ENOTSUP;
+			/* includes a full destination or an empty source */
+			return EINVAL;
+		case kSENSE_KEY_UNIT_ATTENTION:
+			return EAGAIN;
+		default:
+			return EIO;
+	}
+}
+
+static int ch_ioreturn_errno(IOSCSIChanger *ch, IOReturn status)
+{
+	switch (status)
+	{
+		case kIOReturnSuccess:
+			return KERN_SUCCESS;
+		case kIOReturnBadArgument:
+			return EINVAL;
+		case kIOReturnNoMemory:
+			return ENOMEM;
+		default:
+			return ch_errno(ch);
+	}
+}
+
+int ch_open(dev_t dev, int flags, int devtype, struct proc *p)
+{
+	IOSCSIChanger *ch = IOSCSIChanger::devices[minor(dev)];
+	
+	/* any number of readers may share the changer, commands are
+	 * serialised in ch_ioctl */
+	if (ch == NULL)
+		return ENXIO;
+	
+	return KERN_SUCCESS;
+}
+
+int ch_close(dev_t dev, int flags, int devtype, struct proc *p)
+{
+	return KERN_SUCCESS;
+}
+
+int ch_ioctl(dev_t dev, u_long cmd, caddr_t data, int fflag, struct proc *p)
+{
+	IOSCSIChanger *ch = IOSCSIChanger::devices[minor(dev)];
+	IOReturn status = kIOReturnSuccess;
+	int error = 0;
+	
+	IOLockLock(ch->lock);
+	
+	/* element counts are needed to check any element named */
+	if (!(ch->flags & CH_PARAMS_VALID))
+		status = ch->GetElementAddresses();
+	
+	if (status != kIOReturnSuccess)
+	{
+		error = ch_ioreturn_errno(ch, status);
+		goto Exit;
+	}
+	
+	switch (cmd)
+	{
+		case CHIOMOVE:
+		{
+			struct changer_move *cm = (struct changer_move *)data;
+			
+			status = ch->MoveMedium(cm->cm_fromtype, cm->cm_fromunit,
+									cm->cm_totype, cm->cm_tounit,
+									(cm->cm_flags & CM_INVERT) != 0);
+			error = ch_ioreturn_errno(ch, status);
+			break;
+		}
+		case CHIOEXCHANGE:
+		{
+			struct changer_exchange *ce = (struct changer_exchange *)data;
+			
+			status = ch->ExchangeMedium(ce->ce_srctype, ce->ce_srcunit,
+										ce->ce_fdsttype, ce->ce_fdstunit,
+										ce->ce_sdsttype, ce->ce_sdstunit,
+										(ce->ce_flags & CE_INVERT1) != 0,
+										(ce->ce_flags & CE_INVERT2) != 0);
+			error = ch_ioreturn_errno(ch, status);
+			break;
+		}
+		case CHIOPOSITION:
+		{
+			struct changer_position *cp = (struct changer_position *)data;
+			
+			status = ch->PositionToElement(cp->cp_type, cp->cp_unit,
+										   (cp->cp_flags & CP_INVERT) != 0);
+			error = ch_ioreturn_errno(ch, status);
+			break;
+		}
+		case CHIOGPICKER:
+			*(int *)data = ch->picker;
+			break;
+		case CHIOSPICKER:
+			if (*(int *)data < 0 || *(int *)data >= ch->count[CHET_MT])
+				error = EINVAL;
+			else
+				ch->picker = *(int *)data;
+			break;
+		case CHIOGPARAMS:
+		{
+			struct changer_params *cp = (struct changer_params *)data;
+			
+			cp->cp_npickers = ch->count[CHET_MT];
+			cp->cp_nslots = ch->count[CHET_ST];
+			cp->cp_nportals = ch->count[CHET_IE];
+			cp->cp_ndrives = ch->count[CHET_DT];
+			break;
+		}
+		case CHIOIELEM:
+			status = ch->InitializeElementStatus();
+			error = ch_ioreturn_errno(ch, status);
+			break;
+		case CHIOGSTATUS:
+			status = ch->GetElementStatus((struct changer_element_status_request *)data);
+			error = ch_ioreturn_errno(ch, status);
+			break;
+		default:
+			error = ENOTTY;
+	}
+	
+Exit:
+	
+	IOLockUnlock(ch->lock);
+	
+	return error;
+}
+
+#if 0
+#pragma mark -
+#pragma mark SCSI Operations
+#pragma mark -
+#endif /* 0 */
+
+/*
+ *  DoSCSICommand()
+ *  Send a command and fetch sense on CHECK CONDITION. A unit attention
+ *  means the inventory may have changed behind the driver's back (an
+ *  operator opened the door or used a portal, or the changer was
+ *  reset): the cache is dropped and the command retried.
+ */
+SCSITaskStatus
+IOSCSIChanger::DoSCSICommand(
+	SCSITaskIdentifier	request,
+	UInt32				timeoutDuration)
+{
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeliveryFailure;
+	SCSIServiceResponse	serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	int					attempt			= 0;
+	
+	require((request != 0), ErrorExit);
+	
+	for (attempt = 0; ; attempt++)
+	{
+		serviceResponse = SendCommand(request, timeoutDuration);
+		lastSenseKey = 0;
+		lastASC = 0;
+		lastASCQ = 0;
+		taskStatus = kSCSITaskStatus_DeliveryFailure;
+		
+		if (serviceResponse != kSCSIServiceResponse_TASK_COMPLETE)
+		{
+			ERROR_LOG("unknown service response: 0x%x", serviceResponse);
+			break;
+		}
+		
+		taskStatus = GetTaskStatus(request);
+		
+		if (taskStatus == kSCSITaskStatus_CHECK_CONDITION)
+		{
+			GetSense(request);
+			
+			if (lastSenseKey == kSENSE_KEY_RECOVERED_ERROR)
+				taskStatus = kSCSITaskStatus_GOOD;
+		}
+		
+		if (lastSenseKey == kSENSE_KEY_UNIT_ATTENTION)
+		{
+			flags &= ~CH_STATUS_VALID;
+			
+			/* reset or mode parameters changed */
+			if (lastASC == 0x29 || lastASC == 0x2A)
+				flags &= ~CH_PARAMS_VALID;
+		}
+		
+		if (attempt >= CH_RETRIES)
+			break;
+		
+		if (taskStatus == kSCSITaskStatus_BUSY)
+			IOSleep(1000);
+		else if (lastSenseKey != kSENSE_KEY_UNIT_ATTENTION)
+			break;
+	}
+	
+	if (taskStatus != kSCSITaskStatus_GOOD &&
+		taskStatus != kSCSITaskStatus_CHECK_CONDITION)
+	{
+		ERROR_LOG("unknown task status: 0x%x", taskStatus);
+	}
+	
+ErrorExit:
+	
+	lastTaskStatus = taskStatus;
+	
+	return taskStatus;
+}
+
+void
+IOSCSIChanger::GetSense(SCSITaskIdentifier request)
+{
+	SCSI_Sense_Data		senseBuffer = { 0 };
+	bool				validSense = false;
+	SCSIServiceResponse	serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier	senseTask = NULL;
+	
+	IOMemoryDescriptor *bufferDesc = IOMemoryDescriptor::withAddress((void *)&senseBuffer,
+																	 sizeof(senseBuffer),
+																	 kIODirectionIn);
+	
+	validSense = GetAutoSenseData(request, &senseBuffer);
+	
+	if (validSense == false && bufferDesc && (senseTask = GetSCSITask()) != NULL)
+	{
+		if (REQUEST_SENSE(senseTask, bufferDesc, kSenseDefaultSize, 0) == true)
+			serviceResponse = SendCommand(senseTask, kTenSecondTimeoutInMS);
+		
+		if (serviceResponse == kSCSIServiceResponse_TASK_COMPLETE &&
+			GetTaskStatus(senseTask) == kSCSITaskStatus_GOOD)
+			validSense = true;
+		
+		ReleaseSCSITask(senseTask);
+	}
+	
+	if (validSense == true)
+	{
+		lastSenseKey = senseBuffer.SENSE_KEY & kSENSE_KEY_Mask;
+		lastASC = senseBuffer.ADDITIONAL_SENSE_CODE;
+		lastASCQ = senseBuffer.ADDITIONAL_SENSE_CODE_QUALIFIER;
+		
+		if (lastSenseKey != kSENSE_KEY_UNIT_ATTENTION)
+			WARN_LOG("SENSE: Key: 0x%X, ASC: 0x%02X, ASCQ: 0x%02X",
+					 lastSenseKey, lastASC, lastASCQ);
+	}
+	else
+		ERROR_LOG("invalid or unretrievable SCSI SENSE");
+	
+	if (bufferDesc)
+		bufferDesc->release();
+}
+
+/*
+ *  GetElementAddresses()
+ *  Read the first address and number of elements of each type from
+ *  the element address assignment mode page.
+ */
+IOReturn
+IOSCSIChanger::GetElementAddresses(void)
+{
+	IOReturn				status		= kIOReturnError;
+	SCSITaskIdentifier		task		= NULL;
+	SCSITaskStatus			taskStatus	= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer	= NULL;
+	UInt8					modeData[CH_MODE_BUFFER_SIZE] = { 0 };
+	UInt8 *					page		= NULL;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(&modeData,
+												 sizeof(modeData),
+												 kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		MODE_SENSE_6(task,
+					 dataBuffer,
+					 0x1,
+					 0x0,
+					 CH_ELEMENT_ADDRESS_PAGE,
+					 0xFF,
+					 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, CH_NOMOTION_TIMEOUT);
+	}
+	
+	/* skip the header and any block descriptors */
+	page = &modeData[4 + modeData[3]];
+	
+	if (taskStatus == kSCSITaskStatus_GOOD &&
+		page + 18 <= &modeData[sizeof(modeData)] &&
+		(page[0] & 0x3F) == CH_ELEMENT_ADDRESS_PAGE)
+	{
+		UInt32 total = 0;
+		
+		for (int i = 0; i < CHET_MAX; i++)
+		{
+			firstAddr[i] = (page[2 + i * 4] << 8) | page[3 + i * 4];
+			count[i] = (page[4 + i * 4] << 8) | page[5 + i * 4];
+			total += count[i];
+		}
+		
+		/* a changed layout invalidates the whole cache */
+		if (total != elementCount)
+		{
+			FreeElements();
+			
+			elements = (CHElement *)IOMalloc(sizeof(CHElement) * total);
+			
+			if (elements)
+			{
+				bzero(elements, sizeof(CHElement) * total);
+				elementCount = total;
+			}
+		}
+		
+		flags &= ~CH_STATUS_VALID;
+		
+		if (elements || total == 0)
+		{
+			flags |= CH_PARAMS_VALID;
+			status = kIOReturnSuccess;
+		}
+		else
+			status = kIOReturnNoMemory;
+	}
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  ReadElementStatus()
+ *  Read the status of every element into the cache, one READ ELEMENT
+ *  STATUS per element type. Volume tags are asked for, and left out
+ *  if the changer has no reader.
+ */
+IOReturn
+IOSCSIChanger::ReadElementStatus(void)
+{
+	IOReturn status = kIOReturnSuccess;
+	
+	if (!(flags & CH_PARAMS_VALID))
+		status = GetElementAddresses();
+	
+	for (int i = 0; i < CHET_MAX && status == kIOReturnSuccess; i++)
+	{
+		if (count[i] == 0)
+			continue;
+		
+		status = ReadElementStatusType(i, true);
+		
+		if (status != kIOReturnSuccess &&
+			lastSenseKey == kSENSE_KEY_ILLEGAL_REQUEST)
+			status = ReadElementStatusType(i, false);
+	}
+	
+	if (status == kIOReturnSuccess)
+		flags |= CH_STATUS_VALID;
+	
+	return status;
+}
+
+IOReturn
+IOSCSIChanger::ReadElementStatusType(int type, bool voltag)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8 *					data			= NULL;
+	UInt32					size			= 0;
+	UInt32					length			= 0;
+	UInt32					offset			= 8;
+	
+	size = 8 + 8 + count[type] * CH_DESCRIPTOR_MAX;
+	
+	if (size > kSCSICmdFieldMask3Byte)
+		size = kSCSICmdFieldMask3Byte;
+	
+	data = (UInt8 *)IOMalloc(size);
+	
+	require((data != 0), ErrorExit);
+	
+	bzero(data, size);
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(data, size, kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		READ_ELEMENT_STATUS(task, dataBuffer, voltag, ch_smc_type[type],
+							firstAddr[type], count[type], 0, size, 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, CH_MOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		length = 8 + ((data[5] << 16) | (data[6] << 8) | data[7]);
+		
+		if (length > GetRealizedDataTransferCount(task))
+			length = GetRealizedDataTransferCount(task);
+		
+		/* element status pages, each a header and descriptors */
+		while (offset + 8 <= length)
+		{
+			UInt8 *	page		= &data[offset];
+			bool	pvoltag		= (page[1] & 0x80) != 0;
+			UInt32	descLength	= (page[2] << 8) | page[3];
+			UInt32	pageLength	= (page[5] << 16) | (page[6] << 8) | page[7];
+			UInt32	end			= offset + 8 + pageLength;
+			
+			if (end > length)
+				end = length;
+			
+			if (descLength < 12)
+				break;
+			
+			for (offset += 8; offset + descLength <= end; offset += descLength)
+			{
+				UInt8 *		desc	= &data[offset];
+				UInt16		addr	= (desc[0] << 8) | desc[1];
+				CHElement *	elem	= FindElement(type, addr - firstAddr[type]);
+				int			i		= 0;
+				
+				if (elem == NULL)
+					continue;
+				
+				elem->addr = addr;
+				elem->flags = desc[2] & (CES_FULL | CES_IMPEXP | CES_EXCEPT |
+										 CES_ACCESS | CES_EXENAB | CES_INENAB);
+				elem->asc = desc[4];
+				elem->ascq = desc[5];
+				elem->source = (desc[10] << 8) | desc[11];
+				bzero(elem->voltag, sizeof(elem->voltag));
+				
+				if (desc[9] & 0x40)
+					elem->flags |= CES_INVERT;
+				
+				if (desc[9] & 0x80)
+					elem->flags |= CES_SOURCE_VALID;
+				
+				/* primary volume tag: identifier, blank padded */
+				if (pvoltag && descLength >= 12 + 36)
+				{
+					bcopy(&desc[12], elem->voltag, CH_VOLTAG_LEN);
+					
+					for (i = CH_VOLTAG_LEN; i > 0 && elem->voltag[i - 1] == ' '; i--)
+						elem->voltag[i - 1] = '\0';
+					
+					if (i > 0)
+						elem->flags |= CES_VOLTAG_VALID;
+				}
+			}
+			
+			offset = end;
+		}
+		
+		status = kIOReturnSuccess;
+	}
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	IOFree(data, size);
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSIChanger::MoveMedium(int fromType, int fromUnit, int toType, int toUnit, bool invert)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	CHElement *			from			= FindElement(fromType, fromUnit);
+	CHElement *			to				= FindElement(toType, toUnit);
+	
+	if (!from || !to || picker >= count[CHET_MT])
+		return kIOReturnBadArgument;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (MOVE_MEDIUM(task,
+					firstAddr[CHET_MT] + picker,
+					firstAddr[fromType] + fromUnit,
+					firstAddr[toType] + toUnit,
+					invert,
+					0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, CH_MOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		if (flags & CH_STATUS_VALID)
+			MoveCached(from, to, invert);
+		
+		status = kIOReturnSuccess;
+	}
+	else
+		flags &= ~CH_STATUS_VALID;
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSIChanger::ExchangeMedium(int srcType, int srcUnit,
+							  int fdstType, int fdstUnit,
+							  int sdstType, int sdstUnit,
+							  bool invert1, bool invert2)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	CHElement *			src				= FindElement(srcType, srcUnit);
+	CHElement *			fdst			= FindElement(fdstType, fdstUnit);
+	CHElement *			sdst			= FindElement(sdstType, sdstUnit);
+	CHElement			displaced;
+	
+	if (!src || !fdst || !sdst || picker >= count[CHET_MT])
+		return kIOReturnBadArgument;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (EXCHANGE_MEDIUM(task,
+						firstAddr[CHET_MT] + picker,
+						firstAddr[srcType] + srcUnit,
+						firstAddr[fdstType] + fdstUnit,
+						firstAddr[sdstType] + sdstUnit,
+						invert1,
+						invert2,
+						0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, CH_MOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		/* the second destination may be the source */
+		if (flags & CH_STATUS_VALID)
+		{
+			bcopy(fdst, &displaced, sizeof(displaced));
+			MoveCached(src, fdst, invert1);
+			MoveCached(&displaced, sdst, invert2);
+		}
+		
+		status = kIOReturnSuccess;
+	}
+	else
+		flags &= ~CH_STATUS_VALID;
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSIChanger::PositionToElement(int type, int unit, bool invert)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	
+	if (!FindElement(type, unit) || picker >= count[CHET_MT])
+		return kIOReturnBadArgument;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (POSITION_TO_ELEMENT(task,
+							firstAddr[CHET_MT] + picker,
+							firstAddr[type] + unit,
+							invert,
+							0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, CH_MOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+/*
+ *  InitializeElementStatus()
+ *  Have the changer scan every element again, e.g. after media were
+ *  moved by hand, and drop the cache.
+ */
+IOReturn
+IOSCSIChanger::InitializeElementStatus(void)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (INITIALIZE_ELEMENT_STATUS(task, 0x00) == true)
+		taskStatus = DoSCSICommand(task, CH_INIT_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	
+	flags &= ~CH_STATUS_VALID;
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+#if 0
+#pragma mark -
+#pragma mark SMC Commands
+#pragma mark -
+#endif /* 0 */
+
+bool
+IOSCSIChanger::EXCHANGE_MEDIUM(
+	SCSITaskIdentifier	request,
+	SCSICmdField2Byte	MEDIUM_TRANSPORT_ADDRESS,
+	SCSICmdField2Byte	SOURCE_ADDRESS,
+	SCSICmdField2Byte	FIRST_DESTINATION_ADDRESS,
+	SCSICmdField2Byte	SECOND_DESTINATION_ADDRESS,
+	SCSICmdField1Bit	INV1,
+	SCSICmdField1Bit	INV2,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(MEDIUM_TRANSPORT_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(SOURCE_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(FIRST_DESTINATION_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(SECOND_DESTINATION_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(INV1, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(INV2, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request,
+							  kSCSICmd_EXCHANGE_MEDIUM,
+							  0x00,
+							  (MEDIUM_TRANSPORT_ADDRESS >> 8) & 0xFF,
+							   MEDIUM_TRANSPORT_ADDRESS       & 0xFF,
+							  (SOURCE_ADDRESS >> 8) & 0xFF,
+							   SOURCE_ADDRESS       & 0xFF,
+							  (FIRST_DESTINATION_ADDRESS >> 8) & 0xFF,
+							   FIRST_DESTINATION_ADDRESS       & 0xFF,
+							  (SECOND_DESTINATION_ADDRESS >> 8) & 0xFF,
+							   SECOND_DESTINATION_ADDRESS       & 0xFF,
+							  (INV1 << 1) |
+							   INV2,
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CH_MOTION_TIMEOUT);
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSIChanger::INITIALIZE_ELEMENT_STATUS(
+	SCSITaskIdentifier	request,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request,
+							  kSCSICmd_INITIALIZE_ELEMENT_STATUS,
+							  0x00,
+							  0x00,
+							  0x00,
+							  0x00,
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CH_INIT_TIMEOUT);
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSIChanger::MOVE_MEDIUM(
+	SCSITaskIdentifier	request,
+	SCSICmdField2Byte	MEDIUM_TRANSPORT_ADDRESS,
+	SCSICmdField2Byte	SOURCE_ADDRESS,
+	SCSICmdField2Byte	DESTINATION_ADDRESS,
+	SCSICmdField1Bit	INVERT,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(MEDIUM_TRANSPORT_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(SOURCE_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(DESTINATION_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(INVERT, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request,
+							  kSCSICmd_MOVE_MEDIUM,
+							  0x00,
+							  (MEDIUM_TRANSPORT_ADDRESS >> 8) & 0xFF,
+							   MEDIUM_TRANSPORT_ADDRESS       & 0xFF,
+							  (SOURCE_ADDRESS >> 8) & 0xFF,
+							   SOURCE_ADDRESS       & 0xFF,
+							  (DESTINATION_ADDRESS >> 8) & 0xFF,
+							   DESTINATION_ADDRESS       & 0xFF,
+							  0x00,
+							  0x00,
+							  INVERT,
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CH_MOTION_TIMEOUT);
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSIChanger::POSITION_TO_ELEMENT(
+	SCSITaskIdentifier	request,
+	SCSICmdField2Byte	MEDIUM_TRANSPORT_ADDRESS,
+	SCSICmdField2Byte	DESTINATION_ADDRESS,
+	SCSICmdField1Bit	INVERT,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(MEDIUM_TRANSPORT_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(DESTINATION_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(INVERT, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request,
+							  kSCSICmd_POSITION_TO_ELEMENT,
+							  0x00,
+							  (MEDIUM_TRANSPORT_ADDRESS >> 8) & 0xFF,
+							   MEDIUM_TRANSPORT_ADDRESS       & 0xFF,
+							  (DESTINATION_ADDRESS >> 8) & 0xFF,
+							   DESTINATION_ADDRESS       & 0xFF,
+							  0x00,
+							  0x00,
+							  INVERT,
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CH_MOTION_TIMEOUT);
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSIChanger::READ_ELEMENT_STATUS(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField1Bit		VOLTAG,
+	SCSICmdField4Bit		ELEMENT_TYPE_CODE,
+	SCSICmdField2Byte		STARTING_ELEMENT_ADDRESS,
+	SCSICmdField2Byte		NUMBER_OF_ELEMENTS,
+	SCSICmdField1Bit		DVCID,
+	SCSICmdField3Byte		ALLOCATION_LENGTH,
+	SCSICmdField1Byte		CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(VOLTAG, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(ELEMENT_TYPE_CODE, kSCSICmdFieldMask4Bit), ErrorExit);
+	require(IsParameterValid(STARTING_ELEMENT_ADDRESS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(NUMBER_OF_ELEMENTS, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(DVCID, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	require((buffer != 0), ErrorExit);
+	require((buffer->getLength() >= ALLOCATION_LENGTH), ErrorExit);
+	
+	SetCommandDescriptorBlock(request,
+							  kSCSICmd_READ_ELEMENT_STATUS,
+							  (VOLTAG << 4) |
+							   ELEMENT_TYPE_CODE,
+							  (STARTING_ELEMENT_ADDRESS >> 8) & 0xFF,
+							   STARTING_ELEMENT_ADDRESS       & 0xFF,
+							  (NUMBER_OF_ELEMENTS >> 8) & 0xFF,
+							   NUMBER_OF_ELEMENTS       & 0xFF,
+							  DVCID,
+							  (ALLOCATION_LENGTH >> 16) & 0xFF,
+							  (ALLOCATION_LENGTH >>  8) & 0xFF,
+							   ALLOCATION_LENGTH        & 0xFF,
+							  0x00,
+							  CONTROL);
+	
+	SetDataBuffer(request, buffer);
+	
+	SetRequestedDataTransferCount(request, ALLOCATION_LENGTH);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
+	
+	SetTimeoutDuration(request, CH_MOTION_TIMEOUT);
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
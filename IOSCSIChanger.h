@@ -0,0 +1,178 @@
+/*
+ *  IOSCSIChanger.h
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+#include <IOKit/scsi/IOSCSIPrimaryCommandsDevice.h>
+
+#include "IOSCSITape.h"
+#include "chio.h"
+
+/* SCSI-3 Medium Changer Commands (SMC) not covered by IOSCSITape.h */
+enum
+{
+	kSCSICmd_EXCHANGE_MEDIUM				= 0xA6,
+	kSCSICmd_INITIALIZE_ELEMENT_STATUS		= 0x07,
+	kSCSICmd_POSITION_TO_ELEMENT			= 0x2B
+};
+
+/* SMC element type codes */
+enum
+{
+	kSMCElementType_All						= 0x0,
+	kSMCElementType_MediumTransport			= 0x1,
+	kSMCElementType_Storage					= 0x2,
+	kSMCElementType_ImportExport			= 0x3,
+	kSMCElementType_DataTransfer			= 0x4
+};
+
+#define CHANGER_FORMAT "ch%d"
+
+#define CH_ELEMENT_ADDRESS_PAGE	0x1D
+#define CH_RETRIES				2
+
+#define CH_PARAMS_VALID		0x01
+#define CH_STATUS_VALID		0x02
+
+/* element status flags that travel with the medium */
+#define CH_MEDIUM_FLAGS		(CES_FULL | CES_IMPEXP | CES_INVERT | \
+							 CES_SOURCE_VALID | CES_VOLTAG_VALID)
+
+/* cached status of one element */
+struct CHElement
+{
+	UInt16			addr;
+	UInt16			flags;
+	UInt8			asc;
+	UInt8			ascq;
+	UInt16			source;
+	char			voltag[CH_VOLTAG_LEN + 1];
+};
+
+class IOSCSIChanger : public IOSCSIPrimaryCommandsDevice {
+	OSDeclareDefaultStructors(IOSCSIChanger)
+public:
+	unsigned int flags;
+	static IOSCSIChanger **devices;
+	
+	int picker;
+	
+	/* element addresses and counts, indexed by CHET_* */
+	UInt16 firstAddr[CHET_MAX];
+	UInt16 count[CHET_MAX];
+	
+	/* sense of the last command */
+	SCSITaskStatus lastTaskStatus;
+	UInt8 lastSenseKey;
+	UInt8 lastASC;
+	UInt8 lastASCQ;
+	
+	/* Element status cache */
+	IOLock *lock;
+	
+	IOReturn GetElementStatus(struct changer_element_status_request *);
+	
+	/* SCSI Operations */
+	IOReturn GetElementAddresses(void);
+	IOReturn ReadElementStatus(void);
+	IOReturn MoveMedium(int, int, int, int, bool);
+	IOReturn ExchangeMedium(int, int, int, int, int, int, bool, bool);
+	IOReturn PositionToElement(int, int, bool);
+	IOReturn InitializeElementStatus(void);
+private:
+	int changerNumber;
+	
+	/* Element status cache, all types in one array */
+	CHElement *elements;
+	UInt32 elementCount;
+	
+	/* Event log, to the system log only; ERROR_LOG() and friends from
+	 * IOSCSITape.h land here */
+	IOLock *logLock;
+	int logLevel;
+	STLogLimit logLimits[ST_LOG_LIMITS];
+	
+	void LogEvent(int, const char *, ...) __attribute__((format(printf, 3, 4)));
+	
+	CHElement *FindElement(int, int);
+	CHElement *FindElementByAddress(UInt16, int *, int *);
+	void MoveCached(CHElement *, CHElement *, bool);
+	void FreeElements(void);
+	
+	/* SCSI Operations */
+	SCSITaskStatus DoSCSICommand(SCSITaskIdentifier, UInt32);
+	void GetSense(SCSITaskIdentifier);
+	IOReturn ReadElementStatusType(int, bool);
+	
+	/* utilities for major/minor to instance tracking */
+	void *cdev_node;
+	static int deviceCount;
+	
+	bool FindDeviceMinorNumber(void);
+	bool GrowDeviceMinorNumberMemory(void);
+	void ClearDeviceMinorNumber(void);
+	
+	/* pure function overrides from IOSCSIPrimaryCommandsDevice */
+	UInt32 GetInitialPowerState(void);
+	void HandlePowerChange(void);
+	void HandleCheckPowerState(void);
+	void TicklePowerManager(void);
+	
+	bool InitializeDeviceSupport(void);
+	void StartDeviceSupport(void);
+	void SuspendDeviceSupport(void);
+	void ResumeDeviceSupport(void);
+	void StopDeviceSupport(void);
+	void TerminateDeviceSupport(void);
+	
+	UInt32 GetNumberOfPowerStateTransitions(void);
+	bool ClearNotReadyStatus(void);
+	
+	/* SMC Commands */
+	bool EXCHANGE_MEDIUM(
+		SCSITaskIdentifier,
+		SCSICmdField2Byte,
+		SCSICmdField2Byte,
+		SCSICmdField2Byte,
+		SCSICmdField2Byte,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField1Byte);
+	
+	bool INITIALIZE_ELEMENT_STATUS(
+		SCSITaskIdentifier,
+		SCSICmdField1Byte);
+	
+	bool MOVE_MEDIUM(
+		SCSITaskIdentifier,
+		SCSICmdField2Byte,
+		SCSICmdField2Byte,
+		SCSICmdField2Byte,
+		SCSICmdField1Bit,
+		SCSICmdField1Byte);
+	
+	bool POSITION_TO_ELEMENT(
+		SCSITaskIdentifier,
+		SCSICmdField2Byte,
+		SCSICmdField2Byte,
+		SCSICmdField1Bit,
+		SCSICmdField1Byte);
+	
+	bool READ_ELEMENT_STATUS(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField1Bit,
+		SCSICmdField4Bit,
+		SCSICmdField2Byte,
+		SCSICmdField2Byte,
+		SCSICmdField1Bit,
+		SCSICmdField3Byte,
+		SCSICmdField1Byte);
+};
+
+int ch_open(dev_t dev, int flags, int devtype, struct proc *p);
+int ch_close(dev_t dev, int flags, int devtype, struct proc *p);
+int ch_ioctl(dev_t dev, u_long cmd, caddr_t data, int fflag, struct proc *p);
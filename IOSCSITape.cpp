@@ -11,18 +11,64 @@
 #include <sys/conf.h>
 #include <miscfs/devfs/devfs.h>
 #include <sys/errno.h>
+#include <sys/fcntl.h>
 #include "mtio.h"
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <sys/vnode.h>
+#include <sys/proc.h>
+#include <mach/vm_param.h>
 
 #include <IOKit/scsi/SCSICommandOperationCodes.h>
+#include <IOKit/IOMultiMemoryDescriptor.h>
+#include <IOKit/IOSubMemoryDescriptor.h>
 
 #include "IOSCSITape.h"
 #include "custom_mtio.h"
+#include "crc32c.h"
+#include "crc64.h"
 
 #define GROW_FACTOR 10
 #define SCSI_MOTION_TIMEOUT   (kThirtySecondTimeoutInMS * 2 * 5)
 #define SCSI_NOMOTION_TIMEOUT  kTenSecondTimeoutInMS
+#define RSOC_BUFFER_SIZE      4096
+#define RSOC_BUFFER_MAX       65536
+#define MSN_BUFFER_SIZE       (4 + 252)
+#define MAM_BUFFER_SIZE       (4 + 5 + MTMAM_LEN)
+#define MODE_BUFFER_SIZE      255
+#define LOG_BUFFER_SIZE       64
+#define HEALTH_BUFFER_SIZE    512
+#define CRYPT_BUFFER_SIZE     512
+#define CRYPT_PARAM_SIZE      (20 + MTCRYPT_KEYLEN + 4 + MTCRYPT_KADLEN)
+
+#define ST_PAGE_CONTROL			0x0A	/* subpage 0xF0, data protection */
+#define ST_PAGE_DEVICE_CONFIG	0x10	/* subpage 0x01, extension */
+#define ST_SUBPAGE_PROTECTION	0xF0
+#define ST_LBP_CRC32C			0x02	/* logical block protection method */
+#define ST_LBP_LENGTH			4		/* bytes of CRC after each block */
+#define ST_LBP_W				0x80	/* check blocks written */
+#define ST_LBP_R				0x40	/* send a CRC with blocks read */
+#define ST_LOG_WRITE_ERRORS		0x02
+#define ST_LOG_READ_ERRORS		0x03
+#define ST_LOG_TAPE_ALERT		0x2E
+#define ST_LOG_TAPE_CAPACITY	0x31
+
+#define ST_SECURITY_TAPE		0x20	/* tape data encryption protocol */
+#define ST_CRYPT_CAPABILITIES	0x0010	/* in */
+#define ST_CRYPT_STATUS			0x0020	/* in */
+#define ST_CRYPT_SET			0x0010	/* out */
+#define ST_CRYPT_SCOPE_LOCAL	0x1		/* this I_T nexus only */
+
+/* volume change requests */
+enum
+{
+	ST_SPAN_IDLE		= 0,
+	ST_SPAN_REQUESTED	= 1,
+	ST_SPAN_DONE		= 2
+};
+
+static void st_health_timeout(thread_call_param_t, thread_call_param_t);
+static void st_progress_timeout(thread_call_param_t, thread_call_param_t);
 
 #define super IOSCSIPrimaryCommandsDevice
 OSDefineMetaClassAndStructors(IOSCSITape, IOSCSIPrimaryCommandsDevice)
@@ -83,6 +129,10 @@ public:
 CdevMajorIniter::CdevMajorIniter(void)
 {
 	majorNumber = cdevsw_add(-1, &cdevsw);
+	
+	/* kevent() on the devices is answered by st_select() */
+	if (majorNumber >= 0)
+		cdevsw_setkqueueok(majorNumber, &cdevsw, 0);
 }
 
 CdevMajorIniter::~CdevMajorIniter(void)
@@ -101,7 +151,7 @@ struct cdevsw CdevMajorIniter::cdevsw =
 	eno_stop,
 	eno_reset,
 	0,
-	(select_fcn_t *)enodev,
+	st_select,
 	eno_mmap,
 	eno_strat,
 	eno_getc,
@@ -171,6 +221,87 @@ IOSCSITape::ClearDeviceMinorNumber(void)
 bool
 IOSCSITape::InitializeDeviceSupport(void)
 {
+	logLevel = MT_LOG_INFO;
+	logBurst = ST_LOG_BURST;
+	logInterval = ST_LOG_INTERVAL;
+	logNext = 0;
+	bzero(logLimits, sizeof(logLimits));
+	
+	traceEnabled = false;
+	bzero(&traceRing, sizeof(traceRing));
+	traceDraining = 0;
+	
+	captureEnabled = false;
+	captureDraining = 0;
+	bzero(&captureRing, sizeof(captureRing));
+	
+	progressOp = MTPROG_NONE;
+	progressDetached = false;
+	cmdInFlight = 0;
+	bzero(&progressSelect, sizeof(progressSelect));
+	
+	readyWait = ST_READY_WAIT;
+	resid = 0;
+	pewSize = 0;
+	bufferMode = MTBUFFER_OFF;
+	lbpEnabled = false;
+	lbpActive = false;
+	
+	cmdTableValid = false;
+	bzero(cmdSupported, sizeof(cmdSupported));
+	bzero(cmdTimeout, sizeof(cmdTimeout));
+	bzero(cmdTimeoutOverride, sizeof(cmdTimeoutOverride));
+	
+	noLongPosition = false;
+	
+	mediaSerial[0] = '\0';
+	bzero(eodCache, sizeof(eodCache));
+	for (int i = 0; i < ST_EOD_CACHE; i++)
+		eodCache[i].eod = -1;
+	eodCacheNext = 0;
+	eodEntry = NULL;
+	
+	spanState = ST_SPAN_IDLE;
+	spanError = 0;
+	spanMarkPartition = -1;
+	bzero(&spanRequest, sizeof(spanRequest));
+	bzero(&spanSelect, sizeof(spanSelect));
+	
+	bzero(&health, sizeof(health));
+	healthTime = 0;
+	
+	bzero(&cryptStatus, sizeof(cryptStatus));
+	cryptKnown = false;
+	
+	digestEnabled = false;
+	digestActive = false;
+	bzero(digests, sizeof(digests));
+	for (int i = 0; i < ST_DIGEST_FILES; i++)
+		digests[i].md_fileno = -1;
+	digestNext = 0;
+	
+	sharedRing = NULL;
+	sharedMap = NULL;
+	sharedHeader = NULL;
+	
+	cmdLock = IOLockAlloc();
+	logLock = IOLockAlloc();
+	logRing = (struct mtlogent *)IOMalloc(sizeof(struct mtlogent) * ST_LOG_RING);
+	progressLock = IOLockAlloc();
+	progressCall = thread_call_allocate(st_progress_timeout, this);
+	spanLock = IOLockAlloc();
+	healthLock = IOLockAlloc();
+	healthCall = thread_call_allocate(st_health_timeout, this);
+	digestLock = IOLockAlloc();
+	
+	if (!cmdLock || !logLock || !logRing || !progressLock || !progressCall ||
+		!spanLock || !healthLock || !healthCall || !digestLock)
+	{
+		/* whatever was allocated is not torn down for us */
+		TerminateDeviceSupport();
+		return false;
+	}
+	
 	if (FindDeviceMinorNumber())
 	{
 		cdev_node = devfs_make_node(
@@ -181,14 +312,34 @@ IOSCSITape::InitializeDeviceSupport(void)
 									0664,
 									TAPE_FORMAT, tapeNumber);
 		
-		if (cdev_node)
+		ctl_node = devfs_make_node(
+								   makedev(CdevMajorIniter.majorNumber, tapeNumber | ST_CTL_MINOR), 
+								   DEVFS_CHAR,
+								   UID_ROOT,
+								   GID_OPERATOR,
+								   0664,
+								   TAPE_CTL_FORMAT, tapeNumber);
+		
+		if (cdev_node && ctl_node)
 		{
 			flags = 0;
 			
 			return true;
 		}
+		
+		if (cdev_node)
+			devfs_remove(cdev_node);
+		
+		if (ctl_node)
+			devfs_remove(ctl_node);
+		
+		cdev_node = NULL;
+		ctl_node = NULL;
+		ClearDeviceMinorNumber();
 	}
 	
+	TerminateDeviceSupport();
+	
 	return false;
 }
 
@@ -200,11 +351,21 @@ IOSCSITape::StartDeviceSupport(void)
 			   GetProductString(),
 			   GetRevisionString());
 	
-	GetDeviceDetails();
-	GetDeviceBlockLimits();
+	GetCommandTimeouts();
+	
+	/* with no tape loaded, try again once one is */
+	if (GetDeviceDetails() != kIOReturnSuccess ||
+		GetDeviceBlockLimits() != kIOReturnSuccess)
+	{
+		flags |= ST_MEDIA_CHANGED;
+	}
+	else
+		IdentifyMedia();
 	
 	fileno = -1;
 	blkno = -1;
+	lba = -1;
+	rdposLba = -1;
 }
 
 void
@@ -221,6 +382,7 @@ void
 IOSCSITape::StopDeviceSupport(void)
 {
 	devfs_remove(cdev_node);
+	devfs_remove(ctl_node);
 	ClearDeviceMinorNumber();
 }
 
@@ -241,932 +403,6426 @@ IOSCSITape::IsFixedBlockSize(void)
 
 #if 0
 #pragma mark -
-#pragma mark IOKit power management
+#pragma mark Event log
 #pragma mark -
 #endif /* 0 */
 
-UInt32
-IOSCSITape::GetInitialPowerState(void)
-{
-	return 0;
-}
-
-void
-IOSCSITape::HandlePowerChange(void)
-{
-}
-
-void
-IOSCSITape::HandleCheckPowerState(void)
-{
-}
-
-void
-IOSCSITape::TicklePowerManager(void)
+static UInt64
+st_uptime_us(void)
 {
+	UInt64 now, ns;
+	
+	clock_get_uptime(&now);
+	absolutetime_to_nanoseconds(now, &ns);
+	
+	return ns / 1000;
 }
 
+/*
+ *  LogEvent()
+ *  Record a driver event whose level is enabled in the per-device ring
+ *  and, if the message has not exceeded its rate, in the system log.
+ *  Messages are rate limited per format string so a flood of one event
+ *  (e.g. filemarks during a restore) can't hide the others.
+ */
 void
-IOSCSITape::TerminateDeviceSupport(void)
-{
-}
-
-UInt32
-IOSCSITape::GetNumberOfPowerStateTransitions(void)
-{
-	return 0;
-}
-
-#if 0
-#pragma mark -
-#pragma mark Tape driver operations
-#pragma mark -
-#endif /* 0 */
-
-/* The job of these tape driver operations, generally, is to adapt the
- * lower level SCSI operations and convert the results and potential
- * SENSE information into POSIX-ish return codes and results as well
- * as manage driver state like blkno and fileno. */
-
-int st_rewind(IOSCSITape *st)
+IOSCSITape::LogEvent(int level, const char *format, ...)
 {
-	if (st->Rewind() == kIOReturnSuccess)
+	char		msg[MTLOG_MSGLEN];
+	va_list		ap;
+	UInt32		suppressed = 0;
+	
+	va_start(ap, format);
+	vsnprintf(msg, sizeof(msg), format, ap);
+	va_end(ap);
+	
+	if (logRing)
 	{
-		st->fileno = 0;
-		st->blkno = 0;
-		return KERN_SUCCESS;
+		IOLockLock(logLock);
+		
+		struct mtlogent *ent = &logRing[logNext % ST_LOG_RING];
+		
+		ent->le_time = st_uptime_us();
+		ent->le_seq = logNext++;
+		ent->le_level = level;
+		strlcpy(ent->le_msg, msg, sizeof(ent->le_msg));
+		
+		IOLockUnlock(logLock);
 	}
 	
-	return ENODEV;
+	/* the ring has every event, the system log only those up to the
+	 * log level */
+	if (level > logLevel ||
+		!st_log_allowed(logLimits, logLock, logBurst, logInterval, format, &suppressed))
+		return;
+	
+	if (suppressed)
+		IOLog(TAPE_FORMAT ": %s (%u similar messages suppressed)\n",
+			  tapeNumber, msg, suppressed);
+	else
+		IOLog(TAPE_FORMAT ": %s\n", tapeNumber, msg);
 }
 
-int st_space(IOSCSITape *st, SCSISpaceCode type, int number)
+/*
+ *  st_log_allowed()
+ *  Whether a message may go to the system log: at most burst of each
+ *  format string per interval ms, counting the ones held back. limits
+ *  has ST_LOG_LIMITS slots, guarded by lock. A slot is only taken over
+ *  once its window has passed; while every slot is in use, a message
+ *  counts against the one its format hashes to. The changer shares it.
+ */
+bool st_log_allowed(STLogLimit *limits, IOLock *lock, int burst, int interval,
+					const char *format, UInt32 *suppressed)
 {
-	if (st->Space(type, number) == kIOReturnSuccess)
+	STLogLimit *	limit	= NULL;
+	STLogLimit *	spare	= NULL;
+	UInt64			now		= st_uptime_us();
+	UInt64			window	= (UInt64)interval * 1000;
+	bool			allowed	= true;
+	
+	if (burst <= 0)
+		return true;
+	
+	IOLockLock(lock);
+	
+	for (int i = 0; i < ST_LOG_LIMITS; i++)
 	{
-		if (st->fileno != -1)
+		if (limits[i].format == format)
 		{
-			switch (type)
-			{
-				case kSCSISpaceCode_Filemarks:
-					st->fileno += number;
-					st->blkno = 0;
-					break;
-				case kSCSISpaceCode_LogicalBlocks:
-					st->blkno += number;
-					break;
-				case kSCSISpaceCode_EndOfData:
-					st->fileno = -1;
-					st->blkno = -1;
-					break;
-			}
+			limit = &limits[i];
+			break;
 		}
 		
-		return KERN_SUCCESS;
+		if (spare == NULL &&
+			(limits[i].format == NULL || now - limits[i].windowStart >= window))
+			spare = &limits[i];
 	}
 	
-	return ENODEV;
-}
-
-int st_write_filemarks(IOSCSITape *st, int number)
-{
-	if (st->WriteFilemarks(number) == kIOReturnSuccess)
+	if (limit != NULL && now - limit->windowStart >= window)
 	{
-		if (st->fileno != -1)
-		{
-			st->fileno += number;
-			st->blkno = 0;
-		}
-		
-		return KERN_SUCCESS;
+		*suppressed = limit->suppressed;
+		limit->windowStart = now;
+		limit->count = 0;
+		limit->suppressed = 0;
+	}
+	else if (limit == NULL && spare != NULL)
+	{
+		limit = spare;
+		limit->format = format;
+		limit->windowStart = now;
+		limit->count = 0;
+		limit->suppressed = 0;
 	}
+	else if (limit == NULL)
+		limit = &limits[((uintptr_t)format >> 4) % ST_LOG_LIMITS];
 	
-	return ENODEV;
-}
-
-int st_unload(IOSCSITape *st)
-{
-	if (st->LoadUnload(0) == kIOReturnSuccess)
-		return KERN_SUCCESS;
+	if (limit->count < (UInt32)burst)
+		limit->count++;
+	else
+	{
+		limit->suppressed++;
+		allowed = false;
+	}
+	
+	IOLockUnlock(lock);
 	
-	return ENODEV;
+	return allowed;
 }
 
-int st_rdpos(IOSCSITape *st, bool vendor, unsigned int *data)
+/* Copy out up to MTLOG_BATCH events starting at log->ml_seq. Events
+ * that have already been overwritten are counted in ml_lost. */
+void
+IOSCSITape::ReadLog(struct mtlog *log)
 {
-	SCSI_ReadPositionShortForm pos = { 0 };
+	UInt32 seq = log->ml_seq;
+	UInt32 oldest;
 	
-	if (st->ReadPosition(&pos, vendor) == kIOReturnSuccess)
+	log->ml_count = 0;
+	log->ml_lost = 0;
+	
+	IOLockLock(logLock);
+	
+	oldest = (logNext > ST_LOG_RING) ? logNext - ST_LOG_RING : 0;
+	
+	if (seq < oldest)
 	{
-		if (pos.flags & kSCSIReadPositionShortForm_LogicalObjectLocationUnknown)
-			return (ENOTSUP);
-		
-		*data = pos.firstLogicalObjectLocation;
-		
-		return KERN_SUCCESS;
+		log->ml_lost = oldest - seq;
+		seq = oldest;
 	}
 	
-	return ENODEV;	
-}
-
-int st_set_blocksize(IOSCSITape *st, int number)
-{
-	if ((number > 0) &&
-		(st->blkmin || st->blkmax) &&
-		(number < st->blkmin ||
-		 number > st->blkmax))
+	while (seq < logNext && log->ml_count < MTLOG_BATCH)
 	{
-		return (EINVAL);
+		bcopy(&logRing[seq % ST_LOG_RING],
+			  &log->ml_ent[log->ml_count++],
+			  sizeof(struct mtlogent));
+		seq++;
 	}
 	
-	if (st->SetBlockSize(number) == kIOReturnSuccess)
-		return KERN_SUCCESS;
+	IOLockUnlock(logLock);
 	
-	return (ENODEV);	
+	log->ml_seq = seq;
 }
 
 #if 0
 #pragma mark -
-#pragma mark Character device system calls
+#pragma mark Command trace
 #pragma mark -
 #endif /* 0 */
 
-int st_open(dev_t dev, int flags, int devtype, struct proc *p)
+static bool
+st_ring_alloc(STRing *ring, UInt32 recordSize, UInt32 count)
 {
-	IOSCSITape *st = IOSCSITape::devices[minor(dev)];
-	int error = ENXIO;
+	ring->buffer = (UInt8 *)IOMalloc(recordSize * count);
 	
-	if (st->flags & ST_DEVOPEN)
-		error = EBUSY;
-	else
-	{
-		st->flags |= ST_DEVOPEN;
-		error = KERN_SUCCESS;
-	}
+	if (!ring->buffer)
+		return false;
 	
-	return error;
+	bzero(ring->buffer, recordSize * count);
+	
+	ring->recordSize = recordSize;
+	ring->mask = count - 1;
+	ring->head = 0;
+	ring->tail = 0;
+	
+	return true;
 }
 
-int st_close(dev_t dev, int flags, int devtype, struct proc *p)
+static void
+st_ring_free(STRing *ring)
 {
-	IOSCSITape *st = IOSCSITape::devices[minor(dev)];
-
-	/* if the last command was a write then write 2x EOF markers and
-	 * backspace over 1 (for the next write) */
-	if (st->flags & ST_WRITTEN)
-	{
-		st_write_filemarks(st, 2);
-		st_space(st, kSCSISpaceCode_Filemarks, -1);
-		
-		st->flags &= ~ST_WRITTEN;
-	}
+	if (ring->buffer)
+		IOFree(ring->buffer, ring->recordSize * (ring->mask + 1));
 	
-	st->flags &= ~ST_DEVOPEN;
-	
-	return KERN_SUCCESS;
+	ring->buffer = NULL;
 }
 
-int st_readwrite(dev_t dev, struct uio *uio, int ioflag)
+/* Claim the next record for a producer. The record is unpublished until
+ * st_ring_publish() stores its sequence number. The barriers keep the
+ * payload stores between the header being cleared and it being set, as
+ * seen from st_ring_drain(), whose own barriers keep its copy between
+ * two loads of the header. */
+static void *
+st_ring_claim(STRing *ring, UInt32 *seq)
 {
-	IOSCSITape			*st			= IOSCSITape::devices[minor(dev)];
-	IOMemoryDescriptor	*dataBuffer	= IOMemoryDescriptorFromUIO(uio);
-	int					status		= ENOSYS;
-	IOReturn			opStatus	= kIOReturnError;
-	int					lastRealizedBytes = 0;
-	
-	if (dataBuffer == 0)
-		return ENOMEM;
+	UInt8 *record;
 	
-	dataBuffer->prepare();
+	*seq = (UInt32)OSIncrementAtomic(&ring->head);
+	record = ring->buffer + (*seq & ring->mask) * ring->recordSize;
+	*(volatile UInt32 *)record = 0;
+	OSMemoryBarrier();
 	
-	opStatus = st->ReadWrite(dataBuffer, &lastRealizedBytes);
+	return record;
+}
+
+static void
+st_ring_publish(void *record, UInt32 seq)
+{
+	OSMemoryBarrier();
+	*(volatile UInt32 *)record = seq + 1;
+}
+
+/* Copy up to max published records out of the ring, oldest first.
+ * There is a single consumer (the ioctl path), so the tail needs no
+ * atomics; records overwritten before or while being copied are
+ * counted as lost. */
+static UInt32
+st_ring_drain(STRing *ring, void *out, UInt32 max, UInt32 *lost)
+{
+	UInt32	head	= (UInt32)ring->head;
+	UInt32	size	= ring->mask + 1;
+	UInt32	count	= 0;
+	UInt8 *	dst		= (UInt8 *)out;
 	
-	dataBuffer->complete();
-	dataBuffer->release();
+	*lost = 0;
 	
-	if (opStatus == kIOReturnSuccess)
+	if (head - ring->tail > size)
 	{
-		uio_setresid(uio, uio_resid(uio) - lastRealizedBytes);
-		
-		if (st->blkno != -1)
-		{
-			if (st->IsFixedBlockSize())
-				st->blkno += (lastRealizedBytes / st->blksize);
-			else
-				st->blkno++;
-		}
-
-		status = KERN_SUCCESS;
+		*lost = head - size - ring->tail;
+		ring->tail = head - size;
 	}
-	else if (st->sense_flags & SENSE_FILEMARK)
+	
+	while (ring->tail != head && count < max)
 	{
-		if (st->fileno != -1)
+		UInt8 *record = ring->buffer + (ring->tail & ring->mask) * ring->recordSize;
+		
+		/* not yet published by its producer */
+		if (*(volatile UInt32 *)record != ring->tail + 1)
+			break;
+		
+		OSMemoryBarrier();
+		bcopy(record, dst, ring->recordSize);
+		OSMemoryBarrier();
+		
+		if (*(volatile UInt32 *)record != ring->tail + 1)
+			(*lost)++;
+		else
 		{
-			st->fileno++;
-			st->blkno = 0;
+			/* hand out zero-based sequence numbers */
+			(*(UInt32 *)dst)--;
+			dst += ring->recordSize;
+			count++;
 		}
 		
-		status = KERN_SUCCESS;
+		ring->tail++;
 	}
 	
-	return status;
+	return count;
 }
 
-int st_ioctl(dev_t dev, u_long cmd, caddr_t data, int fflag, struct proc *p)
+int
+IOSCSITape::SetTrace(int op)
 {
-	IOSCSITape *st = IOSCSITape::devices[minor(dev)];
-	struct mtop *mt = (struct mtop *) data;
-	struct mtget *g = (struct mtget *) data;
-	int number = mt->mt_count;
-	int error = 0;
-	
-	switch (cmd)
+	switch (op)
 	{
-		case MTIOCGET:
-			memset(g, 0, sizeof(struct mtget));
-			g->mt_type = 0x7;	/* Ultrix compat *//*? */
-			g->mt_blksiz = st->blksize;
-			g->mt_density = st->density;
-			g->mt_fileno = st->fileno;
-			g->mt_blkno = st->blkno;
-			g->mt_dsreg = st->flags;	/* report raw driver flags */
-			g->mt_erreg = st->sense_flags;
-			/* TODO: Implement the full mtget struct */
-			
-			break;
-		case MTIOCTOP:
-			switch (mt->mt_op)
+		case MTTRACE_START:
+			if (!traceRing.buffer &&
+				!st_ring_alloc(&traceRing, sizeof(struct mttrace), ST_TRACE_RING))
 			{
-				case MTBSF:
-					number = -number;
-				case MTFSF:
-					error = st_space(st, kSCSISpaceCode_Filemarks, number);
-					break;
-				case MTBSR:
-					number = -number;
-				case MTFSR:
-					error = st_space(st, kSCSISpaceCode_LogicalBlocks, number);
-					break;
-				case MTREW:
-					error = st_rewind(st);
-					break;
-				case MTWEOF:
-					error = st_write_filemarks(st, number);
-					break;
-				case MTOFFL:
-					error = st_unload(st);
-					break;
-				case MTNOP:
-					break;
-				case MTEOM:
-					error = st_space(st, kSCSISpaceCode_EndOfData, number);
-					break;
-				case MTSETBSIZ:
-					error = st_set_blocksize(st, number);
-					break;
-				default:
-					error = EINVAL;
+				return ENOMEM;
 			}
+			
+			traceEnabled = true;
 			break;
-		case MTIOCRDSPOS:
-			error = st_rdpos(st, false, (unsigned int *)data);
+		case MTTRACE_STOP:
+			traceEnabled = false;
 			break;
-		case MTIOCRDHPOS:
-			error = st_rdpos(st, true, (unsigned int *)data);
+		case MTTRACE_CLEAR:
+			if (!OSCompareAndSwap(0, 1, &traceDraining))
+				return EBUSY;
+			
+			traceRing.tail = (UInt32)traceRing.head;
+			traceDraining = 0;
 			break;
 		default:
-			error = ENOTTY;
+			return EINVAL;
 	}
 	
-	return error;
+	return KERN_SUCCESS;
 }
 
-#if 0
-#pragma mark -
-#pragma mark SCSI Operations
-#pragma mark -
-#endif /* 0 */
-
 /*
- *  DoSCSICommand()
- *  Encapsulate super::SendCommand() to handle unexpected service and
- *  task errors as well as hand off to SCSI SENSE interpreter.
+ *  DrainTrace()
+ *  The ring has a single consumer, and several processes may have the
+ *  control device open, so one drain at a time gets in.
  */
-SCSITaskStatus
-IOSCSITape::DoSCSICommand(
-	SCSITaskIdentifier	request,
-	UInt32				timeoutDuration)
+int
+IOSCSITape::DrainTrace(struct mttracebuf *buf)
 {
-	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeliveryFailure;
-	SCSIServiceResponse	serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
-	
-	require((request != 0), ErrorExit);
-	
-	serviceResponse = SendCommand(request, timeoutDuration);
-	sense_flags = 0;
+	buf->mtb_count = 0;
+	buf->mtb_lost = 0;
 	
-	if (serviceResponse != kSCSIServiceResponse_TASK_COMPLETE)
-	{
-		STATUS_LOG("unknown service response: 0x%x", serviceResponse);
-		goto ErrorExit;
-	}
-	else
-	{
-		taskStatus = GetTaskStatus(request);
-		
-		if (taskStatus == kSCSITaskStatus_CHECK_CONDITION)
-		{
-			/* Get and interpret SCSI SENSE information */
-			GetSense(request);
-		}
-		else if (taskStatus != kSCSITaskStatus_GOOD)
-		{
-			STATUS_LOG("unknown task status: 0x%x", taskStatus);
-		}
-		else if (taskStatus == kSCSITaskStatus_GOOD)
-		{
-			/* setup flags for device file closing */
-			if (flags & ST_WRITTEN_TOGGLE)
-				flags |= ST_WRITTEN;
-			else
-				flags &= ~ST_WRITTEN;
-		}
-	}
+	if (!OSCompareAndSwap(0, 1, &traceDraining))
+		return EBUSY;
 	
-	/* clear the write toggle bit in case the next command is not a
-	 * write */
-	flags &= ~ST_WRITTEN_TOGGLE;
+	if (traceRing.buffer)
+		buf->mtb_count = st_ring_drain(&traceRing, buf->mtb_ent,
+									   MTTRACE_BATCH, &buf->mtb_lost);
 	
-ErrorExit:
+	traceDraining = 0;
 	
-	return taskStatus;
+	return KERN_SUCCESS;
 }
 
-/*
- *  GetSenseInformation
- *
- *  Attempt to get SCSI sense information either from the Auto sense
- *  mechanism or by querying manually.
- */
+/* Called from DoSCSICommand() only while tracing is enabled. */
 void
-IOSCSITape::GetSense(SCSITaskIdentifier request)
+IOSCSITape::TraceCommand(SCSITaskIdentifier request, UInt64 start, SCSITaskStatus taskStatus)
 {
-	SCSI_Sense_Data		senseBuffer = { 0 };
-	bool				validSense = false;
-	SCSIServiceResponse	serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSICommandDescriptorBlock	cdb;
+	struct mttrace *			tr;
+	UInt32						seq;
+	UInt64						now = st_uptime_us();
 	
-	IOMemoryDescriptor *bufferDesc = IOMemoryDescriptor::withAddress((void *)&senseBuffer, 
-																	 sizeof(senseBuffer), 
-																	 kIODirectionIn);
+	if (!traceRing.buffer)
+		return;
 	
-	if (GetTaskStatus(request) == kSCSITaskStatus_CHECK_CONDITION)
-	{
-		validSense = GetAutoSenseData(request, &senseBuffer);
-		
-		if (validSense == false)
-		{
-			if (REQUEST_SENSE(request, bufferDesc, kSenseDefaultSize, 0) == true)
-				serviceResponse = SendCommand(request, kTenSecondTimeoutInMS);
-			
-			if (serviceResponse == kSCSIServiceResponse_TASK_COMPLETE)
-				validSense = true;
-		}
-		
-		if (validSense == true)
-			InterpretSense(&senseBuffer);
-		else
-			STATUS_LOG("invalid or unretrievable SCSI SENSE");
-	}
+	tr = (struct mttrace *)st_ring_claim(&traceRing, &seq);
 	
-	bufferDesc->release();
+	tr->tr_time = start;
+	tr->tr_latency = (UInt32)(now - start);
+	tr->tr_requested = (UInt32)GetRequestedDataTransferCount(request);
+	tr->tr_realized = (UInt32)GetRealizedDataTransferCount(request);
+	tr->tr_status = taskStatus;
+	tr->tr_sensekey = lastSenseKey;
+	tr->tr_asc = lastASC;
+	tr->tr_ascq = lastASCQ;
+	tr->tr_cdblen = GetCommandDescriptorBlockSize(request);
+	
+	bzero(tr->tr_cdb, sizeof(tr->tr_cdb));
+	
+	if (tr->tr_cdblen > sizeof(tr->tr_cdb))
+		tr->tr_cdblen = sizeof(tr->tr_cdb);
+	
+	if (GetCommandDescriptorBlock(request, &cdb))
+		bcopy(cdb, tr->tr_cdb, tr->tr_cdblen);
+	
+	st_ring_publish(tr, seq);
 }
 
-void
-IOSCSITape::InterpretSense(SCSI_Sense_Data *sense)
+int
+IOSCSITape::SetCapture(int op)
 {
-	uint8_t key = sense->SENSE_KEY & kSENSE_KEY_Mask;
-	uint8_t asc = sense->ADDITIONAL_SENSE_CODE;
-	uint8_t ascq = sense->ADDITIONAL_SENSE_CODE_QUALIFIER;
-
-	if ((sense->VALID_RESPONSE_CODE & kSENSE_RESPONSE_CODE_Mask) == kSENSE_RESPONSE_CODE_Current_Errors)
+	switch (op)
 	{
-		/* current errors, fixed format - 0x70 */
-		
-		// sense->VALID_RESPONSE_CODE & kSENSE_DATA_VALID
-
-		if (key  == kSENSE_KEY_NOT_READY &&
-			asc  == 0x04 &&
-			ascq == 0x01)
-		{
-			STATUS_LOG("LOGICAL UNIT IS IN PROCESS OF BECOMING READY");
-			sense_flags |= SENSE_NOTREADY;
-		}
-		else if (key  == kSENSE_KEY_NO_SENSE &&
-				 asc  == 0x00 &&
-				 ascq == 0x04)
-		{
-			STATUS_LOG("BEGINNING-OF-PARTITION/MEDIUM DETECTED");
-			
-			sense_flags |= SENSE_BOM;
-		}
-		else if (key  == kSENSE_KEY_BLANK_CHECK &&
-				 asc  == 0x00 &&
-				 ascq == 0x05)
-				/* sense->SENSE_KEY & kSENSE_EOM_Mask */
-		{
-			STATUS_LOG("END-OF-DATA DETECTED");
-			
-			sense_flags |= SENSE_EOD;
-		}
-		else if ((sense->SENSE_KEY & kSENSE_FILEMARK_Mask) ||
-				 (key  == kSENSE_KEY_NO_SENSE &&
-				  asc  == 0x00 &&
-				  ascq == 0x01))
-		{
-			STATUS_LOG("FILEMARK DETECTED");
-			
-			sense_flags |= SENSE_FILEMARK;
-		}
-		else
-		{
-			STATUS_LOG("SENSE: %s (Key: 0x%X, ASC: 0x%02X, ASCQ: 0x%02X)",
-					   kSCSISenseKeyDescriptions[key], key, asc, ascq);
-
-			if (sense->SENSE_KEY & kSENSE_ILI_Mask)
-				STATUS_LOG("SENSE: Incorrect Length Indicator (ILI)");
-
-			int i;
-			unsigned char *bytes = (unsigned char *)sense;
-			
-			IOLog("SCSI SENSE DATA: ");
-			for (i = 0; i < sizeof(SCSI_Sense_Data); i++)
+		case MTTRACE_START:
+			if (!captureRing.buffer &&
+				!st_ring_alloc(&captureRing, sizeof(struct mtwlrec), ST_CAPTURE_RING))
 			{
-				IOLog("0x%02x ", (int)bytes[i]);
+				return ENOMEM;
 			}
-			IOLog("\n");
-		}
+			
+			captureEnabled = true;
+			break;
+		case MTTRACE_STOP:
+			captureEnabled = false;
+			break;
+		case MTTRACE_CLEAR:
+			if (!OSCompareAndSwap(0, 1, &captureDraining))
+				return EBUSY;
+			
+			captureRing.tail = (UInt32)captureRing.head;
+			captureDraining = 0;
+			break;
+		default:
+			return EINVAL;
 	}
+	
+	return KERN_SUCCESS;
 }
 
-IOReturn
-IOSCSITape::TestUnitReady(void)
+/*
+ *  DrainCapture()
+ *  One drain at a time, as for DrainTrace().
+ */
+int
+IOSCSITape::DrainCapture(struct mtwlbuf *buf)
 {
-	SCSITaskIdentifier	task			= NULL;
-	IOReturn			result			= kIOReturnError;
-	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	buf->mwb_count = 0;
+	buf->mwb_lost = 0;
 	
-	task = GetSCSITask();
+	if (!OSCompareAndSwap(0, 1, &captureDraining))
+		return EBUSY;
 	
-	require((task != 0), ErrorExit);
+	if (captureRing.buffer)
+		buf->mwb_count = st_ring_drain(&captureRing, buf->mwb_ent,
+									   MTWL_BATCH, &buf->mwb_lost);
 	
-	if (TEST_UNIT_READY(task, 0x00) == true)
-		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	captureDraining = 0;
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
-		result = kIOReturnSuccess;
+	return KERN_SUCCESS;
+}
+
+/* Called from the character device entry points only while capture is
+ * enabled; start is the uptime at entry. */
+void
+IOSCSITape::CaptureCall(int op, u_long cmd, int mtop, int count, int result, int error, UInt64 start)
+{
+	struct mtwlrec *	wl;
+	UInt32				seq;
 	
-	ReleaseSCSITask(task);
+	if (!captureRing.buffer)
+		return;
 	
-ErrorExit:
+	wl = (struct mtwlrec *)st_ring_claim(&captureRing, &seq);
 	
-	return result;
+	wl->wl_op = op;
+	wl->wl_mtop = mtop;
+	wl->wl_time = start;
+	wl->wl_cmd = (UInt32)cmd;
+	wl->wl_count = count;
+	wl->wl_result = result;
+	wl->wl_error = error;
+	wl->wl_duration = (UInt32)(st_uptime_us() - start);
+	wl->wl_pad = 0;
+	
+	st_ring_publish(wl, seq);
 }
 
-IOReturn
-IOSCSITape::Rewind(void)
+void
+IOSCSITape::GetLogControl(struct mtlogctl *ctl)
 {
-	IOReturn			status		= kIOReturnError;
-	SCSITaskIdentifier	task		= NULL;
-	SCSITaskStatus		taskStatus	= kSCSITaskStatus_DeliveryFailure;
+	ctl->mlc_level = logLevel;
+	ctl->mlc_burst = logBurst;
+	ctl->mlc_interval = logInterval;
+}
+
+int
+IOSCSITape::SetLogControl(struct mtlogctl *ctl)
+{
+	if (ctl->mlc_level < MT_LOG_ERR ||
+		ctl->mlc_level > MT_LOG_DEBUG ||
+		ctl->mlc_burst < 0 ||
+		ctl->mlc_interval <= 0)
+	{
+		return EINVAL;
+	}
 	
-	task = GetSCSITask();
+	IOLockLock(logLock);
 	
-	require ((task != 0), ErrorExit);
+	logLevel = ctl->mlc_level;
+	logBurst = ctl->mlc_burst;
+	logInterval = ctl->mlc_interval;
+	bzero(logLimits, sizeof(logLimits));
 	
-	if (REWIND(task, 0, 0) == true)
-		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	IOLockUnlock(logLock);
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
-		status = kIOReturnSuccess;
+	return KERN_SUCCESS;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Operation progress
+#pragma mark -
+#endif /* 0 */
+
+/* Long operations record what they are and when they started here so
+ * MTIOCGETPROGRESS can answer from the control device without sending
+ * anything to a drive that is busy. IMMED commands are polled by the
+ * issuing thread with TEST UNIT READY, which refreshes the progress. A
+ * detached operation (a long erase) has no thread waiting on it and is
+ * polled by GetProgress() itself while the drive is otherwise idle,
+ * which is while it can take cmdLock. */
+
+void
+IOSCSITape::BeginProgress(int op)
+{
+	IOLockLock(progressLock);
 	
-	ReleaseSCSITask(task);
+	progressOp = op;
+	progressStart = st_uptime_us();
+	progressValue = -1;
+	progressDetached = false;
 	
-ErrorExit:
+	IOLockUnlock(progressLock);
+}
+
+/* progress of an operation the driver counts itself, out of MTPROG_MAX */
+void
+IOSCSITape::SetProgress(SInt32 value)
+{
+	IOLockLock(progressLock);
+	progressValue = value;
+	IOLockUnlock(progressLock);
+}
+
+void
+IOSCSITape::EndProgress(void)
+{
+	IOLockLock(progressLock);
 	
-	return status;
+	progressOp = MTPROG_NONE;
+	progressDetached = false;
+	selwakeup(&progressSelect);
+	
+	IOLockUnlock(progressLock);
+}
+
+/* a command has finished, select() may now see the drive ready */
+void
+IOSCSITape::ProgressWakeup(void)
+{
+	IOLockLock(progressLock);
+	selwakeup(&progressSelect);
+	IOLockUnlock(progressLock);
+}
+
+static void st_progress_timeout(thread_call_param_t p0, thread_call_param_t p1)
+{
+	((IOSCSITape *)p0)->ProgressTimeout();
+}
+
+void
+IOSCSITape::ScheduleProgress(void)
+{
+	UInt64 deadline = 0;
+	
+	clock_interval_to_deadline(ST_PROGRESS_POLL, kMillisecondScale, &deadline);
+	thread_call_enter_delayed(progressCall, deadline);
 }
 
 /*
- *  GetDeviceDetails()
- *  Get mode sense details and set device parameters.
- *
- *  Would have ideally liked to use super::GetModeSense() but it appears
- *  to set the DBD bit and we need the descriptor values for density,
- *  etc.
+ *  ProgressTimeout()
+ *  Poll a detached operation until it finishes, so that it ends, and
+ *  the health poll and select() see the drive idle, without anyone
+ *  asking for progress.
  */
-IOReturn
-IOSCSITape::GetDeviceDetails(void)
+void
+IOSCSITape::ProgressTimeout(void)
 {
-	IOReturn				status		= kIOReturnError;
-	SCSITaskIdentifier		task		= NULL;
-	SCSITaskStatus			taskStatus	= kSCSITaskStatus_DeviceNotResponding;
-	IOMemoryDescriptor *	dataBuffer	= NULL;
-	SCSI_ModeSense_Default	modeData	= { 0 };
-
-	dataBuffer = IOMemoryDescriptor::withAddress(&modeData,
-												 sizeof(modeData),
-												 kIODirectionIn);
+	bool detached;
 	
-	require((dataBuffer != 0), ErrorExit);
+	if (!IOLockTryLock(cmdLock))
+	{
+		ScheduleProgress();
+		return;
+	}
 	
-	task = GetSCSITask();
+	IOLockLock(progressLock);
+	detached = progressDetached;
+	IOLockUnlock(progressLock);
 	
-	require((task != 0), ErrorExit);
-
-	if (MODE_SENSE_6(task, 
-					 dataBuffer, 
-					 0x0,
-					 0x0,
-					 0x00,
-					 sizeof(SCSI_ModeSense_Default), 
-					 0x00) == true)
+	if (detached)
 	{
-		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+		if (PollProgress() != kIOReturnBusy)
+			EndProgress();
+		else
+			ScheduleProgress();
 	}
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
+	IOLockUnlock(cmdLock);
+}
+
+/*
+ *  PollProgress()
+ *  Ask the drive whether an IMMED command has finished. Returns
+ *  kIOReturnBusy while it runs, recording the drive's progress.
+ */
+IOReturn
+IOSCSITape::PollProgress(void)
+{
+	if (TestUnitReady() == kIOReturnSuccess)
+		return kIOReturnSuccess;
+	
+	if (sense_flags & (SENSE_INPROGRESS | SENSE_NOTREADY))
 	{
-		/* copy mode data for next MODE SELECT */
-		bcopy(&modeData, &lastModeData, sizeof(SCSI_ModeSense_Default));
-		
-		blksize = 
-			(modeData.descriptor.BLOCK_LENGTH[0] << 16) |
-			(modeData.descriptor.BLOCK_LENGTH[1] <<  8) |
-			 modeData.descriptor.BLOCK_LENGTH[2];
+		IOLockLock(progressLock);
 		
-		density = modeData.descriptor.DENSITY_CODE;
-		flags &= ~(ST_READONLY | ST_BUFF_MODE);
-		
-		if (modeData.header.DEVICE_SPECIFIC_PARAMETER & SMH_DSP_WRITE_PROT)
-			flags |= ST_READONLY;
+		if (lastProgress != -1)
+			progressValue = lastProgress;
 		
-		if (modeData.header.DEVICE_SPECIFIC_PARAMETER & SMH_DSP_BUFF_MODE)
-			flags |= ST_BUFF_MODE;
-
-		STATUS_LOG("density code: %d, %d-byte blocks, write-%s, %sbuffered",
-				   density, blksize,
-				   flags & ST_READONLY ? "protected" : "enabled",
-				   flags & ST_BUFF_MODE ? "" : "un");
+		IOLockUnlock(progressLock);
 		
-		status = kIOReturnSuccess;
+		return kIOReturnBusy;
 	}
 	
-	ReleaseSCSITask(task);
-	dataBuffer->release();
-	
-ErrorExit:
-	
-	return status;
+	return kIOReturnError;
 }
 
+/*
+ *  WaitForImmediate()
+ *  Poll an IMMED command until it finishes. Short operations (a rewind
+ *  at the start of the tape) are done within the first few polls, so
+ *  the interval starts small and backs off to ST_PROGRESS_POLL.
+ */
 IOReturn
-IOSCSITape::SetDeviceDetails(SCSI_ModeSense_Default *modeData)
+IOSCSITape::WaitForImmediate(UInt32 timeoutMS)
 {
-	IOReturn				status		= kIOReturnError;
-	IOMemoryDescriptor *	dataBuffer	= NULL;
-	SCSITaskIdentifier		task		= NULL;
-	SCSITaskStatus			taskStatus	= kSCSITaskStatus_DeviceNotResponding;
-	
-	dataBuffer = IOMemoryDescriptor::withAddress(modeData,
-												 sizeof(SCSI_ModeSense_Default),
-												 kIODirectionOut);
-	
-	require((dataBuffer != 0), ErrorExit);
+	UInt64		deadline	= st_uptime_us() + (UInt64)timeoutMS * 1000;
+	IOReturn	status		= kIOReturnBusy;
+	UInt32		interval	= ST_PROGRESS_POLL_MIN;
 	
-	task = GetSCSITask();
-	
-	require((task != 0), ErrorExit);
-	
-	if (MODE_SELECT_6(task, 
-					  dataBuffer, 
-					  0x0, // PF
-					  0x0, // SP
-					  sizeof(SCSI_ModeSense_Default), 
-					  0x00) == true)
-	{
-		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
-	}
-	
-	if (taskStatus == kSCSITaskStatus_GOOD)
+	while ((status = PollProgress()) == kIOReturnBusy)
 	{
-		status = kIOReturnSuccess;
+		if (st_uptime_us() > deadline)
+		{
+			ERROR_LOG("operation did not finish in %u ms", (unsigned int)timeoutMS);
+			return kIOReturnTimeout;
+		}
+		
+		IOSleep(interval);
+		
+		interval *= 2;
+		
+		if (interval > ST_PROGRESS_POLL)
+			interval = ST_PROGRESS_POLL;
 	}
 	
-	ReleaseSCSITask(task);
-	dataBuffer->release();
-	
-ErrorExit:
-	
 	return status;
 }
 
-IOReturn
-IOSCSITape::SetBlockSize(int size)
+/*
+ *  GetProgress()
+ *  The operation in progress. A detached operation is polled first if
+ *  the caller holds cmdLock, or it can be taken.
+ */
+void
+IOSCSITape::GetProgress(struct mtprogress *mp, bool locked)
 {
-	IOReturn				status	= kIOReturnError;
-	SCSI_ModeSense_Default	newMode;
+	bool detached;
 	
-	bcopy(&lastModeData, &newMode, sizeof(SCSI_ModeSense_Default));
+	if (locked || IOLockTryLock(cmdLock))
+	{
+		IOLockLock(progressLock);
+		detached = progressDetached;
+		IOLockUnlock(progressLock);
+		
+		if (detached && PollProgress() != kIOReturnBusy)
+			EndProgress();
+		
+		if (!locked)
+			IOLockUnlock(cmdLock);
+	}
 	
-	newMode.header.MODE_DATA_LENGTH = 0;
-	newMode.descriptor.BLOCK_LENGTH[0] = (size >> 16) & 0xFF;
-	newMode.descriptor.BLOCK_LENGTH[1] = (size >>  8) & 0xFF;
-	newMode.descriptor.BLOCK_LENGTH[2] =  size        & 0xFF;
+	IOLockLock(progressLock);
 	
-	if ((status = SetDeviceDetails(&newMode)) == kIOReturnSuccess)
-		GetDeviceDetails();
+	mp->mp_op = progressOp;
+	mp->mp_progress = progressOp != MTPROG_NONE ? progressValue : -1;
+	mp->mp_elapsed = progressOp != MTPROG_NONE ?
+		(UInt32)((st_uptime_us() - progressStart) / 1000) : 0;
+	mp->mp_inflight = cmdInFlight;
 	
-	return status;
+	IOLockUnlock(progressLock);
 }
 
-IOReturn
-IOSCSITape::GetDeviceBlockLimits(void)
-{
-	SCSITaskIdentifier		task			= NULL;
-	IOReturn				status			= kIOReturnError;
-	UInt8					blockLimitsData[6]	= { 0 };
-	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeliveryFailure;
-	IOMemoryDescriptor *	dataBuffer		= NULL;
-	
-	dataBuffer = IOMemoryDescriptor::withAddress(&blockLimitsData, 
-												 sizeof(blockLimitsData), 
-												 kIODirectionIn);
+#if 0
+#pragma mark -
+#pragma mark Readiness
+#pragma mark -
+#endif /* 0 */
 
-	require ((dataBuffer != 0), ErrorExit);
+/* There is no read-ahead or write-behind, so the tape device is ready
+ * for a read or a write when the drive is: while no command, IMMED
+ * operation or detached operation is in flight. The control device is
+ * readable while a volume change waits on the spanning helper, which
+ * can then answer it without blocking. */
+
+bool
+IOSCSITape::Busy(void)
+{
+	bool busy;
 	
-	task = GetSCSITask();
+	IOLockLock(progressLock);
+	busy = cmdInFlight != 0 || progressOp != MTPROG_NONE;
+	IOLockUnlock(progressLock);
 	
-	require ((task != 0), ErrorExit);
+	return busy;
+}
+
+int
+IOSCSITape::Select(bool ctl, int which, void *wql, struct proc *p)
+{
+	int ready = 1;
 	
-	if (READ_BLOCK_LIMITS(task, dataBuffer, 0x00) == true)
-		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	if (which != FREAD && which != FWRITE)
+		return 0;
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
+	if (!ctl)
 	{
-		// blkgran = blockLimitsData[0] & 0x1F;
+		IOLockLock(progressLock);
 		
-		blkmin =
-			(blockLimitsData[4] <<  8) |
-			 blockLimitsData[5];
+		ready = cmdInFlight == 0 && progressOp == MTPROG_NONE;
 		
-		blkmax =
-			(blockLimitsData[1] << 16) |
-			(blockLimitsData[2] <<  8) |
-			 blockLimitsData[3];
+		if (!ready)
+			selrecord(p, &progressSelect, wql);
 		
-		STATUS_LOG("min/max block size: %d/%d", blkmin, blkmax);
+		IOLockUnlock(progressLock);
+	}
+	else if (which == FREAD)
+	{
+		IOLockLock(spanLock);
 		
-		status = kIOReturnSuccess;
+		ready = spanState == ST_SPAN_REQUESTED;
+		
+		if (!ready)
+			selrecord(p, &spanSelect, wql);
+		
+		IOLockUnlock(spanLock);
 	}
-
-	ReleaseSCSITask(task);
-	dataBuffer->release();
-	
-ErrorExit:
 	
-	return status;
+	return ready;
 }
 
-IOReturn
-IOSCSITape::WriteFilemarks(int count)
+#if 0
+#pragma mark -
+#pragma mark Command timeouts
+#pragma mark -
+#endif /* 0 */
+
+/*
+ *  CommandTimeout()
+ *  The timeout for an operation code: an override set with
+ *  MTIOCSTIMEOUT, else the drive's recommended timeout, else the
+ *  driver's static default passed in by the caller.
+ */
+UInt32
+IOSCSITape::CommandTimeout(UInt8 opcode, UInt32 fallback)
 {
-	SCSITaskIdentifier	task		= NULL;
-	IOReturn			status		= kIOReturnError;
-	SCSITaskStatus		taskStatus	= kSCSITaskStatus_No_Status;
+	if (cmdTimeoutOverride[opcode])
+		return cmdTimeoutOverride[opcode];
 	
-	task = GetSCSITask();
+	if (cmdTimeout[opcode])
+		return cmdTimeout[opcode];
 	
-	require((task != 0), ErrorExit);
+	return fallback;
+}
 
-	flags |= ST_WRITTEN_TOGGLE;
+/* Until the drive has reported its commands everything is assumed to
+ * be supported and left for the drive to reject. */
+bool
+IOSCSITape::IsCommandSupported(UInt8 opcode)
+{
+	if (!cmdTableValid)
+		return true;
+	
+	return (cmdSupported[opcode >> 3] & (1 << (opcode & 7))) != 0;
+}
 
-	if (WRITE_FILEMARKS_6(task, 0x0, 0x0, count, 0) == true)
-		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+void
+IOSCSITape::GetCommandTimeout(struct mttimeout *mto)
+{
+	UInt8 opcode = mto->mto_opcode;
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
-		status = kIOReturnSuccess;
+	mto->mto_supported = IsCommandSupported(opcode);
+	mto->mto_pad = 0;
 	
-	ReleaseSCSITask(task);
+	if (cmdTimeoutOverride[opcode])
+	{
+		mto->mto_source = MTTO_OVERRIDE;
+		mto->mto_timeout = cmdTimeoutOverride[opcode];
+	}
+	else if (cmdTimeout[opcode])
+	{
+		mto->mto_source = MTTO_DRIVE;
+		mto->mto_timeout = cmdTimeout[opcode];
+	}
+	else
+	{
+		mto->mto_source = MTTO_DEFAULT;
+		mto->mto_timeout = 0;
+	}
+}
+
+int
+IOSCSITape::SetCommandTimeout(struct mttimeout *mto)
+{
+	if (mto->mto_timeout != 0 &&
+		(mto->mto_timeout < MTTO_MIN || mto->mto_timeout > MTTO_MAX))
+	{
+		return EINVAL;
+	}
 	
-ErrorExit:
+	cmdTimeoutOverride[mto->mto_opcode] = mto->mto_timeout;
 	
-	return status;	
+	return KERN_SUCCESS;
 }
 
-IOReturn
-IOSCSITape::Space(SCSISpaceCode type, int count)
+#if 0
+#pragma mark -
+#pragma mark End of data cache
+#pragma mark -
+#endif /* 0 */
+
+/* Copy an ASCII field reported by the drive as a string, unprintable
+ * characters replaced and trailing blanks removed. Returns its length. */
+static UInt32
+st_copy_ascii(char *dst, UInt32 size, const UInt8 *src, UInt32 length)
 {
-	SCSITaskIdentifier	task			= NULL;
-	IOReturn			status			= kIOReturnError;
-	SCSITaskStatus		taskStatus		= kSCSITaskStatus_No_Status;
+	UInt32 i;
 	
-	task = GetSCSITask();
+	for (i = 0; i < length && i < size - 1; i++)
+		dst[i] = (src[i] >= 0x20 && src[i] < 0x7F) ? src[i] : '?';
 	
-	require((task != 0), ErrorExit);
+	while (i > 0 && dst[i - 1] == ' ')
+		i--;
 	
-	if (SPACE_6(task, type, count, 0) == true)
-		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	dst[i] = '\0';
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
-		status = kIOReturnSuccess;
+	return i;
+}
+
+/*
+ *  IdentifyMedia()
+ *  Read the serial number of a newly loaded cartridge, so the end of
+ *  data remembered from an earlier mount can be used again. The one
+ *  in the cartridge memory is preferred, as every drive that reads
+ *  the cartridge reports the same.
+ */
+void
+IOSCSITape::IdentifyMedia(void)
+{
+	struct mtmam mm = { 0 };
 	
-	ReleaseSCSITask(task);
+	mm.mm_id = MTMAM_SERIAL;
 	
-ErrorExit:
+	if (ReadAttribute(&mm) == kIOReturnSuccess)
+		st_copy_ascii(mediaSerial, sizeof(mediaSerial), mm.mm_value, mm.mm_length);
+	else if (ReadMediaSerialNumber(mediaSerial, sizeof(mediaSerial)) != kIOReturnSuccess)
+		mediaSerial[0] = '\0';
 	
-	return status;	
+	eodEntry = NULL;
+	spanMarkPartition = -1;
+	
+	if (mediaSerial[0])
+		DEBUG_LOG("media serial number %s", mediaSerial);
 }
 
-IOReturn
-IOSCSITape::LoadUnload(int loadUnload)
+/*
+ *  ForgetMedia()
+ *  The cartridge may have been changed.
+ */
+void
+IOSCSITape::ForgetMedia(void)
 {
-	SCSITaskIdentifier	task			= NULL;
-	IOReturn			status			= kIOReturnError;
-	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	mediaSerial[0] = '\0';
+	eodEntry = NULL;
+	spanMarkPartition = -1;
+	
+	/* TapeAlert flags and counters are about the cartridge as much as
+	 * the drive */
+	IOLockLock(healthLock);
+	bzero(&health, sizeof(health));
+	healthTime = 0;
+	IOLockUnlock(healthLock);
+	
+	/* file numbers of another cartridge */
+	IOLockLock(digestLock);
+	for (int i = 0; i < ST_DIGEST_FILES; i++)
+		digests[i].md_fileno = -1;
+	digestActive = false;
+	IOLockUnlock(digestLock);
+}
+
+/*
+ *  EndOfDataEntry()
+ *  The entry of the loaded cartridge's current partition, looked up
+ *  once per cartridge and partition, and made if create is set. A
+ *  cartridge without a serial number cannot be told from the next one,
+ *  so nothing is kept for it.
+ */
+STEODEntry *
+IOSCSITape::EndOfDataEntry(bool create)
+{
+	if (mediaSerial[0] == '\0')
+		return NULL;
 	
-	task = GetSCSITask();
+	if (eodEntry && eodEntry->partition == partition)
+		return eodEntry;
 	
-	require((task != 0), ErrorExit);
+	eodEntry = NULL;
 	
-	if (LOAD_UNLOAD(task, 0, 0, 0, 0, loadUnload, 0) == true)
-		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	for (int i = 0; i < ST_EOD_CACHE; i++)
+	{
+		if (eodCache[i].partition == partition &&
+			strncmp(eodCache[i].serial, mediaSerial, ST_SERIAL_LEN) == 0)
+		{
+			eodEntry = &eodCache[i];
+			return eodEntry;
+		}
+	}
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
-		status = kIOReturnSuccess;
+	if (create)
+	{
+		/* the oldest cartridge makes room */
+		eodEntry = &eodCache[eodCacheNext];
+		eodCacheNext = (eodCacheNext + 1) % ST_EOD_CACHE;
+		
+		strlcpy(eodEntry->serial, mediaSerial, ST_SERIAL_LEN);
+		eodEntry->partition = partition;
+		eodEntry->eod = -1;
+	}
 	
-	ReleaseSCSITask(task);
+	return eodEntry;
+}
+
+SInt64
+IOSCSITape::GetEndOfData(void)
+{
+	STEODEntry *entry = EndOfDataEntry(false);
 	
-ErrorExit:
+	return entry ? entry->eod : -1;
+}
+
+/*
+ *  SetEndOfData()
+ *  Record the end of data of the current partition, or forget it when
+ *  passed -1. Writing anywhere moves the end of data to just after the
+ *  write, so writers pass their new position, or -1 if it is unknown.
+ */
+void
+IOSCSITape::SetEndOfData(SInt64 eod)
+{
+	STEODEntry *entry = EndOfDataEntry(eod != -1);
 	
-	return status;
+	if (entry)
+		entry->eod = eod;
 }
 
-IOReturn
-IOSCSITape::ReadPosition(SCSI_ReadPositionShortForm *readPos, bool vendor)
+#if 0
+#pragma mark -
+#pragma mark Multi-volume spanning
+#pragma mark -
+#endif /* 0 */
+
+void
+IOSCSITape::SetSpanning(bool enable)
 {
-	SCSITaskIdentifier		task			= NULL;
-	IOReturn				status			= kIOReturnError;
-	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
-	IOMemoryDescriptor *	dataBuffer		= NULL;
-	UInt8					readPosData[20] = { 0 };
+	if (enable)
+	{
+		flags |= ST_SPANNING;
+		spanRequest.ms_volume = 0;
+	}
+	else
+		flags &= ~ST_SPANNING;
+}
+
+/*
+ *  SpanMark()
+ *  Where a spanning writer ended the volume on the loaded cartridge:
+ *  the block address of its end of volume filemark, as recorded in the
+ *  cartridge memory, or -1 if the data does not go on to another
+ *  cartridge. Read once per partition.
+ */
+SInt64
+IOSCSITape::SpanMark(void)
+{
+	struct mtmam	mm		= { 0 };
+	IOReturn		status	= kIOReturnSuccess;
+	UInt64			mark	= 0;
 	
-	dataBuffer = IOMemoryDescriptor::withAddress(&readPosData, 
-												 sizeof(readPosData), 
-												 kIODirectionIn);
+	if (spanMarkPartition == partition)
+		return spanMark;
 	
-	require((dataBuffer != 0), ErrorExit);
+	mm.mm_id = MTMAM_SPAN_END;
+	mm.mm_partition = partition;
 	
-	task = GetSCSITask();
+	status = ReadAttribute(&mm);
 	
-	require((task != 0), ErrorExit);
+	/* a failed read is not the same as no marker */
+	if (status != kIOReturnSuccess &&
+		status != kIOReturnNotFound &&
+		status != kIOReturnUnsupported)
+		return -1;
 	
-	if (READ_POSITION(task, 
-					  dataBuffer, 
-					  (vendor ? kSCSIReadPositionServiceAction_ShortFormVendorSpecific : kSCSIReadPositionServiceAction_ShortFormBlockID), 
-					  0x0, 
-					  0x00) == true)
-	{
-		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
-	}
+	spanMark = -1;
+	spanMarkPartition = partition;
 	
-	if (taskStatus == kSCSITaskStatus_GOOD)
+	if (status == kIOReturnSuccess && mm.mm_format == MTMAM_BINARY &&
+		mm.mm_length == sizeof(mark))
 	{
-		readPos->flags = readPosData[0];
-		readPos->partitionNumber = readPosData[1];
+		for (UInt32 i = 0; i < sizeof(mark); i++)
+			mark = (mark << 8) | mm.mm_value[i];
 		
-		readPos->firstLogicalObjectLocation =
-			(readPosData[4]  << 24) |
-			(readPosData[5]  << 16) |
-			(readPosData[6]  <<  8) |
-			 readPosData[7];
+		spanMark = (SInt64)mark;
+	}
+	
+	return spanMark;
+}
+
+/*
+ *  SetSpanMark()
+ *  Record in the cartridge memory that the volume ends at lba and goes
+ *  on to the next cartridge, or with -1 that it does not.
+ */
+IOReturn
+IOSCSITape::SetSpanMark(SInt64 lba)
+{
+	struct mtmam	mm		= { 0 };
+	IOReturn		status	= kIOReturnSuccess;
+	
+	mm.mm_id = MTMAM_SPAN_END;
+	mm.mm_format = MTMAM_BINARY;
+	mm.mm_partition = partition;
+	
+	/* a length of zero deletes the attribute */
+	if (lba != -1)
+	{
+		mm.mm_length = sizeof(UInt64);
 		
-		readPos->lastLogicalObjectLocation =
-			(readPosData[8]  << 24) |
-			(readPosData[9]  << 16) |
-			(readPosData[10] <<  8) |
-			 readPosData[11];
+		for (UInt32 i = 0; i < sizeof(UInt64); i++)
+			mm.mm_value[i] = ((UInt64)lba >> (8 * (sizeof(UInt64) - 1 - i))) & 0xFF;
+	}
+	
+	status = WriteAttribute(&mm);
+	
+	if (status == kIOReturnSuccess)
+	{
+		spanMark = lba;
+		spanMarkPartition = partition;
+	}
+	
+	return status;
+}
+
+/*
+ *  RequestVolume()
+ *  Hand a volume change to the helper and wait for its answer: 0 once
+ *  the next cartridge is in the drive, or an errno.
+ */
+int
+IOSCSITape::RequestVolume(int op)
+{
+	UInt64	deadline	= 0;
+	int		result		= THREAD_AWAKENED;
+	int		error		= 0;
+	
+	clock_interval_to_deadline(MTSPAN_TIMEOUT, kSecondScale, &deadline);
+	
+	IOLockLock(spanLock);
+	
+	spanRequest.ms_op = op;
+	spanRequest.ms_volume++;
+	spanState = ST_SPAN_REQUESTED;
+	
+	IOLockWakeup(spanLock, &spanState, false);
+	selwakeup(&spanSelect);
+	
+	while (spanState == ST_SPAN_REQUESTED && result == THREAD_AWAKENED)
+		result = IOLockSleepDeadline(spanLock, &spanState, deadline, THREAD_INTERRUPTIBLE);
+	
+	if (spanState == ST_SPAN_DONE)
+		error = spanError;
+	else if (result == THREAD_TIMED_OUT)
+		error = ETIMEDOUT;
+	else
+		error = EINTR;
+	
+	spanState = ST_SPAN_IDLE;
+	
+	IOLockUnlock(spanLock);
+	
+	if (error)
+		ERROR_LOG("volume %u not loaded, error %d", spanRequest.ms_volume, error);
+	else
+		STATUS_LOG("continuing on volume %u", spanRequest.ms_volume);
+	
+	return error;
+}
+
+/*
+ *  WaitVolumeRequest()
+ *  Called by the helper, on the control device, to wait until a
+ *  volume change is wanted.
+ */
+int
+IOSCSITape::WaitVolumeRequest(struct mtspan *ms)
+{
+	int result = THREAD_AWAKENED;
+	int error = EINTR;
+	
+	IOLockLock(spanLock);
+	
+	while (spanState != ST_SPAN_REQUESTED && result == THREAD_AWAKENED)
+		result = IOLockSleep(spanLock, &spanState, THREAD_INTERRUPTIBLE);
+	
+	if (spanState == ST_SPAN_REQUESTED)
+	{
+		*ms = spanRequest;
+		error = KERN_SUCCESS;
+	}
+	
+	IOLockUnlock(spanLock);
+	
+	return error;
+}
+
+int
+IOSCSITape::VolumeRequestDone(int error)
+{
+	int result = EINVAL;
+	
+	IOLockLock(spanLock);
+	
+	if (spanState == ST_SPAN_REQUESTED)
+	{
+		spanError = error;
+		spanState = ST_SPAN_DONE;
 		
-		readPos->logicalObjectsInObjectBuffer =
-			(readPosData[13] << 16) |
-			(readPosData[14] <<  8) |
-			 readPosData[15];
+		IOLockWakeup(spanLock, &spanState, false);
 		
-		readPos->bytesInObjectBuffer =
-			(readPosData[16] << 24) |
-			(readPosData[17] << 16) |
-			(readPosData[18] <<  8) |
-			 readPosData[19];
+		result = KERN_SUCCESS;
+	}
+	
+	IOLockUnlock(spanLock);
+	
+	return result;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Drive health
+#pragma mark -
+#endif /* 0 */
+
+/* TapeAlert and the error counters are polled with LOG SENSE while the
+ * drive is idle: every ST_HEALTH_INTERVAL seconds while the device is
+ * open and once just after it is closed. A poll that finds the opener
+ * holding cmdLock, a command in flight or a long operation running
+ * tries again shortly. */
+
+static void st_health_timeout(thread_call_param_t p0, thread_call_param_t p1)
+{
+	((IOSCSITape *)p0)->HealthTimeout();
+}
+
+/* the value of one log parameter, of a page read by ReadLogPage() */
+static bool st_log_param(const UInt8 *page, UInt16 code, UInt64 *value)
+{
+	UInt32 length = 4 + ((page[2] << 8) | page[3]);
+	UInt32 offset = 0;
+	
+	for (offset = 4; offset + 4 <= length; offset += 4 + page[offset + 3])
+	{
+		UInt8 plen = page[offset + 3];
 		
-		status = kIOReturnSuccess;
+		if (offset + 4 + plen > length)
+			break;
+		
+		if (((page[offset] << 8) | page[offset + 1]) != code)
+			continue;
+		
+		if (plen > 8)
+			return false;
+		
+		*value = 0;
+		
+		for (int i = 0; i < plen; i++)
+			*value = (*value << 8) | page[offset + 4 + i];
+		
+		return true;
 	}
 	
-	ReleaseSCSITask(task);
-	dataBuffer->release();
+	return false;
+}
+
+static void st_error_counters(const UInt8 *page, struct mterrcnt *ec)
+{
+	UInt64 value = 0;
 	
-ErrorExit:
+	bzero(ec, sizeof(struct mterrcnt));
 	
-	return status;
+	if (st_log_param(page, 0x0002, &value))
+		ec->me_retries = value;
+	
+	if (st_log_param(page, 0x0003, &value))
+		ec->me_corrected = value;
+	
+	if (st_log_param(page, 0x0005, &value))
+		ec->me_bytes = value;
+	
+	if (st_log_param(page, 0x0006, &value))
+		ec->me_uncorrected = value;
 }
 
-IOReturn
-IOSCSITape::ReadWrite(IOMemoryDescriptor *dataBuffer, int *realizedBytes)
+/* a counter that went down was reset by the drive, and counts from 0 */
+static UInt64 st_counter_delta(UInt64 now, UInt64 then)
 {
-	SCSITaskIdentifier	task			= NULL;
-	IOReturn			status			= kIOReturnNoResources;
-	SCSITaskStatus		taskStatus		= kSCSITaskStatus_No_Status;
-	bool				cmdStatus		= false;
-	int					transferSize	= 0;
+	return now >= then ? now - then : now;
+}
+
+static void st_error_delta(struct mterrcnt *delta,
+						   const struct mterrcnt *now,
+						   const struct mterrcnt *then)
+{
+	delta->me_corrected = st_counter_delta(now->me_corrected, then->me_corrected);
+	delta->me_retries = st_counter_delta(now->me_retries, then->me_retries);
+	delta->me_uncorrected = st_counter_delta(now->me_uncorrected, then->me_uncorrected);
+	delta->me_bytes = st_counter_delta(now->me_bytes, then->me_bytes);
+}
+
+void
+IOSCSITape::ScheduleHealth(UInt32 seconds)
+{
+	UInt64 deadline = 0;
 	
-	require((dataBuffer != 0), ErrorExit);
+	clock_interval_to_deadline(seconds, kSecondScale, &deadline);
+	thread_call_enter_delayed(healthCall, deadline);
+}
+
+void
+IOSCSITape::HealthTimeout(void)
+{
+	bool busy;
 	
-	transferSize = dataBuffer->getLength();
+	/* no command of the opener's starts until the poll is done */
+	if (!IOLockTryLock(cmdLock))
+	{
+		ScheduleHealth(ST_HEALTH_RETRY);
+		return;
+	}
+	
+	busy = Busy();
+	
+	if (!busy)
+		PollHealth(true);
+	
+	IOLockUnlock(cmdLock);
+	
+	if (busy)
+	{
+		ScheduleHealth(ST_HEALTH_RETRY);
+		return;
+	}
+	
+	if (flags & ST_DEVOPEN)
+		ScheduleHealth(ST_HEALTH_INTERVAL);
+}
 
-	if (IsFixedBlockSize())
+/*
+ *  PollHealth()
+ *  Read the TapeAlert and error counter log pages into the health
+ *  cache, logging any TapeAlert flag that was not set before. A
+ *  background poll leaves the sense of the last command alone.
+ */
+IOReturn
+IOSCSITape::PollHealth(bool background)
+{
+	UInt8				logData[HEALTH_BUFFER_SIZE];
+	struct mterrcnt		writeErrors		= { 0 };
+	struct mterrcnt		readErrors		= { 0 };
+	UInt64				alerts			= 0;
+	UInt64				raised			= 0;
+	UInt64				value			= 0;
+	UInt64				now				= st_uptime_us();
+	UInt32				valid			= 0;
+	
+	if (!IsCommandSupported(kSCSICmd_LOG_SENSE))
+		return kIOReturnUnsupported;
+	
+	if (ReadLogPage(ST_LOG_TAPE_ALERT, logData, sizeof(logData), background) == kIOReturnSuccess)
 	{
-		if (transferSize % blksize)
+		for (int flag = 1; flag <= 64; flag++)
 		{
-			STATUS_LOG("must be multiple of block size");
-			return kIOReturnNotAligned;
+			if (st_log_param(logData, flag, &value) && (value & 1))
+				alerts |= 1ULL << (flag - 1);
 		}
 		
-		transferSize /= blksize;
+		valid |= MTHEALTH_TAPEALERT;
 	}
 	
-	task = GetSCSITask();
-	require((task != 0), ErrorExit);
+	if (ReadLogPage(ST_LOG_WRITE_ERRORS, logData, sizeof(logData), background) == kIOReturnSuccess)
+	{
+		st_error_counters(logData, &writeErrors);
+		valid |= MTHEALTH_WRITE;
+	}
 	
-	if (dataBuffer->getDirection() == kIODirectionIn)
+	if (ReadLogPage(ST_LOG_READ_ERRORS, logData, sizeof(logData), background) == kIOReturnSuccess)
 	{
-		cmdStatus = READ_6(
-			task, 
-			dataBuffer, 
-			blksize, 
-			0x0,
-			IsFixedBlockSize() ? 0x1 : 0x0,
-			transferSize,
-			0x00);
+		st_error_counters(logData, &readErrors);
+		valid |= MTHEALTH_READ;
+	}
+	
+	if (valid == 0)
+		return kIOReturnUnsupported;
+	
+	IOLockLock(healthLock);
+	
+	raised = alerts & ~health.mh_tapealert;
+	health.mh_tapealert |= alerts;
+	
+	if (valid & MTHEALTH_WRITE)
+	{
+		st_error_delta(&health.mh_dwrite, &writeErrors, &health.mh_write);
+		health.mh_write = writeErrors;
+	}
+	
+	if (valid & MTHEALTH_READ)
+	{
+		st_error_delta(&health.mh_dread, &readErrors, &health.mh_read);
+		health.mh_read = readErrors;
+	}
+	
+	health.mh_valid |= valid;
+	health.mh_interval = healthTime ? (UInt32)((now - healthTime) / 1000000) : 0;
+	healthTime = now;
+	
+	IOLockUnlock(healthLock);
+	
+	for (int flag = 1; flag <= 64; flag++)
+	{
+		if (raised & (1ULL << (flag - 1)))
+			WARN_LOG("TapeAlert flag %d set", flag);
 	}
+	
+	return kIOReturnSuccess;
+}
+
+IOReturn
+IOSCSITape::GetHealth(struct mthealth *mh)
+{
+	IOReturn status = kIOReturnSuccess;
+	
+	IOLockLock(healthLock);
+	
+	if (healthTime == 0)
+		status = kIOReturnNotFound;
 	else
 	{
-		cmdStatus = WRITE_6(
-			task, 
-			dataBuffer, 
-			blksize, 
-			IsFixedBlockSize() ? 0x1 : 0x0,
-			transferSize, 
-			0x00);
+		*mh = health;
+		mh->mh_age = (UInt32)((st_uptime_us() - healthTime) / 1000000);
+	}
+	
+	IOLockUnlock(healthLock);
+	
+	return status;
+}
 
-		flags |= ST_WRITTEN_TOGGLE;
+#if 0
+#pragma mark -
+#pragma mark Logical block protection
+#pragma mark -
+#endif /* 0 */
+
+/*
+ *  ProtectBuffer()
+ *  Lay out a protected read or write: each of the caller's blocks
+ *  followed by its CRC32C. The data still moves straight to or from the
+ *  caller's memory, only the CRCs are in a buffer of our own. A write's
+ *  CRCs are computed here, through a kernel mapping of the caller's
+ *  buffer.
+ */
+IOReturn
+IOSCSITape::ProtectBuffer(
+	IOMemoryDescriptor *		dataBuffer,
+	UInt32						blocks,
+	IOMemoryDescriptor **		transferBuffer,
+	IOBufferMemoryDescriptor **	crcBuffer)
+{
+	IOReturn				status		= kIOReturnNoResources;
+	IODirection				direction	= dataBuffer->getDirection();
+	bool					write		= (direction != kIODirectionIn);
+	UInt32					length		= dataBuffer->getLength() / blocks;
+	IOMemoryDescriptor **	ranges		= NULL;
+	UInt32					count		= 0;
+	IOMemoryMap *			map			= NULL;
+	const UInt8 *			data		= NULL;
+	UInt8 *					crcs		= NULL;
+	UInt32					crc			= 0;
+	UInt32					i			= 0;
+	
+	*transferBuffer = NULL;
+	*crcBuffer = IOBufferMemoryDescriptor::withCapacity(
+		blocks * ST_LBP_LENGTH,
+		write ? kIODirectionOut : kIODirectionIn);
+	
+	ranges = (IOMemoryDescriptor **)IOMalloc(sizeof(IOMemoryDescriptor *) * blocks * 2);
+	
+	require((*crcBuffer != 0 && ranges != 0), ErrorExit);
+	
+	crcs = (UInt8 *)(*crcBuffer)->getBytesNoCopy();
+	
+	if (write)
+	{
+		map = dataBuffer->createMappingInTask(kernel_task, 0, kIOMapAnywhere | kIOMapReadOnly);
+		require((map != 0), ErrorExit);
+		
+		data = (const UInt8 *)map->getVirtualAddress();
 	}
 	
-	if (cmdStatus == true)
-		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	for (i = 0; i < blocks; i++)
+	{
+		/* sent least significant byte first */
+		if (write)
+		{
+			crc = crc32c(0, &data[i * length], length);
+			
+			crcs[i * ST_LBP_LENGTH + 0] =  crc        & 0xFF;
+			crcs[i * ST_LBP_LENGTH + 1] = (crc >>  8) & 0xFF;
+			crcs[i * ST_LBP_LENGTH + 2] = (crc >> 16) & 0xFF;
+			crcs[i * ST_LBP_LENGTH + 3] = (crc >> 24) & 0xFF;
+		}
 		
-	*realizedBytes = GetRealizedDataTransferCount(task);
-
-	if (taskStatus == kSCSITaskStatus_GOOD)
-		status = kIOReturnSuccess;
+		ranges[count] = IOSubMemoryDescriptor::withSubRange(
+			dataBuffer, i * length, length, direction);
+		require((ranges[count] != 0), ErrorExit);
+		count++;
+		
+		ranges[count] = IOSubMemoryDescriptor::withSubRange(
+			*crcBuffer, i * ST_LBP_LENGTH, ST_LBP_LENGTH, (*crcBuffer)->getDirection());
+		require((ranges[count] != 0), ErrorExit);
+		count++;
+	}
 	
-	ReleaseSCSITask(task);
+	*transferBuffer = IOMultiMemoryDescriptor::withDescriptors(ranges, count, direction);
+	
+	if (*transferBuffer)
+		status = kIOReturnSuccess;
 	
 ErrorExit:
 	
+	if (map)
+		map->release();
+	
+	/* the multi descriptor holds its own references */
+	while (count > 0)
+		ranges[--count]->release();
+	
+	if (ranges)
+		IOFree(ranges, sizeof(IOMemoryDescriptor *) * blocks * 2);
+	
+	if (status != kIOReturnSuccess && *crcBuffer)
+	{
+		(*crcBuffer)->release();
+		*crcBuffer = NULL;
+	}
+	
+	return status;
+}
+
+/*
+ *  CheckProtection()
+ *  Take the CRCs back out of the count of bytes a protected read or
+ *  write moved, and for a read check each block against its CRC32C.
+ *  A variable block record shorter than the read has its CRC in the
+ *  caller's buffer, just after the data.
+ */
+IOReturn
+IOSCSITape::CheckProtection(
+	IOMemoryDescriptor *	dataBuffer,
+	IOMemoryDescriptor *	transferBuffer,
+	bool					verify,
+	int *					realizedBytes)
+{
+	IOReturn		status		= kIOReturnSuccess;
+	IOMemoryMap *	map			= NULL;
+	const UInt8 *	data		= NULL;
+	UInt8			stored[ST_LBP_LENGTH];
+	UInt32			length		= blksize;
+	UInt32			blocks		= 1;
+	UInt32			crc			= 0;
+	UInt32			i			= 0;
+	
+	if (IsFixedBlockSize())
+		blocks = *realizedBytes / (blksize + ST_LBP_LENGTH);
+	else if (*realizedBytes >= ST_LBP_LENGTH)
+		length = *realizedBytes - ST_LBP_LENGTH;
+	else
+		blocks = 0;
+	
+	*realizedBytes = blocks * length;
+	
+	if (!verify || blocks == 0)
+		return kIOReturnSuccess;
+	
+	map = dataBuffer->createMappingInTask(kernel_task, 0, kIOMapAnywhere | kIOMapReadOnly);
+	
+	if (map == 0)
+		return kIOReturnNoResources;
+	
+	data = (const UInt8 *)map->getVirtualAddress();
+	
+	for (i = 0; i < blocks; i++)
+	{
+		transferBuffer->readBytes(i * (length + ST_LBP_LENGTH) + length,
+								  stored, ST_LBP_LENGTH);
+		
+		crc = crc32c(0, &data[i * length], length);
+		
+		if (crc != (UInt32)(stored[0] | (stored[1] << 8) |
+							(stored[2] << 16) | (stored[3] << 24)))
+		{
+			ERROR_LOG("block %u of %u failed its CRC32C", i + 1, blocks);
+			status = kIOReturnDMAError;
+			break;
+		}
+	}
+	
+	map->release();
+	
 	return status;
 }
 
-#if 0
-#pragma mark -
-#pragma mark 0x01 SSC Implicit Address Commands
-#pragma mark -
-#endif /* 0 */
-
+#if 0
+#pragma mark -
+#pragma mark Per-file digests
+#pragma mark -
+#endif /* 0 */
+
+/*
+ *  SetDigest()
+ *  Turning digests on starts afresh; turning them off keeps the file
+ *  in progress with the others.
+ */
+void
+IOSCSITape::SetDigest(bool enable)
+{
+	IOLockLock(digestLock);
+	
+	if (enable && !digestEnabled)
+	{
+		bzero(digests, sizeof(digests));
+		for (int i = 0; i < ST_DIGEST_FILES; i++)
+			digests[i].md_fileno = -1;
+		digestNext = 0;
+		digestActive = false;
+	}
+	else if (!enable)
+		DigestStore();
+	
+	digestEnabled = enable;
+	
+	IOLockUnlock(digestLock);
+}
+
+/*
+ *  DigestStore()
+ *  Put the file in progress with the last ones done. Called with the
+ *  digest lock held.
+ */
+void
+IOSCSITape::DigestStore(void)
+{
+	if (!digestActive)
+		return;
+	
+	/* a file whose number was lost cannot be asked for */
+	if (digestCurrent.md_fileno != -1)
+	{
+		digests[digestNext] = digestCurrent;
+		digestNext = (digestNext + 1) % ST_DIGEST_FILES;
+	}
+	
+	digestActive = false;
+}
+
+/*
+ *  DigestTransfer()
+ *  Add the bytes of a read or write that started at file and block to
+ *  the digest of the file in progress, or of a new one if it did not
+ *  start where the last one ended. The data is hashed in place through
+ *  a kernel mapping of the caller's buffer.
+ */
+void
+IOSCSITape::DigestTransfer(IOMemoryDescriptor *dataBuffer, int bytes, int file, int block, bool read)
+{
+	IOMemoryMap *	map			= NULL;
+	UInt64			crc			= 0;
+	int				records		= 1;
+	
+	IOLockLock(digestLock);
+	
+	if (digestActive &&
+		(digestCurrent.md_fileno != file ||
+		 digestCurrent.md_partition != partition ||
+		 digestBlock != block ||
+		 ((digestCurrent.md_flags & MTDIGEST_READ) != 0) != read))
+	{
+		DigestStore();
+	}
+	
+	if (!digestActive)
+	{
+		bzero(&digestCurrent, sizeof(digestCurrent));
+		digestCurrent.md_fileno = file;
+		digestCurrent.md_partition = partition;
+		digestCurrent.md_flags = (read ? MTDIGEST_READ : 0) |
+								 (block != 0 ? MTDIGEST_PARTIAL : 0);
+		digestActive = true;
+	}
+	
+	crc = digestCurrent.md_digest;
+	
+	IOLockUnlock(digestLock);
+	
+	/* only this thread changes the digest, the lock is for readers */
+	map = dataBuffer->createMappingInTask(kernel_task, 0, kIOMapAnywhere | kIOMapReadOnly);
+	
+	if (map)
+		crc = crc64(crc, (const void *)map->getVirtualAddress(), bytes);
+	
+	if (IsFixedBlockSize())
+		records = bytes / blksize;
+	
+	IOLockLock(digestLock);
+	
+	if (map)
+	{
+		digestCurrent.md_digest = crc;
+		map->release();
+	}
+	else
+		digestCurrent.md_flags |= MTDIGEST_ERROR;
+	
+	digestCurrent.md_bytes += bytes;
+	digestCurrent.md_records += records;
+	digestBlock = (block == -1) ? -1 : block + records;
+	
+	IOLockUnlock(digestLock);
+}
+
+/*
+ *  DigestEnd()
+ *  A filemark or the end of data at file and block ends the file in
+ *  progress, if that is where it had got to.
+ */
+void
+IOSCSITape::DigestEnd(bool read, int file, int block)
+{
+	IOLockLock(digestLock);
+	
+	if (digestActive &&
+		digestCurrent.md_fileno == file &&
+		digestCurrent.md_partition == partition &&
+		digestBlock == block &&
+		((digestCurrent.md_flags & MTDIGEST_READ) != 0) == read)
+	{
+		digestCurrent.md_flags |= MTDIGEST_DONE;
+		DigestStore();
+	}
+	
+	IOLockUnlock(digestLock);
+}
+
+void
+IOSCSITape::DigestError(void)
+{
+	IOLockLock(digestLock);
+	
+	if (digestActive)
+		digestCurrent.md_flags |= MTDIGEST_ERROR;
+	
+	IOLockUnlock(digestLock);
+}
+
+/*
+ *  GetDigest()
+ *  The newest digest of a file in this partition, or of the file in
+ *  progress.
+ */
+IOReturn
+IOSCSITape::GetDigest(struct mtdigest *md)
+{
+	IOReturn	status	= kIOReturnNotFound;
+	UInt32		slot	= 0;
+	
+	IOLockLock(digestLock);
+	
+	if (digestActive &&
+		(md->md_fileno == -1 ||
+		 (md->md_fileno == digestCurrent.md_fileno &&
+		  digestCurrent.md_partition == partition)))
+	{
+		*md = digestCurrent;
+		status = kIOReturnSuccess;
+	}
+	else if (md->md_fileno != -1)
+	{
+		for (int i = 1; i <= ST_DIGEST_FILES; i++)
+		{
+			slot = (digestNext + ST_DIGEST_FILES - i) % ST_DIGEST_FILES;
+			
+			if (digests[slot].md_fileno == md->md_fileno &&
+				digests[slot].md_partition == partition)
+			{
+				*md = digests[slot];
+				status = kIOReturnSuccess;
+				break;
+			}
+		}
+	}
+	
+	IOLockUnlock(digestLock);
+	
+	return status;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Shared ring
+#pragma mark -
+#endif /* 0 */
+
+/* A ring of slots shared with a reader or writer, so that a run of
+ * records costs one ioctl rather than a read() or write() each, and
+ * none of them wires the caller's pages. The ring is wired for as long
+ * as it is mapped and a slot is sent to the drive where it lies, so
+ * its size is capped at MTRING_MAXSIZE. The header is the caller's to
+ * scribble on, so the driver keeps its own tail and checks what it
+ * reads from there. Mapping and kicking are tape device ioctls, which
+ * run under cmdLock, so a ring is never unmapped while it is kicked. */
+
+IOReturn
+IOSCSITape::MapSharedRing(struct mtringmap *mr)
+{
+	IOBufferMemoryDescriptor	*ring	= NULL;
+	IOMemoryMap					*map	= NULL;
+	UInt32						offset	= round_page(sizeof(struct mtringhdr));
+	UInt64						length	= 0;
+	
+	/* a bad request leaves the ring that is mapped alone */
+	if (mr->mr_slots != 0 &&
+		((mr->mr_dir != MTRING_READ && mr->mr_dir != MTRING_WRITE) ||
+		 mr->mr_slots > MTRING_MAXSLOTS || mr->mr_slotsize == 0 ||
+		 (UInt64)mr->mr_slots * mr->mr_slotsize > MTRING_MAXSIZE))
+		return kIOReturnBadArgument;
+	
+	UnmapSharedRing();
+	
+	if (mr->mr_slots == 0)
+		return kIOReturnSuccess;
+	
+	length = offset + (UInt64)mr->mr_slots * mr->mr_slotsize;
+	
+	ring = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task,
+													   kIODirectionInOut | kIOMemoryKernelUserShared,
+													   length, PAGE_SIZE);
+	
+	if (ring == NULL)
+		return kIOReturnNoMemory;
+	
+	bzero(ring->getBytesNoCopy(), offset);
+	
+	map = ring->createMappingInTask(current_task(), 0, kIOMapAnywhere);
+	
+	if (map == NULL)
+	{
+		ring->release();
+		return kIOReturnNoMemory;
+	}
+	
+	sharedRing = ring;
+	sharedMap = map;
+	sharedHeader = (struct mtringhdr *)ring->getBytesNoCopy();
+	sharedDir = mr->mr_dir;
+	sharedSlots = mr->mr_slots;
+	sharedSlotSize = mr->mr_slotsize;
+	sharedOffset = offset;
+	sharedTail = 0;
+	
+	sharedHeader->mh_slots = sharedSlots;
+	sharedHeader->mh_slotsize = sharedSlotSize;
+	
+	mr->mr_offset = offset;
+	mr->mr_addr = map->getAddress();
+	mr->mr_length = length;
+	
+	return kIOReturnSuccess;
+}
+
+void
+IOSCSITape::UnmapSharedRing(void)
+{
+	if (sharedMap)
+	{
+		sharedMap->release();
+		sharedMap = NULL;
+	}
+	
+	if (sharedRing)
+	{
+		sharedRing->release();
+		sharedRing = NULL;
+	}
+	
+	sharedHeader = NULL;
+}
+
+#if 0
+#pragma mark -
+#pragma mark IOKit power management
+#pragma mark -
+#endif /* 0 */
+
+UInt32
+IOSCSITape::GetInitialPowerState(void)
+{
+	return 0;
+}
+
+void
+IOSCSITape::HandlePowerChange(void)
+{
+}
+
+void
+IOSCSITape::HandleCheckPowerState(void)
+{
+}
+
+void
+IOSCSITape::TicklePowerManager(void)
+{
+}
+
+void
+IOSCSITape::TerminateDeviceSupport(void)
+{
+	/* the poll uses the locks below */
+	if (healthCall)
+	{
+		thread_call_cancel_wait(healthCall);
+		thread_call_free(healthCall);
+		healthCall = NULL;
+	}
+	
+	if (progressCall)
+	{
+		thread_call_cancel_wait(progressCall);
+		thread_call_free(progressCall);
+		progressCall = NULL;
+	}
+	
+	if (logRing)
+	{
+		IOFree(logRing, sizeof(struct mtlogent) * ST_LOG_RING);
+		logRing = NULL;
+	}
+	
+	if (logLock)
+	{
+		IOLockFree(logLock);
+		logLock = NULL;
+	}
+	
+	traceEnabled = false;
+	st_ring_free(&traceRing);
+	
+	captureEnabled = false;
+	st_ring_free(&captureRing);
+	
+	if (progressLock)
+	{
+		selthreadclear(&progressSelect);
+		IOLockFree(progressLock);
+		progressLock = NULL;
+	}
+	
+	if (spanLock)
+	{
+		selthreadclear(&spanSelect);
+		IOLockFree(spanLock);
+		spanLock = NULL;
+	}
+	
+	if (healthLock)
+	{
+		IOLockFree(healthLock);
+		healthLock = NULL;
+	}
+	
+	if (digestLock)
+	{
+		IOLockFree(digestLock);
+		digestLock = NULL;
+	}
+	
+	UnmapSharedRing();
+	
+	if (cmdLock)
+	{
+		IOLockFree(cmdLock);
+		cmdLock = NULL;
+	}
+}
+
+UInt32
+IOSCSITape::GetNumberOfPowerStateTransitions(void)
+{
+	return 0;
+}
+
+#if 0
+#pragma mark -
+#pragma mark Tape driver operations
+#pragma mark -
+#endif /* 0 */
+
+/* The job of these tape driver operations, generally, is to adapt the
+ * lower level SCSI operations and convert the results and potential
+ * SENSE information into POSIX-ish return codes and results as well
+ * as manage driver state like blkno and fileno. */
+
+/*
+ *  st_errno()
+ *  Map the outcome of the last failed command to an errno.
+ */
+static int st_errno(IOSCSITape *st)
+{
+	switch (st->lastTaskStatus)
+	{
+		case kSCSITaskStatus_CHECK_CONDITION:
+			break;
+		case kSCSITaskStatus_BUSY:
+		case kSCSITaskStatus_TASK_SET_FULL:
+		case kSCSITaskStatus_RESERVATION_CONFLICT:
+			return EBUSY;
+		case kSCSITaskStatus_TaskTimeoutOccurred:
+		case kSCSITaskStatus_ProtocolTimeoutOccurred:
+			return ETIMEDOUT;
+		case kSCSITaskStatus_DeviceNotPresent:
+			return ENXIO;
+		default:
+			return EIO;
+	}
+	
+	/* security errors, whatever the sense key, and encryption changed
+	 * under a read or write */
+	if (st->lastASC == 0x74 ||
+		(st->lastASC == 0x2A && st->lastASCQ >= 0x11 && st->lastASCQ <= 0x13))
+		return EACCES;
+	
+	/* LOGICAL BLOCK GUARD CHECK FAILED, the drive's CRC32C check */
+	if (st->lastASC == 0x10 && st->lastASCQ == 0x01)
+		return EILSEQ;
+	
+	switch (st->lastSenseKey)
+	{
+		case kSENSE_KEY_NOT_READY:
+			/* MEDIUM NOT PRESENT */
+			if (st->lastASC == 0x3A)
+				return ENXIO;
+			return EIO;
+		case kSENSE_KEY_ILLEGAL_REQUEST:
+			/* INVALID COMMAND OPERATION CODE */
+			if (st->lastASC == 0x20)
+				return ENOTSUP;
+			return EINVAL;
+		case kSENSE_KEY_DATA_PROTECT:
+			return EACCES;
+		case kSENSE_KEY_VOLUME_OVERFLOW:
+			return ENOSPC;
+		case kSENSE_KEY_BLANK_CHECK:
+		case kSENSE_KEY_MEDIUM_ERROR:
+		case kSENSE_KEY_HARDWARE_ERROR:
+		case kSENSE_KEY_UNIT_ATTENTION:
+		case kSENSE_KEY_ABORTED_COMMAND:
+		default:
+			return EIO;
+	}
+}
+
+int st_rewind(IOSCSITape *st)
+{
+	if (st->Rewind() == kIOReturnSuccess)
+	{
+		st->fileno = 0;
+		st->blkno = 0;
+		st->lba = 0;
+		return KERN_SUCCESS;
+	}
+	
+	return st_errno(st);
+}
+
+int st_space(IOSCSITape *st, SCSISpaceCode type, int number)
+{
+	if (st->Space(type, number) == kIOReturnSuccess)
+	{
+		if (st->fileno != -1)
+		{
+			switch (type)
+			{
+				case kSCSISpaceCode_Filemarks:
+					st->fileno += number;
+					st->blkno = 0;
+					break;
+				case kSCSISpaceCode_LogicalBlocks:
+					st->blkno += number;
+					break;
+				case kSCSISpaceCode_EndOfData:
+					st->fileno = -1;
+					st->blkno = -1;
+					break;
+			}
+		}
+		
+		/* spacing over blocks is the only case where the number of
+		 * logical objects passed is known */
+		if (type == kSCSISpaceCode_LogicalBlocks && st->lba != -1)
+			st->lba += number;
+		else
+			st->lba = -1;
+		
+		/* the drive is idle at end of data, ask where that is */
+		if (type == kSCSISpaceCode_EndOfData && st_resync(st) == KERN_SUCCESS)
+			st->SetEndOfData(st->lba);
+		
+		return KERN_SUCCESS;
+	}
+	
+	return st_errno(st);
+}
+
+/* the command completed past the early warning point */
+static bool st_early_warning(IOSCSITape *st)
+{
+	return ((st->sense_flags & SENSE_EOM) &&
+			st->lastSenseKey == kSENSE_KEY_NO_SENSE);
+}
+
+int st_write_filemarks(IOSCSITape *st, int number)
+{
+	/* past early warning the filemarks are still written */
+	if (st->WriteFilemarks(number) == kIOReturnSuccess ||
+		st_early_warning(st))
+	{
+		if (number > 0 && st->digestEnabled)
+			st->DigestEnd(false, st->fileno, st->blkno);
+		
+		if (number > 0 && st->fileno != -1)
+		{
+			st->fileno += number;
+			st->blkno = 0;
+		}
+		
+		if (st->lba != -1)
+			st->lba += number;
+		
+		if (number > 0)
+			st->SetEndOfData(st->lba);
+		
+		return KERN_SUCCESS;
+	}
+	
+	if (number > 0)
+		st->SetEndOfData(-1);
+	
+	return st_errno(st);
+}
+
+int st_unload(IOSCSITape *st)
+{
+	if (st->LoadUnload(0) == kIOReturnSuccess)
+	{
+		st->fileno = -1;
+		st->blkno = -1;
+		st->lba = -1;
+		st->ForgetMedia();
+		return KERN_SUCCESS;
+	}
+	
+	return st_errno(st);
+}
+
+/*
+ *  st_eom()
+ *  Go to the end of data. When it is remembered for this cartridge
+ *  the tape is located there directly, and the SPACE that follows only
+ *  confirms it; if the cartridge was appended to elsewhere it carries
+ *  on from there.
+ */
+int st_eom(IOSCSITape *st)
+{
+	SInt64 eod = st->GetEndOfData();
+	
+	if (eod != -1 && eod != st->lba && eod <= 0xFFFFFFFF)
+	{
+		if (st_locate(st, (UInt32)eod, false) != KERN_SUCCESS)
+			st->SetEndOfData(-1);
+	}
+	
+	return st_space(st, kSCSISpaceCode_EndOfData, 0);
+}
+
+/* remember what READ POSITION left known, for st_resync() */
+static void st_position_read(IOSCSITape *st)
+{
+	st->rdposLba = st->lba;
+	st->rdposPartition = st->partition;
+	st->rdposFileno = st->fileno;
+	st->rdposBlkno = st->blkno;
+}
+
+int st_rdpos(IOSCSITape *st, bool vendor, unsigned int *data)
+{
+	SCSI_ReadPositionShortForm pos = { 0 };
+	
+	if (st->ReadPosition(&pos, vendor) == kIOReturnSuccess)
+	{
+		if (pos.flags & kSCSIReadPositionShortForm_LogicalObjectLocationUnknown)
+			return (ENOTSUP);
+		
+		*data = pos.firstLogicalObjectLocation;
+		
+		/* the vendor form is a hardware address, not a block count */
+		if (!vendor)
+		{
+			if (st->lba != -1 &&
+				(st->lba != (SInt64)pos.firstLogicalObjectLocation ||
+				 st->partition != pos.partitionNumber))
+			{
+				st->fileno = -1;
+				st->blkno = -1;
+			}
+			
+			st->lba = pos.firstLogicalObjectLocation;
+			st->partition = pos.partitionNumber;
+			
+			if (pos.flags & kSCSIReadPositionShortForm_BeginningOfPartition)
+			{
+				st->fileno = 0;
+				st->blkno = 0;
+			}
+			
+			st_position_read(st);
+		}
+		
+		return KERN_SUCCESS;
+	}
+	
+	return st_errno(st);	
+}
+
+int st_verify(IOSCSITape *st, struct mtverify *mv)
+{
+	bool	locate		= (mv->mv_flags & MTVERIFY_LOCATE);
+	bool	toFilemark	= (mv->mv_count == 0);
+	int		count		= toFilemark ? kSCSICmdFieldMask3Byte : mv->mv_count;
+	int		done		= 0;
+	int		error		= KERN_SUCCESS;
+	
+	mv->mv_verified = 0;
+	mv->mv_stop = MTVERIFY_STOP_COUNT;
+	mv->mv_error = 0;
+	
+	if (count < 0 || count > kSCSICmdFieldMask3Byte)
+		return (EINVAL);
+	
+	st->BeginProgress(MTPROG_VERIFY);
+	
+	if (st->IsFixedBlockSize())
+	{
+		/* one command covers all blocks; on early termination the
+		 * sense INFORMATION field holds the blocks not verified */
+		if (st->Verify(count, locate, mv->mv_lba) == kIOReturnSuccess)
+			done = count;
+		else if (st->sense_flags & (SENSE_FILEMARK | SENSE_EOD))
+			done = count - st->lastSenseInfo;
+		else
+			error = st_errno(st);
+	}
+	else
+	{
+		/* variable block mode verifies one block per command, which
+		 * up to a filemark may be a great many; a signal stops it */
+		while (done < count)
+		{
+			if (proc_issignal(proc_selfpid(), ~(sigset_t)0))
+			{
+				error = EINTR;
+				break;
+			}
+			
+			if (!toFilemark)
+				st->SetProgress((SInt32)((SInt64)done * MTPROG_MAX / count));
+			
+			if (st->Verify(1, locate && done == 0, mv->mv_lba) != kIOReturnSuccess)
+			{
+				if (!(st->sense_flags & (SENSE_FILEMARK | SENSE_EOD)))
+					error = st_errno(st);
+				
+				break;
+			}
+			
+			done++;
+		}
+	}
+	
+	st->EndProgress();
+	
+	if (error != EINTR && (st->sense_flags & SENSE_FILEMARK))
+		mv->mv_stop = MTVERIFY_STOP_FILEMARK;
+	else if (error != EINTR && (st->sense_flags & SENSE_EOD))
+		mv->mv_stop = MTVERIFY_STOP_EOD;
+	
+	if (error && error != EINTR &&
+		!st->IsCommandSupported(locate ? kSCSICmd_VERIFY_16 : kSCSICmd_VERIFY_6))
+		error = ENOTSUP;
+	
+	mv->mv_verified = done;
+	
+	/* VERIFY moves the tape like a read would */
+	if (locate)
+		st->lba = mv->mv_lba;
+	
+	if (st->lba != -1)
+		st->lba += done + (mv->mv_stop == MTVERIFY_STOP_FILEMARK);
+	
+	if (mv->mv_stop == MTVERIFY_STOP_EOD && st->lba != -1)
+		st->SetEndOfData(st->lba);
+	
+	if (locate)
+	{
+		st->fileno = -1;
+		st->blkno = -1;
+	}
+	else if (st->fileno != -1)
+	{
+		if (mv->mv_stop == MTVERIFY_STOP_FILEMARK)
+		{
+			st->fileno++;
+			st->blkno = 0;
+		}
+		else
+			st->blkno += done;
+	}
+	
+	/* the ioctl's results are not copied out if it fails, so a verify
+	 * that got under way reports its error with them */
+	if (error == ENOTSUP && done == 0)
+		return error;
+	
+	if (error)
+	{
+		mv->mv_stop = MTVERIFY_STOP_ERROR;
+		mv->mv_error = error;
+	}
+	
+	return KERN_SUCCESS;
+}
+
+int st_erase(IOSCSITape *st, bool longErase)
+{
+	SInt64 start = st->lba;
+	
+	if (st->Erase(longErase) == kIOReturnSuccess)
+	{
+		/* either erase leaves the end of data where it starts */
+		st->SetEndOfData(start);
+		
+		/* a long erase runs on in the drive, and where the tape
+		 * ends up is not known until it finishes */
+		if (longErase)
+		{
+			st->fileno = -1;
+			st->blkno = -1;
+			st->lba = -1;
+		}
+		
+		return KERN_SUCCESS;
+	}
+	
+	st->SetEndOfData(-1);
+	
+	return st_errno(st);
+}
+
+/*
+ *  st_wait_ready()
+ *  Poll TEST UNIT READY with exponential backoff while the drive is
+ *  becoming ready (04/01) or finishing an operation (04/07), up to
+ *  readyWait seconds. An empty drive is not waited for, and any other
+ *  reason the drive is not ready fails at once. Cached mode and block
+ *  limits are refreshed once the drive is ready if the medium changed.
+ */
+int st_wait_ready(IOSCSITape *st)
+{
+	UInt64	deadline	= st_uptime_us() + (UInt64)st->readyWait * 1000000;
+	UInt32	delay		= ST_READY_POLL;
+	
+	while (st->TestUnitReady() != kIOReturnSuccess)
+	{
+		/* MEDIUM NOT PRESENT */
+		if (st->lastSenseKey == kSENSE_KEY_NOT_READY && st->lastASC == 0x3A)
+			return KERN_SUCCESS;
+		
+		/* a unit attention is consumed by the TEST UNIT READY; no
+		 * wait makes a drive that needs a command or an operator
+		 * ready */
+		if (st->lastSenseKey != kSENSE_KEY_UNIT_ATTENTION &&
+			!(st->lastSenseKey == kSENSE_KEY_NOT_READY &&
+			  st->lastASC == 0x04 &&
+			  (st->lastASCQ == 0x01 || st->lastASCQ == 0x07)))
+		{
+			return st_errno(st);
+		}
+		
+		if (st_uptime_us() > deadline)
+			return ETIMEDOUT;
+		
+		IOSleep(delay);
+		
+		delay <<= 1;
+		
+		if (delay > ST_RETRY_MAX_DELAY)
+			delay = ST_RETRY_MAX_DELAY;
+	}
+	
+	if (st->flags & ST_MEDIA_CHANGED)
+	{
+		if (st->GetDeviceDetails() == kIOReturnSuccess &&
+			st->GetDeviceBlockLimits() == kIOReturnSuccess)
+		{
+			st->flags &= ~ST_MEDIA_CHANGED;
+			st->IdentifyMedia();
+		}
+	}
+	
+	return KERN_SUCCESS;
+}
+
+/*
+ *  st_resync()
+ *  Read the position back from the drive when any part of it is
+ *  unknown. The long form also gives the file number; the short form
+ *  only the logical block address.
+ */
+int st_resync(IOSCSITape *st)
+{
+	SCSI_ReadPositionLongForm	longPos		= { 0 };
+	SCSI_ReadPositionShortForm	shortPos	= { 0 };
+	
+	if (st->fileno != -1 && st->blkno != -1 && st->lba != -1)
+		return KERN_SUCCESS;
+	
+	/* the drive would answer as it did last time */
+	if (st->lba != -1 &&
+		st->lba == st->rdposLba &&
+		st->partition == st->rdposPartition)
+	{
+		if (st->fileno == -1)
+			st->fileno = st->rdposFileno;
+		
+		if (st->blkno == -1)
+			st->blkno = st->rdposBlkno;
+		
+		return KERN_SUCCESS;
+	}
+	
+	if (st->ReadPositionLong(&longPos) == kIOReturnSuccess)
+	{
+		if (longPos.flags & kSCSIReadPositionLongForm_LogicalObjectNumberUnknown)
+			return EIO;
+		
+		st->lba = longPos.logicalObjectNumber;
+		st->partition = longPos.partitionNumber;
+		
+		/* the block number is only recoverable at the start of a
+		 * partition */
+		if (longPos.flags & kSCSIReadPositionLongForm_BeginningOfPartition)
+		{
+			st->fileno = 0;
+			st->blkno = 0;
+		}
+		else if (!(longPos.flags & kSCSIReadPositionLongForm_MarkPositionUnknown) &&
+				 st->fileno != (int)longPos.logicalFileIdentifier)
+		{
+			st->fileno = (int)longPos.logicalFileIdentifier;
+			st->blkno = -1;
+		}
+		
+		st_position_read(st);
+		
+		return KERN_SUCCESS;
+	}
+	
+	if (st->ReadPosition(&shortPos, false) == kIOReturnSuccess)
+	{
+		if (shortPos.flags & kSCSIReadPositionShortForm_LogicalObjectLocationUnknown)
+			return EIO;
+		
+		st->lba = shortPos.firstLogicalObjectLocation;
+		st->partition = shortPos.partitionNumber;
+		
+		if (shortPos.flags & kSCSIReadPositionShortForm_BeginningOfPartition)
+		{
+			st->fileno = 0;
+			st->blkno = 0;
+		}
+		
+		st_position_read(st);
+		
+		return KERN_SUCCESS;
+	}
+	
+	return st_errno(st);
+}
+
+int st_locate(IOSCSITape *st, UInt32 addr, bool hardware)
+{
+	if (st->Locate(addr, hardware) == kIOReturnSuccess)
+	{
+		st->fileno = -1;
+		st->blkno = -1;
+		st->lba = hardware ? -1 : addr;
+		
+		/* pick up the file number while the drive is idle */
+		st_resync(st);
+		
+		return KERN_SUCCESS;
+	}
+	
+	st->fileno = -1;
+	st->blkno = -1;
+	st->lba = -1;
+	
+	return st_errno(st);
+}
+
+int st_read_attribute(IOSCSITape *st, struct mtmam *mm)
+{
+	switch (st->ReadAttribute(mm))
+	{
+		case kIOReturnSuccess:
+			return KERN_SUCCESS;
+		case kIOReturnNotFound:
+			return ENOATTR;
+		case kIOReturnUnsupported:
+			return ENOTSUP;
+		case kIOReturnBadArgument:
+			return EINVAL;
+	}
+	
+	return st_errno(st);
+}
+
+int st_write_attribute(IOSCSITape *st, struct mtmam *mm)
+{
+	/* only host attributes are the application's to write */
+	if (!(mm->mm_id >= MTMAM_HOST_FIRST && mm->mm_id <= MTMAM_HOST_LAST) &&
+		!(mm->mm_id >= MTMAM_VENDOR_FIRST && mm->mm_id <= MTMAM_VENDOR_LAST))
+		return (EINVAL);
+	
+	switch (st->WriteAttribute(mm))
+	{
+		case kIOReturnSuccess:
+			return KERN_SUCCESS;
+		case kIOReturnUnsupported:
+			return ENOTSUP;
+		case kIOReturnBadArgument:
+			return EINVAL;
+	}
+	
+	return st_errno(st);
+}
+
+/*
+ *  st_next_volume()
+ *  Have the helper put the next cartridge in the drive and start at its
+ *  beginning. A writer closes the last cartridge with an end of volume
+ *  filemark first, and records where it is in the cartridge memory; if
+ *  the filemark cannot be written the span fails with its error, as a
+ *  reader could not find the end of the volume.
+ */
+int st_next_volume(IOSCSITape *st, int op)
+{
+	unsigned int	pos		= 0;
+	SInt64			eov		= -1;
+	IOReturn		status	= kIOReturnSuccess;
+	int				error	= 0;
+	
+	if (op == MTSPAN_WRITE)
+	{
+		if (st->lba == -1)
+			st_rdpos(st, false, &pos);
+		
+		/* a reader could not tell where this volume ends */
+		if ((eov = st->lba) == -1)
+			return EIO;
+		
+		if ((error = st_write_filemarks(st, 1)) != KERN_SUCCESS)
+			return error;
+		
+		status = st->SetSpanMark(eov);
+		
+		if (status == kIOReturnUnsupported)
+			return ENOTSUP;
+		else if (status != kIOReturnSuccess)
+			return st_errno(st);
+	}
+	
+	if ((error = st_unload(st)) != KERN_SUCCESS)
+		return error;
+	
+	if ((error = st->RequestVolume(op)) != KERN_SUCCESS)
+		return error;
+	
+	/* the helper may answer before the drive has threaded the tape */
+	if ((error = st_wait_ready(st)) != KERN_SUCCESS)
+		return error;
+	
+	if (st->TestUnitReady() != kIOReturnSuccess)
+		return st_errno(st);
+	
+	st->flags &= ~(ST_WRITTEN | ST_EOM_SIGNALLED);
+	
+	return st_rewind(st);
+}
+
+/*
+ *  st_end_of_volume()
+ *  Whether lba, of the filemark or the end of data just read, is where
+ *  a spanning writer ended the volume on this cartridge.
+ */
+static bool st_end_of_volume(IOSCSITape *st, SInt64 lba)
+{
+	return lba != -1 && st->SpanMark() == lba;
+}
+
+/*
+ *  st_health()
+ *  The drive health as of the last poll. On the tape device itself,
+ *  which is not busy, the drive is polled first.
+ */
+int st_health(IOSCSITape *st, struct mthealth *mh, bool refresh)
+{
+	IOReturn status = kIOReturnSuccess;
+	
+	if (refresh)
+		status = st->PollHealth(false);
+	
+	if (status == kIOReturnSuccess || status == kIOReturnUnsupported)
+		status = st->GetHealth(mh);
+	
+	switch (status)
+	{
+		case kIOReturnSuccess:
+			return KERN_SUCCESS;
+		case kIOReturnNotFound:
+			return refresh ? ENOTSUP : EAGAIN;
+		default:
+			return st_errno(st);
+	}
+}
+
+int st_set_crypt(IOSCSITape *st, struct mtcrypt *mc)
+{
+	switch (st->SetEncryption(mc))
+	{
+		case kIOReturnSuccess:
+			return KERN_SUCCESS;
+		case kIOReturnUnsupported:
+			return ENOTSUP;
+		case kIOReturnBadArgument:
+			return EINVAL;
+	}
+	
+	return st_errno(st);
+}
+
+/*
+ *  st_set_protection()
+ *  Logical block protection is set on the drive at once, so that a
+ *  drive without it says so here rather than on the next read.
+ */
+int st_set_protection(IOSCSITape *st, int mode)
+{
+	IOReturn status = kIOReturnSuccess;
+	
+	if (mode != MTLBP_OFF && mode != MTLBP_CRC32C)
+		return EINVAL;
+	
+	if (mode != MTLBP_OFF || st->lbpActive)
+		status = st->SetProtection(mode != MTLBP_OFF);
+	
+	switch (status)
+	{
+		case kIOReturnSuccess:
+			st->lbpEnabled = (mode != MTLBP_OFF);
+			return KERN_SUCCESS;
+		case kIOReturnUnsupported:
+			return ENOTSUP;
+	}
+	
+	return st_errno(st);
+}
+
+/*
+ *  st_get_crypt()
+ *  The drive's encryption. The control device answers from what was
+ *  last read, the tape device asks the drive.
+ */
+int st_get_crypt(IOSCSITape *st, struct mtcrypt *mc, bool refresh)
+{
+	switch (st->GetEncryption(mc, refresh))
+	{
+		case kIOReturnSuccess:
+			return KERN_SUCCESS;
+		case kIOReturnUnsupported:
+			return ENOTSUP;
+		case kIOReturnNotReady:
+			return EAGAIN;
+	}
+	
+	return st_errno(st);
+}
+
+/*
+ *  st_set_early_warning()
+ *  Zero disables the early warning ENOSPC, anything else enables it. A
+ *  count above 1 also moves the warning that many megabytes earlier.
+ */
+int st_set_early_warning(IOSCSITape *st, int number)
+{
+	IOReturn status;
+	
+	if (number < 0 || number > kSCSICmdFieldMask2Byte)
+		return (EINVAL);
+	
+	if (number > 1 || st->pewSize)
+	{
+		status = st->SetEarlyWarningSize(number > 1 ? number : 0);
+		
+		if (status == kIOReturnUnsupported)
+			return (ENOTSUP);
+		else if (status != kIOReturnSuccess)
+			return st_errno(st);
+	}
+	
+	if (number)
+		st->flags |= ST_EARLY_WARNING;
+	else
+		st->flags &= ~ST_EARLY_WARNING;
+	
+	st->flags &= ~ST_EOM_SIGNALLED;
+	
+	return KERN_SUCCESS;
+}
+
+int st_capacity(IOSCSITape *st, struct mtcapacity *mc)
+{
+	switch (st->GetCapacity(mc))
+	{
+		case kIOReturnSuccess:
+			return KERN_SUCCESS;
+		case kIOReturnUnsupported:
+			return ENOTSUP;
+	}
+	
+	return st_errno(st);
+}
+
+int st_set_blocksize(IOSCSITape *st, int number)
+{
+	if ((number > 0) &&
+		(st->blkmin || st->blkmax) &&
+		(number < st->blkmin ||
+		 number > st->blkmax))
+	{
+		return (EINVAL);
+	}
+	
+	if (st->SetBlockSize(number) == kIOReturnSuccess)
+		return KERN_SUCCESS;
+	
+	return st_errno(st);	
+}
+
+int st_set_buffered(IOSCSITape *st, int mode)
+{
+	if (mode != MTBUFFER_OFF && mode != MTBUFFER_ON && mode != MTBUFFER_SHARED)
+		return (EINVAL);
+	
+	if (st->SetBufferedMode(mode) == kIOReturnSuccess)
+		return KERN_SUCCESS;
+	
+	return st_errno(st);
+}
+
+#if 0
+#pragma mark -
+#pragma mark Character device system calls
+#pragma mark -
+#endif /* 0 */
+
+int st_open(dev_t dev, int flags, int devtype, struct proc *p)
+{
+	IOSCSITape *st = IOSCSITape::devices[ST_UNIT(dev)];
+	int error = ENXIO;
+	
+	if (ST_IS_CTL(dev))
+		return KERN_SUCCESS;
+	
+	/* a non-blocking open does not wait for a busy drive */
+	if (flags & FNONBLOCK)
+	{
+		if (!IOLockTryLock(st->cmdLock))
+			return EAGAIN;
+	}
+	else
+		IOLockLock(st->cmdLock);
+	
+	if (st->flags & ST_DEVOPEN)
+		error = EBUSY;
+	else if ((flags & FNONBLOCK) && st->Busy())
+		error = EAGAIN;
+	else
+	{
+		st->flags |= ST_DEVOPEN;
+		error = KERN_SUCCESS;
+		
+		if (!(flags & FNONBLOCK) && st->readyWait > 0)
+			error = st_wait_ready(st);
+		
+		if (error)
+			st->flags &= ~ST_DEVOPEN;
+		else
+			st->ScheduleHealth(ST_HEALTH_INTERVAL);
+	}
+	
+	IOLockUnlock(st->cmdLock);
+	
+	return error;
+}
+
+int st_close(dev_t dev, int flags, int devtype, struct proc *p)
+{
+	IOSCSITape *st = IOSCSITape::devices[ST_UNIT(dev)];
+
+	if (ST_IS_CTL(dev))
+		return KERN_SUCCESS;
+	
+	IOLockLock(st->cmdLock);
+	
+	/* if the last command was a write then write 2x EOF markers and
+	 * backspace over 1 (for the next write) */
+	if (st->flags & ST_WRITTEN)
+	{
+		st_write_filemarks(st, 2);
+		st_space(st, kSCSISpaceCode_Filemarks, -1);
+		
+		st->flags &= ~ST_WRITTEN;
+	}
+	
+	/* a key given for this open goes with it */
+	if (st->flags & ST_CRYPT_KEY)
+	{
+		struct mtcrypt mc = { 0 };
+		
+		st_set_crypt(st, &mc);
+		st->flags &= ~ST_CRYPT_KEY;
+	}
+	
+	st->flags &= ~(ST_DEVOPEN | ST_READ_REVERSE | ST_EOM_SIGNALLED);
+	
+	/* the ring is mapped in the task that opened the device */
+	st->UnmapSharedRing();
+	
+	IOLockUnlock(st->cmdLock);
+	
+	/* the end of a job is a good time to look at the drive */
+	st->ScheduleHealth(ST_HEALTH_CLOSE);
+	
+	return KERN_SUCCESS;
+}
+
+/*
+ *  st_pending_error()
+ *  An error the next read or write has to report: the drive's
+ *  encryption changed under the reader or writer, or a background poll
+ *  was handed a deferred error of an earlier buffered write.
+ */
+static int st_pending_error(IOSCSITape *st)
+{
+	if (st->flags & ST_CRYPT_CHANGED)
+	{
+		st->flags &= ~ST_CRYPT_CHANGED;
+		return EACCES;
+	}
+	
+	if (st->flags & ST_DEFERRED_ERROR)
+	{
+		st->flags &= ~ST_DEFERRED_ERROR;
+		return EIO;
+	}
+	
+	return KERN_SUCCESS;
+}
+
+/*
+ *  st_transfer()
+ *  Read or write a prepared buffer as one record, or as a run of fixed
+ *  blocks, and account for it. *done is how much of the buffer was
+ *  used, whatever the result. *nextVolume is set when a spanning
+ *  transfer carries on on the next cartridge, and *retry when what was
+ *  not done has to be done again there.
+ */
+static int st_transfer(IOSCSITape *st, IOMemoryDescriptor *dataBuffer, bool read,
+					   int *done, bool *nextVolume, bool *retry)
+{
+	int			status		= EIO;
+	IOReturn	opStatus	= kIOReturnError;
+	int			lastRealizedBytes = 0;
+	int			requestedBytes = (int)dataBuffer->getLength();
+	int			startFile	= st->fileno;
+	int			startBlock	= st->blkno;
+	bool		reverse		= (read && (st->flags & ST_READ_REVERSE));
+	
+	*done = 0;
+	*nextVolume = false;
+	*retry = false;
+	st->resid = 0;
+	
+	/* what follows on the cartridge no longer goes on to the next one */
+	if (!read && st->SpanMark() != -1 &&
+		st->SetSpanMark(-1) != kIOReturnSuccess)
+		return st_errno(st);
+	
+	opStatus = st->ReadWrite(dataBuffer, &lastRealizedBytes);
+	
+	/* hashed while the caller's buffer is still prepared */
+	if (st->digestEnabled && !reverse && lastRealizedBytes > 0)
+		st->DigestTransfer(dataBuffer, lastRealizedBytes, startFile, startBlock,
+						   read);
+	
+	if (opStatus == kIOReturnSuccess)
+	{
+		*done = lastRealizedBytes;
+		
+		int blocks = 1;
+		
+		if (st->IsFixedBlockSize())
+			blocks = lastRealizedBytes / st->blksize;
+		
+		if (st->blkno != -1)
+			st->blkno += reverse ? -blocks : blocks;
+		
+		if (st->lba != -1)
+			st->lba += reverse ? -blocks : blocks;
+		
+		/* before early warning again, e.g. after a rewind */
+		if (!read)
+			st->flags &= ~ST_EOM_SIGNALLED;
+
+		status = KERN_SUCCESS;
+	}
+	else if (opStatus == kIOReturnUnsupported)
+		status = ENOTSUP;
+	else if (opStatus == kIOReturnNotAligned)
+		status = EINVAL;
+	else if (opStatus == kIOReturnNoResources)
+		status = ENOMEM;
+	else if (opStatus == kIOReturnDMAError)
+	{
+		/* a block read failed its CRC32C; the tape has moved past it,
+		 * and past a filemark that stopped the read */
+		int blocks = 1;
+		
+		if (st->IsFixedBlockSize())
+			blocks = lastRealizedBytes / st->blksize;
+		
+		if (st->blkno != -1)
+			st->blkno += blocks;
+		
+		if (st->lba != -1)
+			st->lba += blocks;
+		
+		st->DigestError();
+		
+		if (st->sense_flags & SENSE_FILEMARK)
+		{
+			if (st->lba != -1)
+				st->lba++;
+			
+			if (st->fileno != -1)
+			{
+				st->fileno++;
+				st->blkno = 0;
+			}
+		}
+		
+		status = EBADMSG;
+	}
+	else if (st->sense_flags & SENSE_FILEMARK)
+	{
+		/* in fixed block mode the blocks before the filemark are
+		 * returned, and the filemark itself is passed */
+		int blocks = 1;
+		
+		if (st->IsFixedBlockSize())
+			blocks += lastRealizedBytes / st->blksize;
+		
+		if (!reverse && st->digestEnabled)
+			st->DigestEnd(true, startFile,
+						  startBlock == -1 ? -1 : startBlock + blocks - 1);
+		
+		*done = lastRealizedBytes;
+		
+		if (st->lba != -1)
+			st->lba += reverse ? -blocks : blocks;
+		
+		/* reading backwards over a filemark leaves the tape at the
+		 * end of the previous file, whose length is unknown */
+		if (st->fileno != -1)
+		{
+			st->fileno += reverse ? -1 : 1;
+			st->blkno = reverse ? -1 : 0;
+		}
+		
+		status = KERN_SUCCESS;
+		
+		/* a spanning reader reads on from the next cartridge, and
+		 * reads again there if nothing was returned from this one */
+		if (!reverse && (st->flags & ST_SPANNING) &&
+			st_end_of_volume(st, st->lba == -1 ? -1 : st->lba - 1))
+		{
+			*nextVolume = true;
+			*retry = (lastRealizedBytes == 0);
+		}
+	}
+	else if (read && !reverse && (st->flags & ST_SPANNING) &&
+			 (st->sense_flags & SENSE_EOD) && st->lba != -1 &&
+			 st_end_of_volume(st, st->lba + (st->IsFixedBlockSize() ?
+											  lastRealizedBytes / st->blksize : 0)))
+	{
+		/* the writer's end of volume filemark did not fit; the blocks
+		 * before the end of data are returned */
+		int blocks = 0;
+		
+		if (st->IsFixedBlockSize())
+			blocks = lastRealizedBytes / st->blksize;
+		
+		if (st->digestEnabled)
+			st->DigestEnd(true, startFile,
+						  startBlock == -1 ? -1 : startBlock + blocks);
+		
+		*done = lastRealizedBytes;
+		*nextVolume = true;
+		*retry = (lastRealizedBytes == 0);
+		
+		st->lba += blocks;
+		
+		if (st->blkno != -1)
+			st->blkno += blocks;
+		
+		status = KERN_SUCCESS;
+	}
+	else if (reverse && (st->sense_flags & SENSE_BOM))
+	{
+		st->fileno = 0;
+		st->blkno = 0;
+		st->lba = 0;
+		
+		status = KERN_SUCCESS;
+	}
+	else if (!read && (st->sense_flags & SENSE_EOM))
+	{
+		/* past early warning the drive still writes; the INFORMATION
+		 * field holds what it did not */
+		int residue = st->lastSenseInfo;
+		int written = 0;
+		int blocks = 0;
+		
+		if (st->IsFixedBlockSize())
+			residue *= st->blksize;
+		
+		if (residue < 0 || residue > requestedBytes)
+			residue = requestedBytes;
+		
+		written = requestedBytes - residue;
+		
+		/* the digest has the bytes the drive did not write */
+		if (residue > 0)
+			st->DigestError();
+		
+		/* a spanning writer writes the rest on the next cartridge */
+		if (st->flags & ST_SPANNING)
+		{
+			*nextVolume = true;
+			*retry = (residue > 0);
+		}
+		
+		*done = written;
+		
+		if (st->IsFixedBlockSize())
+			blocks = written / st->blksize;
+		else
+			blocks = (written > 0);
+		
+		if (st->blkno != -1)
+			st->blkno += blocks;
+		
+		if (st->lba != -1)
+			st->lba += blocks;
+		
+		st->resid = st->lastSenseInfo;
+		
+		/* the partition is full, or the writer asked to be told once
+		 * it is nearly so */
+		if (*nextVolume)
+			status = KERN_SUCCESS;
+		else if (st->lastSenseKey != kSENSE_KEY_NO_SENSE)
+			status = ENOSPC;
+		else if ((st->flags & ST_EARLY_WARNING) &&
+				 !(st->flags & ST_EOM_SIGNALLED))
+		{
+			st->flags |= ST_EOM_SIGNALLED;
+			status = ENOSPC;
+		}
+		else
+			status = KERN_SUCCESS;
+	}
+	else if ((st->sense_flags & SENSE_ILI) &&
+			 st->lastSenseKey == kSENSE_KEY_NO_SENSE &&
+			 !st->IsFixedBlockSize())
+	{
+		/* a record shorter than the read is returned as is; one
+		 * longer than it has been read past and its tail is lost */
+		if (st->blkno != -1)
+			st->blkno += reverse ? -1 : 1;
+		
+		if (st->lba != -1)
+			st->lba += reverse ? -1 : 1;
+		
+		if (st->lastSenseInfo >= 0)
+		{
+			*done = lastRealizedBytes;
+			status = KERN_SUCCESS;
+		}
+		else
+		{
+			st->DigestError();
+			status = ENOMEM;
+		}
+	}
+	else
+	{
+		if (read && (st->sense_flags & SENSE_EOD) &&
+			st->lba != -1)
+		{
+			st->SetEndOfData(st->lba);
+		}
+		
+		/* the end of data also ends the last file */
+		if (read && (st->sense_flags & SENSE_EOD) &&
+			!reverse && st->digestEnabled)
+			st->DigestEnd(true, startFile,
+						  startBlock == -1 || !st->IsFixedBlockSize() ? startBlock :
+						  startBlock + lastRealizedBytes / st->blksize);
+		else
+			st->DigestError();
+		
+		status = st_errno(st);
+	}
+	
+	/* a write always leaves the end of data just after it */
+	if (!read)
+		st->SetEndOfData(status == KERN_SUCCESS ||
+						 (st->sense_flags & SENSE_EOM) ? st->lba : -1);
+	
+	return status;
+}
+
+/*
+ *  st_rw()
+ *  read() and write() on the tape device, with cmdLock held.
+ */
+static int st_rw(IOSCSITape *st, struct uio *uio)
+{
+	IOMemoryDescriptor	*dataBuffer	= NULL;
+	int					status		= EIO;
+	int					requestedBytes = uio_resid(uio);
+	int					done		= 0;
+	UInt64				captureStart = 0;
+	bool				nextVolume	= false;
+	bool				retry		= false;
+	int					realized	= 0;
+	int					error		= 0;
+	
+	if ((error = st_pending_error(st)) != KERN_SUCCESS)
+		return error;
+	
+	if (st->captureEnabled)
+		captureStart = st_uptime_us();
+	
+	do
+	{
+		dataBuffer = IOMemoryDescriptorFromUIO(uio);
+		
+		if (dataBuffer == 0)
+		{
+			status = ENOMEM;
+			break;
+		}
+		
+		dataBuffer->prepare();
+		
+		status = st_transfer(st, dataBuffer, uio_rw(uio) == UIO_READ,
+							 &realized, &nextVolume, &retry);
+		
+		dataBuffer->complete();
+		dataBuffer->release();
+		
+		done += realized;
+		
+		/* a retry carries on from where this left off */
+		if (retry)
+			uio_update(uio, realized);
+		else
+			uio_setresid(uio, uio_resid(uio) - realized);
+		
+		if (nextVolume)
+			status = st_next_volume(st, uio_rw(uio) == UIO_READ ? MTSPAN_READ : MTSPAN_WRITE);
+	} while (status == KERN_SUCCESS && retry);
+	
+	if (captureStart)
+		st->CaptureCall(uio_rw(uio) == UIO_READ ? MTWL_READ : MTWL_WRITE,
+						0, 0, requestedBytes, done, status,
+						captureStart);
+	
+	return status;
+}
+
+int st_readwrite(dev_t dev, struct uio *uio, int ioflag)
+{
+	IOSCSITape	*st		= IOSCSITape::devices[ST_UNIT(dev)];
+	int			status	= EIO;
+	
+	if (ST_IS_CTL(dev))
+		return ENXIO;
+	
+	if (ioflag & IO_NDELAY)
+	{
+		if (!IOLockTryLock(st->cmdLock))
+			return EAGAIN;
+		
+		if (st->Busy())
+		{
+			IOLockUnlock(st->cmdLock);
+			return EAGAIN;
+		}
+	}
+	else
+		IOLockLock(st->cmdLock);
+	
+	status = st_rw(st, uio);
+	IOLockUnlock(st->cmdLock);
+	
+	return status;
+}
+
+/*
+ *  st_record()
+ *  Read or write one record of a batch, length bytes of a buffer from
+ *  offset, carrying a spanning transfer on to the next cartridge as
+ *  st_readwrite() does. *done is how much of it was used, and
+ *  *filemark is set when a read passed a filemark.
+ */
+static int st_record(IOSCSITape *st, IOMemoryDescriptor *buffer, UInt32 offset,
+					 UInt32 length, bool read, UInt32 *done, bool *filemark)
+{
+	IOMemoryDescriptor	*dataBuffer	= NULL;
+	int					status		= KERN_SUCCESS;
+	int					realized	= 0;
+	UInt64				captureStart = 0;
+	bool				nextVolume	= false;
+	bool				retry		= false;
+	
+	*done = 0;
+	*filemark = false;
+	
+	if (st->captureEnabled)
+		captureStart = st_uptime_us();
+	
+	do
+	{
+		dataBuffer = IOSubMemoryDescriptor::withSubRange(buffer, offset + *done,
+														 length - *done,
+														 read ? kIODirectionIn : kIODirectionOut);
+		
+		if (dataBuffer == NULL)
+		{
+			status = ENOMEM;
+			break;
+		}
+		
+		/* the caller's addresses are only checked here */
+		if (dataBuffer->prepare() != kIOReturnSuccess)
+		{
+			dataBuffer->release();
+			status = EFAULT;
+			break;
+		}
+		
+		status = st_transfer(st, dataBuffer, read, &realized, &nextVolume, &retry);
+		
+		dataBuffer->complete();
+		dataBuffer->release();
+		
+		*done += realized;
+		*filemark = read && !nextVolume && (st->sense_flags & SENSE_FILEMARK);
+		
+		if (nextVolume)
+			status = st_next_volume(st, read ? MTSPAN_READ : MTSPAN_WRITE);
+	} while (status == KERN_SUCCESS && retry);
+	
+	if (captureStart)
+		st->CaptureCall(read ? MTWL_READ : MTWL_WRITE,
+						0, 0, length, *done, status, captureStart);
+	
+	return status;
+}
+
+/*
+ *  st_kick_ring()
+ *  Write or read the slots of the shared ring handed to the driver, in
+ *  order, until the first that fails or, reading, a filemark.
+ */
+static int st_kick_ring(IOSCSITape *st, struct mtringkick *mk)
+{
+	struct mtringhdr	*hdr		= st->sharedHeader;
+	bool				read		= (st->sharedDir == MTRING_READ);
+	UInt32				count		= 0;
+	UInt32				slot		= 0;
+	UInt32				length		= 0;
+	UInt32				done		= 0;
+	int					status		= KERN_SUCCESS;
+	int					error		= 0;
+	bool				filemark	= false;
+	
+	if (hdr == NULL)
+		return ENXIO;
+	
+	if ((error = st_pending_error(st)) != KERN_SUCCESS)
+		return error;
+	
+	count = hdr->mh_head - st->sharedTail;
+	
+	if (count > st->sharedSlots)
+		return EINVAL;
+	
+	if (mk->mk_count && mk->mk_count < count)
+		count = mk->mk_count;
+	
+	mk->mk_count = 0;
+	mk->mk_flags = 0;
+	
+	while (mk->mk_count < count)
+	{
+		slot = st->sharedTail % st->sharedSlots;
+		length = read ? st->sharedSlotSize : hdr->mh_len[slot];
+		
+		if (length == 0 || length > st->sharedSlotSize)
+			return EINVAL;
+		
+		status = st_record(st, st->sharedRing,
+						   st->sharedOffset + slot * st->sharedSlotSize,
+						   length, read, &done, &filemark);
+		
+		/* a record written past early warning is done, and the
+		 * warning returned after it */
+		if (status != KERN_SUCCESS && (read || done < length))
+			break;
+		
+		if (read)
+			hdr->mh_len[slot] = done;
+		
+		OSMemoryBarrier();
+		hdr->mh_tail = ++st->sharedTail;
+		mk->mk_count++;
+		
+		if (status != KERN_SUCCESS)
+			break;
+		
+		if (filemark)
+		{
+			mk->mk_flags |= MTRING_FILEMARK;
+			break;
+		}
+	}
+	
+	return status;
+}
+
+/*
+ *  st_records()
+ *  Write or read the records of a caller's array, each one as a write()
+ *  or read() of it would be, until the first that fails or, reading, a
+ *  filemark. Only a bad array is an error of the call itself; a record
+ *  that fails has its own.
+ */
+static int st_records(IOSCSITape *st, struct mtrecv *mrv, bool read)
+{
+	struct mtrec		recs[MTRECV_BATCH];
+	IOMemoryDescriptor	*buffer		= NULL;
+	user_addr_t			addr		= (user_addr_t)mrv->mrv_recs;
+	UInt32				count		= mrv->mrv_count;
+	UInt32				batch		= 0;
+	UInt32				i			= 0;
+	int					error		= 0;
+	bool				filemark	= false;
+	bool				stop		= false;
+	
+	if (count > MTRECV_MAX)
+		return EINVAL;
+	
+	if ((error = st_pending_error(st)) != KERN_SUCCESS)
+		return error;
+	
+	mrv->mrv_count = 0;
+	mrv->mrv_flags = 0;
+	
+	while (!stop && count > 0)
+	{
+		batch = count < MTRECV_BATCH ? count : MTRECV_BATCH;
+		
+		if ((error = copyin(addr, recs, batch * sizeof(struct mtrec))))
+			return error;
+		
+		for (i = 0; i < batch && !stop; i++)
+		{
+			recs[i].mre_done = 0;
+			recs[i].mre_error = EINVAL;
+			
+			if (recs[i].mre_len > 0)
+				buffer = IOMemoryDescriptor::withAddressRange(
+					recs[i].mre_addr, recs[i].mre_len,
+					read ? kIODirectionIn : kIODirectionOut, current_task());
+			else
+				buffer = NULL;
+			
+			if (buffer)
+			{
+				recs[i].mre_error = st_record(st, buffer, 0, recs[i].mre_len, read,
+											  &recs[i].mre_done, &filemark);
+				buffer->release();
+			}
+			
+			/* a record written past early warning is done, and the
+			 * warning returned with it */
+			if (recs[i].mre_error == KERN_SUCCESS ||
+				(!read && recs[i].mre_done == recs[i].mre_len))
+				mrv->mrv_count++;
+			
+			if (recs[i].mre_error != KERN_SUCCESS)
+				stop = true;
+			else if (filemark)
+			{
+				mrv->mrv_flags |= MTRECV_FILEMARK;
+				stop = true;
+			}
+		}
+		
+		if ((error = copyout(recs, addr, i * sizeof(struct mtrec))))
+			return error;
+		
+		addr += i * sizeof(struct mtrec);
+		count -= i;
+	}
+	
+	return KERN_SUCCESS;
+}
+
+/*
+ *  st_mtop()
+ *  Carry out an MTIOCTOP operation.
+ */
+static int st_mtop(IOSCSITape *st, struct mtop *mt)
+{
+	int number = mt->mt_count;
+	int error = 0;
+	
+	switch (mt->mt_op)
+	{
+		case MTBSF:
+			number = -number;
+		case MTFSF:
+			error = st_space(st, kSCSISpaceCode_Filemarks, number);
+			break;
+		case MTBSR:
+			number = -number;
+		case MTFSR:
+			error = st_space(st, kSCSISpaceCode_LogicalBlocks, number);
+			break;
+		case MTREW:
+			error = st_rewind(st);
+			break;
+		case MTWEOF:
+			error = st_write_filemarks(st, number);
+			break;
+		case MTOFFL:
+			error = st_unload(st);
+			break;
+		case MTNOP:
+			break;
+		case MTEOM:
+			error = st_eom(st);
+			break;
+		case MTSETBSIZ:
+			error = st_set_blocksize(st, number);
+			break;
+		case MTCACHE:
+			error = st_set_buffered(st, MTBUFFER_ON);
+			break;
+		case MTNOCACHE:
+			error = st_set_buffered(st, MTBUFFER_OFF);
+			break;
+		case MTERASE:
+			error = st_erase(st, number != 0);
+			break;
+		case MTEWARN:
+			error = st_set_early_warning(st, number);
+			break;
+		default:
+			error = EINVAL;
+	}
+	
+	return error;
+}
+
+/*
+ *  st_mtop_merge()
+ *  Fold the next operation of a batch into this one where doing the one
+ *  is the same as doing both: spacing or writing filemarks further the
+ *  same way, or an operation that the next repeats or replaces.
+ */
+static bool st_mtop_merge(struct mtop *mt, const struct mtbatchop *mbo)
+{
+	if (mbo->mbo_op == MTNOP)
+		return true;
+	
+	if (mt->mt_op == MTNOP)
+	{
+		mt->mt_op = mbo->mbo_op;
+		mt->mt_count = mbo->mbo_count;
+		return true;
+	}
+	
+	if (mbo->mbo_op != mt->mt_op)
+		return false;
+	
+	switch (mt->mt_op)
+	{
+		case MTFSF:
+		case MTBSF:
+		case MTFSR:
+		case MTBSR:
+		case MTWEOF:
+			/* backwards then forwards over a filemark is not the
+			 * same as the difference */
+			if (mt->mt_count < 0 || mbo->mbo_count < 0 ||
+				mbo->mbo_count > ST_BATCH_COUNT_MAX - mt->mt_count)
+				return false;
+			
+			mt->mt_count += mbo->mbo_count;
+			return true;
+		case MTREW:
+		case MTEOM:
+		case MTSETBSIZ:
+			mt->mt_op = mbo->mbo_op;
+			mt->mt_count = mbo->mbo_count;
+			return true;
+	}
+	
+	return false;
+}
+
+/*
+ *  st_batch()
+ *  Carry out the operations of a batch in order until one fails. Only
+ *  a bad batch is an error of the call itself; the operation that
+ *  failed has its errno returned in mob_error.
+ */
+static int st_batch(IOSCSITape *st, struct mtopbatch *mob)
+{
+	struct mtop	op;
+	UInt32		next		= 0;
+	int			blockSize	= -1;
+	UInt64		captureStart = 0;
+	
+	if (mob->mob_count > MTBATCH_MAX)
+		return EINVAL;
+	
+	mob->mob_done = 0;
+	mob->mob_error = 0;
+	
+	while (mob->mob_done < mob->mob_count)
+	{
+		op.mt_op = mob->mob_ops[mob->mob_done].mbo_op;
+		op.mt_count = mob->mob_ops[mob->mob_done].mbo_count;
+		
+		for (next = mob->mob_done + 1;
+			 next < mob->mob_count && st_mtop_merge(&op, &mob->mob_ops[next]);
+			 next++);
+		
+		/* a block size this batch has already set */
+		if (op.mt_op == MTSETBSIZ && op.mt_count == blockSize)
+			op.mt_op = MTNOP;
+		
+		/* captured as the operations a replay can repeat */
+		captureStart = st->captureEnabled ? st_uptime_us() : 0;
+		
+		mob->mob_error = st_mtop(st, &op);
+		
+		if (captureStart)
+			st->CaptureCall(MTWL_IOCTL, MTIOCTOP, op.mt_op, op.mt_count, 0,
+							mob->mob_error, captureStart);
+		
+		if (mob->mob_error)
+			break;
+		
+		if (op.mt_op == MTSETBSIZ)
+			blockSize = op.mt_count;
+		else if (op.mt_op == MTOFFL)
+			blockSize = -1;
+		
+		mob->mob_done = next;
+	}
+	
+	return KERN_SUCCESS;
+}
+
+/* ioctls permitted on the control node; none of them move the tape */
+static bool st_ctl_ioctl(u_long cmd)
+{
+	switch (cmd)
+	{
+		case MTIOCGET:
+		case MTIOCGLOG:
+		case MTIOCGLOGCTL:
+		case MTIOCSLOGCTL:
+		case MTIOCTRACE:
+		case MTIOCTRDRAIN:
+		case MTIOCCAPTURE:
+		case MTIOCCAPDRAIN:
+		case MTIOCGETPROGRESS:
+		case MTIOCGTIMEOUT:
+		case MTIOCGREADYWAIT:
+		case MTIOCSREADYWAIT:
+		case MTIOCGPOS:
+		case MTIOCSPANWAIT:
+		case MTIOCSPANDONE:
+		case MTIOCGHEALTH:
+		case MTIOCGCRYPT:
+		case MTIOCGLBP:
+		case MTIOCGDIGEST:
+			return true;
+	}
+	
+	return false;
+}
+
+int st_ioctl(dev_t dev, u_long cmd, caddr_t data, int fflag, struct proc *p)
+{
+	IOSCSITape *st = IOSCSITape::devices[ST_UNIT(dev)];
+	struct mtop *mt = (struct mtop *) data;
+	struct mtget *g = (struct mtget *) data;
+	int error = 0;
+	UInt64 captureStart = 0;
+	
+	if (ST_IS_CTL(dev) && !st_ctl_ioctl(cmd))
+		return EBUSY;
+	
+	/* the workload is what arrives on the tape device itself */
+	if (st->captureEnabled && !ST_IS_CTL(dev))
+		captureStart = st_uptime_us();
+	
+	if (!ST_IS_CTL(dev))
+		IOLockLock(st->cmdLock);
+	
+	switch (cmd)
+	{
+		case MTIOCGET:
+			/* never send commands for the control device, the tape
+			 * device may be busy */
+			if (!ST_IS_CTL(dev))
+				st_resync(st);
+			
+			memset(g, 0, sizeof(struct mtget));
+			g->mt_type = 0x7;	/* Ultrix compat *//*? */
+			g->mt_blksiz = st->blksize;
+			g->mt_density = st->density;
+			g->mt_fileno = st->fileno;
+			g->mt_blkno = st->blkno;
+			g->mt_dsreg = st->flags;	/* report raw driver flags */
+			g->mt_erreg = st->sense_flags;
+			g->mt_resid = st->resid;
+			/* TODO: Implement the full mtget struct */
+			
+			break;
+		case MTIOCTOP:
+			error = st_mtop(st, mt);
+			break;
+		case MTIOCBATCH:
+			error = st_batch(st, (struct mtopbatch *)data);
+			break;
+		case MTIOCRDSPOS:
+			error = st_rdpos(st, false, (unsigned int *)data);
+			break;
+		case MTIOCRDHPOS:
+			error = st_rdpos(st, true, (unsigned int *)data);
+			break;
+		case MTIOCGPOS:
+			if (!ST_IS_CTL(dev))
+				st_resync(st);
+			
+			{
+				struct mtpos *mp = (struct mtpos *)data;
+				
+				mp->mp_fileno = st->fileno;
+				mp->mp_blkno = st->blkno;
+				mp->mp_lba = st->lba;
+				mp->mp_partition = st->partition;
+				mp->mp_flags = (st->lba == 0) ? MTPOS_BOP : 0;
+			}
+			break;
+		case MTIOCSLOCATE:
+			error = st_locate(st, *(uint32_t *)data, false);
+			break;
+		case MTIOCHLOCATE:
+			error = st_locate(st, *(uint32_t *)data, true);
+			break;
+		case MTIOCVERIFY:
+			error = st_verify(st, (struct mtverify *)data);
+			break;
+		case MTIOCEEOT:
+			error = st_set_early_warning(st, 1);
+			break;
+		case MTIOCIEOT:
+			error = st_set_early_warning(st, 0);
+			break;
+		case MTIOCSCRYPT:
+			error = st_set_crypt(st, (struct mtcrypt *)data);
+			break;
+		case MTIOCGCRYPT:
+			error = st_get_crypt(st, (struct mtcrypt *)data, !ST_IS_CTL(dev));
+			break;
+		case MTIOCGHEALTH:
+			error = st_health(st, (struct mthealth *)data, !ST_IS_CTL(dev));
+			break;
+		case MTIOCSLBP:
+			error = st_set_protection(st, *(int *)data);
+			break;
+		case MTIOCGLBP:
+			*(int *)data = st->lbpEnabled ? MTLBP_CRC32C : MTLBP_OFF;
+			break;
+		case MTIOCSBUFFER:
+			error = st_set_buffered(st, *(int *)data);
+			break;
+		case MTIOCGBUFFER:
+			*(int *)data = st->bufferMode;
+			break;
+		case MTIOCFLUSH:
+			error = st_write_filemarks(st, 0);
+			break;
+		case MTIOCRINGMAP:
+			switch (st->MapSharedRing((struct mtringmap *)data))
+			{
+				case kIOReturnSuccess:
+					break;
+				case kIOReturnBadArgument:
+					error = EINVAL;
+					break;
+				default:
+					error = ENOMEM;
+			}
+			break;
+		case MTIOCRINGKICK:
+			error = st_kick_ring(st, (struct mtringkick *)data);
+			break;
+		case MTIOCWRITEV:
+			error = st_records(st, (struct mtrecv *)data, false);
+			break;
+		case MTIOCREADV:
+			error = st_records(st, (struct mtrecv *)data, true);
+			break;
+		case MTIOCSDIGEST:
+			if (*(int *)data != MTDIGEST_OFF && *(int *)data != MTDIGEST_CRC64)
+				error = EINVAL;
+			else
+				st->SetDigest(*(int *)data != MTDIGEST_OFF);
+			break;
+		case MTIOCGDIGEST:
+			if (st->GetDigest((struct mtdigest *)data) != kIOReturnSuccess)
+				error = ENOENT;
+			break;
+		case MTIOCSSPAN:
+			st->SetSpanning(*(int *)data != 0);
+			break;
+		case MTIOCSPANWAIT:
+			error = st->WaitVolumeRequest((struct mtspan *)data);
+			break;
+		case MTIOCSPANDONE:
+			error = st->VolumeRequestDone(*(int *)data);
+			break;
+		case MTIOCGCAPACITY:
+			error = st_capacity(st, (struct mtcapacity *)data);
+			break;
+		case MTIOCGMAM:
+			error = st_read_attribute(st, (struct mtmam *)data);
+			break;
+		case MTIOCSMAM:
+			if (!(fflag & FWRITE))
+				error = EBADF;
+			else
+				error = st_write_attribute(st, (struct mtmam *)data);
+			break;
+		case MTIOCGETPROGRESS:
+			st->GetProgress((struct mtprogress *)data, !ST_IS_CTL(dev));
+			break;
+		case MTIOCGTIMEOUT:
+			st->GetCommandTimeout((struct mttimeout *)data);
+			break;
+		case MTIOCGREADYWAIT:
+			*(int *)data = st->readyWait;
+			break;
+		case MTIOCSREADYWAIT:
+			if (*(int *)data < 0)
+				error = EINVAL;
+			else
+				st->readyWait = *(int *)data;
+			break;
+		case MTIOCSTIMEOUT:
+			error = st->SetCommandTimeout((struct mttimeout *)data);
+			break;
+		case MTIOCSREVERSE:
+			if (*(int *)data)
+				st->flags |= ST_READ_REVERSE;
+			else
+				st->flags &= ~ST_READ_REVERSE;
+			break;
+		case MTIOCGLOG:
+			st->ReadLog((struct mtlog *)data);
+			break;
+		case MTIOCGLOGCTL:
+			st->GetLogControl((struct mtlogctl *)data);
+			break;
+		case MTIOCSLOGCTL:
+			error = st->SetLogControl((struct mtlogctl *)data);
+			break;
+		case MTIOCTRACE:
+			error = st->SetTrace(*(int *)data);
+			break;
+		case MTIOCTRDRAIN:
+			/* the trace is read from the control device only */
+			if (!ST_IS_CTL(dev))
+				error = ENXIO;
+			else
+				error = st->DrainTrace((struct mttracebuf *)data);
+			break;
+		case MTIOCCAPTURE:
+			error = st->SetCapture(*(int *)data);
+			captureStart = 0;
+			break;
+		case MTIOCCAPDRAIN:
+			/* the capture is read from the control device only */
+			if (!ST_IS_CTL(dev))
+				error = ENXIO;
+			else
+				error = st->DrainCapture((struct mtwlbuf *)data);
+			captureStart = 0;
+			break;
+		default:
+			error = ENOTTY;
+	}
+	
+	if (!ST_IS_CTL(dev))
+		IOLockUnlock(st->cmdLock);
+	
+	if (captureStart)
+		st->CaptureCall(MTWL_IOCTL, cmd,
+						cmd == MTIOCTOP ? mt->mt_op : 0,
+						cmd == MTIOCTOP ? mt->mt_count : 0,
+						0, error, captureStart);
+	
+	return error;
+}
+
+int st_select(dev_t dev, int which, void *wql, struct proc *p)
+{
+	IOSCSITape *st = IOSCSITape::devices[ST_UNIT(dev)];
+	
+	return st->Select(ST_IS_CTL(dev), which, wql, p);
+}
+
+#if 0
+#pragma mark -
+#pragma mark SCSI Operations
+#pragma mark -
+#endif /* 0 */
+
+/* Commands are retried according to how far the drive may have got
+ * with them: one that moves the tape relative to where it is must not
+ * be sent again once the drive might have started it, while one that
+ * only moves it to an absolute position can be. */
+enum
+{
+	ST_CMD_NOMOTION		= 0,
+	ST_CMD_ABSOLUTE		= 1,
+	ST_CMD_RELATIVE		= 2
+};
+
+static int
+st_cmd_class(UInt8 opcode)
+{
+	switch (opcode)
+	{
+		case kSCSICmd_READ_6:
+		case kSCSICmd_READ_REVERSE:
+		case kSCSICmd_WRITE_6:
+		case kSCSICmd_WRITE_FILEMARKS:
+		case kSCSICmd_SPACE:
+		case kSCSICmd_VERIFY_6:
+		case kSCSICmd_ERASE:
+			return ST_CMD_RELATIVE;
+		case kSCSICmd_REWIND:
+		case kSCSICmd_LOAD_UNLOAD:
+		case kSCSICmd_LOCATE:
+		case kSCSICmd_VERIFY_16:
+			return ST_CMD_ABSOLUTE;
+	}
+	
+	return ST_CMD_NOMOTION;
+}
+
+/* Retry policy for transient conditions, first match wins. A zero
+ * sense key matches on task status alone. */
+static const struct st_retry_policy
+{
+	SCSITaskStatus	status;
+	UInt8			key;
+	UInt8			asc;		/* 0xFF matches any */
+	UInt8			ascq;		/* 0xFF matches any */
+	int				retries;
+	UInt32			delay;		/* ms before the first retry */
+	int				maxClass;	/* highest ST_CMD_* retried */
+	const char *	name;
+} st_retry_policies[] =
+{
+	{ kSCSITaskStatus_BUSY,				0, 0xFF, 0xFF, 6, 100, ST_CMD_RELATIVE, "busy" },
+	{ kSCSITaskStatus_TASK_SET_FULL,	0, 0xFF, 0xFF, 6, 100, ST_CMD_RELATIVE, "task set full" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_UNIT_ATTENTION, 0x28, 0xFF, 3, 0, ST_CMD_ABSOLUTE, "medium changed" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_UNIT_ATTENTION, 0x29, 0xFF, 3, 0, ST_CMD_ABSOLUTE, "reset" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_UNIT_ATTENTION, 0x2A, 0x11, 3, 0, ST_CMD_NOMOTION, "encryption changed" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_UNIT_ATTENTION, 0x2A, 0x12, 3, 0, ST_CMD_NOMOTION, "encryption changed" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_UNIT_ATTENTION, 0x2A, 0x13, 3, 0, ST_CMD_NOMOTION, "encryption changed" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_UNIT_ATTENTION, 0xFF, 0xFF, 3, 0, ST_CMD_RELATIVE, "unit attention" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_NOT_READY, 0x04, 0x01, 8, 250, ST_CMD_RELATIVE, "becoming ready" },
+	{ kSCSITaskStatus_CHECK_CONDITION,	kSENSE_KEY_ABORTED_COMMAND, 0xFF, 0xFF, 3, 100, ST_CMD_NOMOTION, "aborted command" },
+};
+
+static const struct st_retry_policy *
+st_retry_match(SCSITaskStatus status, UInt8 key, UInt8 asc, UInt8 ascq)
+{
+	unsigned int i;
+	
+	for (i = 0; i < sizeof(st_retry_policies) / sizeof(st_retry_policies[0]); i++)
+	{
+		const struct st_retry_policy *rp = &st_retry_policies[i];
+		
+		if (rp->status == status &&
+			(rp->key == 0 || rp->key == key) &&
+			(rp->asc == 0xFF || rp->asc == asc) &&
+			(rp->ascq == 0xFF || rp->ascq == ascq))
+		{
+			return rp;
+		}
+	}
+	
+	return NULL;
+}
+
+/*
+ *  DoSCSICommand()
+ *  Encapsulate super::SendCommand() to handle unexpected service and
+ *  task errors as well as hand off to SCSI SENSE interpreter. Transient
+ *  conditions are retried with exponential backoff as st_retry_policies
+ *  allows.
+ */
+SCSITaskStatus
+IOSCSITape::DoSCSICommand(
+	SCSITaskIdentifier	request,
+	UInt32				timeoutDuration)
+{
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeliveryFailure;
+	SCSIServiceResponse	serviceResponse	= kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	UInt64				traceStart		= 0;
+	SCSICommandDescriptorBlock	cdb;
+	UInt8				opcode			= 0;
+	int					cmdClass		= ST_CMD_RELATIVE;
+	int					attempt			= 0;
+	UInt32				delay			= 0;
+	const struct st_retry_policy *policy = NULL;
+	
+	require((request != 0), ErrorExit);
+	
+	/* the caller's timeout is the fallback for the drive's own */
+	if (GetCommandDescriptorBlock(request, &cdb))
+	{
+		opcode = cdb[0];
+		cmdClass = st_cmd_class(opcode);
+		timeoutDuration = CommandTimeout(opcode, timeoutDuration);
+	}
+	
+	for (attempt = 0; ; attempt++)
+	{
+		if (traceEnabled)
+			traceStart = st_uptime_us();
+		
+		OSIncrementAtomic(&cmdInFlight);
+		serviceResponse = SendCommand(request, timeoutDuration);
+		OSDecrementAtomic(&cmdInFlight);
+		ProgressWakeup();
+		sense_flags = 0;
+		lastSenseKey = 0;
+		lastASC = 0;
+		lastASCQ = 0;
+		lastSenseInfo = 0;
+		lastProgress = -1;
+		taskStatus = kSCSITaskStatus_DeliveryFailure;
+		
+		if (serviceResponse != kSCSIServiceResponse_TASK_COMPLETE)
+		{
+			ERROR_LOG("unknown service response: 0x%x", serviceResponse);
+			lastTaskStatus = taskStatus;
+			goto ErrorExit;
+		}
+		
+		taskStatus = GetTaskStatus(request);
+		
+		if (taskStatus == kSCSITaskStatus_CHECK_CONDITION)
+		{
+			/* Get and interpret SCSI SENSE information */
+			GetSense(request);
+			
+			/* the command completed after the drive recovered */
+			if (lastSenseKey == kSENSE_KEY_RECOVERED_ERROR)
+				taskStatus = kSCSITaskStatus_GOOD;
+			
+			if (lastSenseKey == kSENSE_KEY_UNIT_ATTENTION)
+				UnitAttention(lastASC, lastASCQ);
+		}
+		
+		if (traceStart)
+			TraceCommand(request, traceStart, taskStatus);
+		
+		traceStart = 0;
+		
+		policy = st_retry_match(taskStatus, lastSenseKey, lastASC, lastASCQ);
+		
+		/* TEST UNIT READY is how callers watch the drive get ready; a
+		 * protected read or write has to be protected again first */
+		if (policy == NULL ||
+			attempt >= policy->retries ||
+			cmdClass > policy->maxClass ||
+			(opcode == kSCSICmd_TEST_UNIT_READY && lastSenseKey == kSENSE_KEY_NOT_READY) ||
+			(lbpEnabled && !lbpActive &&
+			 (opcode == kSCSICmd_READ_6 || opcode == kSCSICmd_WRITE_6)))
+		{
+			break;
+		}
+		
+		delay = policy->delay << attempt;
+		
+		if (delay > ST_RETRY_MAX_DELAY)
+			delay = ST_RETRY_MAX_DELAY;
+		
+		WARN_LOG("%s, retrying command 0x%02x (%d of %d)",
+				 policy->name, opcode, attempt + 1, policy->retries);
+		
+		if (delay)
+			IOSleep(delay);
+	}
+	
+	lastTaskStatus = taskStatus;
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		/* setup flags for device file closing */
+		if (flags & ST_WRITTEN_TOGGLE)
+			flags |= ST_WRITTEN;
+		else
+			flags &= ~ST_WRITTEN;
+	}
+	else if (taskStatus != kSCSITaskStatus_CHECK_CONDITION)
+	{
+		ERROR_LOG("unknown task status: 0x%x", taskStatus);
+	}
+	else if (lastSenseKey == kSENSE_KEY_UNIT_ATTENTION &&
+			 lastASC == 0x2A && lastASCQ >= 0x11 && lastASCQ <= 0x13)
+	{
+		/* the caller hears of the encryption change from this one */
+		flags &= ~ST_CRYPT_CHANGED;
+	}
+	
+	/* clear the write toggle bit in case the next command is not a
+	 * write */
+	flags &= ~ST_WRITTEN_TOGGLE;
+	
+ErrorExit:
+	
+	if (traceStart)
+		TraceCommand(request, traceStart, taskStatus);
+	
+	return taskStatus;
+}
+
+/*
+ *  GetSenseInformation
+ *
+ *  Attempt to get SCSI sense information either from the Auto sense
+ *  mechanism or by querying manually.
+ */
+void
+IOSCSITape::GetSense(SCSITaskIdentifier request)
+{
+	SCSI_Sense_Data		senseBuffer = { 0 };
+	bool				validSense = false;
+	SCSIServiceResponse	serviceResponse = kSCSIServiceResponse_SERVICE_DELIVERY_OR_TARGET_FAILURE;
+	SCSITaskIdentifier	senseTask = NULL;
+	
+	IOMemoryDescriptor *bufferDesc = IOMemoryDescriptor::withAddress((void *)&senseBuffer, 
+																	 sizeof(senseBuffer), 
+																	 kIODirectionIn);
+	
+	if (GetTaskStatus(request) == kSCSITaskStatus_CHECK_CONDITION)
+	{
+		validSense = GetAutoSenseData(request, &senseBuffer);
+		
+		/* REQUEST SENSE goes on its own task so the original
+		 * command is left intact to be retried */
+		if (validSense == false && (senseTask = GetSCSITask()) != NULL)
+		{
+			if (REQUEST_SENSE(senseTask, bufferDesc, kSenseDefaultSize, 0) == true)
+				serviceResponse = SendCommand(senseTask, kTenSecondTimeoutInMS);
+			
+			if (serviceResponse == kSCSIServiceResponse_TASK_COMPLETE &&
+				GetTaskStatus(senseTask) == kSCSITaskStatus_GOOD)
+				validSense = true;
+			
+			ReleaseSCSITask(senseTask);
+		}
+		
+		if (validSense == true)
+			InterpretSense(&senseBuffer);
+		else
+			ERROR_LOG("invalid or unretrievable SCSI SENSE");
+	}
+	
+	bufferDesc->release();
+}
+
+void
+IOSCSITape::InterpretSense(SCSI_Sense_Data *sense)
+{
+	uint8_t key = sense->SENSE_KEY & kSENSE_KEY_Mask;
+	uint8_t asc = sense->ADDITIONAL_SENSE_CODE;
+	uint8_t ascq = sense->ADDITIONAL_SENSE_CODE_QUALIFIER;
+
+	lastSenseKey = key;
+	lastASC = asc;
+	lastASCQ = ascq;
+	
+	if ((sense->VALID_RESPONSE_CODE & kSENSE_RESPONSE_CODE_Mask) == kSENSE_RESPONSE_CODE_Current_Errors)
+	{
+		/* current errors, fixed format - 0x70 */
+		
+		/* the INFORMATION field holds the residue of the command
+		 * (blocks, or bytes in variable block mode) */
+		if (sense->VALID_RESPONSE_CODE & kSENSE_DATA_VALID)
+			lastSenseInfo = (SInt32)((sense->INFORMATION_1 << 24) |
+									 (sense->INFORMATION_2 << 16) |
+									 (sense->INFORMATION_3 <<  8) |
+									  sense->INFORMATION_4);
+		
+		if (sense->SENSE_KEY & kSENSE_ILI_Mask)
+			sense_flags |= SENSE_ILI;
+		
+		/* sense key specific progress indication */
+		if ((key == kSENSE_KEY_NO_SENSE || key == kSENSE_KEY_NOT_READY) &&
+			(sense->SKSV_SENSE_KEY_SPECIFIC_MSB & kSENSE_SKSV_Mask))
+			lastProgress = (sense->SENSE_KEY_SPECIFIC_MID << 8) |
+							sense->SENSE_KEY_SPECIFIC_LSB;
+
+		if (key  == kSENSE_KEY_NOT_READY &&
+			asc  == 0x04 &&
+			ascq == 0x01)
+		{
+			DEBUG_LOG("LOGICAL UNIT IS IN PROCESS OF BECOMING READY");
+			sense_flags |= SENSE_NOTREADY;
+		}
+		else if ((key  == kSENSE_KEY_NOT_READY &&
+				  asc  == 0x04 &&
+				  (ascq == 0x04 || ascq == 0x07)) ||
+				 ((key == kSENSE_KEY_NO_SENSE || key == kSENSE_KEY_NOT_READY) &&
+				  asc  == 0x00 &&
+				  ascq >= 0x16 && ascq <= 0x1A))
+		{
+			DEBUG_LOG("LOGICAL UNIT NOT READY, OPERATION IN PROGRESS");
+			sense_flags |= SENSE_INPROGRESS;
+		}
+		else if (key  == kSENSE_KEY_NO_SENSE &&
+				 asc  == 0x00 &&
+				 ascq == 0x04)
+		{
+			DEBUG_LOG("BEGINNING-OF-PARTITION/MEDIUM DETECTED");
+			
+			sense_flags |= SENSE_BOM;
+		}
+		else if (key  == kSENSE_KEY_BLANK_CHECK &&
+				 asc  == 0x00 &&
+				 ascq == 0x05)
+				/* sense->SENSE_KEY & kSENSE_EOM_Mask */
+		{
+			DEBUG_LOG("END-OF-DATA DETECTED");
+			
+			sense_flags |= SENSE_EOD;
+		}
+		else if ((sense->SENSE_KEY & kSENSE_FILEMARK_Mask) ||
+				 (key  == kSENSE_KEY_NO_SENSE &&
+				  asc  == 0x00 &&
+				  ascq == 0x01))
+		{
+			DEBUG_LOG("FILEMARK DETECTED");
+			
+			sense_flags |= SENSE_FILEMARK;
+		}
+		else if ((sense->SENSE_KEY & kSENSE_EOM_Mask) &&
+				 (key == kSENSE_KEY_NO_SENSE ||
+				  key == kSENSE_KEY_VOLUME_OVERFLOW))
+		{
+			if (key == kSENSE_KEY_VOLUME_OVERFLOW)
+				WARN_LOG("END-OF-PARTITION/MEDIUM REACHED");
+			else if (asc == 0x00 && ascq == 0x07)
+				DEBUG_LOG("PROGRAMMABLE EARLY WARNING DETECTED");
+			else
+				DEBUG_LOG("EARLY WARNING DETECTED");
+			
+			sense_flags |= SENSE_EOM;
+		}
+		else if (asc == 0x74)
+		{
+			switch (ascq)
+			{
+				case 0x01:
+					ERROR_LOG("UNABLE TO DECRYPT DATA");
+					break;
+				case 0x02:
+					ERROR_LOG("UNENCRYPTED DATA ENCOUNTERED WHILE DECRYPTING");
+					break;
+				case 0x03:
+					ERROR_LOG("INCORRECT DATA ENCRYPTION KEY");
+					break;
+				case 0x04:
+					ERROR_LOG("CRYPTOGRAPHIC INTEGRITY VALIDATION FAILED");
+					break;
+				case 0x05:
+					ERROR_LOG("ERROR DECRYPTING DATA");
+					break;
+				default:
+					ERROR_LOG("SECURITY ERROR (ASCQ: 0x%02X)", ascq);
+			}
+		}
+		else if (key  == kSENSE_KEY_UNIT_ATTENTION &&
+				 asc  == 0x2A &&
+				 ascq >= 0x11 && ascq <= 0x13)
+		{
+			DEBUG_LOG("DATA ENCRYPTION PARAMETERS CHANGED");
+		}
+		else if (key  == kSENSE_KEY_NO_SENSE &&
+				 asc  == 0x00 &&
+				 ascq == 0x00 &&
+				 (sense->SENSE_KEY & kSENSE_ILI_Mask))
+		{
+			/* routine in variable block mode */
+			DEBUG_LOG("INCORRECT LENGTH, residue %d", (int)lastSenseInfo);
+		}
+		else
+		{
+			WARN_LOG("SENSE: %s (Key: 0x%X, ASC: 0x%02X, ASCQ: 0x%02X)",
+					 kSCSISenseKeyDescriptions[key], key, asc, ascq);
+
+			if (sense->SENSE_KEY & kSENSE_ILI_Mask)
+				DEBUG_LOG("SENSE: Incorrect Length Indicator (ILI)");
+
+			/* format the raw sense as one event rather than an
+			 * IOLog() call per byte */
+			int i;
+			char hex[sizeof(SCSI_Sense_Data) * 3 + 1];
+			unsigned char *bytes = (unsigned char *)sense;
+			
+			for (i = 0; i < sizeof(SCSI_Sense_Data); i++)
+				snprintf(&hex[i * 3], 4, "%02x ", (int)bytes[i]);
+			
+			DEBUG_LOG("SCSI SENSE DATA: %s", hex);
+		}
+	}
+}
+
+/*
+ *  UnitAttention()
+ *  Act on a unit attention, whichever command it came back on.
+ */
+void
+IOSCSITape::UnitAttention(UInt8 asc, UInt8 ascq)
+{
+	/* after a reset or medium change the drive may no longer be where
+	 * we think it is */
+	if (asc == 0x28 || asc == 0x29)
+	{
+		fileno = -1;
+		blkno = -1;
+		lba = -1;
+	}
+	
+	/* NOT READY TO READY CHANGE, MEDIUM MAY HAVE CHANGED */
+	if (asc == 0x28)
+	{
+		flags |= ST_MEDIA_CHANGED;
+		ForgetMedia();
+	}
+	
+	/* a reset, or another initiator's MODE SELECT, may have turned
+	 * logical block protection off */
+	if (asc == 0x29 || (asc == 0x2A && ascq == 0x01))
+		lbpActive = false;
+	
+	/* DATA ENCRYPTION PARAMETERS CHANGED, or the key was replaced */
+	if (asc == 0x2A && ascq >= 0x11 && ascq <= 0x13)
+	{
+		WARN_LOG("data encryption changed by another initiator or the drive");
+		cryptKnown = false;
+		
+		/* the next read or write fails if this command does not */
+		flags |= ST_CRYPT_CHANGED;
+	}
+}
+
+IOReturn
+IOSCSITape::TestUnitReady(void)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			result			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (TEST_UNIT_READY(task, 0x00) == true)
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		result = kIOReturnSuccess;
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return result;
+}
+
+IOReturn
+IOSCSITape::Rewind(void)
+{
+	IOReturn			status		= kIOReturnError;
+	SCSITaskIdentifier	task		= NULL;
+	SCSITaskStatus		taskStatus	= kSCSITaskStatus_DeliveryFailure;
+	
+	task = GetSCSITask();
+	
+	require ((task != 0), ErrorExit);
+	
+	BeginProgress(MTPROG_REWIND);
+	
+	/* issued with IMMED and polled so progress can be reported */
+	if (REWIND(task, 1, 0) == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = WaitForImmediate(CommandTimeout(kSCSICmd_REWIND, SCSI_MOTION_TIMEOUT));
+	
+	EndProgress();
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+/*
+ *  GetDeviceDetails()
+ *  Get mode sense details and set device parameters.
+ *
+ *  Would have ideally liked to use super::GetModeSense() but it appears
+ *  to set the DBD bit and we need the descriptor values for density,
+ *  etc.
+ */
+IOReturn
+IOSCSITape::GetDeviceDetails(void)
+{
+	IOReturn				status		= kIOReturnError;
+	SCSITaskIdentifier		task		= NULL;
+	SCSITaskStatus			taskStatus	= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer	= NULL;
+	SCSI_ModeSense_Default	modeData	= { 0 };
+
+	dataBuffer = IOMemoryDescriptor::withAddress(&modeData,
+												 sizeof(modeData),
+												 kIODirectionIn);
+	
+	require((dataBuffer != 0), ErrorExit);
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+
+	if (MODE_SENSE_6(task, 
+					 dataBuffer, 
+					 0x0,
+					 0x0,
+					 0x00,
+					 sizeof(SCSI_ModeSense_Default), 
+					 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		/* copy mode data for next MODE SELECT */
+		bcopy(&modeData, &lastModeData, sizeof(SCSI_ModeSense_Default));
+		
+		blksize = 
+			(modeData.descriptor.BLOCK_LENGTH[0] << 16) |
+			(modeData.descriptor.BLOCK_LENGTH[1] <<  8) |
+			 modeData.descriptor.BLOCK_LENGTH[2];
+		
+		density = modeData.descriptor.DENSITY_CODE;
+		flags &= ~(ST_READONLY | ST_BUFF_MODE);
+		
+		if (modeData.header.DEVICE_SPECIFIC_PARAMETER & SMH_DSP_WRITE_PROT)
+			flags |= ST_READONLY;
+		
+		if (modeData.header.DEVICE_SPECIFIC_PARAMETER & SMH_DSP_BUFF_MODE)
+			flags |= ST_BUFF_MODE;
+		
+		bufferMode = (modeData.header.DEVICE_SPECIFIC_PARAMETER & SMH_DSP_BUFF_MODE) >> 4;
+
+		STATUS_LOG("density code: %d, %d-byte blocks, write-%s, %sbuffered",
+				   density, blksize,
+				   flags & ST_READONLY ? "protected" : "enabled",
+				   flags & ST_BUFF_MODE ? "" : "un");
+		
+		status = kIOReturnSuccess;
+	}
+	
+	ReleaseSCSITask(task);
+	dataBuffer->release();
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::SetDeviceDetails(SCSI_ModeSense_Default *modeData)
+{
+	IOReturn				status		= kIOReturnError;
+	IOMemoryDescriptor *	dataBuffer	= NULL;
+	SCSITaskIdentifier		task		= NULL;
+	SCSITaskStatus			taskStatus	= kSCSITaskStatus_DeviceNotResponding;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(modeData,
+												 sizeof(SCSI_ModeSense_Default),
+												 kIODirectionOut);
+	
+	require((dataBuffer != 0), ErrorExit);
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (MODE_SELECT_6(task, 
+					  dataBuffer, 
+					  0x0, // PF
+					  0x0, // SP
+					  sizeof(SCSI_ModeSense_Default), 
+					  0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		status = kIOReturnSuccess;
+	}
+	
+	ReleaseSCSITask(task);
+	dataBuffer->release();
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::SetBlockSize(int size)
+{
+	IOReturn				status	= kIOReturnError;
+	SCSI_ModeSense_Default	newMode;
+	
+	bcopy(&lastModeData, &newMode, sizeof(SCSI_ModeSense_Default));
+	
+	newMode.header.MODE_DATA_LENGTH = 0;
+	newMode.descriptor.BLOCK_LENGTH[0] = (size >> 16) & 0xFF;
+	newMode.descriptor.BLOCK_LENGTH[1] = (size >>  8) & 0xFF;
+	newMode.descriptor.BLOCK_LENGTH[2] =  size        & 0xFF;
+	
+	if ((status = SetDeviceDetails(&newMode)) == kIOReturnSuccess)
+		GetDeviceDetails();
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::SetBufferedMode(int mode)
+{
+	IOReturn				status	= kIOReturnError;
+	SCSI_ModeSense_Default	newMode;
+	
+	bcopy(&lastModeData, &newMode, sizeof(SCSI_ModeSense_Default));
+	
+	newMode.header.MODE_DATA_LENGTH = 0;
+	newMode.header.DEVICE_SPECIFIC_PARAMETER &= ~(SMH_DSP_BUFF_MODE | SMH_DSP_WRITE_PROT);
+	newMode.header.DEVICE_SPECIFIC_PARAMETER |= (mode << 4) & SMH_DSP_BUFF_MODE;
+	
+	if ((status = SetDeviceDetails(&newMode)) == kIOReturnSuccess)
+		GetDeviceDetails();
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::GetDeviceBlockLimits(void)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	UInt8					blockLimitsData[6]	= { 0 };
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeliveryFailure;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(&blockLimitsData, 
+												 sizeof(blockLimitsData), 
+												 kIODirectionIn);
+
+	require ((dataBuffer != 0), ErrorExit);
+	
+	task = GetSCSITask();
+	
+	require ((task != 0), ErrorExit);
+	
+	if (READ_BLOCK_LIMITS(task, dataBuffer, 0x00) == true)
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		// blkgran = blockLimitsData[0] & 0x1F;
+		
+		blkmin =
+			(blockLimitsData[4] <<  8) |
+			 blockLimitsData[5];
+		
+		blkmax =
+			(blockLimitsData[1] << 16) |
+			(blockLimitsData[2] <<  8) |
+			 blockLimitsData[3];
+		
+		STATUS_LOG("min/max block size: %d/%d", blkmin, blkmax);
+		
+		status = kIOReturnSuccess;
+	}
+
+	ReleaseSCSITask(task);
+	dataBuffer->release();
+	
+ErrorExit:
+	
+	return status;
+}
+
+/*
+ *  GetCommandTimeouts()
+ *  Learn which commands the drive supports, and its recommended
+ *  timeout for each, from REPORT SUPPORTED OPERATION CODES. Drives
+ *  without the command keep the driver's static timeouts.
+ */
+IOReturn
+IOSCSITape::GetCommandTimeouts(void)
+{
+	IOReturn				status			= kIOReturnError;
+	UInt8 *					data			= NULL;
+	UInt32					size			= RSOC_BUFFER_SIZE;
+	UInt32					reported		= 0;
+	UInt32					length			= 0;
+	UInt32					offset			= 0;
+	int						count			= 0;
+	
+	data = (UInt8 *)IOMalloc(size);
+	
+	require ((data != 0), ErrorExit);
+	
+	status = ReportOperationCodes(data, size, &reported, &length);
+	
+	/* a drive with more commands than fit says how many bytes it has,
+	 * so ask again for all of them */
+	if (status == kIOReturnSuccess && reported > size && reported <= RSOC_BUFFER_MAX)
+	{
+		IOFree(data, size);
+		size = reported;
+		data = (UInt8 *)IOMalloc(size);
+		
+		require ((data != 0), ErrorExit);
+		
+		status = ReportOperationCodes(data, size, &reported, &length);
+	}
+	
+	if (status == kIOReturnSuccess)
+	{
+		if (length > reported)
+			length = reported;
+		
+		bzero(cmdSupported, sizeof(cmdSupported));
+		bzero(cmdTimeout, sizeof(cmdTimeout));
+		
+		/* 8 byte command descriptors, each followed by a 12 byte
+		 * timeouts descriptor when CTDP is set */
+		for (offset = 4; offset + 8 <= length; count++)
+		{
+			UInt8 *	desc	= &data[offset];
+			UInt8	opcode	= desc[0];
+			bool	ctdp	= (desc[5] & 0x02) != 0;
+			
+			cmdSupported[opcode >> 3] |= (1 << (opcode & 7));
+			
+			if (ctdp && offset + 20 <= length)
+			{
+				UInt32 recommended =
+					(desc[16] << 24) |
+					(desc[17] << 16) |
+					(desc[18] <<  8) |
+					 desc[19];
+				
+				if (recommended > 0xFFFFFFFF / 1000)
+					recommended = 0xFFFFFFFF / 1000;
+				
+				/* service actions of one opcode share an entry */
+				if (recommended * 1000 > cmdTimeout[opcode])
+					cmdTimeout[opcode] = recommended * 1000;
+			}
+			
+			offset += ctdp ? 20 : 8;
+		}
+		
+		/* commands missing from a truncated list are not unsupported,
+		 * so they are left for the drive to reject as before */
+		cmdTableValid = (length == reported);
+		
+		if (cmdTableValid)
+			STATUS_LOG("%d supported commands reported", count);
+		else
+			WARN_LOG("%d supported commands reported, list truncated", count);
+	}
+	
+	IOFree(data, size);
+	
+ErrorExit:
+	
+	return status;
+}
+
+/*
+ *  ReportOperationCodes()
+ *  REPORT SUPPORTED OPERATION CODES, all commands, into a buffer of
+ *  size bytes. *reported is the length of the whole list, which may be
+ *  more than was asked for, and *length how much of it arrived.
+ */
+IOReturn
+IOSCSITape::ReportOperationCodes(UInt8 *data, UInt32 size, UInt32 *reported, UInt32 *length)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeliveryFailure;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	
+	bzero(data, size);
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(data, 
+												 size, 
+												 kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		REPORT_SUPPORTED_OPERATION_CODES(task, dataBuffer, 1, 0, 0, 0, size, 0) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		*reported = 4 +
+			((data[0] << 24) |
+			 (data[1] << 16) |
+			 (data[2] <<  8) |
+			  data[3]);
+		
+		*length = (UInt32)GetRealizedDataTransferCount(task);
+		
+		status = kIOReturnSuccess;
+	}
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  ReadMediaSerialNumber()
+ *  The serial number of the loaded cartridge as a string, trailing
+ *  blanks removed. Fails if the drive or medium does not report one.
+ */
+IOReturn
+IOSCSITape::ReadMediaSerialNumber(char *serial, UInt32 size)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8					msnData[MSN_BUFFER_SIZE] = { 0 };
+	UInt32					length			= 0;
+	
+	if (!IsCommandSupported(kSCSICmd_READ_MEDIA_SERIAL_NUMBER))
+		return kIOReturnUnsupported;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(&msnData, 
+												 sizeof(msnData), 
+												 kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		READ_MEDIA_SERIAL_NUMBER(task, dataBuffer, sizeof(msnData), 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		length =
+			(msnData[0] << 24) |
+			(msnData[1] << 16) |
+			(msnData[2] <<  8) |
+			 msnData[3];
+		
+		if (length > sizeof(msnData) - 4)
+			length = sizeof(msnData) - 4;
+		
+		if (st_copy_ascii(serial, size, &msnData[4], length) > 0)
+			status = kIOReturnSuccess;
+	}
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  ReadAttribute()
+ *  Read one attribute from the cartridge memory. The drive returns the
+ *  attributes from the one asked for onwards, so when the first one is
+ *  another the cartridge does not have it.
+ */
+IOReturn
+IOSCSITape::ReadAttribute(struct mtmam *mm)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8					mamData[MAM_BUFFER_SIZE] = { 0 };
+	UInt32					available		= 0;
+	UInt32					length			= 0;
+	
+	if (!IsCommandSupported(kSCSICmd_READ_ATTRIBUTE))
+		return kIOReturnUnsupported;
+	
+	if (mm->mm_partition > kSCSICmdFieldMask1Byte)
+		return kIOReturnBadArgument;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(&mamData, 
+												 sizeof(mamData), 
+												 kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		READ_ATTRIBUTE(task, dataBuffer, 
+					   kSCSIReadAttributeServiceAction_AttributeValues, 
+					   0, mm->mm_partition, mm->mm_id, 
+					   sizeof(mamData), 0, 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		available =
+			(mamData[0] << 24) |
+			(mamData[1] << 16) |
+			(mamData[2] <<  8) |
+			 mamData[3];
+		
+		status = kIOReturnNotFound;
+		
+		if (available >= 5 && ((mamData[4] << 8) | mamData[5]) == mm->mm_id)
+		{
+			length = (mamData[7] << 8) | mamData[8];
+			
+			if (length > MTMAM_LEN)
+				length = MTMAM_LEN;
+			
+			mm->mm_format = mamData[6] & 0x03;
+			mm->mm_readonly = (mamData[6] & 0x80) != 0;
+			mm->mm_length = length;
+			bcopy(&mamData[9], mm->mm_value, length);
+			
+			status = kIOReturnSuccess;
+		}
+	}
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  WriteAttribute()
+ *  Write one attribute to the cartridge memory, through the drive's
+ *  attribute cache.
+ */
+IOReturn
+IOSCSITape::WriteAttribute(struct mtmam *mm)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8					mamData[MAM_BUFFER_SIZE] = { 0 };
+	UInt32					length			= 0;
+	
+	if (!IsCommandSupported(kSCSICmd_WRITE_ATTRIBUTE))
+		return kIOReturnUnsupported;
+	
+	if (mm->mm_partition > kSCSICmdFieldMask1Byte ||
+		mm->mm_length > MTMAM_LEN)
+		return kIOReturnBadArgument;
+	
+	/* parameter data length, then a single attribute */
+	length = 4 + 5 + mm->mm_length;
+	
+	mamData[0] = ((length - 4) >> 24) & 0xFF;
+	mamData[1] = ((length - 4) >> 16) & 0xFF;
+	mamData[2] = ((length - 4) >>  8) & 0xFF;
+	mamData[3] =  (length - 4)        & 0xFF;
+	mamData[4] = (mm->mm_id >> 8) & 0xFF;
+	mamData[5] =  mm->mm_id       & 0xFF;
+	mamData[6] =  mm->mm_format   & 0x03;
+	mamData[7] = (mm->mm_length >> 8) & 0xFF;
+	mamData[8] =  mm->mm_length       & 0xFF;
+	bcopy(mm->mm_value, &mamData[9], mm->mm_length);
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(&mamData, 
+												 length, 
+												 kIODirectionOut);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		WRITE_ATTRIBUTE(task, dataBuffer, 0, 0, mm->mm_partition, length, 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  ReadModePage()
+ *  Read one mode page into buffer, as the 4 byte mode parameter header
+ *  followed by the page; block descriptors are left out. Fails with
+ *  kIOReturnUnsupported if the drive does not have the page.
+ */
+IOReturn
+IOSCSITape::ReadModePage(UInt8 page, UInt8 subpage, UInt8 *buffer, UInt32 size)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8 *					pageData		= NULL;
+	
+	if (size > MODE_BUFFER_SIZE)
+		size = MODE_BUFFER_SIZE;
+	
+	bzero(buffer, size);
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(buffer, 
+												 size, 
+												 kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		MODE_SENSE_SUBPAGE_6(task, dataBuffer, 0x1, 0x0, page, subpage, size, 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		/* skip any block descriptors the drive sent anyway */
+		pageData = &buffer[4 + buffer[3]];
+		
+		if (4 + buffer[3] + 2 <= size &&
+			(pageData[0] & 0x3F) == page &&
+			(subpage == 0 || ((pageData[0] & 0x40) && pageData[1] == subpage)))
+		{
+			if (buffer[3])
+			{
+				memmove(&buffer[4], pageData, size - 4 - buffer[3]);
+				buffer[3] = 0;
+			}
+			
+			status = kIOReturnSuccess;
+		}
+		else
+			status = kIOReturnUnsupported;
+	}
+	else if (lastTaskStatus == kSCSITaskStatus_CHECK_CONDITION &&
+			 lastSenseKey == kSENSE_KEY_ILLEGAL_REQUEST)
+		status = kIOReturnUnsupported;
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  WriteModePage()
+ *  Write back a page read by ReadModePage(). The header's buffered mode
+ *  and speed are kept, as MODE SELECT applies them too.
+ */
+IOReturn
+IOSCSITape::WriteModePage(UInt8 *buffer, UInt32 length)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	
+	/* MODE DATA LENGTH is reserved and the PS bit must be zero */
+	buffer[0] = 0;
+	buffer[2] &= ~SMH_DSP_WRITE_PROT;
+	buffer[4] &= 0x7F;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(buffer, 
+												 length, 
+												 kIODirectionOut);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		MODE_SELECT_6(task, dataBuffer, 0x1, 0x0, length, 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  SetEarlyWarningSize()
+ *  Program the early warning this many megabytes before the drive's
+ *  own, through the PEWS field of the device configuration extension
+ *  page. Zero turns it off.
+ */
+IOReturn
+IOSCSITape::SetEarlyWarningSize(UInt16 size)
+{
+	IOReturn	status					= kIOReturnError;
+	UInt8		modeData[MODE_BUFFER_SIZE];
+	UInt32		length					= 0;
+	
+	status = ReadModePage(ST_PAGE_DEVICE_CONFIG, 0x01, modeData, sizeof(modeData));
+	
+	if (status != kIOReturnSuccess)
+		return status;
+	
+	length = 4 + 4 + ((modeData[6] << 8) | modeData[7]);
+	
+	if (length < 4 + 8 || length > sizeof(modeData))
+		return kIOReturnUnsupported;
+	
+	modeData[4 + 6] = (size >> 8) & 0xFF;
+	modeData[4 + 7] =  size       & 0xFF;
+	
+	if ((status = WriteModePage(modeData, length)) == kIOReturnSuccess)
+		pewSize = size;
+	
+	return status;
+}
+
+/*
+ *  SetProtection()
+ *  Turn logical block protection with CRC32C on or off, for both reads
+ *  and writes, through the control data protection page.
+ */
+IOReturn
+IOSCSITape::SetProtection(bool enable)
+{
+	IOReturn	status					= kIOReturnError;
+	UInt8		modeData[MODE_BUFFER_SIZE];
+	UInt32		length					= 0;
+	
+	status = ReadModePage(ST_PAGE_CONTROL, ST_SUBPAGE_PROTECTION, modeData, sizeof(modeData));
+	
+	if (status != kIOReturnSuccess)
+		return status;
+	
+	length = 4 + 4 + ((modeData[6] << 8) | modeData[7]);
+	
+	if (length < 4 + 8 || length > sizeof(modeData))
+		return kIOReturnUnsupported;
+	
+	modeData[4 + 4] = enable ? ST_LBP_CRC32C : 0;
+	modeData[4 + 5] = enable ? ST_LBP_LENGTH : 0;
+	modeData[4 + 6] &= ~(ST_LBP_W | ST_LBP_R);
+	
+	if (enable)
+		modeData[4 + 6] |= ST_LBP_W | ST_LBP_R;
+	
+	status = WriteModePage(modeData, length);
+	
+	/* a drive without CRC32C rejects the method */
+	if (status != kIOReturnSuccess &&
+		lastTaskStatus == kSCSITaskStatus_CHECK_CONDITION &&
+		lastSenseKey == kSENSE_KEY_ILLEGAL_REQUEST)
+		status = kIOReturnUnsupported;
+	
+	if (status == kIOReturnSuccess)
+		lbpActive = enable;
+	
+	return status;
+}
+
+/*
+ *  ReadLogPage()
+ *  Read the cumulative values of one log page into buffer. The page
+ *  length in the header is cut down to what fits. A background read
+ *  leaves the sense of the last command alone, so the caller's I/O
+ *  does not see it.
+ */
+IOReturn
+IOSCSITape::ReadLogPage(UInt8 page, UInt8 *buffer, UInt32 size, bool background)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt32					length			= 0;
+	SCSI_Sense_Data			senseData		= { 0 };
+	
+	bzero(buffer, size);
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(buffer, 
+												 size, 
+												 kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		LOG_SENSE(task, dataBuffer, 0, 0, 0x1, page, 0, size, 0x00) == true)
+	{
+		if (background)
+		{
+			OSIncrementAtomic(&cmdInFlight);
+			
+			if (SendCommand(task, SCSI_NOMOTION_TIMEOUT) == kSCSIServiceResponse_TASK_COMPLETE)
+				taskStatus = GetTaskStatus(task);
+			
+			OSDecrementAtomic(&cmdInFlight);
+			ProgressWakeup();
+			
+			/* no other command will see a unit attention or a
+			 * deferred error the poll took */
+			if (taskStatus == kSCSITaskStatus_CHECK_CONDITION &&
+				GetAutoSenseData(task, &senseData))
+			{
+				if ((senseData.VALID_RESPONSE_CODE & kSENSE_RESPONSE_CODE_Mask) ==
+					kSENSE_RESPONSE_CODE_Deferred_Errors)
+				{
+					ERROR_LOG("deferred error, key 0x%X, ASC 0x%02X, ASCQ 0x%02X",
+							  senseData.SENSE_KEY & kSENSE_KEY_Mask,
+							  senseData.ADDITIONAL_SENSE_CODE,
+							  senseData.ADDITIONAL_SENSE_CODE_QUALIFIER);
+					
+					/* the next read or write fails */
+					flags |= ST_DEFERRED_ERROR;
+				}
+				else if ((senseData.SENSE_KEY & kSENSE_KEY_Mask) == kSENSE_KEY_UNIT_ATTENTION)
+				{
+					UnitAttention(senseData.ADDITIONAL_SENSE_CODE,
+								  senseData.ADDITIONAL_SENSE_CODE_QUALIFIER);
+				}
+			}
+		}
+		else
+			taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		if ((buffer[0] & 0x3F) == page)
+		{
+			length = (buffer[2] << 8) | buffer[3];
+			
+			if (4 + length > size)
+			{
+				length = size - 4;
+				buffer[2] = (length >> 8) & 0xFF;
+				buffer[3] =  length       & 0xFF;
+			}
+			
+			status = kIOReturnSuccess;
+		}
+		else
+			status = kIOReturnUnsupported;
+	}
+	else if (!background &&
+			 lastTaskStatus == kSCSITaskStatus_CHECK_CONDITION &&
+			 lastSenseKey == kSENSE_KEY_ILLEGAL_REQUEST)
+		status = kIOReturnUnsupported;
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  GetCapacity()
+ *  Remaining and maximum capacity of the current partition, from the
+ *  tape capacity log page, which covers the first two partitions, or
+ *  else from the cartridge memory.
+ */
+IOReturn
+IOSCSITape::GetCapacity(struct mtcapacity *mc)
+{
+	IOReturn				status			= kIOReturnError;
+	UInt8					logData[LOG_BUFFER_SIZE];
+	UInt64					value			= 0;
+	struct mtmam			mm				= { 0 };
+	
+	bzero(mc, sizeof(struct mtcapacity));
+	mc->mc_partition = partition;
+	
+	/* parameters 1 and 2 are the remaining capacity of the first and
+	 * second partition, 3 and 4 their maximum */
+	if (partition <= 1 && IsCommandSupported(kSCSICmd_LOG_SENSE) &&
+		ReadLogPage(ST_LOG_TAPE_CAPACITY, logData, sizeof(logData), false) == kIOReturnSuccess &&
+		st_log_param(logData, 1 + partition, &mc->mc_remaining) &&
+		st_log_param(logData, 3 + partition, &value))
+	{
+		mc->mc_maximum = value;
+		return kIOReturnSuccess;
+	}
+	
+	mc->mc_remaining = 0;
+	
+	mm.mm_partition = partition;
+	mm.mm_id = MTMAM_REMAINING_CAP;
+	
+	if ((status = ReadAttribute(&mm)) != kIOReturnSuccess)
+		return status == kIOReturnNotFound ? kIOReturnUnsupported : status;
+	
+	for (UInt32 i = 0; i < mm.mm_length && i < 8; i++)
+		mc->mc_remaining = (mc->mc_remaining << 8) | mm.mm_value[i];
+	
+	mm.mm_id = MTMAM_MAXIMUM_CAP;
+	
+	if ((status = ReadAttribute(&mm)) != kIOReturnSuccess)
+		return status == kIOReturnNotFound ? kIOReturnUnsupported : status;
+	
+	for (UInt32 i = 0; i < mm.mm_length && i < 8; i++)
+		mc->mc_maximum = (mc->mc_maximum << 8) | mm.mm_value[i];
+	
+	return kIOReturnSuccess;
+}
+
+/*
+ *  ReadSecurityPage()
+ *  Read one page of the tape data encryption security protocol.
+ */
+IOReturn
+IOSCSITape::ReadSecurityPage(UInt16 page, UInt8 *buffer, UInt32 size)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	
+	if (!IsCommandSupported(kSCSICmd_SECURITY_PROTOCOL_IN))
+		return kIOReturnUnsupported;
+	
+	bzero(buffer, size);
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(buffer, 
+												 size, 
+												 kIODirectionIn);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		SECURITY_PROTOCOL_IN(task, dataBuffer, ST_SECURITY_TAPE, page, 0, size, 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		if (((buffer[0] << 8) | buffer[1]) == page)
+			status = kIOReturnSuccess;
+		else
+			status = kIOReturnUnsupported;
+	}
+	else if (lastTaskStatus == kSCSITaskStatus_CHECK_CONDITION &&
+			 lastSenseKey == kSENSE_KEY_ILLEGAL_REQUEST)
+		status = kIOReturnUnsupported;
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  FindCryptAlgorithm()
+ *  The first algorithm the drive can encrypt with that takes a key of
+ *  the given length, from the data encryption capabilities page.
+ */
+IOReturn
+IOSCSITape::FindCryptAlgorithm(UInt32 keyLength, UInt8 *algorithm)
+{
+	UInt8		pageData[CRYPT_BUFFER_SIZE];
+	IOReturn	status		= kIOReturnError;
+	UInt32		length		= 0;
+	UInt32		offset		= 0;
+	
+	if ((status = ReadSecurityPage(ST_CRYPT_CAPABILITIES, pageData, sizeof(pageData))) != kIOReturnSuccess)
+		return status;
+	
+	length = 4 + ((pageData[2] << 8) | pageData[3]);
+	
+	if (length > sizeof(pageData))
+		length = sizeof(pageData);
+	
+	/* algorithm descriptors follow a 20 byte header; ENCRYPT_C of 2
+	 * means the drive encrypts with a key it is given */
+	for (offset = 20; offset + 12 <= length;
+		 offset += 4 + ((pageData[offset + 2] << 8) | pageData[offset + 3]))
+	{
+		UInt8 *	desc	= &pageData[offset];
+		UInt32	keySize	= (desc[10] << 8) | desc[11];
+		
+		if ((desc[4] & 0x03) == 0x02 && keySize == keyLength)
+		{
+			*algorithm = desc[0];
+			return kIOReturnSuccess;
+		}
+	}
+	
+	return kIOReturnBadArgument;
+}
+
+/*
+ *  SetEncryption()
+ *  Set the drive's data encryption mode and key for this initiator.
+ *  The key is scrubbed from memory once it has been sent.
+ */
+IOReturn
+IOSCSITape::SetEncryption(struct mtcrypt *mc)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8					param[CRYPT_PARAM_SIZE] = { 0 };
+	UInt8					algorithm		= mc->mc_algorithm;
+	UInt32					length			= 0;
+	
+	if (!IsCommandSupported(kSCSICmd_SECURITY_PROTOCOL_OUT))
+		return kIOReturnUnsupported;
+	
+	if (mc->mc_mode > MTCRYPT_MIXED ||
+		mc->mc_algorithm > 0xFF ||
+		mc->mc_keylen > MTCRYPT_KEYLEN ||
+		mc->mc_kadlen > MTCRYPT_KADLEN ||
+		(mc->mc_mode != MTCRYPT_OFF && mc->mc_keylen == 0))
+	{
+		return kIOReturnBadArgument;
+	}
+	
+	if (mc->mc_mode != MTCRYPT_OFF && algorithm == 0 &&
+		(status = FindCryptAlgorithm(mc->mc_keylen, &algorithm)) != kIOReturnSuccess)
+	{
+		return status;
+	}
+	
+	/* set data encryption page */
+	param[0] = (ST_CRYPT_SET >> 8) & 0xFF;
+	param[1] =  ST_CRYPT_SET       & 0xFF;
+	param[4] = ST_CRYPT_SCOPE_LOCAL << 5;
+	
+	switch (mc->mc_mode)
+	{
+		case MTCRYPT_ON:
+			param[6] = 0x02;	/* ENCRYPT */
+			param[7] = 0x02;	/* DECRYPT */
+			break;
+		case MTCRYPT_MIXED:
+			param[6] = 0x02;	/* ENCRYPT */
+			param[7] = 0x03;	/* MIXED */
+			break;
+	}
+	
+	length = 20;
+	
+	if (mc->mc_mode != MTCRYPT_OFF)
+	{
+		param[8] = algorithm;
+		param[18] = (mc->mc_keylen >> 8) & 0xFF;
+		param[19] =  mc->mc_keylen       & 0xFF;
+		memcpy(&param[20], mc->mc_key, mc->mc_keylen);
+		length += mc->mc_keylen;
+		
+		/* an unauthenticated key-associated data descriptor, written
+		 * with each block to name the key */
+		if (mc->mc_kadlen)
+		{
+			param[length + 2] = (mc->mc_kadlen >> 8) & 0xFF;
+			param[length + 3] =  mc->mc_kadlen       & 0xFF;
+			memcpy(&param[length + 4], mc->mc_kad, mc->mc_kadlen);
+			length += 4 + mc->mc_kadlen;
+		}
+	}
+	
+	param[2] = ((length - 4) >> 8) & 0xFF;
+	param[3] =  (length - 4)       & 0xFF;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(param, 
+												 length, 
+												 kIODirectionOut);
+	
+	task = GetSCSITask();
+	
+	if (dataBuffer && task &&
+		SECURITY_PROTOCOL_OUT(task, dataBuffer, ST_SECURITY_TAPE, ST_CRYPT_SET, 0, length, 0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	bzero(param, sizeof(param));
+	bzero(mc->mc_key, sizeof(mc->mc_key));
+	
+	/* ask the drive what it made of it next time */
+	cryptKnown = false;
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		if (mc->mc_mode != MTCRYPT_OFF && !(mc->mc_flags & MTCRYPT_KEEP))
+			flags |= ST_CRYPT_KEY;
+		else
+			flags &= ~ST_CRYPT_KEY;
+		
+		status = kIOReturnSuccess;
+	}
+	else
+		status = kIOReturnError;
+	
+	if (task)
+		ReleaseSCSITask(task);
+	
+	if (dataBuffer)
+		dataBuffer->release();
+	
+	return status;
+}
+
+/*
+ *  GetEncryption()
+ *  The drive's data encryption mode and key-associated data, from the
+ *  data encryption status page, or as last read.
+ */
+IOReturn
+IOSCSITape::GetEncryption(struct mtcrypt *mc, bool refresh)
+{
+	UInt8			pageData[CRYPT_BUFFER_SIZE];
+	IOReturn		status		= kIOReturnError;
+	UInt32			length		= 0;
+	UInt32			offset		= 0;
+	struct mtcrypt	current		= { 0 };
+	
+	if (!refresh)
+	{
+		if (!cryptKnown)
+			return kIOReturnNotReady;
+		
+		*mc = cryptStatus;
+		return kIOReturnSuccess;
+	}
+	
+	if ((status = ReadSecurityPage(ST_CRYPT_STATUS, pageData, sizeof(pageData))) != kIOReturnSuccess)
+		return status;
+	
+	length = 4 + ((pageData[2] << 8) | pageData[3]);
+	
+	if (length > sizeof(pageData))
+		length = sizeof(pageData);
+	
+	if (pageData[5] == 0x00 && pageData[6] == 0x00)
+		current.mc_mode = MTCRYPT_OFF;
+	else if (pageData[5] == 0x02 && pageData[6] == 0x02)
+		current.mc_mode = MTCRYPT_ON;
+	else if (pageData[5] == 0x02 && pageData[6] == 0x03)
+		current.mc_mode = MTCRYPT_MIXED;
+	else
+		current.mc_mode = MTCRYPT_OTHER;
+	
+	if (current.mc_mode != MTCRYPT_OFF)
+		current.mc_algorithm = pageData[7];
+	
+	if (!(flags & ST_CRYPT_KEY))
+		current.mc_flags = MTCRYPT_KEEP;
+	
+	/* the first key-associated data descriptor, authenticated or not */
+	for (offset = 24; offset + 4 <= length;
+		 offset += 4 + ((pageData[offset + 2] << 8) | pageData[offset + 3]))
+	{
+		UInt8 *	desc		= &pageData[offset];
+		UInt32	kadLength	= (desc[2] << 8) | desc[3];
+		
+		if (desc[0] > 0x01 || offset + 4 + kadLength > length)
+			continue;
+		
+		if (kadLength > MTCRYPT_KADLEN)
+			kadLength = MTCRYPT_KADLEN;
+		
+		memcpy(current.mc_kad, &desc[4], kadLength);
+		current.mc_kadlen = kadLength;
+		break;
+	}
+	
+	cryptStatus = current;
+	cryptKnown = true;
+	*mc = current;
+	
+	return kIOReturnSuccess;
+}
+
+IOReturn
+IOSCSITape::WriteFilemarks(int count)
+{
+	SCSITaskIdentifier	task		= NULL;
+	IOReturn			status		= kIOReturnError;
+	SCSITaskStatus		taskStatus	= kSCSITaskStatus_No_Status;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+
+	/* a flush, with no filemarks, leaves the close as it was */
+	if (count > 0 || (flags & ST_WRITTEN))
+		flags |= ST_WRITTEN_TOGGLE;
+
+	if (WRITE_FILEMARKS_6(task, 0x0, 0x0, count, 0) == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;	
+}
+
+IOReturn
+IOSCSITape::Space(SCSISpaceCode type, int count)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_No_Status;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	BeginProgress(MTPROG_SPACE);
+	
+	if (SPACE_6(task, type, count, 0) == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	
+	EndProgress();
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;	
+}
+
+/*
+ *  Erase()
+ *  A short erase writes end of data at the current position. A long
+ *  erase clears the rest of the partition and is issued with IMMED,
+ *  since it can take hours; poll it with TestUnitReady().
+ */
+IOReturn
+IOSCSITape::Erase(bool longErase)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_No_Status;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	BeginProgress(MTPROG_ERASE);
+	
+	if (ERASE_6(task, longErase, longErase, 0) == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	
+	/* a long erase is followed by GetProgress() from here on */
+	if (status == kIOReturnSuccess && longErase)
+	{
+		IOLockLock(progressLock);
+		progressDetached = true;
+		IOLockUnlock(progressLock);
+		
+		ScheduleProgress();
+	}
+	else
+		EndProgress();
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+/*
+ *  Verify()
+ *  Have the drive read back and check count blocks without sending
+ *  them to the host. In variable block mode a single block is checked
+ *  and the drive may report its real length with ILI, which is not an
+ *  error. With locate, VERIFY(16) positions to lba first.
+ */
+IOReturn
+IOSCSITape::Verify(int count, bool locate, UInt64 lba)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_No_Status;
+	bool				fixed			= IsFixedBlockSize();
+	int					length			= count;
+	bool				cdbValid		= false;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (!fixed)
+		length = blkmax ? blkmax : kSCSICmdFieldMask3Byte;
+	
+	if (!IsCommandSupported(locate ? kSCSICmd_VERIFY_16 : kSCSICmd_VERIFY_6))
+		status = kIOReturnUnsupported;
+	else if (locate)
+		cdbValid = VERIFY_16(task, 0, 0, fixed, 0, lba, length, 0);
+	else
+		cdbValid = VERIFY_6(task, 0, 0, fixed, length, 0);
+	
+	if (cdbValid == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	else if (taskStatus == kSCSITaskStatus_CHECK_CONDITION &&
+			 !fixed &&
+			 lastSenseKey == kSENSE_KEY_NO_SENSE &&
+			 sense_flags == SENSE_ILI)
+		status = kIOReturnSuccess;
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::LoadUnload(int loadUnload)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	BeginProgress(loadUnload ? MTPROG_LOAD : MTPROG_UNLOAD);
+	
+	/* issued with IMMED and polled so progress can be reported */
+	if (LOAD_UNLOAD(task, 1, 0, 0, 0, loadUnload, 0) == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = WaitForImmediate(CommandTimeout(kSCSICmd_LOAD_UNLOAD, SCSI_MOTION_TIMEOUT));
+	
+	/* once unloaded the drive reports MEDIUM NOT PRESENT */
+	if (status == kIOReturnError && !loadUnload && lastASC == 0x3A)
+		status = kIOReturnSuccess;
+	
+	EndProgress();
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::ReadPosition(SCSI_ReadPositionShortForm *readPos, bool vendor)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8					readPosData[20] = { 0 };
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(&readPosData, 
+												 sizeof(readPosData), 
+												 kIODirectionIn);
+	
+	require((dataBuffer != 0), ErrorExit);
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (READ_POSITION(task, 
+					  dataBuffer, 
+					  (vendor ? kSCSIReadPositionServiceAction_ShortFormVendorSpecific : kSCSIReadPositionServiceAction_ShortFormBlockID), 
+					  0x0, 
+					  0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		readPos->flags = readPosData[0];
+		readPos->partitionNumber = readPosData[1];
+		
+		readPos->firstLogicalObjectLocation =
+			(readPosData[4]  << 24) |
+			(readPosData[5]  << 16) |
+			(readPosData[6]  <<  8) |
+			 readPosData[7];
+		
+		readPos->lastLogicalObjectLocation =
+			(readPosData[8]  << 24) |
+			(readPosData[9]  << 16) |
+			(readPosData[10] <<  8) |
+			 readPosData[11];
+		
+		readPos->logicalObjectsInObjectBuffer =
+			(readPosData[13] << 16) |
+			(readPosData[14] <<  8) |
+			 readPosData[15];
+		
+		readPos->bytesInObjectBuffer =
+			(readPosData[16] << 24) |
+			(readPosData[17] << 16) |
+			(readPosData[18] <<  8) |
+			 readPosData[19];
+		
+		status = kIOReturnSuccess;
+	}
+	
+	ReleaseSCSITask(task);
+	dataBuffer->release();
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::ReadPositionLong(SCSI_ReadPositionLongForm *readPos)
+{
+	SCSITaskIdentifier		task			= NULL;
+	IOReturn				status			= kIOReturnError;
+	SCSITaskStatus			taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	IOMemoryDescriptor *	dataBuffer		= NULL;
+	UInt8					readPosData[32] = { 0 };
+	
+	/* the long form is optional before SSC-2 */
+	if (noLongPosition)
+		return kIOReturnUnsupported;
+	
+	dataBuffer = IOMemoryDescriptor::withAddress(&readPosData, 
+												 sizeof(readPosData), 
+												 kIODirectionIn);
+	
+	require((dataBuffer != 0), ErrorExit);
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	if (READ_POSITION(task, 
+					  dataBuffer, 
+					  kSCSIReadPositionServiceAction_LongForm, 
+					  0x0, 
+					  0x00) == true)
+	{
+		taskStatus = DoSCSICommand(task, SCSI_NOMOTION_TIMEOUT);
+	}
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+	{
+		readPos->flags = readPosData[0];
+		
+		readPos->partitionNumber =
+			(readPosData[4]  << 24) |
+			(readPosData[5]  << 16) |
+			(readPosData[6]  <<  8) |
+			 readPosData[7];
+		
+		readPos->logicalObjectNumber = 0;
+		readPos->logicalFileIdentifier = 0;
+		
+		for (int i = 0; i < 8; i++)
+		{
+			readPos->logicalObjectNumber =
+				(readPos->logicalObjectNumber << 8) | readPosData[8 + i];
+			readPos->logicalFileIdentifier =
+				(readPos->logicalFileIdentifier << 8) | readPosData[16 + i];
+		}
+		
+		status = kIOReturnSuccess;
+	}
+	else if (taskStatus == kSCSITaskStatus_CHECK_CONDITION &&
+			 lastSenseKey == kSENSE_KEY_ILLEGAL_REQUEST)
+	{
+		noLongPosition = true;
+		status = kIOReturnUnsupported;
+	}
+	
+	ReleaseSCSITask(task);
+	dataBuffer->release();
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::Locate(UInt32 addr, bool hardware)
+{
+	SCSITaskIdentifier	task			= NULL;
+	IOReturn			status			= kIOReturnError;
+	SCSITaskStatus		taskStatus		= kSCSITaskStatus_DeviceNotResponding;
+	
+	task = GetSCSITask();
+	
+	require((task != 0), ErrorExit);
+	
+	BeginProgress(MTPROG_LOCATE);
+	
+	/* issued with IMMED and polled so progress can be reported */
+	if (LOCATE_10(task, hardware, 0, 1, addr, 0, 0) == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+	
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = WaitForImmediate(CommandTimeout(kSCSICmd_LOCATE, SCSI_MOTION_TIMEOUT));
+	
+	EndProgress();
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	return status;
+}
+
+IOReturn
+IOSCSITape::ReadWrite(IOMemoryDescriptor *dataBuffer, int *realizedBytes)
+{
+	SCSITaskIdentifier			task			= NULL;
+	IOReturn					status			= kIOReturnNoResources;
+	IOReturn					lbpStatus		= kIOReturnSuccess;
+	SCSITaskStatus				taskStatus		= kSCSITaskStatus_No_Status;
+	bool						cmdStatus		= false;
+	int							transferSize	= 0;
+	int							blockSize		= blksize;
+	IOMemoryDescriptor *		transferBuffer	= dataBuffer;
+	IOBufferMemoryDescriptor *	crcBuffer		= NULL;
+	bool						read			= false;
+	
+	require((dataBuffer != 0), ErrorExit);
+	
+	transferSize = dataBuffer->getLength();
+	read = (dataBuffer->getDirection() == kIODirectionIn);
+
+	if (IsFixedBlockSize())
+	{
+		if (transferSize % blksize)
+		{
+			ERROR_LOG("must be multiple of block size");
+			return kIOReturnNotAligned;
+		}
+		
+		transferSize /= blksize;
+	}
+	
+	if (read && (flags & ST_READ_REVERSE) &&
+		(lbpEnabled || !IsCommandSupported(kSCSICmd_READ_REVERSE)))
+	{
+		return kIOReturnUnsupported;
+	}
+	
+	/* with logical block protection each block carries its CRC32C */
+	if (lbpEnabled && transferSize > 0)
+	{
+		/* the drive forgets it on a reset */
+		if (!lbpActive && (status = SetProtection(true)) != kIOReturnSuccess)
+			return status;
+		
+		status = ProtectBuffer(dataBuffer,
+							   IsFixedBlockSize() ? transferSize : 1,
+							   &transferBuffer,
+							   &crcBuffer);
+		
+		if (status != kIOReturnSuccess)
+			return status;
+		
+		if (IsFixedBlockSize())
+			blockSize += ST_LBP_LENGTH;
+		else
+			transferSize += ST_LBP_LENGTH;
+		
+		transferBuffer->prepare();
+		status = kIOReturnNoResources;
+	}
+	
+	task = GetSCSITask();
+	require((task != 0), ErrorExit);
+	
+	if (read && (flags & ST_READ_REVERSE))
+	{
+		/* BYTORD keeps the bytes of each record in written order */
+		cmdStatus = READ_REVERSE_6(
+			task, 
+			transferBuffer, 
+			blockSize, 
+			0x1,
+			0x0,
+			IsFixedBlockSize() ? 0x1 : 0x0,
+			transferSize,
+			0x00);
+	}
+	else if (read)
+	{
+		cmdStatus = READ_6(
+			task, 
+			transferBuffer, 
+			blockSize, 
+			0x0,
+			IsFixedBlockSize() ? 0x1 : 0x0,
+			transferSize,
+			0x00);
+	}
+	else
+	{
+		cmdStatus = WRITE_6(
+			task, 
+			transferBuffer, 
+			blockSize, 
+			IsFixedBlockSize() ? 0x1 : 0x0,
+			transferSize, 
+			0x00);
+
+		flags |= ST_WRITTEN_TOGGLE;
+	}
+	
+	if (cmdStatus == true)
+		taskStatus = DoSCSICommand(task, SCSI_MOTION_TIMEOUT);
+		
+	*realizedBytes = GetRealizedDataTransferCount(task);
+
+	if (taskStatus == kSCSITaskStatus_GOOD)
+		status = kIOReturnSuccess;
+	else if (cmdStatus == true)
+		status = kIOReturnIOError;
+	
+	/* a record longer than the read has no CRC where we look */
+	if (crcBuffer)
+	{
+		lbpStatus = CheckProtection(dataBuffer,
+									transferBuffer,
+									read && (IsFixedBlockSize() ||
+											 !(sense_flags & SENSE_ILI) ||
+											 lastSenseInfo >= 0),
+									realizedBytes);
+		
+		if (lbpStatus != kIOReturnSuccess)
+			status = lbpStatus;
+	}
+	
+	ReleaseSCSITask(task);
+	
+ErrorExit:
+	
+	if (crcBuffer)
+	{
+		transferBuffer->complete();
+		transferBuffer->release();
+		crcBuffer->release();
+	}
+	
+	return status;
+}
+
+#if 0
+#pragma mark -
+#pragma mark 0x01 SSC Implicit Address Commands
+#pragma mark -
+#endif /* 0 */
+
+bool
+IOSCSITape::ERASE_6(
+	SCSITaskIdentifier	request,
+	SCSICmdField1Bit	IMMED,
+	SCSICmdField1Bit	LONG,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(LONG, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_ERASE, 
+							  (LONG << 1) |
+							   IMMED, 
+							  0x00, 
+							  0x00, 
+							  0x00, 
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_ERASE, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}				   
+
+bool
+IOSCSITape::READ_6(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	readBuffer,
+	UInt32					blockSize,
+	SCSICmdField1Bit		SILI,
+	SCSICmdField1Bit		FIXED,
+	SCSICmdField3Byte		TRANSFER_LENGTH,
+	SCSICmdField1Byte		CONTROL)
+{
+	UInt32	requestedByteCount	= 0;
+	bool	result				= false;
+	
+	require(IsParameterValid(SILI, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(FIXED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	if (FIXED)
+		requestedByteCount = TRANSFER_LENGTH * blockSize;
+	else
+		requestedByteCount = TRANSFER_LENGTH;
+	
+	require((readBuffer != 0), ErrorExit);
+	require((readBuffer->getLength() >= requestedByteCount), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_READ_6, 
+							  (SILI << 1) |
+							   FIXED, 
+							  (TRANSFER_LENGTH >> 16) & 0xFF, 
+							  (TRANSFER_LENGTH >>  8) & 0xFF, 
+							   TRANSFER_LENGTH        & 0xFF, 
+							  CONTROL);
+	
+	SetDataBuffer(request, readBuffer);
+	
+	SetRequestedDataTransferCount(request, requestedByteCount);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_READ_6, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::READ_REVERSE_6(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	readBuffer,
+	UInt32					blockSize,
+	SCSICmdField1Bit		BYTORD,
+	SCSICmdField1Bit		SILI,
+	SCSICmdField1Bit		FIXED,
+	SCSICmdField3Byte		TRANSFER_LENGTH,
+	SCSICmdField1Byte		CONTROL)
+{
+	UInt32	requestedByteCount	= 0;
+	bool	result				= false;
+	
+	require(IsParameterValid(BYTORD, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(SILI, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(FIXED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	if (FIXED)
+		requestedByteCount = TRANSFER_LENGTH * blockSize;
+	else
+		requestedByteCount = TRANSFER_LENGTH;
+	
+	require((readBuffer != 0), ErrorExit);
+	require((readBuffer->getLength() >= requestedByteCount), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_READ_REVERSE, 
+							  (BYTORD << 2) |
+							  (SILI << 1) |
+							   FIXED, 
+							  (TRANSFER_LENGTH >> 16) & 0xFF, 
+							  (TRANSFER_LENGTH >>  8) & 0xFF, 
+							   TRANSFER_LENGTH        & 0xFF, 
+							  CONTROL);
+	
+	SetDataBuffer(request, readBuffer);
+	
+	SetRequestedDataTransferCount(request, requestedByteCount);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_READ_REVERSE, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::SPACE_6(
+	SCSITaskIdentifier	request,
+	SCSICmdField4Bit	CODE,
+	SCSICmdField3Byte	COUNT,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(CODE, kSCSICmdFieldMask4Bit), ErrorExit);
+	
+	/* allow a two's complement negative number in the 3-byte integer
+	 * space to not cause an error with IsParameterValid() */
+	if ((COUNT & 0xFF800000) == 0xFF800000)
+		COUNT = COUNT & 0xFFFFFF;
+	
+	require(IsParameterValid(COUNT, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_SPACE, 
+							  CODE, 
+							  (COUNT >> 16) & 0xFF, 
+							  (COUNT >>  8) & 0xFF, 
+							   COUNT        & 0xFF, 
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_SPACE, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::VERIFY_6(
+	SCSITaskIdentifier	request,
+	SCSICmdField1Bit	IMMED,
+	SCSICmdField1Bit	BYTCMP,
+	SCSICmdField1Bit	FIXED,
+	SCSICmdField3Byte	VERIFICATION_LENGTH,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(BYTCMP, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(FIXED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(VERIFICATION_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	/* byte compare needs a data-out buffer, which is not supported */
+	require((BYTCMP == 0), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_VERIFY_6, 
+							  (IMMED << 2) |
+							  (BYTCMP << 1) |
+							   FIXED, 
+							  (VERIFICATION_LENGTH >> 16) & 0xFF, 
+							  (VERIFICATION_LENGTH >>  8) & 0xFF, 
+							   VERIFICATION_LENGTH        & 0xFF, 
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_VERIFY_6, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::WRITE_6(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	writeBuffer,
+	UInt32					blockSize,
+	SCSICmdField1Bit		FIXED,
+	SCSICmdField3Byte		TRANSFER_LENGTH,
+	SCSICmdField1Byte		CONTROL)
+{
+	UInt32	requestedByteCount	= 0;
+	bool	result				= false;
+	
+	require(IsParameterValid(FIXED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	if (FIXED)
+		requestedByteCount = TRANSFER_LENGTH * blockSize;
+	else
+		requestedByteCount = TRANSFER_LENGTH;
+	
+	require((writeBuffer != 0), ErrorExit);
+	require((writeBuffer->getLength() >= requestedByteCount), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_WRITE_6, 
+							  FIXED, 
+							  (TRANSFER_LENGTH >> 16) & 0xFF, 
+							  (TRANSFER_LENGTH >>  8) & 0xFF, 
+							   TRANSFER_LENGTH        & 0xFF, 
+							  CONTROL);
+	
+	SetDataBuffer(request, writeBuffer);
+	
+	SetRequestedDataTransferCount(request, requestedByteCount);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromInitiatorToTarget);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_WRITE_6, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::WRITE_FILEMARKS_6(
+	SCSITaskIdentifier	request,
+	SCSICmdField1Bit	WSMK,
+	SCSICmdField1Bit	IMMED,
+	SCSICmdField3Byte	TRANSFER_LENGTH,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(WSMK, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_WRITE_FILEMARKS, 
+							  (WSMK << 1) |
+							   IMMED, 
+							  (TRANSFER_LENGTH >> 16) & 0xFF, 
+							  (TRANSFER_LENGTH >>  8) & 0xFF, 
+							   TRANSFER_LENGTH        & 0xFF, 
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_WRITE_FILEMARKS, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+#if 0
+#pragma mark -
+#pragma mark 0x01 SSC Common Commands
+#pragma mark -
+#endif /* 0 */
+
+bool
+IOSCSITape::LOAD_UNLOAD(
+	SCSITaskIdentifier	request,
+	SCSICmdField1Bit	IMMED,
+	SCSICmdField1Bit	HOLD,
+	SCSICmdField1Bit	EOT,
+	SCSICmdField1Bit	RETEN,
+	SCSICmdField1Bit	LOAD,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(HOLD, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(EOT, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(RETEN, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(LOAD, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_LOAD_UNLOAD, 
+							  IMMED, 
+							  0x00, 
+							  0x00, 
+							  (HOLD  << 3) |
+							  (EOT   << 2) |
+							  (RETEN << 1) |
+							   LOAD, 
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_LOAD_UNLOAD, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::LOCATE_10(
+	SCSITaskIdentifier	request,
+	SCSICmdField1Bit	BT,
+	SCSICmdField1Bit	CP,
+	SCSICmdField1Bit	IMMED,
+	SCSICmdField4Byte	LOGICAL_OBJECT_IDENTIFIER,
+	SCSICmdField1Byte	PARTITION,
+	SCSICmdField1Byte	CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(BT, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(CP, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(LOGICAL_OBJECT_IDENTIFIER, kSCSICmdFieldMask4Byte), ErrorExit);
+	require(IsParameterValid(PARTITION, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_LOCATE, 
+							  (BT << 2) |
+							  (CP << 1) |
+							   IMMED, 
+							  0x00, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 24) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 16) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >>  8) & 0xFF, 
+							   LOGICAL_OBJECT_IDENTIFIER        & 0xFF, 
+							  0x00, 
+							  PARTITION, 
+							  CONTROL);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_LOCATE, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::READ_BLOCK_LIMITS(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	readBuffer,
+	SCSICmdField1Byte		CONTROL)
+{
+	bool result = false;
+	
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	require((readBuffer != 0), ErrorExit);
+	require((readBuffer->getLength() >= 6), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_READ_BLOCK_LIMITS, 
+							  0x00, 
+							  0x00, 
+							  0x00, 
+							  0x00, 
+							  CONTROL);
+	
+	SetDataBuffer(request, readBuffer);
+	
+	SetRequestedDataTransferCount(request, 6);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_READ_BLOCK_LIMITS, SCSI_NOMOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
+bool
+IOSCSITape::READ_POSITION(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField5Bit		SERVICE_ACTION,
+	SCSICmdField2Byte		ALLOCATION_LENGTH,
+	SCSICmdField1Byte		CONTROL)
+{
+	bool	result	= false;
+	int		count	= 0;
+	
+	require(IsParameterValid(SERVICE_ACTION, kSCSICmdFieldMask5Bit), ErrorExit);
+	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
+	
+	require((buffer != 0), ErrorExit);
+	
+	switch (SERVICE_ACTION)
+	{
+		case kSCSIReadPositionServiceAction_ShortFormBlockID:
+		case kSCSIReadPositionServiceAction_ShortFormVendorSpecific:
+			count = 20;
+			break;
+		case kSCSIReadPositionServiceAction_LongForm:
+			count = 32;
+			break;
+		case kSCSIReadPositionServiceAction_ExtendedForm:
+			count = 28;
+			break;
+		default:
+			/* unknown service action */
+			count = buffer->getLength();
+			break;
+	}
+	
+	require((buffer->getLength() >= count), ErrorExit);
+	
+	SetCommandDescriptorBlock(request, 
+							  kSCSICmd_READ_POSITION, 
+							  SERVICE_ACTION, 
+							  0x00, 
+							  0x00, 
+							  0x00, 
+							  0x00,
+							  0x00,
+							  (ALLOCATION_LENGTH >> 8) & 0xFF,
+							   ALLOCATION_LENGTH       & 0xFF,
+							  CONTROL);
+	
+	SetDataBuffer(request, buffer);
+	
+	SetRequestedDataTransferCount(request, count);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_READ_POSITION, SCSI_NOMOTION_TIMEOUT));
+	
+	result = true;
+	
+ErrorExit:
+	
+	return result;
+}
+
 bool
-IOSCSITape::ERASE_6(
+IOSCSITape::REWIND(
 	SCSITaskIdentifier	request,
 	SCSICmdField1Bit	IMMED,
-	SCSICmdField1Bit	LONG,
 	SCSICmdField1Byte	CONTROL)
 {
 	bool result = false;
 	
 	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(LONG, kSCSICmdFieldMask1Bit), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_ERASE, 
-							  (LONG << 1) |
-							   IMMED, 
+							  kSCSICmd_REWIND, 
+							  IMMED, 
 							  0x00, 
 							  0x00, 
 							  0x00, 
@@ -1174,55 +6830,67 @@ IOSCSITape::ERASE_6(
 	
 	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
 	
-	SetTimeoutDuration(request, SCSI_MOTION_TIMEOUT);
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_REWIND, SCSI_MOTION_TIMEOUT));
+	
+	result = true;
 	
 ErrorExit:
 	
 	return result;
-}				   
+}
+
+#if 0
+#pragma mark -
+#pragma mark SPC Commands
+#pragma mark -
+#endif /* 0 */
 
 bool
-IOSCSITape::READ_6(
+IOSCSITape::REPORT_SUPPORTED_OPERATION_CODES(
 	SCSITaskIdentifier		request,
-	IOMemoryDescriptor *	readBuffer,
-	UInt32					blockSize,
-	SCSICmdField1Bit		SILI,
-	SCSICmdField1Bit		FIXED,
-	SCSICmdField3Byte		TRANSFER_LENGTH,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField1Bit		RCTD,
+	SCSICmdField3Bit		REPORTING_OPTIONS,
+	SCSICmdField1Byte		REQUESTED_OPERATION_CODE,
+	SCSICmdField2Byte		REQUESTED_SERVICE_ACTION,
+	SCSICmdField4Byte		ALLOCATION_LENGTH,
 	SCSICmdField1Byte		CONTROL)
 {
-	UInt32	requestedByteCount	= 0;
-	bool	result				= false;
+	bool result = false;
 	
-	require(IsParameterValid(SILI, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(FIXED, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(RCTD, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(REPORTING_OPTIONS, kSCSICmdFieldMask3Bit), ErrorExit);
+	require(IsParameterValid(REQUESTED_OPERATION_CODE, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(REQUESTED_SERVICE_ACTION, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask4Byte), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
-	if (FIXED)
-		requestedByteCount = TRANSFER_LENGTH * blockSize;
-	else
-		requestedByteCount = TRANSFER_LENGTH;
-	
-	require((readBuffer != 0), ErrorExit);
-	require((readBuffer->getLength() >= requestedByteCount), ErrorExit);
+	require((buffer != 0), ErrorExit);
+	require((buffer->getLength() >= ALLOCATION_LENGTH), ErrorExit);
 	
+	/* MAINTENANCE IN, service action 0x0C */
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_READ_6, 
-							  (SILI << 1) |
-							   FIXED, 
-							  (TRANSFER_LENGTH >> 16) & 0xFF, 
-							  (TRANSFER_LENGTH >>  8) & 0xFF, 
-							   TRANSFER_LENGTH        & 0xFF, 
+							  kSCSICmd_MAINTENANCE_IN, 
+							  0x0C, 
+							  (RCTD << 7) |
+							   REPORTING_OPTIONS, 
+							  REQUESTED_OPERATION_CODE, 
+							  (REQUESTED_SERVICE_ACTION >> 8) & 0xFF, 
+							   REQUESTED_SERVICE_ACTION       & 0xFF, 
+							  (ALLOCATION_LENGTH >> 24) & 0xFF, 
+							  (ALLOCATION_LENGTH >> 16) & 0xFF, 
+							  (ALLOCATION_LENGTH >>  8) & 0xFF, 
+							   ALLOCATION_LENGTH        & 0xFF, 
+							  0x00, 
 							  CONTROL);
 	
-	SetDataBuffer(request, readBuffer);
+	SetDataBuffer(request, buffer);
 	
-	SetRequestedDataTransferCount(request, requestedByteCount);
+	SetRequestedDataTransferCount(request, ALLOCATION_LENGTH);
 	
 	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
 	
-	SetTimeoutDuration(request, SCSI_MOTION_TIMEOUT);
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_MAINTENANCE_IN, SCSI_NOMOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -1232,35 +6900,42 @@ ErrorExit:
 }
 
 bool
-IOSCSITape::SPACE_6(
-	SCSITaskIdentifier	request,
-	SCSICmdField4Bit	CODE,
-	SCSICmdField3Byte	COUNT,
-	SCSICmdField1Byte	CONTROL)
+IOSCSITape::READ_MEDIA_SERIAL_NUMBER(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField4Byte		ALLOCATION_LENGTH,
+	SCSICmdField1Byte		CONTROL)
 {
 	bool result = false;
 	
-	require(IsParameterValid(CODE, kSCSICmdFieldMask4Bit), ErrorExit);
-	
-	/* allow a two's complement negative number in the 3-byte integer
-	 * space to not cause an error with IsParameterValid() */
-	if ((COUNT & 0xFF800000) == 0xFF800000)
-		COUNT = COUNT & 0xFFFFFF;
-	
-	require(IsParameterValid(COUNT, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask4Byte), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
+	require((buffer != 0), ErrorExit);
+	require((buffer->getLength() >= ALLOCATION_LENGTH), ErrorExit);
+	
+	/* SERVICE ACTION IN(12), service action 0x01 */
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_SPACE, 
-							  CODE, 
-							  (COUNT >> 16) & 0xFF, 
-							  (COUNT >>  8) & 0xFF, 
-							   COUNT        & 0xFF, 
+							  kSCSICmd_READ_MEDIA_SERIAL_NUMBER, 
+							  0x01, 
+							  0x00, 
+							  0x00, 
+							  0x00, 
+							  0x00, 
+							  (ALLOCATION_LENGTH >> 24) & 0xFF, 
+							  (ALLOCATION_LENGTH >> 16) & 0xFF, 
+							  (ALLOCATION_LENGTH >>  8) & 0xFF, 
+							   ALLOCATION_LENGTH        & 0xFF, 
+							  0x00, 
 							  CONTROL);
 	
-	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	SetDataBuffer(request, buffer);
+	
+	SetRequestedDataTransferCount(request, ALLOCATION_LENGTH);
+	
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
 	
-	SetTimeoutDuration(request, SCSI_MOTION_TIMEOUT);
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_READ_MEDIA_SERIAL_NUMBER, SCSI_NOMOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -1269,45 +6944,46 @@ ErrorExit:
 	return result;
 }
 
+/* MODE SENSE(6) with the subpage code, which the superclass builder
+ * leaves reserved */
 bool
-IOSCSITape::WRITE_6(
+IOSCSITape::MODE_SENSE_SUBPAGE_6(
 	SCSITaskIdentifier		request,
-	IOMemoryDescriptor *	writeBuffer,
-	UInt32					blockSize,
-	SCSICmdField1Bit		FIXED,
-	SCSICmdField3Byte		TRANSFER_LENGTH,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField1Bit		DBD,
+	SCSICmdField2Bit		PC,
+	SCSICmdField6Bit		PAGE_CODE,
+	SCSICmdField1Byte		SUBPAGE_CODE,
+	SCSICmdField1Byte		ALLOCATION_LENGTH,
 	SCSICmdField1Byte		CONTROL)
 {
-	UInt32	requestedByteCount	= 0;
-	bool	result				= false;
+	bool result = false;
 	
-	require(IsParameterValid(FIXED, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(DBD, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(PC, kSCSICmdFieldMask2Bit), ErrorExit);
+	require(IsParameterValid(PAGE_CODE, kSCSICmdFieldMask6Bit), ErrorExit);
+	require(IsParameterValid(SUBPAGE_CODE, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask1Byte), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
-	if (FIXED)
-		requestedByteCount = TRANSFER_LENGTH * blockSize;
-	else
-		requestedByteCount = TRANSFER_LENGTH;
-	
-	require((writeBuffer != 0), ErrorExit);
-	require((writeBuffer->getLength() >= requestedByteCount), ErrorExit);
+	require((buffer != 0), ErrorExit);
+	require((buffer->getLength() >= ALLOCATION_LENGTH), ErrorExit);
 	
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_WRITE_6, 
-							  FIXED, 
-							  (TRANSFER_LENGTH >> 16) & 0xFF, 
-							  (TRANSFER_LENGTH >>  8) & 0xFF, 
-							   TRANSFER_LENGTH        & 0xFF, 
+							  kSCSICmd_MODE_SENSE_6, 
+							  DBD << 3, 
+							  (PC << 6) | PAGE_CODE, 
+							  SUBPAGE_CODE, 
+							  ALLOCATION_LENGTH, 
 							  CONTROL);
 	
-	SetDataBuffer(request, writeBuffer);
+	SetDataBuffer(request, buffer);
 	
-	SetRequestedDataTransferCount(request, requestedByteCount);
+	SetRequestedDataTransferCount(request, ALLOCATION_LENGTH);
 	
-	SetDataTransferDirection(request, kSCSIDataTransfer_FromInitiatorToTarget);
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
 	
-	SetTimeoutDuration(request, SCSI_MOTION_TIMEOUT);
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_MODE_SENSE_6, SCSI_NOMOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -1317,32 +6993,55 @@ ErrorExit:
 }
 
 bool
-IOSCSITape::WRITE_FILEMARKS_6(
-	SCSITaskIdentifier	request,
-	SCSICmdField1Bit	WSMK,
-	SCSICmdField1Bit	IMMED,
-	SCSICmdField3Byte	TRANSFER_LENGTH,
-	SCSICmdField1Byte	CONTROL)
+IOSCSITape::READ_ATTRIBUTE(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField5Bit		SERVICE_ACTION,
+	SCSICmdField1Byte		VOLUME_NUMBER,
+	SCSICmdField1Byte		PARTITION_NUMBER,
+	SCSICmdField2Byte		FIRST_ATTRIBUTE_IDENTIFIER,
+	SCSICmdField4Byte		ALLOCATION_LENGTH,
+	SCSICmdField1Bit		CACHE,
+	SCSICmdField1Byte		CONTROL)
 {
 	bool result = false;
 	
-	require(IsParameterValid(WSMK, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
+	require(IsParameterValid(SERVICE_ACTION, kSCSICmdFieldMask5Bit), ErrorExit);
+	require(IsParameterValid(VOLUME_NUMBER, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(PARTITION_NUMBER, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(FIRST_ATTRIBUTE_IDENTIFIER, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask4Byte), ErrorExit);
+	require(IsParameterValid(CACHE, kSCSICmdFieldMask1Bit), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
+	require((buffer != 0), ErrorExit);
+	require((buffer->getLength() >= ALLOCATION_LENGTH), ErrorExit);
+	
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_WRITE_FILEMARKS, 
-							  (WSMK << 1) |
-							   IMMED, 
-							  (TRANSFER_LENGTH >> 16) & 0xFF, 
-							  (TRANSFER_LENGTH >>  8) & 0xFF, 
-							   TRANSFER_LENGTH        & 0xFF, 
+							  kSCSICmd_READ_ATTRIBUTE, 
+							  SERVICE_ACTION, 
+							  0x00, 
+							  0x00, 
+							  0x00, 
+							  VOLUME_NUMBER, 
+							  0x00, 
+							  PARTITION_NUMBER, 
+							  (FIRST_ATTRIBUTE_IDENTIFIER >> 8) & 0xFF, 
+							   FIRST_ATTRIBUTE_IDENTIFIER       & 0xFF, 
+							  (ALLOCATION_LENGTH >> 24) & 0xFF, 
+							  (ALLOCATION_LENGTH >> 16) & 0xFF, 
+							  (ALLOCATION_LENGTH >>  8) & 0xFF, 
+							   ALLOCATION_LENGTH        & 0xFF, 
+							  CACHE, 
 							  CONTROL);
 	
-	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	SetDataBuffer(request, buffer);
+	
+	SetRequestedDataTransferCount(request, ALLOCATION_LENGTH);
 	
-	SetTimeoutDuration(request, SCSI_MOTION_TIMEOUT);
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_READ_ATTRIBUTE, SCSI_NOMOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -1351,45 +7050,52 @@ ErrorExit:
 	return result;
 }
 
-#if 0
-#pragma mark -
-#pragma mark 0x01 SSC Common Commands
-#pragma mark -
-#endif /* 0 */
-
 bool
-IOSCSITape::LOAD_UNLOAD(
-	SCSITaskIdentifier	request,
-	SCSICmdField1Bit	IMMED,
-	SCSICmdField1Bit	HOLD,
-	SCSICmdField1Bit	EOT,
-	SCSICmdField1Bit	RETEN,
-	SCSICmdField1Bit	LOAD,
-	SCSICmdField1Byte	CONTROL)
+IOSCSITape::WRITE_ATTRIBUTE(
+	SCSITaskIdentifier		request,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField1Bit		WTC,
+	SCSICmdField1Byte		VOLUME_NUMBER,
+	SCSICmdField1Byte		PARTITION_NUMBER,
+	SCSICmdField4Byte		PARAMETER_LIST_LENGTH,
+	SCSICmdField1Byte		CONTROL)
 {
 	bool result = false;
 	
-	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(HOLD, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(EOT, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(RETEN, kSCSICmdFieldMask1Bit), ErrorExit);
-	require(IsParameterValid(LOAD, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(WTC, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(VOLUME_NUMBER, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(PARTITION_NUMBER, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(PARAMETER_LIST_LENGTH, kSCSICmdFieldMask4Byte), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
+	require((buffer != 0), ErrorExit);
+	require((buffer->getLength() >= PARAMETER_LIST_LENGTH), ErrorExit);
+	
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_LOAD_UNLOAD, 
-							  IMMED, 
+							  kSCSICmd_WRITE_ATTRIBUTE, 
+							  WTC, 
 							  0x00, 
 							  0x00, 
-							  (HOLD  << 3) |
-							  (EOT   << 2) |
-							  (RETEN << 1) |
-							   LOAD, 
+							  0x00, 
+							  VOLUME_NUMBER, 
+							  0x00, 
+							  PARTITION_NUMBER, 
+							  0x00, 
+							  0x00, 
+							  (PARAMETER_LIST_LENGTH >> 24) & 0xFF, 
+							  (PARAMETER_LIST_LENGTH >> 16) & 0xFF, 
+							  (PARAMETER_LIST_LENGTH >>  8) & 0xFF, 
+							   PARAMETER_LIST_LENGTH        & 0xFF, 
+							  0x00, 
 							  CONTROL);
 	
-	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
+	SetDataBuffer(request, buffer);
+	
+	SetRequestedDataTransferCount(request, PARAMETER_LIST_LENGTH);
 	
-	SetTimeoutDuration(request, SCSI_MOTION_TIMEOUT);
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromInitiatorToTarget);
+	
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_WRITE_ATTRIBUTE, SCSI_NOMOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -1399,33 +7105,47 @@ ErrorExit:
 }
 
 bool
-IOSCSITape::READ_BLOCK_LIMITS(
+IOSCSITape::SECURITY_PROTOCOL_IN(
 	SCSITaskIdentifier		request,
-	IOMemoryDescriptor *	readBuffer,
+	IOMemoryDescriptor *	buffer,
+	SCSICmdField1Byte		SECURITY_PROTOCOL,
+	SCSICmdField2Byte		SECURITY_PROTOCOL_SPECIFIC,
+	SCSICmdField1Bit		INC_512,
+	SCSICmdField4Byte		ALLOCATION_LENGTH,
 	SCSICmdField1Byte		CONTROL)
 {
 	bool result = false;
 	
+	require(IsParameterValid(SECURITY_PROTOCOL, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(SECURITY_PROTOCOL_SPECIFIC, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(INC_512, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask4Byte), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
-	require((readBuffer != 0), ErrorExit);
-	require((readBuffer->getLength() >= 6), ErrorExit);
+	require((buffer != 0), ErrorExit);
+	require((buffer->getLength() >= ALLOCATION_LENGTH), ErrorExit);
 	
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_READ_BLOCK_LIMITS, 
-							  0x00, 
-							  0x00, 
+							  kSCSICmd_SECURITY_PROTOCOL_IN, 
+							  SECURITY_PROTOCOL, 
+							  (SECURITY_PROTOCOL_SPECIFIC >> 8) & 0xFF, 
+							   SECURITY_PROTOCOL_SPECIFIC       & 0xFF, 
+							  INC_512 << 7, 
 							  0x00, 
+							  (ALLOCATION_LENGTH >> 24) & 0xFF, 
+							  (ALLOCATION_LENGTH >> 16) & 0xFF, 
+							  (ALLOCATION_LENGTH >>  8) & 0xFF, 
+							   ALLOCATION_LENGTH        & 0xFF, 
 							  0x00, 
 							  CONTROL);
 	
-	SetDataBuffer(request, readBuffer);
+	SetDataBuffer(request, buffer);
 	
-	SetRequestedDataTransferCount(request, 6);
+	SetRequestedDataTransferCount(request, ALLOCATION_LENGTH);
 	
 	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
 	
-	SetTimeoutDuration(request, SCSI_NOMOTION_TIMEOUT);
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_SECURITY_PROTOCOL_IN, SCSI_NOMOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -1435,61 +7155,47 @@ ErrorExit:
 }
 
 bool
-IOSCSITape::READ_POSITION(
+IOSCSITape::SECURITY_PROTOCOL_OUT(
 	SCSITaskIdentifier		request,
 	IOMemoryDescriptor *	buffer,
-	SCSICmdField5Bit		SERVICE_ACTION,
-	SCSICmdField2Byte		ALLOCATION_LENGTH,
+	SCSICmdField1Byte		SECURITY_PROTOCOL,
+	SCSICmdField2Byte		SECURITY_PROTOCOL_SPECIFIC,
+	SCSICmdField1Bit		INC_512,
+	SCSICmdField4Byte		TRANSFER_LENGTH,
 	SCSICmdField1Byte		CONTROL)
 {
-	bool	result	= false;
-	int		count	= 0;
+	bool result = false;
 	
-	require(IsParameterValid(SERVICE_ACTION, kSCSICmdFieldMask5Bit), ErrorExit);
-	require(IsParameterValid(ALLOCATION_LENGTH, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(SECURITY_PROTOCOL, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(SECURITY_PROTOCOL_SPECIFIC, kSCSICmdFieldMask2Byte), ErrorExit);
+	require(IsParameterValid(INC_512, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(TRANSFER_LENGTH, kSCSICmdFieldMask4Byte), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
 	require((buffer != 0), ErrorExit);
-	
-	switch (SERVICE_ACTION)
-	{
-		case kSCSIReadPositionServiceAction_ShortFormBlockID:
-		case kSCSIReadPositionServiceAction_ShortFormVendorSpecific:
-			count = 20;
-			break;
-		case kSCSIReadPositionServiceAction_LongForm:
-			count = 32;
-			break;
-		case kSCSIReadPositionServiceAction_ExtendedForm:
-			count = 28;
-			break;
-		default:
-			/* unknown service action */
-			count = buffer->getLength();
-			break;
-	}
-	
-	require((buffer->getLength() >= count), ErrorExit);
+	require((buffer->getLength() >= TRANSFER_LENGTH), ErrorExit);
 	
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_READ_POSITION, 
-							  SERVICE_ACTION, 
-							  0x00, 
+							  kSCSICmd_SECURITY_PROTOCOL_OUT, 
+							  SECURITY_PROTOCOL, 
+							  (SECURITY_PROTOCOL_SPECIFIC >> 8) & 0xFF, 
+							   SECURITY_PROTOCOL_SPECIFIC       & 0xFF, 
+							  INC_512 << 7, 
 							  0x00, 
+							  (TRANSFER_LENGTH >> 24) & 0xFF, 
+							  (TRANSFER_LENGTH >> 16) & 0xFF, 
+							  (TRANSFER_LENGTH >>  8) & 0xFF, 
+							   TRANSFER_LENGTH        & 0xFF, 
 							  0x00, 
-							  0x00,
-							  0x00,
-							  (ALLOCATION_LENGTH >> 8) & 0xFF,
-							   ALLOCATION_LENGTH       & 0xFF,
 							  CONTROL);
 	
 	SetDataBuffer(request, buffer);
 	
-	SetRequestedDataTransferCount(request, count);
+	SetRequestedDataTransferCount(request, TRANSFER_LENGTH);
 	
-	SetDataTransferDirection(request, kSCSIDataTransfer_FromTargetToInitiator);
+	SetDataTransferDirection(request, kSCSIDataTransfer_FromInitiatorToTarget);
 	
-	SetTimeoutDuration(request, SCSI_NOMOTION_TIMEOUT);
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_SECURITY_PROTOCOL_OUT, SCSI_NOMOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -1498,28 +7204,58 @@ ErrorExit:
 	return result;
 }
 
+#if 0
+#pragma mark -
+#pragma mark 0x01 SSC Explicit Address Commands
+#pragma mark -
+#endif /* 0 */
+
 bool
-IOSCSITape::REWIND(
+IOSCSITape::VERIFY_16(
 	SCSITaskIdentifier	request,
 	SCSICmdField1Bit	IMMED,
+	SCSICmdField1Bit	BYTCMP,
+	SCSICmdField1Bit	FIXED,
+	SCSICmdField1Byte	PARTITION,
+	SCSICmdField8Byte	LOGICAL_OBJECT_IDENTIFIER,
+	SCSICmdField3Byte	VERIFICATION_LENGTH,
 	SCSICmdField1Byte	CONTROL)
 {
 	bool result = false;
 	
 	require(IsParameterValid(IMMED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(BYTCMP, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(FIXED, kSCSICmdFieldMask1Bit), ErrorExit);
+	require(IsParameterValid(PARTITION, kSCSICmdFieldMask1Byte), ErrorExit);
+	require(IsParameterValid(VERIFICATION_LENGTH, kSCSICmdFieldMask3Byte), ErrorExit);
 	require(IsParameterValid(CONTROL, kSCSICmdFieldMask1Byte), ErrorExit);
 	
+	/* byte compare needs a data-out buffer, which is not supported */
+	require((BYTCMP == 0), ErrorExit);
+	
 	SetCommandDescriptorBlock(request, 
-							  kSCSICmd_REWIND, 
-							  IMMED, 
-							  0x00, 
-							  0x00, 
+							  kSCSICmd_VERIFY_16, 
+							  (IMMED << 2) |
+							  (BYTCMP << 1) |
+							   FIXED, 
 							  0x00, 
+							  PARTITION, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 56) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 48) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 40) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 32) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 24) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >> 16) & 0xFF, 
+							  (LOGICAL_OBJECT_IDENTIFIER >>  8) & 0xFF, 
+							   LOGICAL_OBJECT_IDENTIFIER        & 0xFF, 
+							  (VERIFICATION_LENGTH >> 16) & 0xFF, 
+							  (VERIFICATION_LENGTH >>  8) & 0xFF, 
+							   VERIFICATION_LENGTH        & 0xFF, 
 							  CONTROL);
 	
 	SetDataTransferDirection(request, kSCSIDataTransfer_NoDataTransfer);
 	
-	SetTimeoutDuration(request, SCSI_MOTION_TIMEOUT);
+	SetTimeoutDuration(request, CommandTimeout(kSCSICmd_VERIFY_16, SCSI_MOTION_TIMEOUT));
 	
 	result = true;
 	
@@ -9,6 +9,10 @@
 
 #include <IOKit/scsi/IOSCSIMultimediaCommandsDevice.h>
 #include <IOKit/scsi/SCSICmds_MODE_Definitions.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <kern/thread_call.h>
+
+#include "custom_mtio.h"
 
 /* These were defined in the OS-supplied SCSICommandOperationCodes.h but
  * "#if 0"-ed out. May need to back these out if the official ones ever
@@ -33,9 +37,23 @@ enum
     kSCSICmd_REWIND                         = 0x01, /* Sec. 5.3.11: Mandatory*/
     kSCSICmd_SPACE                          = 0x11, /* Sec. 5.3.12: Mandatory*/
     kSCSICmd_VERIFY_6                       = 0x13, /* Sec. 5.3.13: Optional */
+    kSCSICmd_VERIFY_16                      = 0x8F, /* SSC-3 Sec. 6.8: Optional */
     kSCSICmd_WRITE_FILEMARKS                = 0x10  /* Sec. 5.3.15: Mandatory*/
 };
 
+/* SPC-3 medium auxiliary memory commands */
+enum
+{
+	kSCSICmd_READ_ATTRIBUTE					= 0x8C,
+	kSCSICmd_WRITE_ATTRIBUTE				= 0x8D
+};
+
+enum
+{
+	kSCSIReadAttributeServiceAction_AttributeValues	= 0x00,
+	kSCSIReadAttributeServiceAction_AttributeList	= 0x01
+};
+
 enum
 {
 	kSCSIReadPositionServiceAction_ShortFormBlockID			= 0x00,
@@ -72,6 +90,22 @@ struct SCSI_ReadPositionShortForm
 	UInt32	bytesInObjectBuffer;
 };
 
+struct SCSI_ReadPositionLongForm
+{
+	UInt8	flags;
+	UInt32	partitionNumber;
+	UInt64	logicalObjectNumber;
+	UInt64	logicalFileIdentifier;
+};
+
+enum ReadPositionLongFormFlags
+{
+	kSCSIReadPositionLongForm_BeginningOfPartition			= 0x80,
+	kSCSIReadPositionLongForm_EndOfPartition				= 0x40,
+	kSCSIReadPositionLongForm_MarkPositionUnknown			= 0x08,
+	kSCSIReadPositionLongForm_LogicalObjectNumberUnknown	= 0x04
+};
+
 enum ReadPositionShortFormFlags
 {
 	kSCSIReadPositionShortForm_BeginningOfPartition			= 0x80,
@@ -89,19 +123,90 @@ enum ReadPositionShortFormFlags
 #define SMH_DSP_WRITE_PROT      0x80
 
 #define TAPE_FORMAT "rst%d"
-#define STATUS_LOG(s, ...) IOLog(TAPE_FORMAT ": " s "\n", tapeNumber, ## __VA_ARGS__)
+#define TAPE_CTL_FORMAT "rst%d.ctl"
+
+/* The control node shares the unit number but never claims the drive,
+ * so status and log ioctls work while another process has it open. */
+#define ST_CTL_MINOR		0x800000
+#define ST_UNIT(dev)		(minor(dev) & ~ST_CTL_MINOR)
+#define ST_IS_CTL(dev)		(minor(dev) & ST_CTL_MINOR)
+
+#define ERROR_LOG(s, ...)	LogEvent(MT_LOG_ERR, s, ## __VA_ARGS__)
+#define WARN_LOG(s, ...)	LogEvent(MT_LOG_WARN, s, ## __VA_ARGS__)
+#define STATUS_LOG(s, ...)	LogEvent(MT_LOG_INFO, s, ## __VA_ARGS__)
+#define DEBUG_LOG(s, ...)	LogEvent(MT_LOG_DEBUG, s, ## __VA_ARGS__)
+
+#define ST_LOG_RING			64		/* events kept per device */
+#define ST_LOG_LIMITS		16		/* rate limited message slots */
+#define ST_LOG_BURST		5
+#define ST_LOG_INTERVAL		10000	/* ms */
+
+#define ST_TRACE_RING		1024	/* trace records, power of two */
+#define ST_CAPTURE_RING		4096	/* workload records, power of two */
+
+#define ST_PROGRESS_POLL_MIN	20		/* ms, first poll of an IMMED command */
+#define ST_PROGRESS_POLL	1000	/* ms, longest between polls */
+#define ST_RETRY_MAX_DELAY	5000	/* ms, cap on retry backoff */
+#define ST_READY_WAIT		60		/* s, default wait for ready on open */
+#define ST_READY_POLL		100		/* ms, first ready poll interval */
+#define ST_HEALTH_INTERVAL	300		/* s between health polls while open */
+#define ST_HEALTH_RETRY		5		/* s, wait for a busy drive to go idle */
+#define ST_HEALTH_CLOSE		2		/* s after close, poll once more */
+
+#define ST_SERIAL_LEN		64		/* media serial number, with NUL */
+#define ST_EOD_CACHE		16		/* cartridges whose EOD is kept */
+#define ST_DIGEST_FILES		64		/* files whose digest is kept */
+#define ST_BATCH_COUNT_MAX	0x7FFFFF	/* largest SPACE or WRITE FILEMARKS */
 
 #define ST_DEVOPEN			0x01
 #define ST_READONLY			0x02
 #define ST_BUFF_MODE		0x04
 #define ST_WRITTEN			0x08
 #define ST_WRITTEN_TOGGLE	0x10
+#define ST_READ_REVERSE		0x20
+#define ST_MEDIA_CHANGED	0x40
+#define ST_EARLY_WARNING	0x80
+#define ST_EOM_SIGNALLED	0x100
+#define ST_SPANNING			0x200
+#define ST_CRYPT_KEY		0x400	/* key to clear on close */
+#define ST_CRYPT_CHANGED	0x800	/* changed by someone else, not reported */
+#define ST_DEFERRED_ERROR	0x1000	/* found by a background poll, not reported */
 
 #define SENSE_FILEMARK		0x01
 #define SENSE_EOD			0x02
 #define SENSE_BOM			0x04
 #define SENSE_ILI			0x08
 #define SENSE_NOTREADY		0x10
+#define SENSE_INPROGRESS	0x20
+#define SENSE_EOM			0x40
+
+/* Fixed-size record ring with lock-free producers. The first field of
+ * every record is its sequence number + 1, written last to publish it. */
+struct STRing
+{
+	UInt8 *			buffer;
+	UInt32			recordSize;
+	UInt32			mask;
+	volatile SInt32	head;
+	UInt32			tail;
+};
+
+/* End of data of a partition. Cartridges without a serial number have
+ * an empty one and are forgotten when the media changes. */
+struct STEODEntry
+{
+	char			serial[ST_SERIAL_LEN];
+	UInt32			partition;
+	SInt64			eod;
+};
+
+struct STLogLimit
+{
+	const char *	format;
+	UInt64			windowStart;
+	UInt32			count;
+	UInt32			suppressed;
+};
 
 class IOSCSITape : public IOSCSIPrimaryCommandsDevice {
 	OSDeclareDefaultStructors(IOSCSITape)
@@ -117,22 +222,153 @@ public:
 	
 	int blkno;
 	int fileno;
+	SInt64 lba;
+	UInt32 partition;
+	
+	/* where READ POSITION last put the tape, so a position it could
+	 * only partly recover is not asked for again until the tape moves */
+	SInt64 rdposLba;
+	UInt32 rdposPartition;
+	int rdposFileno;
+	int rdposBlkno;
+	
+	/* seconds open waits for the drive to become ready */
+	int readyWait;
+	
+	/* residue of the last write past early warning */
+	int resid;
+	
+	/* programmable early warning, MB before the drive's own */
+	UInt16 pewSize;
+	
+	/* buffered mode as of the last MODE SENSE, MTBUFFER_* */
+	int bufferMode;
+	
+	/* logical block protection wanted, and set on the drive */
+	bool lbpEnabled;
+	bool lbpActive;
+	
+	/* held for each call of the tape device's opener and only tried
+	 * by background polls, so a poll never sends a command, or leaves
+	 * its sense, under one of the opener's */
+	IOLock *cmdLock;
 
 	/* Utilities */
 	bool IsFixedBlockSize(void);
+	
+	/* Event log */
+	void LogEvent(int, const char *, ...) __attribute__((format(printf, 3, 4)));
+	void ReadLog(struct mtlog *);
+	void GetLogControl(struct mtlogctl *);
+	int SetLogControl(struct mtlogctl *);
+	
+	/* Command trace */
+	int SetTrace(int);
+	int DrainTrace(struct mttracebuf *);
+	
+	/* Workload capture */
+	bool captureEnabled;
+	
+	int SetCapture(int);
+	int DrainCapture(struct mtwlbuf *);
+	void CaptureCall(int, u_long, int, int, int, int, UInt64);
+	
+	/* Operation progress */
+	void BeginProgress(int);
+	void SetProgress(SInt32);
+	void EndProgress(void);
+	void GetProgress(struct mtprogress *, bool);
+	void ProgressTimeout(void);
+	
+	/* Readiness for select() */
+	bool Busy(void);
+	int Select(bool, int, void *, struct proc *);
+	
+	/* Command timeouts */
+	UInt32 CommandTimeout(UInt8, UInt32);
+	bool IsCommandSupported(UInt8);
+	void GetCommandTimeout(struct mttimeout *);
+	int SetCommandTimeout(struct mttimeout *);
+	
+	/* End of data cache */
+	void IdentifyMedia(void);
+	void ForgetMedia(void);
+	SInt64 GetEndOfData(void);
+	void SetEndOfData(SInt64);
+	
+	/* Multi-volume spanning */
+	void SetSpanning(bool);
+	SInt64 SpanMark(void);
+	IOReturn SetSpanMark(SInt64);
+	int RequestVolume(int);
+	int WaitVolumeRequest(struct mtspan *);
+	int VolumeRequestDone(int);
+	
+	/* Drive health */
+	void ScheduleHealth(UInt32);
+	void HealthTimeout(void);
+	IOReturn PollHealth(bool);
+	IOReturn GetHealth(struct mthealth *);
+	
+	/* Per-file digests */
+	bool digestEnabled;
+	
+	void SetDigest(bool);
+	void DigestTransfer(IOMemoryDescriptor *, int, int, int, bool);
+	void DigestEnd(bool, int, int);
+	void DigestError(void);
+	IOReturn GetDigest(struct mtdigest *);
+	
+	/* Shared ring, mapped into the task that asked for it */
+	IOBufferMemoryDescriptor *sharedRing;
+	struct mtringhdr *sharedHeader;
+	int sharedDir;
+	UInt32 sharedSlots;
+	UInt32 sharedSlotSize;
+	UInt32 sharedOffset;
+	UInt32 sharedTail;
+	
+	IOReturn MapSharedRing(struct mtringmap *);
+	void UnmapSharedRing(void);
 
+	/* sense of the last command, for tracing and error reporting */
+	SCSITaskStatus lastTaskStatus;
+	UInt8 lastSenseKey;
+	UInt8 lastASC;
+	UInt8 lastASCQ;
+	SInt32 lastSenseInfo;
+	SInt32 lastProgress;
+	
 	/* SCSI Operations */
 	IOReturn Rewind(void);
 	IOReturn GetDeviceDetails(void);
 	IOReturn GetDeviceBlockLimits(void);
+	IOReturn GetCommandTimeouts(void);
+	IOReturn ReportOperationCodes(UInt8 *, UInt32, UInt32 *, UInt32 *);
+	IOReturn ReadMediaSerialNumber(char *, UInt32);
+	IOReturn ReadAttribute(struct mtmam *);
+	IOReturn WriteAttribute(struct mtmam *);
 	IOReturn TestUnitReady(void);
 	IOReturn WriteFilemarks(int);
 	IOReturn Space(SCSISpaceCode, int);
 	IOReturn LoadUnload(int);
 	IOReturn ReadPosition(SCSI_ReadPositionShortForm *, bool);
+	IOReturn ReadPositionLong(SCSI_ReadPositionLongForm *);
+	IOReturn Locate(UInt32, bool);
 	IOReturn ReadWrite(IOMemoryDescriptor *, int *);
+	IOReturn Verify(int, bool, UInt64);
+	IOReturn Erase(bool);
 	IOReturn SetDeviceDetails(SCSI_ModeSense_Default *);
 	IOReturn SetBlockSize(int);
+	IOReturn SetBufferedMode(int);
+	IOReturn ReadModePage(UInt8, UInt8, UInt8 *, UInt32);
+	IOReturn WriteModePage(UInt8 *, UInt32);
+	IOReturn SetEarlyWarningSize(UInt16);
+	IOReturn SetProtection(bool);
+	IOReturn GetCapacity(struct mtcapacity *);
+	IOReturn ReadLogPage(UInt8, UInt8 *, UInt32, bool);
+	IOReturn SetEncryption(struct mtcrypt *);
+	IOReturn GetEncryption(struct mtcrypt *, bool);
 private:
 	int tapeNumber;
 	
@@ -141,9 +377,106 @@ private:
 	SCSITaskStatus DoSCSICommand(SCSITaskIdentifier, UInt32);
 	void GetSense(SCSITaskIdentifier);
 	void InterpretSense(SCSI_Sense_Data *);
+	void UnitAttention(UInt8, UInt8);
+	IOReturn ReadSecurityPage(UInt16, UInt8 *, UInt32);
+	IOReturn FindCryptAlgorithm(UInt32, UInt8 *);
+	
+	/* Logical block protection */
+	IOReturn ProtectBuffer(
+		IOMemoryDescriptor *,
+		UInt32,
+		IOMemoryDescriptor **,
+		IOBufferMemoryDescriptor **);
+	IOReturn CheckProtection(IOMemoryDescriptor *, IOMemoryDescriptor *, bool, int *);
+	
+	/* drive encryption as of the last query */
+	struct mtcrypt cryptStatus;
+	bool cryptKnown;
 
+	/* Event log */
+	IOLock *logLock;
+	struct mtlogent *logRing;
+	UInt32 logNext;
+	int logLevel;
+	int logBurst;
+	int logInterval;
+	STLogLimit logLimits[ST_LOG_LIMITS];
+	
+	/* Command trace */
+	bool traceEnabled;
+	STRing traceRing;
+	volatile UInt32 traceDraining;
+	
+	void TraceCommand(SCSITaskIdentifier, UInt64, SCSITaskStatus);
+	
+	/* Workload capture */
+	STRing captureRing;
+	volatile UInt32 captureDraining;
+	
+	/* Operation progress */
+	IOLock *progressLock;
+	int progressOp;
+	UInt64 progressStart;
+	SInt32 progressValue;
+	bool progressDetached;
+	volatile SInt32 cmdInFlight;
+	struct selinfo progressSelect;	/* threads in select() on the tape device */
+	
+	thread_call_t progressCall;
+	
+	void ScheduleProgress(void);
+	void ProgressWakeup(void);
+	IOReturn PollProgress(void);
+	IOReturn WaitForImmediate(UInt32);
+	
+	/* Command timeouts, in ms, indexed by operation code */
+	bool cmdTableValid;
+	UInt8 cmdSupported[32];
+	UInt32 cmdTimeout[256];
+	UInt32 cmdTimeoutOverride[256];
+	
+	/* set once the drive rejects the long form of READ POSITION */
+	bool noLongPosition;
+	
+	/* End of data cache */
+	char mediaSerial[ST_SERIAL_LEN];
+	STEODEntry eodCache[ST_EOD_CACHE];
+	UInt32 eodCacheNext;
+	STEODEntry *eodEntry;	/* of the loaded cartridge, once found */
+	
+	STEODEntry *EndOfDataEntry(bool);
+	
+	/* Multi-volume spanning, a request handed to the helper */
+	IOLock *spanLock;
+	int spanState;
+	int spanError;
+	struct mtspan spanRequest;
+	struct selinfo spanSelect;	/* threads in select() on the control device */
+	SInt64 spanMark;			/* of the loaded cartridge, once read */
+	SInt64 spanMarkPartition;	/* partition spanMark is of, or -1 */
+	
+	/* Drive health, as of the last poll */
+	IOLock *healthLock;
+	thread_call_t healthCall;
+	struct mthealth health;
+	UInt64 healthTime;
+	
+	/* Per-file digests, the file in progress and the last ones done */
+	IOLock *digestLock;
+	struct mtdigest digestCurrent;
+	bool digestActive;
+	int digestBlock;
+	struct mtdigest digests[ST_DIGEST_FILES];
+	UInt32 digestNext;
+	
+	void DigestStore(void);
+	
+	/* Shared ring */
+	IOMemoryMap *sharedMap;
+	
 	/* utilities for major/minor to instance tracking */
 	void *cdev_node;
+	void *ctl_node;
 	static int deviceCount;
 
 	bool FindDeviceMinorNumber(void);
@@ -182,12 +515,30 @@ private:
 		SCSICmdField3Byte,
 		SCSICmdField1Byte);
 	
+	bool READ_REVERSE_6(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		UInt32,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField3Byte,
+		SCSICmdField1Byte);
+	
 	bool SPACE_6(
 		SCSITaskIdentifier,
 		SCSICmdField4Bit,
 		SCSICmdField3Byte,
 		SCSICmdField1Byte);
 	
+	bool VERIFY_6(
+		SCSITaskIdentifier,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField3Byte,
+		SCSICmdField1Byte);
+	
 	bool WRITE_6(
 		SCSITaskIdentifier,
 		IOMemoryDescriptor *,
@@ -213,6 +564,15 @@ private:
 		SCSICmdField1Bit,
 		SCSICmdField1Byte);
 	
+	bool LOCATE_10(
+		SCSITaskIdentifier,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField4Byte,
+		SCSICmdField1Byte,
+		SCSICmdField1Byte);
+	
 	bool READ_BLOCK_LIMITS(
 		SCSITaskIdentifier,
 		IOMemoryDescriptor *,
@@ -229,17 +589,113 @@ private:
 		SCSITaskIdentifier,
 		SCSICmdField1Bit,
 		SCSICmdField1Byte);
+	
+	/* SPC Commands */
+	bool REPORT_SUPPORTED_OPERATION_CODES(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField1Bit,
+		SCSICmdField3Bit,
+		SCSICmdField1Byte,
+		SCSICmdField2Byte,
+		SCSICmdField4Byte,
+		SCSICmdField1Byte);
+	
+	bool READ_MEDIA_SERIAL_NUMBER(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField4Byte,
+		SCSICmdField1Byte);
+	
+	bool MODE_SENSE_SUBPAGE_6(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField1Bit,
+		SCSICmdField2Bit,
+		SCSICmdField6Bit,
+		SCSICmdField1Byte,
+		SCSICmdField1Byte,
+		SCSICmdField1Byte);
+	
+	bool READ_ATTRIBUTE(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField5Bit,
+		SCSICmdField1Byte,
+		SCSICmdField1Byte,
+		SCSICmdField2Byte,
+		SCSICmdField4Byte,
+		SCSICmdField1Bit,
+		SCSICmdField1Byte);
+	
+	bool WRITE_ATTRIBUTE(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField1Bit,
+		SCSICmdField1Byte,
+		SCSICmdField1Byte,
+		SCSICmdField4Byte,
+		SCSICmdField1Byte);
+	
+	bool SECURITY_PROTOCOL_IN(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField1Byte,
+		SCSICmdField2Byte,
+		SCSICmdField1Bit,
+		SCSICmdField4Byte,
+		SCSICmdField1Byte);
+	
+	bool SECURITY_PROTOCOL_OUT(
+		SCSITaskIdentifier,
+		IOMemoryDescriptor *,
+		SCSICmdField1Byte,
+		SCSICmdField2Byte,
+		SCSICmdField1Bit,
+		SCSICmdField4Byte,
+		SCSICmdField1Byte);
+	
+	/* SSC Explicit Address Commands */
+	bool VERIFY_16(
+		SCSITaskIdentifier,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField1Bit,
+		SCSICmdField1Byte,
+		SCSICmdField8Byte,
+		SCSICmdField3Byte,
+		SCSICmdField1Byte);
 };
 
+bool st_log_allowed(STLogLimit *limits, IOLock *lock, int burst, int interval,
+					const char *format, UInt32 *suppressed);
+
 int st_rewind(IOSCSITape *st);
 int st_space(IOSCSITape *st, SCSISpaceCode type, int number);
 int st_write_filemarks(IOSCSITape *st, int number);
 int st_unload(IOSCSITape *st);
 int st_rdpos(IOSCSITape *st, bool vendor, unsigned int *data);
+int st_verify(IOSCSITape *st, struct mtverify *mv);
+int st_erase(IOSCSITape *st, bool longErase);
+int st_wait_ready(IOSCSITape *st);
+int st_resync(IOSCSITape *st);
+int st_locate(IOSCSITape *st, UInt32 addr, bool hardware);
+int st_eom(IOSCSITape *st);
+int st_read_attribute(IOSCSITape *st, struct mtmam *mm);
+int st_write_attribute(IOSCSITape *st, struct mtmam *mm);
+int st_set_early_warning(IOSCSITape *st, int number);
+int st_capacity(IOSCSITape *st, struct mtcapacity *mc);
+int st_next_volume(IOSCSITape *st, int op);
+int st_health(IOSCSITape *st, struct mthealth *mh, bool refresh);
+int st_set_crypt(IOSCSITape *st, struct mtcrypt *mc);
+int st_get_crypt(IOSCSITape *st, struct mtcrypt *mc, bool refresh);
+int st_set_protection(IOSCSITape *st, int mode);
+int st_set_buffered(IOSCSITape *st, int mode);
 
 int st_open(dev_t dev, int flags, int devtype, struct proc *p);
 int st_close(dev_t dev, int flags, int devtype, struct proc *p);
 int st_readwrite(dev_t dev, struct uio *uio, int ioflag);
 int st_ioctl(dev_t dev, u_long cmd, caddr_t data, int fflag, struct proc *p);
+int st_select(dev_t dev, int which, void *wql, struct proc *p);
 
 IOMemoryDescriptor *IOMemoryDescriptorFromUIO(struct uio *);
@@ -0,0 +1,517 @@
+/*
+ *  chio.c
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ *  Operate a SCSI medium changer: move media between slots, drives
+ *  and portals, and list what the changer holds.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "chio.h"
+#include "custom_mtio.h"
+
+struct element_type {
+	const char	*et_name;
+	int		et_type;
+};
+
+static const struct element_type elements[] = {
+	{ "picker",	CHET_MT },
+	{ "slot",	CHET_ST },
+	{ "portal",	CHET_IE },
+	{ "drive",	CHET_DT },
+	{ NULL,		0 }
+};
+
+static int	changer;
+
+static int	parse_type(const char *);
+static int	parse_unit(const char *);
+static int	parse_invert(int, char *[], const char *, const char *);
+static const char *type_name(int);
+static void	do_move(int, char *[]);
+static void	do_exchange(int, char *[]);
+static void	do_position(int, char *[]);
+static void	do_params(int, char *[]);
+static void	do_getpicker(int, char *[]);
+static void	do_setpicker(int, char *[]);
+static void	do_status(int, char *[]);
+static void	do_ielem(int, char *[]);
+static void	do_span(int, char *[]);
+static int	span_swap(int, int);
+static void	usage(void);
+
+static const struct command {
+	const char	*c_name;
+	void		(*c_fn)(int, char *[]);
+} commands[] = {
+	{ "exchange",	do_exchange },
+	{ "getpicker",	do_getpicker },
+	{ "ielem",	do_ielem },
+	{ "move",	do_move },
+	{ "params",	do_params },
+	{ "position",	do_position },
+	{ "setpicker",	do_setpicker },
+	{ "span",	do_span },
+	{ "status",	do_status },
+	{ NULL,		NULL }
+};
+
+int
+main(int argc, char *argv[])
+{
+	const struct command *cp;
+	const char *device = NULL;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "f:")) != -1)
+		switch (ch) {
+		case 'f':
+			device = optarg;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1)
+		usage();
+	if (device == NULL && (device = getenv("CHANGER")) == NULL)
+		device = "/dev/ch0";
+
+	for (cp = commands; cp->c_name != NULL; cp++)
+		if (strcmp(cp->c_name, argv[0]) == 0)
+			break;
+	if (cp->c_name == NULL)
+		usage();
+
+	if ((changer = open(device, O_RDWR)) < 0)
+		err(1, "%s", device);
+
+	(*cp->c_fn)(argc - 1, argv + 1);
+
+	(void)close(changer);
+	exit(0);
+}
+
+static int
+parse_type(const char *name)
+{
+	const struct element_type *et;
+
+	for (et = elements; et->et_name != NULL; et++)
+		if (strcmp(et->et_name, name) == 0)
+			return et->et_type;
+	errx(1, "unknown element type: %s", name);
+}
+
+static int
+parse_unit(const char *s)
+{
+	char *p;
+	long unit;
+
+	unit = strtol(s, &p, 10);
+	if (*s == '\0' || *p != '\0' || unit < 0 || unit > 0xffff)
+		errx(1, "invalid element unit: %s", s);
+	return (int)unit;
+}
+
+/* trailing keywords asking for the first or second medium to be
+ * turned over */
+static int
+parse_invert(int argc, char *argv[], const char *inv1, const char *inv2)
+{
+	int flags = 0, i;
+
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], inv1) == 0)
+			flags |= 1;
+		else if (inv2 != NULL && strcmp(argv[i], inv2) == 0)
+			flags |= 2;
+		else
+			usage();
+	}
+	return flags;
+}
+
+static const char *
+type_name(int type)
+{
+	const struct element_type *et;
+
+	for (et = elements; et->et_name != NULL; et++)
+		if (et->et_type == type)
+			return et->et_name;
+	return "?";
+}
+
+static void
+do_move(int argc, char *argv[])
+{
+	struct changer_move cm;
+
+	if (argc < 4)
+		usage();
+
+	memset(&cm, 0, sizeof(cm));
+	cm.cm_fromtype = parse_type(argv[0]);
+	cm.cm_fromunit = parse_unit(argv[1]);
+	cm.cm_totype = parse_type(argv[2]);
+	cm.cm_tounit = parse_unit(argv[3]);
+	if (parse_invert(argc - 4, argv + 4, "inv", NULL))
+		cm.cm_flags |= CM_INVERT;
+
+	if (ioctl(changer, CHIOMOVE, &cm) < 0)
+		err(1, "move");
+}
+
+static void
+do_exchange(int argc, char *argv[])
+{
+	struct changer_exchange ce;
+	int inv;
+
+	if (argc < 4)
+		usage();
+
+	memset(&ce, 0, sizeof(ce));
+	ce.ce_srctype = parse_type(argv[0]);
+	ce.ce_srcunit = parse_unit(argv[1]);
+	ce.ce_fdsttype = parse_type(argv[2]);
+	ce.ce_fdstunit = parse_unit(argv[3]);
+	argc -= 4;
+	argv += 4;
+
+	/* without a second destination the media swap places */
+	if (argc >= 2 && strncmp(argv[0], "inv", 3) != 0) {
+		ce.ce_sdsttype = parse_type(argv[0]);
+		ce.ce_sdstunit = parse_unit(argv[1]);
+		argc -= 2;
+		argv += 2;
+	} else {
+		ce.ce_sdsttype = ce.ce_srctype;
+		ce.ce_sdstunit = ce.ce_srcunit;
+	}
+
+	inv = parse_invert(argc, argv, "inv1", "inv2");
+	if (inv & 1)
+		ce.ce_flags |= CE_INVERT1;
+	if (inv & 2)
+		ce.ce_flags |= CE_INVERT2;
+
+	if (ioctl(changer, CHIOEXCHANGE, &ce) < 0)
+		err(1, "exchange");
+}
+
+static void
+do_position(int argc, char *argv[])
+{
+	struct changer_position cp;
+
+	if (argc < 2)
+		usage();
+
+	memset(&cp, 0, sizeof(cp));
+	cp.cp_type = parse_type(argv[0]);
+	cp.cp_unit = parse_unit(argv[1]);
+	if (parse_invert(argc - 2, argv + 2, "inv", NULL))
+		cp.cp_flags |= CP_INVERT;
+
+	if (ioctl(changer, CHIOPOSITION, &cp) < 0)
+		err(1, "position");
+}
+
+static void
+do_params(int argc, char *argv[])
+{
+	struct changer_params cp;
+
+	if (argc != 0)
+		usage();
+
+	if (ioctl(changer, CHIOGPARAMS, &cp) < 0)
+		err(1, "params");
+
+	printf("%u slot%s, %u drive%s, %u picker%s, %u portal%s\n",
+	    cp.cp_nslots, cp.cp_nslots == 1 ? "" : "s",
+	    cp.cp_ndrives, cp.cp_ndrives == 1 ? "" : "s",
+	    cp.cp_npickers, cp.cp_npickers == 1 ? "" : "s",
+	    cp.cp_nportals, cp.cp_nportals == 1 ? "" : "s");
+}
+
+static void
+do_getpicker(int argc, char *argv[])
+{
+	int picker;
+
+	if (argc != 0)
+		usage();
+
+	if (ioctl(changer, CHIOGPICKER, &picker) < 0)
+		err(1, "getpicker");
+
+	printf("picker %d\n", picker);
+}
+
+static void
+do_setpicker(int argc, char *argv[])
+{
+	int picker;
+
+	if (argc != 1)
+		usage();
+
+	picker = parse_unit(argv[0]);
+
+	if (ioctl(changer, CHIOSPICKER, &picker) < 0)
+		err(1, "setpicker");
+}
+
+static void
+print_status(const struct changer_element_status *ces)
+{
+	static const struct {
+		int		f_flag;
+		const char	*f_name;
+	} flags[] = {
+		{ CES_FULL,	"FULL" },
+		{ CES_IMPEXP,	"IMPEXP" },
+		{ CES_EXCEPT,	"EXCEPT" },
+		{ CES_ACCESS,	"ACCESS" },
+		{ CES_EXENAB,	"EXENAB" },
+		{ CES_INENAB,	"INENAB" },
+		{ CES_INVERT,	"INVERT" },
+		{ 0,		NULL }
+	};
+	const char *sep = "";
+	int i;
+
+	printf("%s %d: <", type_name(ces->ces_type), ces->ces_unit);
+	for (i = 0; flags[i].f_name != NULL; i++)
+		if (ces->ces_flags & flags[i].f_flag) {
+			printf("%s%s", sep, flags[i].f_name);
+			sep = ",";
+		}
+	printf(">");
+
+	if (ces->ces_flags & CES_VOLTAG_VALID)
+		printf(" voltag: <%s>", ces->ces_voltag);
+	if (ces->ces_flags & CES_SOURCE_VALID)
+		printf(" source: <%s %d>", type_name(ces->ces_source_type),
+		    ces->ces_source_unit);
+	if (ces->ces_flags & CES_EXCEPT)
+		printf(" sense: <0x%02x/0x%02x>", ces->ces_asc, ces->ces_ascq);
+	printf("\n");
+}
+
+/*
+ * status [-r] [type [unit]]
+ */
+static void
+do_status(int argc, char *argv[])
+{
+	struct changer_element_status_request cesr;
+	int type, first = CHET_MT, last = CHET_DT, unit = 0, flags = 0, i;
+
+	if (argc > 0 && strcmp(argv[0], "-r") == 0) {
+		flags |= CESR_REFRESH;
+		argc--;
+		argv++;
+	}
+	if (argc > 2)
+		usage();
+	if (argc > 0)
+		first = last = parse_type(argv[0]);
+	if (argc > 1)
+		unit = parse_unit(argv[1]);
+
+	for (type = first; type <= last; type++) {
+		memset(&cesr, 0, sizeof(cesr));
+		cesr.cesr_type = type;
+		cesr.cesr_unit = unit;
+		cesr.cesr_flags = flags;
+
+		do {
+			if (ioctl(changer, CHIOGSTATUS, &cesr) < 0)
+				err(1, "status");
+			/* a single element if a unit was given */
+			if (argc > 1 && cesr.cesr_count > 1)
+				cesr.cesr_count = 1;
+			for (i = 0; i < cesr.cesr_count; i++)
+				print_status(&cesr.cesr_data[i]);
+			cesr.cesr_unit += cesr.cesr_count;
+
+			/* only the first batch refreshes the cache */
+			cesr.cesr_flags &= ~CESR_REFRESH;
+		} while (argc < 2 && cesr.cesr_count == CH_STATUS_BATCH);
+
+		flags &= ~CESR_REFRESH;
+	}
+}
+
+static void
+do_ielem(int argc, char *argv[])
+{
+	if (argc != 0)
+		usage();
+
+	if (ioctl(changer, CHIOIELEM) < 0)
+		err(1, "ielem");
+}
+
+/* the status of one element, or -1 if it is not known */
+static int
+element_status(int type, int unit, struct changer_element_status *ces)
+{
+	struct changer_element_status_request cesr;
+
+	memset(&cesr, 0, sizeof(cesr));
+	cesr.cesr_type = type;
+	cesr.cesr_unit = unit;
+
+	if (ioctl(changer, CHIOGSTATUS, &cesr) < 0)
+		return -1;
+	if (cesr.cesr_count < 1) {
+		errno = ENXIO;
+		return -1;
+	}
+	*ces = cesr.cesr_data[0];
+	return 0;
+}
+
+/*
+ * Put the cartridge in the drive back where it came from, or in the first
+ * empty slot, and load the one in next.
+ */
+static int
+span_swap(int drive, int next)
+{
+	struct changer_params cp;
+	struct changer_element_status ces;
+	struct changer_move cm;
+	int slot = -1, i;
+
+	if (ioctl(changer, CHIOGPARAMS, &cp) < 0)
+		return errno;
+	if (element_status(CHET_DT, drive, &ces) < 0)
+		return errno;
+
+	if (ces.ces_flags & CES_FULL) {
+		if ((ces.ces_flags & CES_SOURCE_VALID) &&
+		    ces.ces_source_type == CHET_ST)
+			slot = ces.ces_source_unit;
+		else
+			for (i = 0; i < (int)cp.cp_nslots; i++) {
+				struct changer_element_status s;
+
+				if (element_status(CHET_ST, i, &s) == 0 &&
+				    !(s.ces_flags & CES_FULL)) {
+					slot = i;
+					break;
+				}
+			}
+		if (slot < 0)
+			return ENOSPC;
+
+		memset(&cm, 0, sizeof(cm));
+		cm.cm_fromtype = CHET_DT;
+		cm.cm_fromunit = drive;
+		cm.cm_totype = CHET_ST;
+		cm.cm_tounit = slot;
+		if (ioctl(changer, CHIOMOVE, &cm) < 0)
+			return errno;
+	}
+
+	/* a cartridge of the set that is not where it was listed */
+	if (element_status(CHET_ST, next, &ces) < 0)
+		return errno;
+	if (!(ces.ces_flags & CES_FULL))
+		return ENOENT;
+
+	memset(&cm, 0, sizeof(cm));
+	cm.cm_fromtype = CHET_ST;
+	cm.cm_fromunit = next;
+	cm.cm_totype = CHET_DT;
+	cm.cm_tounit = drive;
+	if (ioctl(changer, CHIOMOVE, &cm) < 0)
+		return errno;
+	printf("volume loaded from slot %d\n", next);
+	return 0;
+}
+
+/*
+ * span <tape> <drive> <slot> [<slot> ...]
+ */
+static void
+do_span(int argc, char *argv[])
+{
+	struct mtspan ms;
+	int tape, drive, error, i;
+
+	if (argc < 3)
+		usage();
+	drive = parse_unit(argv[1]);
+	for (i = 2; i < argc; i++)
+		(void)parse_unit(argv[i]);
+
+	/* the control device, so that the writer can keep the tape open */
+	if ((tape = open(argv[0], O_RDONLY)) < 0)
+		err(1, "%s", argv[0]);
+
+	for (;;) {
+		if (ioctl(tape, MTIOCSPANWAIT, &ms) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "%s: wait", argv[0]);
+		}
+
+		printf("%s wants volume %u\n",
+		    ms.ms_op == MTSPAN_WRITE ? "writer" : "reader",
+		    ms.ms_volume);
+		fflush(stdout);
+
+		/* the slots hold the set in order, from volume 0 */
+		if (ms.ms_volume >= (uint32_t)(argc - 2))
+			error = ENOSPC;
+		else
+			error = span_swap(drive, parse_unit(argv[2 + ms.ms_volume]));
+		if (error != 0)
+			warnx("volume %u: %s", ms.ms_volume, strerror(error));
+
+		if (ioctl(tape, MTIOCSPANDONE, &error) < 0)
+			warn("%s: done", argv[0]);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: chio [-f changer] command [args ...]\n"
+	    "       move <from-type> <from-unit> <to-type> <to-unit> [inv]\n"
+	    "       exchange <src-type> <src-unit> <dst1-type> <dst1-unit>\n"
+	    "           [<dst2-type> <dst2-unit>] [inv1] [inv2]\n"
+	    "       position <to-type> <to-unit> [inv]\n"
+	    "       params\n"
+	    "       getpicker\n"
+	    "       setpicker <unit>\n"
+	    "       status [-r] [<type> [<unit>]]\n"
+	    "       ielem\n"
+	    "       span <tape-control> <drive-unit> <slot> [<slot> ...]\n");
+	exit(1);
+}
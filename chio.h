@@ -0,0 +1,127 @@
+/*
+ *  chio.h
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+#ifndef _CHIO_H_
+#define _CHIO_H_
+
+/*
+ * Element types. Elements are named by type and unit, the unit being
+ * the element's index among those of its type.
+ */
+#define	CHET_MT		0	/* medium transport (picker) */
+#define	CHET_ST		1	/* storage slot */
+#define	CHET_IE		2	/* import/export portal */
+#define	CHET_DT		3	/* data transfer (drive) */
+#define	CHET_MAX	4
+
+/*
+ * Move the medium in one element to another, with the picker set by
+ * CHIOSPICKER.
+ */
+#define	CM_INVERT	0x01	/* turn the medium over */
+
+struct changer_move {
+	uint16_t	cm_fromtype;
+	uint16_t	cm_fromunit;
+	uint16_t	cm_totype;
+	uint16_t	cm_tounit;
+	uint32_t	cm_flags;	/* CM_* */
+};
+
+/*
+ * Move the medium in the source to the first destination, and the
+ * medium that was there to the second. The second destination may be
+ * the source itself.
+ */
+#define	CE_INVERT1	0x01	/* turn over the first medium */
+#define	CE_INVERT2	0x02	/* turn over the second medium */
+
+struct changer_exchange {
+	uint16_t	ce_srctype;
+	uint16_t	ce_srcunit;
+	uint16_t	ce_fdsttype;
+	uint16_t	ce_fdstunit;
+	uint16_t	ce_sdsttype;
+	uint16_t	ce_sdstunit;
+	uint32_t	ce_flags;	/* CE_* */
+};
+
+/*
+ * Position the picker in front of an element.
+ */
+#define	CP_INVERT	0x01	/* invert the picker */
+
+struct changer_position {
+	uint16_t	cp_type;
+	uint16_t	cp_unit;
+	uint32_t	cp_flags;	/* CP_* */
+};
+
+/*
+ * Number of elements of each type.
+ */
+struct changer_params {
+	uint32_t	cp_npickers;
+	uint32_t	cp_nslots;
+	uint32_t	cp_nportals;
+	uint32_t	cp_ndrives;
+};
+
+/*
+ * Element status. The driver keeps the status of every element and
+ * only reads it again from the changer after a unit attention (a door
+ * opened, a reset) or when CESR_REFRESH is set; moves made through the
+ * driver update it in place.
+ */
+#define	CES_FULL		0x0001	/* holds a medium */
+#define	CES_IMPEXP		0x0002	/* placed by the operator */
+#define	CES_EXCEPT		0x0004	/* abnormal state, see asc/ascq */
+#define	CES_ACCESS		0x0008	/* accessible by the picker */
+#define	CES_EXENAB		0x0010	/* portal can export */
+#define	CES_INENAB		0x0020	/* portal can import */
+#define	CES_INVERT		0x0040	/* medium was turned over */
+#define	CES_SOURCE_VALID	0x0080	/* ces_source_* are valid */
+#define	CES_VOLTAG_VALID	0x0100	/* ces_voltag is valid */
+
+#define	CH_VOLTAG_LEN		32	/* volume identifier */
+#define	CH_STATUS_BATCH		16
+
+struct changer_element_status {
+	uint16_t	ces_type;		/* CHET_* */
+	uint16_t	ces_unit;
+	uint16_t	ces_addr;		/* SCSI element address */
+	uint16_t	ces_flags;		/* CES_* */
+	uint8_t		ces_asc;		/* additional sense code */
+	uint8_t		ces_ascq;		/* and qualifier */
+	uint16_t	ces_source_type;	/* where the medium came from */
+	uint16_t	ces_source_unit;
+	uint16_t	ces_pad;
+	char		ces_voltag[CH_VOLTAG_LEN + 1];
+	char		ces_pad2[3];
+};
+
+#define	CESR_REFRESH	0x01	/* read the status from the changer */
+
+struct changer_element_status_request {
+	uint16_t	cesr_type;	/* in: CHET_* */
+	uint16_t	cesr_unit;	/* in: first unit wanted */
+	uint16_t	cesr_flags;	/* in: CESR_* */
+	uint16_t	cesr_count;	/* out: entries returned */
+	struct changer_element_status	cesr_data[CH_STATUS_BATCH];
+};
+
+#define	CHIOMOVE	_IOW('C', 1, struct changer_move)	/* move medium */
+#define	CHIOEXCHANGE	_IOW('C', 2, struct changer_exchange)	/* exchange medium */
+#define	CHIOPOSITION	_IOW('C', 3, struct changer_position)	/* position picker */
+#define	CHIOGPICKER	_IOR('C', 4, int)	/* get current picker */
+#define	CHIOSPICKER	_IOW('C', 5, int)	/* set current picker */
+#define	CHIOGPARAMS	_IOR('C', 6, struct changer_params)	/* get element counts */
+#define	CHIOIELEM	_IO('C', 7)	/* rescan the inventory */
+#define	CHIOGSTATUS	_IOWR('C', 8, struct changer_element_status_request)	/* get element status */
+
+#endif /* _CHIO_H_ */
@@ -0,0 +1,398 @@
+/*
+ *  crc32c.c
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+/*
+ * The hardware version runs three CRC32 instruction streams over
+ * adjacent stretches of the buffer, as each instruction waits on the
+ * one before it in its own stream, and joins the three CRCs with tables
+ * that apply a stretch's worth of zeros. Only general purpose registers
+ * are used, so it is safe in the kernel without saving the FPU state.
+ * Without the instructions the CRC is computed eight bytes at a time
+ * from tables. The tables are built on first use by the one thread
+ * that claims them, and published with a release store; a thread that
+ * finds them still being built computes its CRC without them.
+ */
+
+#include "crc32c.h"
+
+#define CRC32C_POLY		0x82F63B78	/* reflected */
+#define CRC32C_LONG		8192
+#define CRC32C_SHORT	256
+
+/* states of a set of tables */
+#define CRC32C_UNBUILT	0
+#define CRC32C_BUILDING	1
+#define CRC32C_READY	2
+
+#if defined(__x86_64__)
+#define CRC32C_X86		1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM		1
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CRC32C_BIG_ENDIAN	1
+#endif
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_table_state;
+
+#if CRC32C_X86 || CRC32C_ARM
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+static int crc32c_zeros_state;
+#endif
+
+/*
+ * Whether a set of tables can be used, building them if no other thread
+ * has started to. The acquire load pairs with the release store, so the
+ * tables are seen whole once the state is.
+ */
+static int crc32c_tables(int *state, void (*build)(void))
+{
+	int expected = CRC32C_UNBUILT;
+
+	if (__atomic_load_n(state, __ATOMIC_ACQUIRE) == CRC32C_READY)
+		return 1;
+
+	if (!__atomic_compare_exchange_n(state, &expected, CRC32C_BUILDING, 0,
+									 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return 0;
+
+	build();
+	__atomic_store_n(state, CRC32C_READY, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+static void crc32c_init_table(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+
+		crc32c_table[0][i] = crc;
+	}
+
+	/* table j is byte i followed by j zero bytes */
+	for (i = 0; i < 256; i++)
+	{
+		crc = crc32c_table[0][i];
+
+		for (j = 1; j < 8; j++)
+		{
+			crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+}
+
+/* a bit at a time, while another thread builds the tables */
+static uint32_t crc32c_bitwise(uint32_t crc, const uint8_t *p, size_t len)
+{
+	int j;
+
+	crc = ~crc;
+
+	while (len--)
+	{
+		crc ^= *p++;
+
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+#ifndef CRC32C_BIG_ENDIAN
+	uint64_t word;
+#endif
+
+	if (!crc32c_tables(&crc32c_table_state, crc32c_init_table))
+		return crc32c_bitwise(crc, p, len);
+
+	crc = ~crc;
+
+#ifndef CRC32C_BIG_ENDIAN
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8)
+	{
+		word = *(const uint64_t *)p ^ crc;
+
+		crc = crc32c_table[7][ word        & 0xFF] ^
+			  crc32c_table[6][(word >>  8) & 0xFF] ^
+			  crc32c_table[5][(word >> 16) & 0xFF] ^
+			  crc32c_table[4][(word >> 24) & 0xFF] ^
+			  crc32c_table[3][(word >> 32) & 0xFF] ^
+			  crc32c_table[2][(word >> 40) & 0xFF] ^
+			  crc32c_table[1][(word >> 48) & 0xFF] ^
+			  crc32c_table[0][ word >> 56        ];
+
+		p += 8;
+		len -= 8;
+	}
+#endif
+
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+#if CRC32C_X86 || CRC32C_ARM
+
+#if CRC32C_X86
+
+static inline uint64_t crc32c_u64(uint64_t crc, uint64_t data)
+{
+	__asm__("crc32q %1, %0" : "+r" (crc) : "rm" (data));
+	return crc;
+}
+
+static inline uint32_t crc32c_u8(uint32_t crc, uint8_t data)
+{
+	__asm__("crc32b %1, %0" : "+r" (crc) : "rm" (data));
+	return crc;
+}
+
+#else /* CRC32C_ARM */
+
+static inline uint64_t crc32c_u64(uint64_t crc, uint64_t data)
+{
+	uint32_t c = (uint32_t)crc;
+
+	__asm__("crc32cx %w0, %w0, %x1" : "+r" (c) : "r" (data));
+	return c;
+}
+
+static inline uint32_t crc32c_u8(uint32_t crc, uint8_t data)
+{
+	__asm__("crc32cb %w0, %w0, %w1" : "+r" (crc) : "r" ((uint32_t)data));
+	return crc;
+}
+
+#endif
+
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	while (vec)
+	{
+		if (vec & 1)
+			sum ^= *mat;
+
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* the operator that feeds len zero bytes, a power of two, to a CRC */
+static void crc32c_zeros_op(uint32_t *even, size_t len)
+{
+	uint32_t odd[32];
+	uint32_t row = 1;
+	int n;
+
+	/* one zero bit */
+	odd[0] = CRC32C_POLY;
+
+	for (n = 1; n < 32; n++)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	/* two, then four zero bits */
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	/* each square doubles it, the first to one zero byte */
+	do
+	{
+		gf2_matrix_square(even, odd);
+		len >>= 1;
+
+		if (len == 0)
+			return;
+
+		gf2_matrix_square(odd, even);
+		len >>= 1;
+	} while (len);
+
+	for (n = 0; n < 32; n++)
+		even[n] = odd[n];
+}
+
+static void crc32c_zeros(uint32_t zeros[][256], size_t len)
+{
+	uint32_t op[32];
+	uint32_t n;
+
+	crc32c_zeros_op(op, len);
+
+	for (n = 0; n < 256; n++)
+	{
+		zeros[0][n] = gf2_matrix_times(op, n);
+		zeros[1][n] = gf2_matrix_times(op, n << 8);
+		zeros[2][n] = gf2_matrix_times(op, n << 16);
+		zeros[3][n] = gf2_matrix_times(op, n << 24);
+	}
+}
+
+static void crc32c_init_zeros(void)
+{
+	crc32c_zeros(crc32c_long, CRC32C_LONG);
+	crc32c_zeros(crc32c_short, CRC32C_SHORT);
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc)
+{
+	return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^
+		   zeros[2][(crc >> 16) & 0xFF] ^ zeros[3][crc >> 24];
+}
+
+/* three streams of stride bytes each, joined when all three are done */
+static inline uint64_t crc32c_stripes(
+	uint64_t crc0, const uint8_t **next, size_t *len,
+	size_t stride, uint32_t zeros[][256])
+{
+	const uint8_t *p = *next;
+	const uint8_t *end;
+	uint64_t crc1, crc2;
+
+	while (*len >= stride * 3)
+	{
+		crc1 = 0;
+		crc2 = 0;
+		end = p + stride;
+
+		do
+		{
+			crc0 = crc32c_u64(crc0, *(const uint64_t *)p);
+			crc1 = crc32c_u64(crc1, *(const uint64_t *)(p + stride));
+			crc2 = crc32c_u64(crc2, *(const uint64_t *)(p + stride * 2));
+			p += 8;
+		} while (p < end);
+
+		crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ (uint32_t)crc1;
+		crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ (uint32_t)crc2;
+
+		p += stride * 2;
+		*len -= stride * 3;
+	}
+
+	*next = p;
+
+	return crc0;
+}
+
+uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	uint64_t crc0;
+	int striped;
+
+	striped = crc32c_tables(&crc32c_zeros_state, crc32c_init_zeros);
+
+	crc0 = ~crc;
+
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc0 = crc32c_u8((uint32_t)crc0, *p++);
+		len--;
+	}
+
+	/* one stream only, while another thread builds the tables */
+	if (striped)
+	{
+		crc0 = crc32c_stripes(crc0, &p, &len, CRC32C_LONG, crc32c_long);
+		crc0 = crc32c_stripes(crc0, &p, &len, CRC32C_SHORT, crc32c_short);
+	}
+
+	while (len >= 8)
+	{
+		crc0 = crc32c_u64(crc0, *(const uint64_t *)p);
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc0 = crc32c_u8((uint32_t)crc0, *p++);
+
+	return ~(uint32_t)crc0;
+}
+
+int crc32c_hw_available(void)
+{
+#if CRC32C_X86
+	static int available = -1;
+	uint32_t eax, ebx, ecx, edx;
+
+	if (available < 0)
+	{
+		/* CPUID leaf 1, ECX bit 20 is SSE4.2 */
+		__asm__ __volatile__("cpuid"
+							 : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+							 : "a" (1), "c" (0));
+
+		available = (ecx >> 20) & 1;
+	}
+
+	return available;
+#else
+	return 1;
+#endif
+}
+
+#else /* !(CRC32C_X86 || CRC32C_ARM) */
+
+uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len)
+{
+	return crc32c_sw(crc, buf, len);
+}
+
+int crc32c_hw_available(void)
+{
+	return 0;
+}
+
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	if (crc32c_hw_available())
+		return crc32c_hw(crc, buf, len);
+
+	return crc32c_sw(crc, buf, len);
+}
@@ -0,0 +1,35 @@
+/*
+ *  crc32c.h
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRC32C (Castagnoli), as used by logical block protection. Start with
+ * 0 and pass the previous result to continue over more data. Uses the
+ * CPU's CRC32 instructions where it has them.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* the two implementations behind crc32c(), for testing */
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32c_hw(uint32_t crc, const void *buf, size_t len);
+int crc32c_hw_available(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CRC32C_H_ */
@@ -0,0 +1,139 @@
+/*
+ *  crc32c_bench.c
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+/*
+ * Checks the CRC32C implementations against each other and times them
+ * on blocks of a given size. It is not part of the build; on Linux or
+ * macOS:
+ *
+ *	cc -O2 -o crc32c_bench crc32c_bench.c crc32c.c
+ *	./crc32c_bench [block size [megabytes]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32c.h"
+
+typedef uint32_t (*crc_fn)(uint32_t, const void *, size_t);
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check(const char *name, crc_fn fn, const uint8_t *buf)
+{
+	size_t len, off;
+	uint32_t crc;
+
+	/* the check value of the CRC-32C catalogue entry */
+	if ((crc = fn(0, "123456789", 9)) != 0xE3069283)
+	{
+		fprintf(stderr, "%s: check value %08x\n", name, crc);
+		return 1;
+	}
+
+	/* every alignment, and lengths across the striping thresholds */
+	for (off = 0; off < 8; off++)
+	{
+		for (len = 0; len < 3 * 8192 * 2 + 64; len += (len < 2048) ? 1 : 509)
+		{
+			if (fn(0, buf + off, len) != crc32c_sw(0, buf + off, len))
+			{
+				fprintf(stderr, "%s: mismatch at offset %zu length %zu\n",
+						name, off, len);
+				return 1;
+			}
+
+			/* continuing over a split gives the same result */
+			if (fn(fn(0, buf + off, len / 3), buf + off + len / 3,
+				   len - len / 3) != crc32c_sw(0, buf + off, len))
+			{
+				fprintf(stderr, "%s: split mismatch at length %zu\n",
+						name, len);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void bench(const char *name, crc_fn fn, const uint8_t *buf,
+				  size_t size, size_t total)
+{
+	size_t done;
+	uint32_t crc = 0;
+	double start, elapsed;
+
+	start = now();
+
+	for (done = 0; done < total; done += size)
+		crc = fn(crc, buf, size);
+
+	elapsed = now() - start;
+
+	printf("%-10s %8zu bytes  %9.1f MB/s  (%08x)\n", name, size,
+		   total / elapsed / 1e6, crc);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = 262144;
+	size_t total = 1024;
+	size_t max, i;
+	uint8_t *buf;
+
+	if (argc > 1)
+		size = strtoul(argv[1], NULL, 0);
+
+	if (argc > 2)
+		total = strtoul(argv[2], NULL, 0);
+
+	if (size == 0 || total == 0)
+	{
+		fprintf(stderr, "usage: %s [block size [megabytes]]\n", argv[0]);
+		return 2;
+	}
+
+	total <<= 20;
+	max = size > 65536 ? size : 65536;
+
+	if ((buf = malloc(max + 8)) == NULL)
+	{
+		perror("malloc");
+		return 1;
+	}
+
+	srandom(1);
+
+	for (i = 0; i < max + 8; i++)
+		buf[i] = random();
+
+	if (check("sw", crc32c_sw, buf) ||
+		(crc32c_hw_available() && check("hw", crc32c_hw, buf)))
+		return 1;
+
+	bench("sw", crc32c_sw, buf, size, total);
+
+	if (crc32c_hw_available())
+		bench("hw", crc32c_hw, buf, size, total);
+	else
+		printf("hw         not available on this CPU\n");
+
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ *  crc64.c
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+/*
+ * Eight bytes at a time from tables, as crc32c_sw() does. The tables
+ * are built on first use by the one thread that claims them, and
+ * published with a release store; a thread that finds them still being
+ * built computes its CRC a bit at a time.
+ */
+
+#include "crc64.h"
+
+#define CRC64_POLY		0xC96C5795D7870F42ULL	/* reflected */
+
+#define CRC64_UNBUILT	0
+#define CRC64_BUILDING	1
+#define CRC64_READY		2
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CRC64_BIG_ENDIAN	1
+#endif
+
+static uint64_t crc64_table[8][256];
+static int crc64_table_state;
+
+static void crc64_init_table(void)
+{
+	uint64_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC64_POLY & (0 - (crc & 1)));
+
+		crc64_table[0][i] = crc;
+	}
+
+	/* table j is byte i followed by j zero bytes */
+	for (i = 0; i < 256; i++)
+	{
+		crc = crc64_table[0][i];
+
+		for (j = 1; j < 8; j++)
+		{
+			crc = crc64_table[0][crc & 0xFF] ^ (crc >> 8);
+			crc64_table[j][i] = crc;
+		}
+	}
+}
+
+/* whether the tables can be used, building them if nobody else is */
+static int crc64_tables(void)
+{
+	int expected = CRC64_UNBUILT;
+
+	if (__atomic_load_n(&crc64_table_state, __ATOMIC_ACQUIRE) == CRC64_READY)
+		return 1;
+
+	if (!__atomic_compare_exchange_n(&crc64_table_state, &expected,
+									 CRC64_BUILDING, 0,
+									 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return 0;
+
+	crc64_init_table();
+	__atomic_store_n(&crc64_table_state, CRC64_READY, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+static uint64_t crc64_bitwise(uint64_t crc, const uint8_t *p, size_t len)
+{
+	int j;
+
+	crc = ~crc;
+
+	while (len--)
+	{
+		crc ^= *p++;
+
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC64_POLY & (0 - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+uint64_t crc64(uint64_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+
+	if (!crc64_tables())
+		return crc64_bitwise(crc, p, len);
+
+	crc = ~crc;
+
+#ifndef CRC64_BIG_ENDIAN
+	while (len && ((uintptr_t)p & 7))
+	{
+		crc = crc64_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8)
+	{
+		crc ^= *(const uint64_t *)p;
+
+		crc = crc64_table[7][ crc        & 0xFF] ^
+			  crc64_table[6][(crc >>  8) & 0xFF] ^
+			  crc64_table[5][(crc >> 16) & 0xFF] ^
+			  crc64_table[4][(crc >> 24) & 0xFF] ^
+			  crc64_table[3][(crc >> 32) & 0xFF] ^
+			  crc64_table[2][(crc >> 40) & 0xFF] ^
+			  crc64_table[1][(crc >> 48) & 0xFF] ^
+			  crc64_table[0][ crc >> 56        ];
+
+		p += 8;
+		len -= 8;
+	}
+#endif
+
+	while (len--)
+		crc = crc64_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
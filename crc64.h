@@ -0,0 +1,30 @@
+/*
+ *  crc64.h
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ */
+
+#ifndef _CRC64_H_
+#define _CRC64_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRC-64/XZ (ECMA-182, reflected), the check of xz and of crc64(1) on
+ * most systems. Start with 0 and pass the previous result to continue
+ * over more data.
+ */
+uint64_t crc64(uint64_t crc, const void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CRC64_H_ */
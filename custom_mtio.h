@@ -11,6 +11,17 @@
 #define _CUSTOM_MTIO_H_
 
 #define	MTCMPRESS	16	/* set/clear device compression */
+
+/*
+ * Early warning. Writing past the drive's early warning point, near the
+ * end of the partition, still succeeds. With MTEWARN (or MTIOCEEOT) set,
+ * the first write past it instead fails with ENOSPC, after writing
+ * what it could; mt_resid holds what it did not write, in blocks in
+ * fixed block mode and in bytes otherwise. The writes that follow
+ * succeed, leaving room for trailers, until the partition is full. A
+ * count above 1 also has the drive warn that many megabytes earlier
+ * (programmable early warning), where it supports this.
+ */
 #define	MTEWARN		17	/* set/clear early warning behaviour */
 
 /*
@@ -24,4 +35,562 @@
 #define	MTIOCSLOCATE	_IOW('m', 5, uint32_t)	/* seek to logical blk addr */
 #define	MTIOCHLOCATE	_IOW('m', 6, uint32_t)	/* seek to hardware blk addr */
 
+/*
+ * Driver event log. Every driver event is recorded in a small per-device
+ * ring; only events at or below the configured level are passed on to
+ * the system log, and each distinct message is rate limited.
+ */
+#define	MT_LOG_ERR	0	/* errors the operator should see */
+#define	MT_LOG_WARN	1	/* unexpected but recoverable conditions */
+#define	MT_LOG_INFO	2	/* device attach details */
+#define	MT_LOG_DEBUG	3	/* per-command events (filemarks, sense) */
+
+#define	MTLOG_MSGLEN	112
+#define	MTLOG_BATCH	16
+
+struct mtlogent {
+	uint64_t	le_time;	/* uptime in microseconds */
+	uint32_t	le_seq;		/* event sequence number */
+	uint16_t	le_level;	/* MT_LOG_* */
+	uint16_t	le_pad;
+	char		le_msg[MTLOG_MSGLEN];
+};
+
+struct mtlog {
+	uint32_t	ml_seq;		/* in: first seq wanted, out: next seq */
+	uint32_t	ml_count;	/* out: entries returned */
+	uint32_t	ml_lost;	/* out: entries overwritten before read */
+	uint32_t	ml_pad;
+	struct mtlogent	ml_ent[MTLOG_BATCH];
+};
+
+struct mtlogctl {
+	int32_t		mlc_level;	/* highest MT_LOG_* sent to system log */
+	int32_t		mlc_burst;	/* messages allowed per interval */
+	int32_t		mlc_interval;	/* rate limit interval in ms */
+};
+
+#define	MTIOCGLOG	_IOWR('m', 7, struct mtlog)	/* read event log */
+#define	MTIOCGLOGCTL	_IOR('m', 8, struct mtlogctl)	/* get log settings */
+#define	MTIOCSLOGCTL	_IOW('m', 8, struct mtlogctl)	/* set log settings */
+
+/*
+ * SCSI command trace. While tracing is on, every command issued to the
+ * drive is recorded on completion in a per-device ring that is drained
+ * with MTIOCTRDRAIN on the control device, one drain at a time; a drain
+ * that finds another in progress fails with EBUSY. Records that are
+ * overwritten before they are drained are counted in mtb_lost.
+ */
+#define	MTTRACE_STOP	0
+#define	MTTRACE_START	1
+#define	MTTRACE_CLEAR	2
+
+#define	MTTRACE_BATCH	64
+
+struct mttrace {
+	uint32_t	tr_seq;		/* record sequence number */
+	uint32_t	tr_latency;	/* command latency in microseconds */
+	uint64_t	tr_time;	/* issue time, uptime in microseconds */
+	uint32_t	tr_requested;	/* bytes requested */
+	uint32_t	tr_realized;	/* bytes transferred */
+	uint32_t	tr_status;	/* SCSI task status */
+	uint8_t		tr_sensekey;	/* sense key, if CHECK CONDITION */
+	uint8_t		tr_asc;
+	uint8_t		tr_ascq;
+	uint8_t		tr_cdblen;
+	uint8_t		tr_cdb[16];
+};
+
+struct mttracebuf {
+	uint32_t	mtb_count;	/* out: records returned */
+	uint32_t	mtb_lost;	/* out: records dropped since last drain */
+	struct mttrace	mtb_ent[MTTRACE_BATCH];
+};
+
+#define	MTIOCTRACE	_IOW('m', 9, int)		/* MTTRACE_* */
+#define	MTIOCTRDRAIN	_IOR('m', 9, struct mttracebuf)	/* drain trace */
+
+/*
+ * Workload capture. While capture is on, every read(), write() and ioctl()
+ * on the tape device is recorded (without its data) so the workload can
+ * later be replayed by tapereplay(1). Capture is controlled with the
+ * MTTRACE_* operations. MTIOCCAPDRAIN works on the control device only,
+ * and fails with EBUSY while another process is draining.
+ */
+#define	MTWL_READ	1
+#define	MTWL_WRITE	2
+#define	MTWL_IOCTL	3
+
+#define	MTWL_BATCH	64
+
+struct mtwlrec {
+	uint32_t	wl_seq;		/* record sequence number */
+	uint16_t	wl_op;		/* MTWL_* */
+	uint16_t	wl_mtop;	/* mt_op, for MTIOCTOP */
+	uint64_t	wl_time;	/* call entry, uptime in microseconds */
+	uint32_t	wl_cmd;		/* ioctl command */
+	int32_t		wl_count;	/* bytes requested, or mt_count */
+	int32_t		wl_result;	/* bytes transferred */
+	int32_t		wl_error;	/* errno returned */
+	uint32_t	wl_duration;	/* microseconds spent in the driver */
+	uint32_t	wl_pad;
+};
+
+struct mtwlbuf {
+	uint32_t	mwb_count;	/* out: records returned */
+	uint32_t	mwb_lost;	/* out: records dropped since last drain */
+	struct mtwlrec	mwb_ent[MTWL_BATCH];
+};
+
+#define	MTIOCCAPTURE	_IOW('m', 10, int)		/* MTTRACE_* */
+#define	MTIOCCAPDRAIN	_IOR('m', 10, struct mtwlbuf)	/* drain capture */
+
+/*
+ * Drive-side verify. The drive reads back and checks the blocks itself
+ * without transferring them to the host. A count of zero verifies up to
+ * the next filemark. With MTVERIFY_LOCATE the drive first positions to
+ * mv_lba (VERIFY(16)); drives without VERIFY(16) fail with ENOTSUP.
+ * Once blocks have been checked the ioctl succeeds, so the results are
+ * returned: a verify that stopped short of mv_count says where in
+ * mv_stop, and one that failed has the errno in mv_error. In variable
+ * block mode each block is a command of its own; the verify can be
+ * followed with MTIOCGETPROGRESS as MTPROG_VERIFY, and a signal stops
+ * it between blocks with EINTR.
+ */
+#define	MTVERIFY_LOCATE		0x01	/* start at mv_lba */
+
+#define	MTVERIFY_STOP_COUNT	0	/* all requested blocks verified */
+#define	MTVERIFY_STOP_FILEMARK	1	/* stopped after a filemark */
+#define	MTVERIFY_STOP_EOD	2	/* stopped at end of data */
+#define	MTVERIFY_STOP_ERROR	3	/* failed, see mv_error */
+
+struct mtverify {
+	int32_t		mv_count;	/* in: blocks to verify, 0 to filemark */
+	uint32_t	mv_flags;	/* in: MTVERIFY_* */
+	uint64_t	mv_lba;		/* in: start position with LOCATE */
+	int32_t		mv_verified;	/* out: blocks verified */
+	int32_t		mv_stop;	/* out: MTVERIFY_STOP_* */
+	int32_t		mv_error;	/* out: errno with MTVERIFY_STOP_ERROR */
+	int32_t		mv_pad;
+};
+
+#define	MTIOCVERIFY	_IOWR('m', 11, struct mtverify)	/* verify blocks */
+
+/*
+ * Reverse reads. While set, read(2) returns the records before the
+ * current position, last first, using READ REVERSE; the bytes within
+ * each record keep their written order. Reading back over a filemark
+ * returns 0 and leaves the tape before it. The mode lasts until it is
+ * cleared or the device is closed.
+ */
+#define	MTIOCSREVERSE	_IOW('m', 12, int)	/* 1 = read backwards */
+
+/*
+ * Progress of a long running operation. MTERASE with a count of zero
+ * does a short erase, which only writes end of data; any other count
+ * starts a long erase and returns at once, leaving it to be followed
+ * here. The drive's progress, out of MTPROG_MAX, is -1 when the drive
+ * does not report it. MTIOCGETPROGRESS never waits for the operation
+ * and may be used on the control device.
+ */
+#define	MTPROG_NONE	0
+#define	MTPROG_REWIND	1
+#define	MTPROG_LOAD	2
+#define	MTPROG_UNLOAD	3
+#define	MTPROG_SPACE	4
+#define	MTPROG_LOCATE	5
+#define	MTPROG_ERASE	6
+#define	MTPROG_VERIFY	7
+
+#define	MTPROG_MAX	65536
+
+struct mtprogress {
+	int32_t		mp_op;		/* MTPROG_* in progress */
+	int32_t		mp_progress;	/* drive-reported progress */
+	uint32_t	mp_elapsed;	/* ms since the operation started */
+	int32_t		mp_inflight;	/* commands being run by the drive */
+};
+
+#define	MTIOCGETPROGRESS _IOR('m', 13, struct mtprogress)	/* progress */
+
+/*
+ * Command timeouts. The driver learns the drive's recommended timeout
+ * for each command from REPORT SUPPORTED OPERATION CODES and falls back
+ * to its own defaults. MTIOCSTIMEOUT, on the tape device only,
+ * overrides the timeout for one operation code until the driver is
+ * unloaded; a timeout of zero removes the override, and any other
+ * outside MTTO_MIN to MTTO_MAX fails with EINVAL.
+ */
+#define	MTTO_DEFAULT	0	/* driver default */
+#define	MTTO_DRIVE	1	/* reported by the drive */
+#define	MTTO_OVERRIDE	2	/* set with MTIOCSTIMEOUT */
+
+#define	MTTO_MIN	1000		/* ms */
+#define	MTTO_MAX	(7 * 24 * 3600 * 1000U)	/* ms, a week */
+
+struct mttimeout {
+	uint8_t		mto_opcode;	/* in: operation code */
+	uint8_t		mto_supported;	/* out: drive supports it */
+	uint8_t		mto_source;	/* out: MTTO_* */
+	uint8_t		mto_pad;
+	uint32_t	mto_timeout;	/* ms, 0 when MTTO_DEFAULT */
+};
+
+#define	MTIOCGTIMEOUT	_IOWR('m', 14, struct mttimeout)	/* get timeout */
+#define	MTIOCSTIMEOUT	_IOW('m', 15, struct mttimeout)		/* set timeout */
+
+/*
+ * Ready wait. Unless opened with O_NONBLOCK, the tape device waits on
+ * open for a drive that is becoming ready or finishing an operation,
+ * for at most this many seconds, and fails with ETIMEDOUT if it is
+ * still not ready. An empty drive does not wait; a drive not ready for
+ * any other reason fails the open at once. Zero disables the wait.
+ * With O_NONBLOCK, an open, read or write finding a command or a long
+ * operation in flight fails with EAGAIN instead; select() and kevent()
+ * report the tape device ready once it is done.
+ */
+#define	MTIOCGREADYWAIT	_IOR('m', 16, int)	/* get ready wait */
+#define	MTIOCSREADYWAIT	_IOW('m', 17, int)	/* set ready wait */
+
+/*
+ * Position. When the tape device's file or block number has been lost
+ * the driver reads the position back from the drive; -1 means it is
+ * still unknown. The logical block address counts blocks and filemarks
+ * from the beginning of the partition, as MTIOCRDSPOS and MTIOCSLOCATE
+ * do. The control device reports what the driver last knew.
+ */
+#define	MTPOS_BOP	0x01	/* at beginning of partition */
+
+struct mtpos {
+	int32_t		mp_fileno;	/* file number */
+	int32_t		mp_blkno;	/* block number within the file */
+	int64_t		mp_lba;		/* logical block address */
+	uint32_t	mp_partition;	/* partition */
+	uint32_t	mp_flags;	/* MTPOS_* */
+};
+
+#define	MTIOCGPOS	_IOR('m', 18, struct mtpos)	/* get position */
+
+/*
+ * Medium auxiliary memory (MAM). Attributes held in the cartridge's
+ * memory chip are read and written without moving the tape, so a
+ * cartridge can be identified as soon as it is loaded. MTIOCGMAM reads
+ * one attribute of a partition; it fails with ENOATTR when the
+ * cartridge does not have it. MTIOCSMAM writes a host attribute
+ * (MTMAM_HOST_FIRST to MTMAM_HOST_LAST, or the vendor specific host
+ * range), and a length of zero deletes it. Binary values are big
+ * endian.
+ */
+#define	MTMAM_REMAINING_CAP	0x0000	/* binary, MiB left in partition */
+#define	MTMAM_MAXIMUM_CAP	0x0001	/* binary, MiB in partition */
+#define	MTMAM_LOAD_COUNT	0x0003	/* binary, times loaded */
+#define	MTMAM_MANUFACTURER	0x0400	/* ascii, medium manufacturer */
+#define	MTMAM_SERIAL		0x0401	/* ascii, medium serial number */
+#define	MTMAM_APP_VENDOR	0x0800	/* ascii, application vendor */
+#define	MTMAM_APP_NAME		0x0801	/* ascii, application name */
+#define	MTMAM_APP_VERSION	0x0802	/* ascii, application version */
+#define	MTMAM_USER_LABEL	0x0803	/* text, user medium text label */
+#define	MTMAM_LAST_WRITTEN	0x0804	/* ascii, YYYYMMDDHHMM */
+#define	MTMAM_BARCODE		0x0806	/* ascii, barcode */
+#define	MTMAM_OWNING_HOST	0x0807	/* text, owning host */
+#define	MTMAM_MEDIA_POOL	0x0808	/* text, media pool */
+
+#define	MTMAM_HOST_FIRST	0x0800
+#define	MTMAM_HOST_LAST		0x0BFF
+#define	MTMAM_VENDOR_FIRST	0x1400
+#define	MTMAM_VENDOR_LAST	0x17FF
+
+#define	MTMAM_BINARY		0x00
+#define	MTMAM_ASCII		0x01
+#define	MTMAM_TEXT		0x02
+
+#define	MTMAM_LEN		160	/* longest standard attribute */
+
+struct mtmam {
+	uint16_t	mm_id;		/* in: attribute identifier */
+	uint8_t		mm_format;	/* MTMAM_BINARY, _ASCII or _TEXT */
+	uint8_t		mm_readonly;	/* out: attribute cannot be written */
+	uint32_t	mm_partition;	/* in: partition */
+	uint32_t	mm_length;	/* bytes of mm_value */
+	uint8_t		mm_value[MTMAM_LEN];
+};
+
+#define	MTIOCGMAM	_IOWR('m', 19, struct mtmam)	/* read attribute */
+#define	MTIOCSMAM	_IOW('m', 19, struct mtmam)	/* write attribute */
+
+/*
+ * Remaining capacity of the current partition, in megabytes as the
+ * drive counts them, from the tape capacity log page or else from the
+ * cartridge memory.
+ */
+struct mtcapacity {
+	uint64_t	mc_remaining;	/* MB left in the partition */
+	uint64_t	mc_maximum;	/* MB the partition holds */
+	uint32_t	mc_partition;	/* partition */
+	uint32_t	mc_pad;
+};
+
+#define	MTIOCGCAPACITY	_IOR('m', 20, struct mtcapacity)	/* capacity */
+
+/*
+ * Multi-volume spanning. While spanning is on, a write that reaches
+ * early warning is completed, an end of volume filemark is written, its
+ * block address is recorded in the MTMAM_SPAN_END host attribute of the
+ * cartridge memory, and the cartridge is unloaded. The writer then
+ * waits while a helper, such as chio(1) span, loads the next cartridge,
+ * and carries on at its beginning. A read that reaches the filemark, or
+ * the end of data, at the recorded address goes on to the next
+ * cartridge the same way; on a cartridge without the attribute the data
+ * ends where it ends. Any write deletes the attribute, so writing
+ * spanned volumes needs a drive with cartridge memory. The helper waits
+ * on the control device with MTIOCSPANWAIT and answers with MTIOCSPANDONE,
+ * passing 0 once the next cartridge is in the drive, or the errno the
+ * writer or reader should get. Without an answer within MTSPAN_TIMEOUT
+ * seconds the write or read fails with ETIMEDOUT.
+ */
+#define	MTSPAN_WRITE	1
+#define	MTSPAN_READ	2
+
+#define	MTSPAN_TIMEOUT	3600
+
+#define	MTMAM_SPAN_END	0x1400	/* binary, 8 bytes, end of volume address */
+
+struct mtspan {
+	uint32_t	ms_op;		/* MTSPAN_WRITE or MTSPAN_READ */
+	uint32_t	ms_volume;	/* cartridge wanted, the first being 0 */
+};
+
+#define	MTIOCSSPAN	_IOW('m', 21, int)		/* 1 = span volumes */
+#define	MTIOCSPANWAIT	_IOR('m', 22, struct mtspan)	/* wait for a change */
+#define	MTIOCSPANDONE	_IOW('m', 22, int)		/* change done, errno */
+
+/*
+ * Drive health. The driver polls the TapeAlert and the write and read
+ * error counter log pages while the drive is idle and keeps the last
+ * results. TapeAlert flags stay set until the cartridge is unloaded.
+ * A rising count of corrected errors per byte processed means the drive
+ * is retrying, and is slowing down, before anything fails.
+ */
+#define	MTHEALTH_TAPEALERT	0x01	/* mh_tapealert is valid */
+#define	MTHEALTH_WRITE		0x02	/* mh_write is valid */
+#define	MTHEALTH_READ		0x04	/* mh_read is valid */
+
+struct mterrcnt {
+	uint64_t	me_corrected;	/* errors corrected */
+	uint64_t	me_retries;	/* rewrites or rereads */
+	uint64_t	me_uncorrected;	/* errors not corrected */
+	uint64_t	me_bytes;	/* bytes processed */
+};
+
+struct mthealth {
+	uint64_t	mh_tapealert;	/* flag n is bit n - 1 */
+	struct mterrcnt	mh_write;	/* write error counters */
+	struct mterrcnt	mh_read;	/* read error counters */
+	struct mterrcnt	mh_dwrite;	/* change over the last interval */
+	struct mterrcnt	mh_dread;
+	uint32_t	mh_valid;	/* MTHEALTH_* */
+	uint32_t	mh_age;		/* seconds since the last poll */
+	uint32_t	mh_interval;	/* seconds between the last two polls */
+	uint32_t	mh_pad;
+};
+
+#define	MTIOCGHEALTH	_IOR('m', 23, struct mthealth)	/* drive health */
+
+/*
+ * Drive encryption. MTIOCSCRYPT gives the drive a data encryption key
+ * and mode for this initiator only. The key is cleared again when the
+ * device is closed, unless MTCRYPT_KEEP is set; setting MTCRYPT_OFF
+ * clears it at once. MTIOCGCRYPT reports the drive's current mode and
+ * the key-associated data written with the data, but never the key.
+ * An algorithm of 0 picks the first the drive has for the key length.
+ */
+#define	MTCRYPT_OFF	0	/* plain writes and reads */
+#define	MTCRYPT_ON	1	/* encrypt writes, decrypt reads */
+#define	MTCRYPT_MIXED	2	/* encrypt writes, read plain and encrypted */
+#define	MTCRYPT_OTHER	255	/* a mode set some other way */
+
+#define	MTCRYPT_KEEP	0x01	/* keep the key after close */
+
+#define	MTCRYPT_KEYLEN	32
+#define	MTCRYPT_KADLEN	32
+
+struct mtcrypt {
+	uint32_t	mc_mode;	/* MTCRYPT_* */
+	uint32_t	mc_flags;	/* MTCRYPT_KEEP */
+	uint32_t	mc_algorithm;	/* drive's algorithm index */
+	uint32_t	mc_keylen;
+	uint32_t	mc_kadlen;
+	uint8_t		mc_key[MTCRYPT_KEYLEN];
+	uint8_t		mc_kad[MTCRYPT_KADLEN];	/* key-associated data */
+};
+
+#define	MTIOCSCRYPT	_IOW('m', 24, struct mtcrypt)	/* set encryption */
+#define	MTIOCGCRYPT	_IOR('m', 24, struct mtcrypt)	/* get encryption */
+
+/*
+ * Logical block protection. With MTLBP_CRC32C the drive checks a CRC32C
+ * of every block written and returns one with every block read; the
+ * driver computes and checks them on the host side, so the caller's
+ * data stays as it was. A block that fails the host's check returns
+ * EBADMSG, one that fails the drive's EILSEQ. The mode is put back on
+ * the drive after a reset and lasts until it is turned off.
+ */
+#define	MTLBP_OFF	0
+#define	MTLBP_CRC32C	1
+
+#define	MTIOCSLBP	_IOW('m', 25, int)	/* MTLBP_* */
+#define	MTIOCGLBP	_IOR('m', 25, int)	/* MTLBP_* */
+
+/*
+ * Per-file digests. While MTDIGEST_CRC64 is set the driver keeps a
+ * CRC-64/XZ of the data read or written in each tape file, from the
+ * block the transfer started at up to the filemark or end of data. The
+ * digests of the most recent files are kept until the cartridge is
+ * changed or digests are turned on again. MTIOCGDIGEST returns the
+ * newest one for md_fileno, or for the file in progress if it is -1.
+ */
+#define	MTDIGEST_OFF	0
+#define	MTDIGEST_CRC64	1
+
+#define	MTDIGEST_READ		0x01	/* of data read, not written */
+#define	MTDIGEST_PARTIAL	0x02	/* not from the file's first block */
+#define	MTDIGEST_DONE		0x04	/* up to a filemark or end of data */
+#define	MTDIGEST_ERROR		0x08	/* a read or write in it failed */
+
+struct mtdigest {
+	int32_t		md_fileno;	/* in/out: file number, -1 current */
+	uint32_t	md_partition;
+	uint32_t	md_flags;	/* MTDIGEST_* */
+	uint32_t	md_records;	/* blocks or records */
+	uint64_t	md_bytes;
+	uint64_t	md_digest;	/* CRC-64/XZ */
+};
+
+#define	MTIOCSDIGEST	_IOW('m', 26, int)		/* MTDIGEST_* */
+#define	MTIOCGDIGEST	_IOWR('m', 26, struct mtdigest)	/* get digest */
+
+/*
+ * Buffered mode. Buffered, a write returns once the drive has the data
+ * rather than once it is on tape; MTIOCFLUSH waits for everything
+ * buffered to be written, without writing a filemark or moving the
+ * tape, so a writer can pay for the wait only at its own checkpoints.
+ * Errors found while flushing are returned by MTIOCFLUSH. MTCACHE and
+ * MTNOCACHE select MTBUFFER_ON and MTBUFFER_OFF.
+ */
+#define	MTBUFFER_OFF	0	/* unbuffered */
+#define	MTBUFFER_ON	1	/* buffered */
+#define	MTBUFFER_SHARED	2	/* buffered, ordered among initiators */
+
+#define	MTIOCSBUFFER	_IOW('m', 27, int)	/* MTBUFFER_* */
+#define	MTIOCGBUFFER	_IOR('m', 27, int)	/* MTBUFFER_* */
+#define	MTIOCFLUSH	_IO('m', 28)		/* write out the buffer */
+
+/*
+ * Shared ring. MTIOCRINGMAP maps a ring of fixed size slots into the
+ * caller, and records are written from it or read into it without a
+ * read() or write() for each. The caller hands slots to the driver by
+ * advancing mh_head, and MTIOCRINGKICK has the driver write or read
+ * every slot handed over, or mk_count of them, advancing mh_tail past
+ * each one done. Both are free running counts; the slot of count n is
+ * n % mh_slots, at mr_offset + (n % mh_slots) * mh_slotsize.
+ *
+ * Writing, mh_len[] is the length of the record in each slot. Reading,
+ * each slot is read with a read of mh_slotsize bytes and the driver
+ * sets mh_len[] to what was read; a read that passes a filemark is the
+ * last one done and sets MTRING_FILEMARK. A slot that fails is not
+ * done and MTIOCRINGKICK returns its error, with mh_tail at the slot.
+ * A ring of 0 slots unmaps it, as does closing the device. The ring is
+ * wired while it is mapped, so all of its slots together are at most
+ * MTRING_MAXSIZE bytes; a request that is not valid fails with EINVAL
+ * and leaves the ring mapped before in place.
+ */
+#define	MTRING_READ	0
+#define	MTRING_WRITE	1
+
+#define	MTRING_MAXSLOTS	512
+#define	MTRING_MAXSIZE	(16 * 1024 * 1024)	/* all of the slots */
+
+struct mtringmap {
+	int32_t		mr_dir;		/* MTRING_READ or MTRING_WRITE */
+	uint32_t	mr_slots;	/* number of slots, 0 to unmap */
+	uint32_t	mr_slotsize;	/* bytes in a slot */
+	uint32_t	mr_offset;	/* out: of the first slot */
+	uint64_t	mr_addr;	/* out: the ring in the caller */
+	uint64_t	mr_length;	/* out: of the ring */
+};
+
+/* at the start of the ring */
+struct mtringhdr {
+	volatile uint32_t	mh_head;	/* slots handed to the driver */
+	volatile uint32_t	mh_tail;	/* slots the driver has done */
+	uint32_t	mh_slots;
+	uint32_t	mh_slotsize;
+	uint32_t	mh_len[MTRING_MAXSLOTS];	/* bytes in each slot */
+};
+
+#define	MTRING_FILEMARK	0x01	/* a read stopped at a filemark */
+
+struct mtringkick {
+	uint32_t	mk_count;	/* slots to do, 0 all; out: done */
+	uint32_t	mk_flags;	/* out: MTRING_* */
+};
+
+#define	MTIOCRINGMAP	_IOWR('m', 29, struct mtringmap)	/* map a ring */
+#define	MTIOCRINGKICK	_IOWR('m', 30, struct mtringkick)	/* do its slots */
+
+/*
+ * Batched records. MTIOCWRITEV writes, and MTIOCREADV reads, each record
+ * of an array as a write() or read() of it would, in one call. They stop
+ * at the first record that fails, with its errno in mre_error, and when
+ * reading after the first that passes a filemark. mrv_count comes back
+ * as the number of records done and mre_done as the bytes of each.
+ */
+#define	MTRECV_MAX	4096	/* records in a call */
+#define	MTRECV_BATCH	32	/* records copied in at a time */
+
+#define	MTRECV_FILEMARK	0x01	/* a read stopped at a filemark */
+
+struct mtrec {
+	uint64_t	mre_addr;	/* the record in the caller */
+	uint32_t	mre_len;	/* bytes to write, or most to read */
+	uint32_t	mre_done;	/* out: bytes written or read */
+	int32_t		mre_error;	/* out: errno */
+	uint32_t	mre_pad;
+};
+
+struct mtrecv {
+	uint64_t	mrv_recs;	/* array of struct mtrec in the caller */
+	uint32_t	mrv_count;	/* records in it; out: records done */
+	uint32_t	mrv_flags;	/* out: MTRECV_* */
+};
+
+#define	MTIOCWRITEV	_IOWR('m', 31, struct mtrecv)	/* write records */
+#define	MTIOCREADV	_IOWR('m', 32, struct mtrecv)	/* read records */
+
+/*
+ * Batched operations. MTIOCBATCH carries out the MTIOCTOP operations of
+ * mob_ops in order in one call, stopping at the first that fails.
+ * Adjacent operations that add up are done as one, so two fsf 1 are a
+ * single SPACE of two filemarks, and a block size already set by the
+ * batch is not set again. mob_done comes back as the number done; when
+ * one fails its errno is in mob_error, and none done together with it
+ * is counted.
+ */
+#define	MTBATCH_MAX	64
+
+struct mtbatchop {
+	int32_t		mbo_op;		/* as mt_op */
+	int32_t		mbo_count;	/* as mt_count */
+};
+
+struct mtopbatch {
+	uint32_t	mob_count;	/* operations in mob_ops */
+	uint32_t	mob_done;	/* out: operations done */
+	int32_t		mob_error;	/* out: errno of the one that failed */
+	uint32_t	mob_pad;
+	struct mtbatchop	mob_ops[MTBATCH_MAX];
+};
+
+#define	MTIOCBATCH	_IOWR('m', 33, struct mtopbatch)	/* do operations */
+
 #endif /* _CUSTOM_MTIO_H_ */
\ No newline at end of file
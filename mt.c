@@ -55,6 +55,7 @@ __RCSID("$NetBSD: mt.c,v 1.46 2008/07/20 00:52:40 lukem Exp $");
 
 #include <ctype.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <paths.h>
 #include <stdio.h>
@@ -67,6 +68,8 @@ __RCSID("$NetBSD: mt.c,v 1.46 2008/07/20 00:52:40 lukem Exp $");
 
 /* pseudo ioctl constants */
 #define MTASF	100
+#define MTLOGLEVEL	101
+#define MTLOGRATE	102
 
 struct commands {
 	const char *c_name;		/* command */
@@ -75,21 +78,33 @@ struct commands {
 	int c_code;			/* ioctl code for MTIOCTOP command */
 	int c_ronly;			/* open tape read-only */
 	int c_mincount;			/* min allowed count value */
+	int c_keyword;			/* takes a keyword instead of a count */
 };
 
 #define CMD(a)	a, sizeof(a) - 1
 const struct commands com[] = {
 	{ CMD("asf"),		MTIOCTOP,     MTASF,      1,  0 },
 	{ CMD("blocksize"),	MTIOCTOP,     MTSETBSIZ,  1,  0 },
+	{ CMD("buffer"),	MTIOCSBUFFER, 0,          1,  0 },
 	{ CMD("bsf"),		MTIOCTOP,     MTBSF,      1,  1 },
 	{ CMD("bsr"),		MTIOCTOP,     MTBSR,      1,  1 },
+	{ CMD("capacity"),	MTIOCGCAPACITY, 0,        1,  0 },
 	{ CMD("compress"),	MTIOCTOP,     MTCMPRESS,  1,  0 },
+	{ CMD("crypt"),		MTIOCSCRYPT,  0,          1,  0,  1 },
 	{ CMD("density"),	MTIOCTOP,     MTSETDNSTY, 1,  0 },
+	{ CMD("digest"),	MTIOCGDIGEST, 0,          1,  0 },
 	{ CMD("eof"),		MTIOCTOP,     MTWEOF,     0,  1 },
 	{ CMD("eom"),		MTIOCTOP,     MTEOM,      1,  0 },
+	{ CMD("flush"),		MTIOCFLUSH,   0,          0,  0 },
 	{ CMD("erase"),		MTIOCTOP,     MTERASE,    0,  0 },
 	{ CMD("fsf"),		MTIOCTOP,     MTFSF,      1,  1 },
 	{ CMD("fsr"),		MTIOCTOP,     MTFSR,      1,  1 },
+	{ CMD("health"),	MTIOCGHEALTH, 0,          1,  0 },
+	{ CMD("lbp"),		MTIOCSLBP,    0,          1,  0 },
+	{ CMD("log"),		MTIOCGLOG,    0,          1,  0 },
+	{ CMD("loglevel"),	MTIOCSLOGCTL, MTLOGLEVEL, 1,  0 },
+	{ CMD("lograte"),	MTIOCSLOGCTL, MTLOGRATE,  1,  0 },
+	{ CMD("mam"),		MTIOCGMAM,    0,          1,  0 },
 	{ CMD("offline"),	MTIOCTOP,     MTOFFL,     1,  0 },
 	{ CMD("rdhpos"),	MTIOCRDHPOS,  0,          1,  0 },
 	{ CMD("rdspos"),	MTIOCRDSPOS,  0,          1,  0 },
@@ -100,13 +115,31 @@ const struct commands com[] = {
 	{ CMD("setdensity"),	MTIOCTOP,     MTSETDNSTY, 1,  0 },
 	{ CMD("sethpos"),	MTIOCHLOCATE, 0,          1,  0 },
 	{ CMD("setspos"),	MTIOCSLOCATE, 0,          1,  0 },
+	{ CMD("span"),		MTIOCSSPAN,   0,          1,  0 },
 	{ CMD("status"),	MTIOCGET,     MTNOP,      1,  0 },
+	{ CMD("trace"),		MTIOCTRACE,   0,          1,  0,  1 },
+	{ CMD("verify"),	MTIOCVERIFY,  0,          1,  0 },
 	{ CMD("weof"),		MTIOCTOP,     MTWEOF,     0,  1 },
 	{ CMD("eew"),		MTIOCTOP,     MTEWARN,    1,  0 },
 	{ .c_name = NULL }
 };
 
 void printreg(const char *, u_int, const char *);
+void printmam(int, const char *);
+void printattr(const char *, const struct mtmam *);
+void writemam(int, const char *, uint16_t, const char *);
+void printlog(int, const char *);
+void printhealth(const char *, const struct mthealth *);
+void digest(int, const char *, const char *);
+void printcrypt(const struct mtcrypt *);
+void setcrypt(int, const char *, const char *, const char *);
+void printtrace(int, const char *, int);
+char *ctlpath(const char *);
+int printprogress(int, const char *);
+void printstatus(int, const char *, int);
+const struct commands *findcmd(const char *);
+int iscount(const char *);
+void batch(const char *, int, char *[]);
 void status(struct mtget *);
 void usage(void);
 int main(int, char *[]);
@@ -114,14 +147,17 @@ int main(int, char *[]);
 int
 main(int argc, char *argv[])
 {
-	const struct commands *cp, *comp;
-	struct mtget mt_status;
+	const struct commands *comp;
 	struct mtop mt_com;
-	int ch, mtfd, flags;
+	struct mtlogctl mt_logctl;
+	struct mtverify mt_verify;
+	struct mtmam mt_mam;
+	struct mtcapacity mt_cap;
+	struct mthealth mt_health;
+	int ch, mtfd, flags, havecount, waitprogress;
 	char *p;
-	const char *tape;
+	const char *tape, *keyword;
 	int count;
-	size_t len;
 
 	setprogname(argv[0]);
 	if ((tape = getenv("TAPE")) == NULL)
@@ -140,31 +176,63 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if (argc < 1 || argc > 2)
+	if (argc < 1)
 		usage();
 
-	len = strlen(p = *argv++);
-	for (comp = NULL, cp = com; cp->c_name != NULL; cp++) {
-		size_t clen = MIN(len, cp->c_namelen);
-		if (strncmp(p, cp->c_name, clen) == 0) {
-			if (comp != NULL)
-				errx(1, "%s: Ambiguous command `%s' or `%s'?",
-				    p, cp->c_name, comp->c_name);
-			else
-				comp = cp;
-		}
+	comp = findcmd(*argv++);
+
+	/* tape operations and status may follow one another */
+	if ((comp->c_spcl == MTIOCTOP || comp->c_spcl == MTIOCGET) &&
+	    (argc > 2 || (argc == 2 && !iscount(argv[0]) &&
+	    strcmp(argv[0], "-w") != 0))) {
+		batch(tape, argc, argv - 1);
+		exit(0);
 	}
-	if (comp == NULL)
-		errx(1, "%s: unknown command", p);
 
-	if (*argv) {
+	if (argc > 3)
+		usage();
+
+	/* only mam and crypt take a value after their argument */
+	if (argc > 2 && comp->c_spcl != MTIOCGMAM &&
+	    comp->c_spcl != MTIOCSCRYPT)
+		usage();
+
+	/* status -w follows a long operation until it completes */
+	waitprogress = 0;
+	if (comp->c_spcl == MTIOCGET && *argv && strcmp(*argv, "-w") == 0) {
+		waitprogress = 1;
+		argv++;
+	}
+
+	keyword = NULL;
+	if (comp->c_spcl == MTIOCGMAM || comp->c_spcl == MTIOCGDIGEST) {
+		count = 1;
+		havecount = 0;
+	} else if (comp->c_keyword) {
+		if (*argv == NULL)
+			usage();
+		keyword = *argv;
+		count = 1;
+		havecount = 0;
+	} else if (*argv) {
 		count = strtol(*argv, &p, 10);
 		if (count < comp->c_mincount || *p)
 			errx(2, "%s: illegal count", *argv);
-	} else
+		havecount = 1;
+	} else {
 		count = 1;
+		havecount = 0;
+	}
 
 	flags = comp->c_ronly ? O_RDONLY : O_WRONLY;
+	if (comp->c_spcl == MTIOCGMAM && argc == 3)
+		flags = O_WRONLY;
+
+	/* the log and the trace are only on the control device, which can
+	 * be opened while a job has the tape */
+	if (comp->c_spcl == MTIOCGLOG || comp->c_spcl == MTIOCSLOGCTL ||
+	    comp->c_spcl == MTIOCTRACE)
+		tape = ctlpath(tape);
 
 	if ((mtfd = open(tape, flags)) < 0)
 		err(2, "%s", tape);
@@ -201,9 +269,7 @@ main(int argc, char *argv[])
 		break;
 
 	case MTIOCGET:
-		if (ioctl(mtfd, MTIOCGET, &mt_status) < 0)
-			err(2, "%s: %s", tape, comp->c_name);
-		status(&mt_status);
+		printstatus(mtfd, tape, waitprogress);
 		break;
 
 	case MTIOCRDSPOS:
@@ -219,6 +285,145 @@ main(int argc, char *argv[])
 			err(2, "%s", tape);
 		break;
 
+	case MTIOCGLOG:
+		printlog(mtfd, tape);
+		break;
+
+	case MTIOCSLOGCTL:
+		if (ioctl(mtfd, MTIOCGLOGCTL, &mt_logctl) < 0)
+			err(2, "%s: %s", tape, comp->c_name);
+		if (havecount) {
+			if (comp->c_code == MTLOGLEVEL)
+				mt_logctl.mlc_level = count;
+			else
+				mt_logctl.mlc_burst = count;
+			if (ioctl(mtfd, MTIOCSLOGCTL, &mt_logctl) < 0)
+				err(2, "%s: %s", tape, comp->c_name);
+		}
+		printf("%s: log level %d, %d messages per %d ms\n", tape,
+		    mt_logctl.mlc_level, mt_logctl.mlc_burst,
+		    mt_logctl.mlc_interval);
+		break;
+
+	case MTIOCTRACE:
+		if (strcmp(keyword, "start") == 0)
+			count = MTTRACE_START;
+		else if (strcmp(keyword, "stop") == 0)
+			count = MTTRACE_STOP;
+		else if (strcmp(keyword, "clear") == 0)
+			count = MTTRACE_CLEAR;
+		else if (strcmp(keyword, "dump") == 0 ||
+		    strcmp(keyword, "csv") == 0) {
+			printtrace(mtfd, tape, keyword[0] == 'c');
+			break;
+		} else
+			errx(1, "%s: unknown trace command `%s'",
+			    comp->c_name, keyword);
+		if (ioctl(mtfd, MTIOCTRACE, &count) < 0)
+			err(2, "%s: %s %s", tape, comp->c_name, keyword);
+		break;
+
+	case MTIOCVERIFY:
+		/* without a count, verify up to the next filemark */
+		memset(&mt_verify, 0, sizeof(mt_verify));
+		mt_verify.mv_count = havecount ? count : 0;
+		if (ioctl(mtfd, MTIOCVERIFY, &mt_verify) < 0)
+			err(2, "%s: %s", tape, comp->c_name);
+		if (mt_verify.mv_stop == MTVERIFY_STOP_ERROR) {
+			errno = mt_verify.mv_error;
+			warn("%s: %s", tape, comp->c_name);
+		}
+		printf("%s: %d blocks verified%s\n", tape,
+		    mt_verify.mv_verified,
+		    mt_verify.mv_stop == MTVERIFY_STOP_FILEMARK ?
+		    ", stopped at filemark" :
+		    mt_verify.mv_stop == MTVERIFY_STOP_EOD ?
+		    ", stopped at end of data" : "");
+		/* a count not verified in full is a failure */
+		if (mt_verify.mv_stop == MTVERIFY_STOP_ERROR ||
+		    (havecount && mt_verify.mv_verified < count))
+			exit(2);
+		break;
+
+	case MTIOCSCRYPT:
+		setcrypt(mtfd, tape, keyword, argv[1]);
+		break;
+
+	case MTIOCGDIGEST:
+		digest(mtfd, tape, *argv);
+		break;
+
+	case MTIOCGHEALTH:
+		if (ioctl(mtfd, MTIOCGHEALTH, &mt_health) < 0)
+			err(2, "%s: %s", tape, comp->c_name);
+		printhealth(tape, &mt_health);
+		break;
+
+	case MTIOCSBUFFER:
+		/* without a count, report the mode */
+		if (havecount) {
+			if (ioctl(mtfd, MTIOCSBUFFER, &count) < 0)
+				err(2, "%s: %s", tape, comp->c_name);
+		} else {
+			if (ioctl(mtfd, MTIOCGBUFFER, &count) < 0)
+				err(2, "%s: %s", tape, comp->c_name);
+			printf("%s: %s\n", tape,
+			    count == MTBUFFER_OFF ? "unbuffered" :
+			    count == MTBUFFER_ON ? "buffered" :
+			    "buffered, shared among initiators");
+		}
+		break;
+
+	case MTIOCFLUSH:
+		if (ioctl(mtfd, MTIOCFLUSH) < 0)
+			err(2, "%s: %s", tape, comp->c_name);
+		break;
+
+	case MTIOCSLBP:
+		/* without a count, report the mode */
+		if (havecount) {
+			if (ioctl(mtfd, MTIOCSLBP, &count) < 0)
+				err(2, "%s: %s", tape, comp->c_name);
+		} else {
+			if (ioctl(mtfd, MTIOCGLBP, &count) < 0)
+				err(2, "%s: %s", tape, comp->c_name);
+			printf("%s: logical block protection %s\n", tape,
+			    count == MTLBP_OFF ? "off" : "crc32c");
+		}
+		break;
+
+	case MTIOCSSPAN:
+		if (ioctl(mtfd, MTIOCSSPAN, &count) < 0)
+			err(2, "%s: %s", tape, comp->c_name);
+		break;
+
+	case MTIOCGCAPACITY:
+		if (ioctl(mtfd, MTIOCGCAPACITY, &mt_cap) < 0)
+			err(2, "%s: %s", tape, comp->c_name);
+		printf("%s: partition %u, %" PRIu64 " MB remaining of %" PRIu64
+		    " MB\n", tape, mt_cap.mc_partition, mt_cap.mc_remaining,
+		    mt_cap.mc_maximum);
+		break;
+
+	case MTIOCGMAM:
+		if (argv[0] == NULL) {
+			printmam(mtfd, tape);
+			break;
+		}
+		count = strtol(argv[0], &p, 0);
+		if (count < 0 || count > 0xffff || *p)
+			errx(2, "%s: illegal attribute", argv[0]);
+		if (argv[1] != NULL) {
+			writemam(mtfd, tape, count, argv[1]);
+			break;
+		}
+		memset(&mt_mam, 0, sizeof(mt_mam));
+		mt_mam.mm_id = count;
+		if (ioctl(mtfd, MTIOCGMAM, &mt_mam) < 0)
+			err(2, "%s: %s", tape, comp->c_name);
+		printattr(NULL, &mt_mam);
+		break;
+
 	default:
 		errx(1, "internal error: unknown request %ld", comp->c_spcl);
 	}
@@ -227,6 +432,159 @@ main(int argc, char *argv[])
 	/* NOTREACHED */
 }
 
+/*
+ * Look up a command by name or unambiguous prefix.
+ */
+const struct commands *
+findcmd(const char *p)
+{
+	const struct commands *cp, *comp;
+	size_t len;
+
+	len = strlen(p);
+
+	/* a whole name wins over the longer names it is a prefix of */
+	for (cp = com; cp->c_name != NULL; cp++)
+		if (len == cp->c_namelen && strcmp(p, cp->c_name) == 0)
+			return (cp);
+
+	for (comp = NULL, cp = com; cp->c_name != NULL; cp++) {
+		size_t clen = MIN(len, cp->c_namelen);
+		if (strncmp(p, cp->c_name, clen) == 0) {
+			if (comp != NULL)
+				errx(1, "%s: Ambiguous command `%s' or `%s'?",
+				    p, cp->c_name, comp->c_name);
+			else
+				comp = cp;
+		}
+	}
+	if (comp == NULL)
+		errx(1, "%s: unknown command", p);
+	return (comp);
+}
+
+int
+iscount(const char *p)
+{
+	char *ep;
+
+	(void)strtol(p, &ep, 10);
+	return (*p != '\0' && *ep == '\0');
+}
+
+/*
+ * Print the status, the position and what the drive is doing.
+ */
+void
+printstatus(int mtfd, const char *tape, int waitprogress)
+{
+	struct mtget mt_status;
+	struct mtpos mt_pos;
+	struct mtcrypt mt_crypt;
+	int lbp;
+
+	if (ioctl(mtfd, MTIOCGET, &mt_status) < 0)
+		err(2, "%s: status", tape);
+	status(&mt_status);
+	if (ioctl(mtfd, MTIOCGPOS, &mt_pos) == 0) {
+		if (mt_pos.mp_lba < 0)
+			(void)printf("logical block address: unknown\n");
+		else
+			(void)printf("logical block address: %lld\n",
+			    (long long)mt_pos.mp_lba);
+	}
+	if (ioctl(mtfd, MTIOCGCRYPT, &mt_crypt) == 0)
+		printcrypt(&mt_crypt);
+	if (ioctl(mtfd, MTIOCGLBP, &lbp) == 0 && lbp != MTLBP_OFF)
+		(void)printf("logical block protection: crc32c\n");
+	while (printprogress(mtfd, tape) && waitprogress)
+		sleep(1);
+}
+
+/*
+ * Several tape operations, and status, over one open. Each run of
+ * operations is sent as one MTIOCBATCH, which the driver may carry out
+ * as fewer commands than were given.
+ */
+static void
+runbatch(int mtfd, const char *tape, struct mtopbatch *mb,
+    const char **names)
+{
+	if (mb->mob_count == 0)
+		return;
+	if (ioctl(mtfd, MTIOCBATCH, mb) < 0)
+		err(2, "%s", tape);
+	if (mb->mob_error) {
+		errno = mb->mob_error;
+		err(2, "%s: %s", tape, names[mb->mob_done]);
+	}
+	mb->mob_count = 0;
+}
+
+void
+batch(const char *tape, int argc, char *argv[])
+{
+	const struct commands *comp;
+	struct mtopbatch mb;
+	const char *names[MTBATCH_MAX];
+	int i, mtfd, flags, count;
+
+	/* every command is checked before any is sent */
+	flags = O_RDONLY;
+	for (i = 0; i < argc; i++) {
+		comp = findcmd(argv[i]);
+		if (comp->c_spcl != MTIOCTOP && comp->c_spcl != MTIOCGET)
+			errx(1, "%s: cannot follow other commands",
+			    comp->c_name);
+		if (!comp->c_ronly)
+			flags = O_WRONLY;
+		if (i + 1 < argc && iscount(argv[i + 1])) {
+			if (comp->c_spcl == MTIOCGET ||
+			    strtol(argv[i + 1], NULL, 10) < comp->c_mincount)
+				errx(2, "%s: illegal count", argv[i + 1]);
+			i++;
+		}
+	}
+
+	if ((mtfd = open(tape, flags)) < 0)
+		err(2, "%s", tape);
+
+	memset(&mb, 0, sizeof(mb));
+	for (i = 0; i < argc; i++) {
+		comp = findcmd(argv[i]);
+		count = 1;
+		if (i + 1 < argc && iscount(argv[i + 1]))
+			count = strtol(argv[++i], NULL, 10);
+
+		if (comp->c_spcl == MTIOCGET) {
+			runbatch(mtfd, tape, &mb, names);
+			printstatus(mtfd, tape, 0);
+			continue;
+		}
+
+		if (mb.mob_count + 2 > MTBATCH_MAX)
+			runbatch(mtfd, tape, &mb, names);
+
+		/* asf is a rewind and a forward space */
+		if (comp->c_code == MTASF) {
+			names[mb.mob_count] = comp->c_name;
+			mb.mob_ops[mb.mob_count].mbo_op = MTREW;
+			mb.mob_ops[mb.mob_count++].mbo_count = 1;
+			if (count == 0)
+				continue;
+			names[mb.mob_count] = comp->c_name;
+			mb.mob_ops[mb.mob_count].mbo_op = MTFSF;
+		} else {
+			names[mb.mob_count] = comp->c_name;
+			mb.mob_ops[mb.mob_count].mbo_op = comp->c_code;
+		}
+		mb.mob_ops[mb.mob_count++].mbo_count = count;
+	}
+	runbatch(mtfd, tape, &mb, names);
+
+	(void)close(mtfd);
+}
+
 #if defined(sun) && !defined(__SVR4)
 #include <sundev/tmreg.h>
 #include <sundev/arreg.h>
@@ -286,6 +644,552 @@ status(struct mtget *bp)
 	(void)printf("current block number: %d\n", bp->mt_blkno);
 }
 
+/*
+ * Dump the driver's event ring, oldest event first.
+ */
+void
+printlog(int mtfd, const char *tape)
+{
+	static const char *levels[] = { "err", "warn", "info", "debug" };
+	struct mtlog log;
+	struct mtlogent *ent;
+	uint32_t i;
+
+	memset(&log, 0, sizeof(log));
+	do {
+		if (ioctl(mtfd, MTIOCGLOG, &log) < 0)
+			err(2, "%s: log", tape);
+		if (log.ml_lost)
+			printf("(%u events lost)\n", log.ml_lost);
+		for (i = 0; i < log.ml_count; i++) {
+			ent = &log.ml_ent[i];
+			printf("%llu.%06llu %-5s %.*s\n",
+			    (unsigned long long)(ent->le_time / 1000000),
+			    (unsigned long long)(ent->le_time % 1000000),
+			    ent->le_level <= MT_LOG_DEBUG ?
+				levels[ent->le_level] : "?",
+			    MTLOG_MSGLEN, ent->le_msg);
+		}
+	} while (log.ml_count == MTLOG_BATCH);
+}
+
+const struct opcode_desc {
+	uint8_t	o_code;
+	const	char *o_name;
+} opcodes[] = {
+	{ 0x00,	"TEST_UNIT_READY" },
+	{ 0x01,	"REWIND" },
+	{ 0x03,	"REQUEST_SENSE" },
+	{ 0x05,	"READ_BLOCK_LIMITS" },
+	{ 0x08,	"READ_6" },
+	{ 0x0a,	"WRITE_6" },
+	{ 0x0f,	"READ_REVERSE" },
+	{ 0x10,	"WRITE_FILEMARKS" },
+	{ 0x11,	"SPACE" },
+	{ 0x12,	"INQUIRY" },
+	{ 0x13,	"VERIFY_6" },
+	{ 0x15,	"MODE_SELECT_6" },
+	{ 0x19,	"ERASE" },
+	{ 0x1a,	"MODE_SENSE_6" },
+	{ 0x1b,	"LOAD_UNLOAD" },
+	{ 0x2b,	"LOCATE" },
+	{ 0x34,	"READ_POSITION" },
+	{ 0x4d,	"LOG_SENSE" },
+	{ 0x8c,	"READ_ATTRIBUTE" },
+	{ 0x8d,	"WRITE_ATTRIBUTE" },
+	{ 0xa2,	"SECURITY_PROTOCOL_IN" },
+	{ 0xb5,	"SECURITY_PROTOCOL_OUT" },
+	{ .o_name = NULL }
+};
+
+static const char *
+opcode_name(uint8_t code)
+{
+	const struct opcode_desc *op;
+
+	for (op = opcodes; op->o_name != NULL; op++)
+		if (op->o_code == code)
+			return op->o_name;
+	return "?";
+}
+
+/*
+ * Print the long operation in progress, if any. Returns 0 when the
+ * drive is idle.
+ */
+int
+printprogress(int mtfd, const char *tape)
+{
+	static const char *ops[] = {
+		"none", "rewind", "load", "unload", "space", "locate", "erase",
+		"verify"
+	};
+	struct mtprogress mp;
+
+	if (ioctl(mtfd, MTIOCGETPROGRESS, &mp) < 0)
+		err(2, "%s", tape);
+	if (mp.mp_op == MTPROG_NONE)
+		return 0;
+
+	printf("%s in progress, ",
+	    mp.mp_op < (int)(sizeof(ops) / sizeof(ops[0])) ?
+	    ops[mp.mp_op] : "operation");
+	if (mp.mp_progress >= 0)
+		printf("%d%% done, ",
+		    (int)((int64_t)mp.mp_progress * 100 / MTPROG_MAX));
+	printf("%u s elapsed\n", mp.mp_elapsed / 1000);
+	fflush(stdout);
+	return 1;
+}
+
+/*
+ * The control device of a tape device, which may already be one.
+ */
+char *
+ctlpath(const char *tape)
+{
+	size_t len;
+	char *ctl;
+
+	len = strlen(tape);
+	if (len >= 4 && strcmp(tape + len - 4, ".ctl") == 0) {
+		if ((ctl = strdup(tape)) == NULL)
+			err(2, NULL);
+	} else if (asprintf(&ctl, "%s.ctl", tape) < 0)
+		err(2, NULL);
+	return (ctl);
+}
+
+/*
+ * Drain the driver's command trace and decode it as text or CSV. The
+ * trace is read from the control device, and only what was recorded
+ * so far: while tracing is on the drain would otherwise never end.
+ */
+void
+printtrace(int mtfd, const char *ctl, int csv)
+{
+	struct mttracebuf buf;
+	struct mttrace *tr;
+	uint32_t i, j;
+
+	if (csv)
+		printf("time_us,seq,opcode,cdb,requested,realized,status,"
+		    "sense_key,asc,ascq,latency_us\n");
+	do {
+		if (ioctl(mtfd, MTIOCTRDRAIN, &buf) < 0)
+			err(2, "%s: trace", ctl);
+		if (buf.mtb_lost)
+			fprintf(stderr, "%s: %u trace records lost\n", ctl,
+			    buf.mtb_lost);
+		for (i = 0; i < buf.mtb_count; i++) {
+			tr = &buf.mtb_ent[i];
+			if (csv)
+				printf("%llu,%u,%s,", (unsigned long long)tr->tr_time,
+				    tr->tr_seq, opcode_name(tr->tr_cdb[0]));
+			else
+				printf("%llu.%06llu #%u %-17s ",
+				    (unsigned long long)(tr->tr_time / 1000000),
+				    (unsigned long long)(tr->tr_time % 1000000),
+				    tr->tr_seq, opcode_name(tr->tr_cdb[0]));
+			for (j = 0; j < tr->tr_cdblen; j++)
+				printf("%02x", tr->tr_cdb[j]);
+			if (csv)
+				printf(",%u,%u,0x%x,0x%x,0x%02x,0x%02x,%u\n",
+				    tr->tr_requested, tr->tr_realized,
+				    tr->tr_status, tr->tr_sensekey, tr->tr_asc,
+				    tr->tr_ascq, tr->tr_latency);
+			else {
+				printf(" %u/%u bytes status 0x%x", tr->tr_realized,
+				    tr->tr_requested, tr->tr_status);
+				if (tr->tr_sensekey || tr->tr_asc || tr->tr_ascq)
+					printf(" sense %x/%02x/%02x", tr->tr_sensekey,
+					    tr->tr_asc, tr->tr_ascq);
+				printf(" %u us\n", tr->tr_latency);
+			}
+		}
+	} while (buf.mtb_count == MTTRACE_BATCH);
+}
+
+/*
+ * Print the drive's encryption mode and the key-associated data, which
+ * names the key.
+ */
+void
+printcrypt(const struct mtcrypt *mc)
+{
+	uint32_t i;
+	int text;
+
+	switch (mc->mc_mode) {
+	case MTCRYPT_OFF:
+		printf("encryption: off\n");
+		return;
+	case MTCRYPT_ON:
+		printf("encryption: on");
+		break;
+	case MTCRYPT_MIXED:
+		printf("encryption: on, reading plain data too");
+		break;
+	default:
+		printf("encryption: set by another initiator");
+		break;
+	}
+	printf(", algorithm %u", mc->mc_algorithm);
+	if (mc->mc_kadlen != 0) {
+		for (text = 1, i = 0; i < mc->mc_kadlen; i++)
+			if (!isprint(mc->mc_kad[i]))
+				text = 0;
+		printf(", key ");
+		for (i = 0; i < mc->mc_kadlen; i++)
+			printf(text ? "%c" : "%02x", mc->mc_kad[i]);
+	}
+	if (!(mc->mc_flags & MTCRYPT_KEEP))
+		printf(", until closed");
+	printf("\n");
+}
+
+static int
+hexdigit(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * crypt off|on|mixed [keyfile]
+ *
+ * The key file holds the key in hex on its first line and, optionally,
+ * a description of the key on its second, which the drive writes with
+ * the data as the key-associated data. The key is kept in the drive
+ * after mt exits, until "crypt off" or the drive is reset.
+ */
+void
+setcrypt(int mtfd, const char *tape, const char *mode, const char *keyfile)
+{
+	struct mtcrypt mc;
+	char line[2 * MTCRYPT_KEYLEN + MTCRYPT_KADLEN + 2];
+	FILE *fp;
+	size_t len;
+	char *p;
+	int hi, lo;
+
+	memset(&mc, 0, sizeof(mc));
+	mc.mc_flags = MTCRYPT_KEEP;
+	if (strcmp(mode, "off") == 0)
+		mc.mc_mode = MTCRYPT_OFF;
+	else if (strcmp(mode, "on") == 0)
+		mc.mc_mode = MTCRYPT_ON;
+	else if (strcmp(mode, "mixed") == 0)
+		mc.mc_mode = MTCRYPT_MIXED;
+	else
+		errx(1, "crypt: unknown mode `%s'", mode);
+
+	if (mc.mc_mode != MTCRYPT_OFF) {
+		if (keyfile == NULL)
+			usage();
+		if ((fp = fopen(keyfile, "r")) == NULL)
+			err(2, "%s", keyfile);
+		if (fgets(line, sizeof(line), fp) == NULL)
+			errx(2, "%s: no key", keyfile);
+		for (p = line; mc.mc_keylen < MTCRYPT_KEYLEN &&
+		    (hi = hexdigit(p[0])) >= 0 && (lo = hexdigit(p[1])) >= 0;
+		    p += 2)
+			mc.mc_key[mc.mc_keylen++] = hi << 4 | lo;
+		if (mc.mc_keylen == 0 || (*p != '\n' && *p != '\0'))
+			errx(2, "%s: the key must be up to %d bytes in hex",
+			    keyfile, MTCRYPT_KEYLEN);
+		memset(line, 0, sizeof(line));
+		if (fgets(line, sizeof(line), fp) != NULL) {
+			len = strcspn(line, "\n");
+			if (len > MTCRYPT_KADLEN)
+				errx(2, "%s: the key description is longer than "
+				    "%d bytes", keyfile, MTCRYPT_KADLEN);
+			memcpy(mc.mc_kad, line, len);
+			mc.mc_kadlen = len;
+		}
+		fclose(fp);
+	} else if (keyfile != NULL)
+		usage();
+
+	if (ioctl(mtfd, MTIOCSCRYPT, &mc) < 0) {
+		memset(&mc, 0, sizeof(mc));
+		err(2, "%s: crypt", tape);
+	}
+	memset(&mc, 0, sizeof(mc));
+}
+
+/* TapeAlert flags, from SSC-3 annex A */
+static const char *tapealerts[64] = {
+	[0] = "read warning",
+	[1] = "write warning",
+	[2] = "hard error",
+	[3] = "media",
+	[4] = "read failure",
+	[5] = "write failure",
+	[6] = "media life",
+	[7] = "not data grade",
+	[8] = "write protect",
+	[9] = "no removal",
+	[10] = "cleaning media",
+	[11] = "unsupported format",
+	[12] = "recoverable snapped tape",
+	[13] = "unrecoverable snapped tape",
+	[14] = "cartridge memory failure",
+	[15] = "forced eject",
+	[16] = "read only format",
+	[17] = "tape directory corrupted on load",
+	[18] = "nearing media life",
+	[19] = "clean now",
+	[20] = "clean periodic",
+	[21] = "expired cleaning media",
+	[22] = "invalid cleaning tape",
+	[23] = "retension requested",
+	[24] = "dual-port interface error",
+	[25] = "cooling fan failure",
+	[26] = "power supply failure",
+	[27] = "power consumption",
+	[28] = "drive maintenance",
+	[29] = "hardware A",
+	[30] = "hardware B",
+	[31] = "interface",
+	[32] = "eject media",
+	[33] = "microcode update fail",
+	[34] = "drive humidity",
+	[35] = "drive temperature",
+	[36] = "drive voltage",
+	[37] = "predictive failure",
+	[38] = "diagnostics required",
+	[48] = "diminished native capacity",
+	[49] = "lost statistics",
+	[50] = "tape directory invalid at unload",
+	[51] = "tape system area write failure",
+	[52] = "tape system area read failure",
+	[53] = "no start of data",
+	[54] = "loading failure",
+	[55] = "unrecoverable unload failure",
+	[56] = "automation interface failure",
+	[57] = "microcode failure",
+	[58] = "WORM medium integrity check failed",
+	[59] = "WORM medium overwrite attempted",
+};
+
+static void
+printerrcnt(const char *name, const struct mterrcnt *ec,
+    const struct mterrcnt *delta, uint32_t interval)
+{
+	printf("%s: %" PRIu64 " corrected, %" PRIu64 " retries, %" PRIu64
+	    " uncorrected, %" PRIu64 " MB processed\n", name,
+	    ec->me_corrected, ec->me_retries, ec->me_uncorrected,
+	    ec->me_bytes / 1000000);
+	/* the rate that predicts a drive slowing down on retries */
+	if (interval != 0 && delta->me_bytes >= 1000000)
+		printf("%s: %" PRIu64 " corrected per GB over the last %u s\n",
+		    name, delta->me_corrected * 1000 / (delta->me_bytes / 1000000),
+		    interval);
+}
+
+/*
+ * Print the drive health as of the driver's last poll.
+ */
+/*
+ * digest [on|off|file]
+ *
+ * Turn per-file digests on or off, or print the digest of a file, or
+ * of the file in progress if none is given.
+ */
+void
+digest(int mtfd, const char *tape, const char *arg)
+{
+	struct mtdigest md;
+	char *p;
+	int mode;
+
+	if (arg != NULL && (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0)) {
+		mode = arg[1] == 'n' ? MTDIGEST_CRC64 : MTDIGEST_OFF;
+		if (ioctl(mtfd, MTIOCSDIGEST, &mode) < 0)
+			err(2, "%s: digest %s", tape, arg);
+		return;
+	}
+
+	memset(&md, 0, sizeof(md));
+	md.md_fileno = -1;
+	if (arg != NULL) {
+		md.md_fileno = strtol(arg, &p, 10);
+		if (md.md_fileno < 0 || *p)
+			errx(2, "%s: illegal file number", arg);
+	}
+
+	if (ioctl(mtfd, MTIOCGDIGEST, &md) < 0) {
+		if (errno == ENOENT)
+			errx(2, "%s: no digest of %s", tape,
+			    arg != NULL ? "that file" : "a file in progress");
+		err(2, "%s: digest", tape);
+	}
+
+	printf("%s: file %d: crc64 %016" PRIx64 ", %" PRIu64 " bytes in %u "
+	    "records %s%s%s%s\n", tape, md.md_fileno, md.md_digest,
+	    md.md_bytes, md.md_records,
+	    md.md_flags & MTDIGEST_READ ? "read" : "written",
+	    md.md_flags & MTDIGEST_PARTIAL ? ", from part way in" : "",
+	    md.md_flags & MTDIGEST_DONE ? ", to the end" : ", so far",
+	    md.md_flags & MTDIGEST_ERROR ? ", with errors" : "");
+}
+
+void
+printhealth(const char *tape, const struct mthealth *mh)
+{
+	int flag, any;
+
+	printf("%s: polled %u s ago\n", tape, mh->mh_age);
+
+	if (mh->mh_valid & MTHEALTH_TAPEALERT) {
+		printf("tapealert:");
+		for (any = 0, flag = 0; flag < 64; flag++) {
+			if (!(mh->mh_tapealert & (1ULL << flag)))
+				continue;
+			if (tapealerts[flag] != NULL)
+				printf("%s %d (%s)", any ? "," : "", flag + 1,
+				    tapealerts[flag]);
+			else
+				printf("%s %d", any ? "," : "", flag + 1);
+			any = 1;
+		}
+		printf("%s\n", any ? "" : " none");
+	}
+	if (mh->mh_valid & MTHEALTH_WRITE)
+		printerrcnt("write", &mh->mh_write, &mh->mh_dwrite,
+		    mh->mh_interval);
+	if (mh->mh_valid & MTHEALTH_READ)
+		printerrcnt("read", &mh->mh_read, &mh->mh_dread,
+		    mh->mh_interval);
+}
+
+const struct mam_desc {
+	uint16_t m_id;
+	uint8_t	m_format;
+	uint8_t	m_length;		/* standard length, 0 if any */
+	const	char *m_name;
+} mams[] = {
+	{ MTMAM_SERIAL,		MTMAM_ASCII,	32,	"serial number" },
+	{ MTMAM_BARCODE,	MTMAM_ASCII,	32,	"barcode" },
+	{ MTMAM_USER_LABEL,	MTMAM_TEXT,	160,	"volume label" },
+	{ MTMAM_MANUFACTURER,	MTMAM_ASCII,	8,	"manufacturer" },
+	{ MTMAM_REMAINING_CAP,	MTMAM_BINARY,	8,	"remaining capacity" },
+	{ MTMAM_MAXIMUM_CAP,	MTMAM_BINARY,	8,	"maximum capacity" },
+	{ MTMAM_LOAD_COUNT,	MTMAM_BINARY,	8,	"load count" },
+	{ MTMAM_APP_VENDOR,	MTMAM_ASCII,	8,	"application vendor" },
+	{ MTMAM_APP_NAME,	MTMAM_ASCII,	32,	"application name" },
+	{ MTMAM_APP_VERSION,	MTMAM_ASCII,	8,	"application version" },
+	{ MTMAM_LAST_WRITTEN,	MTMAM_ASCII,	12,	"last written" },
+	{ MTMAM_OWNING_HOST,	MTMAM_TEXT,	80,	"owning host" },
+	{ MTMAM_MEDIA_POOL,	MTMAM_TEXT,	160,	"media pool" },
+	{ .m_name = NULL }
+};
+
+static const struct mam_desc *
+mam_lookup(uint16_t id)
+{
+	const struct mam_desc *md;
+
+	for (md = mams; md->m_name != NULL; md++)
+		if (md->m_id == id)
+			return md;
+	return NULL;
+}
+
+/*
+ * Print the attributes in the cartridge memory that identify it,
+ * skipping those the cartridge does not have.
+ */
+void
+printmam(int mtfd, const char *tape)
+{
+	const struct mam_desc *md;
+	struct mtmam mm;
+
+	for (md = mams; md->m_name != NULL; md++) {
+		memset(&mm, 0, sizeof(mm));
+		mm.mm_id = md->m_id;
+		if (ioctl(mtfd, MTIOCGMAM, &mm) < 0) {
+			if (errno == ENOATTR)
+				continue;
+			err(2, "%s: mam", tape);
+		}
+		printattr(md->m_name, &mm);
+	}
+}
+
+void
+printattr(const char *name, const struct mtmam *mm)
+{
+	const struct mam_desc *md;
+	uint64_t v;
+	uint32_t i, len;
+
+	if (name == NULL && (md = mam_lookup(mm->mm_id)) != NULL)
+		name = md->m_name;
+	if (name != NULL)
+		printf("%s: ", name);
+	else
+		printf("attribute 0x%04x: ", mm->mm_id);
+
+	if (mm->mm_format == MTMAM_BINARY && mm->mm_length <= 8) {
+		for (v = 0, i = 0; i < mm->mm_length; i++)
+			v = (v << 8) | mm->mm_value[i];
+		printf("%" PRIu64, v);
+		if (mm->mm_id == MTMAM_REMAINING_CAP ||
+		    mm->mm_id == MTMAM_MAXIMUM_CAP)
+			printf(" MiB");
+	} else if (mm->mm_format == MTMAM_BINARY) {
+		for (i = 0; i < mm->mm_length; i++)
+			printf("%02x", mm->mm_value[i]);
+	} else {
+		/* ASCII values are blank padded, text ones NUL padded */
+		for (len = mm->mm_length; len > 0 &&
+		    (mm->mm_value[len - 1] == ' ' ||
+		    mm->mm_value[len - 1] == '\0'); len--)
+			continue;
+		printf("%.*s", (int)len, (const char *)mm->mm_value);
+	}
+	printf("\n");
+}
+
+/*
+ * Write a host attribute. Standard attributes are padded to their
+ * length; an empty value deletes the attribute.
+ */
+void
+writemam(int mtfd, const char *tape, uint16_t id, const char *value)
+{
+	const struct mam_desc *md;
+	struct mtmam mm;
+	size_t len;
+
+	md = mam_lookup(id);
+	len = strlen(value);
+	if (len > MTMAM_LEN || (md != NULL && len > md->m_length))
+		errx(2, "%s: value too long", value);
+
+	memset(&mm, 0, sizeof(mm));
+	mm.mm_id = id;
+	mm.mm_format = md != NULL ? md->m_format : MTMAM_ASCII;
+	memcpy(mm.mm_value, value, len);
+	mm.mm_length = len;
+	if (len > 0 && md != NULL) {
+		memset(mm.mm_value + len,
+		    mm.mm_format == MTMAM_ASCII ? ' ' : '\0', md->m_length - len);
+		mm.mm_length = md->m_length;
+	}
+
+	if (ioctl(mtfd, MTIOCSMAM, &mm) < 0)
+		err(2, "%s: mam", tape);
+}
+
 /*
  * Print a register a la the %b format of the kernel's printf.
  */
@@ -320,8 +1224,15 @@ printreg(const char *s, u_int v, const char *bits)
 void
 usage(void)
 {
-	(void)fprintf(stderr, "usage: %s [-f device] command [count]\n",
-	    getprogname());
+	(void)fprintf(stderr, "usage: %s [-f device] command [count]\n"
+	    "       %s [-f device] command [count] command [count] ...\n"
+	    "       %s [-f device] status [-w]\n"
+	    "       %s [-f device] trace start|stop|clear|dump|csv\n"
+	    "       %s [-f device] mam [attribute [value]]\n"
+	    "       %s [-f device] crypt off|on|mixed [keyfile]\n"
+	    "       %s [-f device] digest [on|off|file]\n",
+	    getprogname(), getprogname(), getprogname(), getprogname(),
+	    getprogname(), getprogname(), getprogname());
 	exit(1);
 	/* NOTREACHED */
 }
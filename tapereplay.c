@@ -0,0 +1,467 @@
+/*
+ *  tapereplay.c
+ *  IOSCSITape
+ *
+ *  This software is licensed under an MIT license. See LICENSE.txt.
+ *
+ *  Record the syscall-level workload seen by the tape driver and replay
+ *  it with synthetic data against a tape device or a simulated target.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include "mtio.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+#include "custom_mtio.h"
+
+#define WL_MAGIC	"TPWL"
+#define WL_VERSION	1
+
+struct wlheader {
+	char		wh_magic[4];
+	uint32_t	wh_version;
+	uint32_t	wh_reclen;	/* sizeof(struct mtwlrec) */
+	uint32_t	wh_pad;
+};
+
+struct opstats {
+	uint64_t	os_count;
+	uint64_t	os_bytes;
+	uint64_t	os_errors;
+	uint64_t	os_total;	/* replayed latency, us */
+	uint64_t	os_max;
+	uint64_t	os_captured;	/* captured latency, us */
+};
+
+static volatile sig_atomic_t done;
+
+static int	fast;		/* ignore captured think time */
+static int	simulate;	/* don't touch a device */
+static double	simrate;	/* simulated MB/s, 0 to use captured times */
+static int	zerofill;
+
+static void	record(const char *, const char *, int);
+static void	replay(const char *, const char *);
+static void	print(const char *);
+static struct mtwlrec *load(const char *, size_t *);
+static void	usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	const char *tape = NULL;
+	char *ctl;
+	int ch, seconds = 0;
+
+	while ((ch = getopt(argc, argv, "af:nr:t:z")) != -1)
+		switch (ch) {
+		case 'a':
+			fast = 1;
+			break;
+		case 'f':
+			tape = optarg;
+			break;
+		case 'n':
+			simulate = 1;
+			break;
+		case 'r':
+			simrate = strtod(optarg, NULL);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'z':
+			zerofill = 1;
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2)
+		usage();
+	if (tape == NULL && (tape = getenv("TAPE")) == NULL)
+		tape = "/dev/rst0";
+	/*
+	 * Record from the control device, which is the only one the capture
+	 * is drained from, leaving the tape free.
+	 */
+	if (strcmp(argv[0], "record") == 0 && (strlen(tape) < 4 ||
+	    strcmp(tape + strlen(tape) - 4, ".ctl") != 0)) {
+		if (asprintf(&ctl, "%s.ctl", tape) < 0)
+			err(2, NULL);
+		tape = ctl;
+	}
+
+	if (strcmp(argv[0], "record") == 0)
+		record(tape, argv[1], seconds);
+	else if (strcmp(argv[0], "replay") == 0)
+		replay(tape, argv[1]);
+	else if (strcmp(argv[0], "print") == 0)
+		print(argv[1]);
+	else
+		usage();
+
+	exit(0);
+}
+
+static uint64_t
+now_us(void)
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0)
+		mach_timebase_info(&tb);
+	return mach_absolute_time() * tb.numer / tb.denom / 1000;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/*
+ * Sleep until the given time. nanosleep() overshoots by scheduler
+ * latency, so the last stretch is spun to keep replay timing precise.
+ */
+static void
+wait_until(uint64_t when)
+{
+	struct timespec ts;
+	uint64_t t;
+
+	while ((t = now_us()) < when) {
+		if (when - t > 2000) {
+			ts.tv_sec = (when - t - 1000) / 1000000;
+			ts.tv_nsec = ((when - t - 1000) % 1000000) * 1000;
+			nanosleep(&ts, NULL);
+		}
+	}
+}
+
+static void
+stop(int sig)
+{
+	done = 1;
+}
+
+/*
+ * Turn on workload capture and stream records into a file until
+ * interrupted (or for the given number of seconds), from the control
+ * node (e.g. /dev/rst0.ctl) so the tape device stays free for the
+ * application being recorded.
+ */
+static void
+record(const char *tape, const char *file, int seconds)
+{
+	struct wlheader wh;
+	struct mtwlbuf buf;
+	uint64_t records = 0, lost = 0, deadline;
+	FILE *fp;
+	int fd, op;
+
+	if ((fd = open(tape, O_RDONLY)) < 0)
+		err(2, "%s", tape);
+	if ((fp = fopen(file, "w")) == NULL)
+		err(2, "%s", file);
+
+	memset(&wh, 0, sizeof(wh));
+	memcpy(wh.wh_magic, WL_MAGIC, sizeof(wh.wh_magic));
+	wh.wh_version = WL_VERSION;
+	wh.wh_reclen = sizeof(struct mtwlrec);
+	if (fwrite(&wh, sizeof(wh), 1, fp) != 1)
+		err(2, "%s", file);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	op = MTTRACE_CLEAR;
+	if (ioctl(fd, MTIOCCAPTURE, &op) < 0)
+		err(2, "%s: capture", tape);
+	op = MTTRACE_START;
+	if (ioctl(fd, MTIOCCAPTURE, &op) < 0)
+		err(2, "%s: capture", tape);
+
+	deadline = seconds ? now_us() + (uint64_t)seconds * 1000000 : 0;
+	for (;;) {
+		if (done || (deadline && now_us() >= deadline)) {
+			op = MTTRACE_STOP;
+			if (ioctl(fd, MTIOCCAPTURE, &op) < 0)
+				err(2, "%s: capture", tape);
+		}
+		do {
+			if (ioctl(fd, MTIOCCAPDRAIN, &buf) < 0)
+				err(2, "%s: capture", tape);
+			if (fwrite(buf.mwb_ent, sizeof(struct mtwlrec),
+			    buf.mwb_count, fp) != buf.mwb_count)
+				err(2, "%s", file);
+			records += buf.mwb_count;
+			lost += buf.mwb_lost;
+		} while (buf.mwb_count == MTWL_BATCH);
+		if (op == MTTRACE_STOP)
+			break;
+		usleep(100000);
+	}
+
+	if (fclose(fp) != 0)
+		err(2, "%s", file);
+	close(fd);
+
+	printf("%s: %" PRIu64 " calls recorded", file, records);
+	if (lost)
+		printf(", %" PRIu64 " lost (drain more often)", lost);
+	printf("\n");
+}
+
+static struct mtwlrec *
+load(const char *file, size_t *count)
+{
+	struct wlheader wh;
+	struct mtwlrec *recs = NULL;
+	size_t n = 0, size = 0;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(2, "%s", file);
+	if (fread(&wh, sizeof(wh), 1, fp) != 1 ||
+	    memcmp(wh.wh_magic, WL_MAGIC, sizeof(wh.wh_magic)) != 0)
+		errx(2, "%s: not a tape workload file", file);
+	if (wh.wh_version != WL_VERSION ||
+	    wh.wh_reclen != sizeof(struct mtwlrec))
+		errx(2, "%s: unsupported workload version", file);
+
+	for (;;) {
+		if (n == size) {
+			size = size ? size * 2 : 1024;
+			if ((recs = realloc(recs, size * sizeof(*recs))) == NULL)
+				err(2, NULL);
+		}
+		if (fread(&recs[n], sizeof(*recs), 1, fp) != 1)
+			break;
+		n++;
+	}
+	if (ferror(fp))
+		err(2, "%s", file);
+	fclose(fp);
+
+	*count = n;
+	return recs;
+}
+
+static const char *
+opname(const struct mtwlrec *wl)
+{
+	static const char *mtops[] = {
+		"weof", "fsf", "bsf", "fsr", "bsr", "rewind", "offline",
+		"nop", "retension", "erase", "eom", "nbsf", "cache",
+		"nocache", "setblk", "setdensity", "compress", "eew"
+	};
+
+	switch (wl->wl_op) {
+	case MTWL_READ:
+		return "read";
+	case MTWL_WRITE:
+		return "write";
+	}
+	if (wl->wl_cmd == MTIOCTOP) {
+		if (wl->wl_mtop < sizeof(mtops) / sizeof(mtops[0]))
+			return mtops[wl->wl_mtop];
+		return "mtop";
+	}
+	if (wl->wl_cmd == MTIOCGET)
+		return "status";
+	return "ioctl";
+}
+
+static void
+print(const char *file)
+{
+	struct mtwlrec *recs;
+	size_t i, n;
+	uint64_t base;
+
+	recs = load(file, &n);
+	base = n ? recs[0].wl_time : 0;
+	for (i = 0; i < n; i++)
+		printf("%10.6f %-10s count %-8d result %-8d error %-3d %u us\n",
+		    (recs[i].wl_time - base) / 1e6, opname(&recs[i]),
+		    recs[i].wl_count, recs[i].wl_result, recs[i].wl_error,
+		    recs[i].wl_duration);
+	free(recs);
+}
+
+/*
+ * Simulated target: an ideal drive streaming at simrate MB/s, or one
+ * that takes exactly as long as the captured call did.
+ */
+static int
+sim_issue(const struct mtwlrec *wl)
+{
+	uint64_t t;
+
+	if (simrate > 0 && wl->wl_op != MTWL_IOCTL)
+		t = (uint64_t)(wl->wl_count / simrate);
+	else
+		t = wl->wl_duration;
+	wait_until(now_us() + t);
+
+	return wl->wl_result;
+}
+
+static int
+dev_issue(int fd, const struct mtwlrec *wl, char *buf)
+{
+	struct mtop mt_com;
+	struct mtget mt_status;
+
+	switch (wl->wl_op) {
+	case MTWL_READ:
+		return read(fd, buf, wl->wl_count);
+	case MTWL_WRITE:
+		return write(fd, buf, wl->wl_count);
+	}
+
+	if (wl->wl_cmd == MTIOCTOP) {
+		mt_com.mt_op = wl->wl_mtop;
+		mt_com.mt_count = wl->wl_count;
+		return ioctl(fd, MTIOCTOP, &mt_com);
+	}
+	if (wl->wl_cmd == MTIOCGET)
+		return ioctl(fd, MTIOCGET, &mt_status);
+
+	/* other ioctls carry arguments we didn't capture */
+	errno = ENOTTY;
+	return -1;
+}
+
+/*
+ * Re-issue a captured workload. Each call is issued after the same
+ * application think time that preceded it in the capture (the gap
+ * between the previous call returning and this one starting), so a
+ * faster or slower driver shows up directly in the elapsed time.
+ */
+static void
+replay(const char *tape, const char *file)
+{
+	struct opstats stats[4];
+	struct mtwlrec *recs, *wl;
+	size_t i, n, bufsize = 0;
+	uint64_t start, last, t, lat, think;
+	uint64_t skipped = 0;
+	char *buf = NULL;
+	int fd = -1, ret;
+	const char *names[] = { "", "read", "write", "ioctl" };
+
+	recs = load(file, &n);
+	if (n == 0)
+		errx(1, "%s: no calls recorded", file);
+
+	for (i = 0; i < n; i++)
+		if (recs[i].wl_op != MTWL_IOCTL &&
+		    (size_t)recs[i].wl_count > bufsize)
+			bufsize = recs[i].wl_count;
+	if (bufsize) {
+		if ((buf = malloc(bufsize)) == NULL)
+			err(2, NULL);
+		if (zerofill)
+			memset(buf, 0, bufsize);
+		else
+			for (i = 0; i < bufsize; i++)	/* defeat drive compression */
+				buf[i] = (char)random();
+	}
+
+	if (!simulate && (fd = open(tape, O_RDWR)) < 0)
+		err(2, "%s", tape);
+
+	memset(stats, 0, sizeof(stats));
+	start = last = now_us();
+	for (i = 0; i < n; i++) {
+		wl = &recs[i];
+
+		if (!fast && i > 0) {
+			t = recs[i - 1].wl_time + recs[i - 1].wl_duration;
+			think = wl->wl_time > t ? wl->wl_time - t : 0;
+			wait_until(last + think);
+		}
+
+		if (wl->wl_op == MTWL_IOCTL && wl->wl_cmd != MTIOCTOP &&
+		    wl->wl_cmd != MTIOCGET) {
+			skipped++;
+			continue;
+		}
+
+		t = now_us();
+		ret = simulate ? sim_issue(wl) : dev_issue(fd, wl, buf);
+		last = now_us();
+		lat = last - t;
+
+		if (wl->wl_op < 1 || wl->wl_op > 3)
+			continue;
+		stats[wl->wl_op].os_count++;
+		stats[wl->wl_op].os_total += lat;
+		stats[wl->wl_op].os_captured += wl->wl_duration;
+		if (lat > stats[wl->wl_op].os_max)
+			stats[wl->wl_op].os_max = lat;
+		if (ret < 0)
+			stats[wl->wl_op].os_errors++;
+		else if (wl->wl_op != MTWL_IOCTL)
+			stats[wl->wl_op].os_bytes += ret;
+	}
+	t = now_us() - start;
+
+	if (fd >= 0)
+		close(fd);
+
+	printf("%zu calls replayed in %.3f s (captured %.3f s)%s\n",
+	    n - (size_t)skipped, t / 1e6,
+	    (recs[n - 1].wl_time + recs[n - 1].wl_duration -
+	    recs[0].wl_time) / 1e6, simulate ? " against simulated target" : "");
+	for (i = 1; i < 4; i++) {
+		if (stats[i].os_count == 0)
+			continue;
+		printf("%-6s %8" PRIu64 " calls %12" PRIu64 " bytes "
+		    "%8.1f MB/s  mean %7.0f us (captured %7.0f us)  max %7" PRIu64
+		    " us  %" PRIu64 " errors\n", names[i],
+		    stats[i].os_count, stats[i].os_bytes,
+		    stats[i].os_total ? stats[i].os_bytes /
+		    (double)stats[i].os_total : 0.0,
+		    stats[i].os_total / (double)stats[i].os_count,
+		    stats[i].os_captured / (double)stats[i].os_count,
+		    stats[i].os_max, stats[i].os_errors);
+	}
+	if (skipped)
+		printf("%" PRIu64 " ioctls with uncaptured arguments skipped\n",
+		    skipped);
+
+	free(buf);
+	free(recs);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: tapereplay [-f device] [-t seconds] record file\n"
+	    "       tapereplay [-anz] [-r MB/s] [-f device] replay file\n"
+	    "       tapereplay print file\n");
+	exit(1);
+}